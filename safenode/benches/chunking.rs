@@ -0,0 +1,58 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use safenode::bench::{chunk_bytes, pack};
+
+use bytes::Bytes;
+use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput};
+use rand::RngCore;
+
+// From a file too small to be self-encrypted, to one spread over about a hundred chunks.
+const FILE_SIZES: [usize; 4] = [1024, 1024 * 1024, 10 * 1024 * 1024, 50 * 1024 * 1024];
+
+fn random_bytes(size: usize) -> Bytes {
+    let mut bytes = vec![0u8; size];
+    rand::thread_rng().fill_bytes(&mut bytes);
+    Bytes::from(bytes)
+}
+
+fn chunking(c: &mut Criterion) {
+    let mut group = c.benchmark_group("chunk_bytes");
+    group.sample_size(10);
+    for size in FILE_SIZES {
+        let bytes = random_bytes(size);
+        let _ = group.throughput(Throughput::Bytes(size as u64));
+        let _ = group.bench_with_input(BenchmarkId::from_parameter(size), &bytes, |b, bytes| {
+            b.iter(|| chunk_bytes(bytes.clone()).expect("Chunking to succeed"))
+        });
+    }
+    group.finish();
+}
+
+fn packing(c: &mut Criterion) {
+    let mut group = c.benchmark_group("pack");
+    group.sample_size(10);
+    // Only self-encrypted files are packed.
+    for size in FILE_SIZES.into_iter().skip(1) {
+        let bytes = random_bytes(size);
+        let _ = group.throughput(Throughput::Bytes(size as u64));
+        let _ = group.bench_with_input(BenchmarkId::from_parameter(size), &bytes, |b, bytes| {
+            b.iter_batched(
+                || self_encryption::encrypt(bytes.clone()).expect("Encryption to succeed"),
+                |(data_map, encrypted_chunks)| {
+                    pack(data_map, encrypted_chunks).expect("Packing to succeed")
+                },
+                BatchSize::PerIteration,
+            )
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, chunking, packing);
+criterion_main!(benches);
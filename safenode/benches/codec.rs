@@ -0,0 +1,64 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use safenode::{
+    bench::{decode_request, decode_response, encode_request, encode_response},
+    protocol::{
+        chunk::Chunk,
+        messages::{Cmd, QueryResponse, Request, Response},
+    },
+};
+
+use bytes::Bytes;
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use futures::executor::block_on;
+use rand::RngCore;
+
+// From a small file's chunk to a full self-encrypted one.
+const CHUNK_SIZES: [usize; 3] = [1024, 256 * 1024, 1024 * 1024];
+
+fn random_chunk(size: usize) -> Chunk {
+    let mut bytes = vec![0u8; size];
+    rand::thread_rng().fill_bytes(&mut bytes);
+    Chunk::new(Bytes::from(bytes))
+}
+
+fn store_chunk(c: &mut Criterion) {
+    let mut group = c.benchmark_group("codec/store_chunk");
+    for size in CHUNK_SIZES {
+        let req = Request::Cmd(Cmd::StoreChunk(random_chunk(size)));
+        let encoded = block_on(encode_request(req.clone())).expect("Encoding to succeed");
+        let _ = group.throughput(Throughput::Bytes(size as u64));
+        let _ = group.bench_with_input(BenchmarkId::new("encode", size), &req, |b, req| {
+            b.iter(|| block_on(encode_request(req.clone())).expect("Encoding to succeed"))
+        });
+        let _ = group.bench_with_input(BenchmarkId::new("decode", size), &encoded, |b, bytes| {
+            b.iter(|| block_on(decode_request(bytes)).expect("Decoding to succeed"))
+        });
+    }
+    group.finish();
+}
+
+fn get_chunk(c: &mut Criterion) {
+    let mut group = c.benchmark_group("codec/get_chunk");
+    for size in CHUNK_SIZES {
+        let resp = Response::Query(QueryResponse::GetChunk(Ok(random_chunk(size))));
+        let encoded = block_on(encode_response(resp.clone())).expect("Encoding to succeed");
+        let _ = group.throughput(Throughput::Bytes(size as u64));
+        let _ = group.bench_with_input(BenchmarkId::new("encode", size), &resp, |b, resp| {
+            b.iter(|| block_on(encode_response(resp.clone())).expect("Encoding to succeed"))
+        });
+        let _ = group.bench_with_input(BenchmarkId::new("decode", size), &encoded, |b, bytes| {
+            b.iter(|| block_on(decode_response(bytes)).expect("Decoding to succeed"))
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, store_chunk, get_chunk);
+criterion_main!(benches);
@@ -0,0 +1,108 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use safenode::protocol::register::{Register, User, MAX_REG_NUM_ENTRIES};
+
+use bls::SecretKey;
+use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion};
+use rand::RngCore;
+use std::collections::BTreeSet;
+use xor_name::XorName;
+
+// Up to one entry short of the max, for one more to be written.
+const ENTRY_COUNTS: [usize; 4] = [16, 128, 512, MAX_REG_NUM_ENTRIES as usize - 1];
+const ENTRY_SIZE: usize = 512;
+
+fn random_entry() -> Vec<u8> {
+    let mut entry = vec![0u8; ENTRY_SIZE];
+    rand::thread_rng().fill_bytes(&mut entry);
+    entry
+}
+
+fn empty_register() -> Register {
+    let authority = User::Key(SecretKey::random().public_key());
+    Register::new_owned(authority, XorName::random(&mut rand::thread_rng()), 15_000)
+}
+
+// Writes the entries to the Register, each one a child of the one written before,
+// as a single writer does.
+fn write_entries(register: &mut Register, count: usize) {
+    let mut children = register.heads();
+    for _ in 0..count {
+        let (hash, _op) = register
+            .write(random_entry(), children)
+            .expect("Writing to succeed");
+        children = BTreeSet::from([hash]);
+    }
+}
+
+fn write(c: &mut Criterion) {
+    let mut group = c.benchmark_group("register/write");
+    for count in ENTRY_COUNTS {
+        let mut register = empty_register();
+        write_entries(&mut register, count);
+        let _ = group.bench_with_input(
+            BenchmarkId::from_parameter(count),
+            &register,
+            |b, register| {
+                b.iter_batched(
+                    || (register.clone(), random_entry()),
+                    |(mut register, entry)| {
+                        let children = register.heads();
+                        register.write(entry, children).expect("Writing to succeed")
+                    },
+                    BatchSize::SmallInput,
+                )
+            },
+        );
+    }
+    group.finish();
+}
+
+fn merge(c: &mut Criterion) {
+    let mut group = c.benchmark_group("register/merge");
+    for count in ENTRY_COUNTS {
+        // Two replicas which have each seen half of the entries.
+        let mut replica = empty_register();
+        let mut other = replica.clone();
+        write_entries(&mut replica, count / 2);
+        write_entries(&mut other, count - count / 2);
+        let _ = group.bench_with_input(
+            BenchmarkId::from_parameter(count),
+            &(replica, other),
+            |b, (replica, other)| {
+                b.iter_batched(
+                    || (replica.clone(), other.clone()),
+                    |(mut replica, other)| {
+                        replica.merge(other);
+                        replica
+                    },
+                    BatchSize::SmallInput,
+                )
+            },
+        );
+    }
+    group.finish();
+}
+
+fn read(c: &mut Criterion) {
+    let mut group = c.benchmark_group("register/read");
+    for count in ENTRY_COUNTS {
+        let mut register = empty_register();
+        write_entries(&mut register, count);
+        let _ = group.bench_with_input(
+            BenchmarkId::from_parameter(count),
+            &register,
+            |b, register| b.iter(|| register.read()),
+        );
+    }
+    group.finish();
+}
+
+criterion_group!(benches, write, merge, read);
+criterion_main!(benches);
@@ -0,0 +1,69 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use safenode::protocol::fees::SpendQ;
+
+use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput};
+use rand::Rng;
+
+const QUEUE_LENS: [usize; 3] = [1_000, 10_000, 100_000];
+
+fn random_fees(count: usize) -> Vec<u64> {
+    let mut rng = rand::thread_rng();
+    (0..count)
+        .map(|_| rng.gen_range(1_000..1_000_000))
+        .collect()
+}
+
+fn filled_queue(fees: &[u64]) -> SpendQ<usize> {
+    let mut queue = SpendQ::with_fee(4_000);
+    for (item, fee) in fees.iter().enumerate() {
+        queue.push(item, *fee);
+    }
+    queue
+}
+
+// Pushing a spend onto a queue of the len, which the snapshot of the stats is updated on.
+fn push(c: &mut Criterion) {
+    let mut group = c.benchmark_group("spend_queue/push");
+    for len in QUEUE_LENS {
+        let fees = random_fees(len);
+        let mut queue = filled_queue(&fees);
+        let mut item = len;
+        let _ = group.bench_function(BenchmarkId::from_parameter(len), |b| {
+            b.iter(|| {
+                // Each spend pushed is popped again, for the queue to stay at the len.
+                queue.push(item, fees[item % len]);
+                item += 1;
+                queue.pop()
+            })
+        });
+    }
+    group.finish();
+}
+
+// Popping all the spends of a queue of the len, the highest fees first.
+fn pop(c: &mut Criterion) {
+    let mut group = c.benchmark_group("spend_queue/pop");
+    group.sample_size(10);
+    for len in QUEUE_LENS {
+        let fees = random_fees(len);
+        let _ = group.throughput(Throughput::Elements(len as u64));
+        let _ = group.bench_function(BenchmarkId::from_parameter(len), |b| {
+            b.iter_batched(
+                || filled_queue(&fees),
+                |mut queue| while queue.pop().is_some() {},
+                BatchSize::PerIteration,
+            )
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, push, pop);
+criterion_main!(benches);
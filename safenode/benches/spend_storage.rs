@@ -0,0 +1,61 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use safenode::bench::{self, SpendStorage};
+
+use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput};
+use futures::future::join_all;
+use tokio::runtime::Runtime;
+
+// The spends of each iteration, all of different dbcs.
+const SPENDS: usize = 256;
+// From spends added one after the other, to many more at once than there are threads.
+const CONCURRENCY: [usize; 4] = [1, 8, 64, 256];
+
+// Adds the spends to new storage, with up to the concurrency of them being added at once.
+fn try_add(c: &mut Criterion) {
+    let runtime = Runtime::new().expect("Runtime to be created");
+    let spends = bench::spends(SPENDS);
+
+    let mut group = c.benchmark_group("spend_storage/try_add");
+    group.sample_size(10);
+    let _ = group.throughput(Throughput::Elements(SPENDS as u64));
+    for concurrency in CONCURRENCY {
+        let _ = group.bench_function(BenchmarkId::from_parameter(concurrency), |b| {
+            b.to_async(&runtime).iter_batched(
+                || {
+                    let root_dir = tempfile::tempdir().expect("Temp dir to be created");
+                    let storage = runtime.block_on(SpendStorage::new(root_dir.path()));
+                    (root_dir, storage)
+                },
+                |(_root_dir, storage)| {
+                    let spends = &spends;
+                    async move {
+                        for batch in spends.chunks(concurrency) {
+                            let adds = batch.iter().map(|spend| {
+                                let storage = storage.clone();
+                                let spend = spend.clone();
+                                tokio::spawn(async move { storage.try_add(&spend).await })
+                            });
+                            for result in join_all(adds).await {
+                                result
+                                    .expect("Task to complete")
+                                    .expect("Spend to be added");
+                            }
+                        }
+                    }
+                },
+                BatchSize::PerIteration,
+            )
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, try_add);
+criterion_main!(benches);
@@ -0,0 +1,137 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+// Thin wrappers over the internals measured by the benchmarks in `benches/`.
+// They are kept as small as possible, for what is measured to be the internals themselves.
+
+use crate::{
+    client::{self, Error as ClientError},
+    network::{MsgCodec, MsgProtocol},
+    network_transfers::Error as TransferError,
+    protocol::{
+        chunk::Chunk,
+        dbc_genesis::create_genesis_dbc,
+        messages::{Request, Response},
+        transfers::create_offline_transfer,
+    },
+    storage,
+};
+
+use sn_dbc::{MainKey, SignedSpend, Token};
+
+use futures::io::Cursor;
+use libp2p::request_response::Codec;
+use self_encryption::{DataMap, EncryptedChunk};
+use std::{io, path::Path};
+use xor_name::XorName;
+
+/// Chunks the bytes as a file uploaded by a client, see `Files::upload`.
+pub fn chunk_bytes(bytes: bytes::Bytes) -> Result<(XorName, Vec<Chunk>), ClientError> {
+    client::chunk_bytes(bytes)
+}
+
+/// Packs the self-encrypted chunks along with the data map of a file,
+/// as done by `chunk_bytes` once the file is self-encrypted.
+pub fn pack(
+    data_map: DataMap,
+    encrypted_chunks: Vec<EncryptedChunk>,
+) -> Result<(XorName, Vec<Chunk>), ClientError> {
+    Ok(client::pack(data_map, encrypted_chunks)?)
+}
+
+/// Encodes the request as written to a peer.
+pub async fn encode_request(req: Request) -> io::Result<Vec<u8>> {
+    let mut io = Cursor::new(Vec::new());
+    MsgCodec()
+        .write_request(&MsgProtocol(), &mut io, req)
+        .await?;
+    Ok(io.into_inner())
+}
+
+/// Decodes a request as read from a peer.
+pub async fn decode_request(bytes: &[u8]) -> io::Result<Request> {
+    MsgCodec()
+        .read_request(&MsgProtocol(), &mut Cursor::new(bytes))
+        .await
+}
+
+/// Encodes the response as written to a peer.
+pub async fn encode_response(resp: Response) -> io::Result<Vec<u8>> {
+    let mut io = Cursor::new(Vec::new());
+    MsgCodec()
+        .write_response(&MsgProtocol(), &mut io, resp)
+        .await?;
+    Ok(io.into_inner())
+}
+
+/// Decodes a response as read from a peer.
+pub async fn decode_response(bytes: &[u8]) -> io::Result<Response> {
+    MsgCodec()
+        .read_response(&MsgProtocol(), &mut Cursor::new(bytes))
+        .await
+}
+
+/// Returns `count` spends, each of a different dbc.
+///
+/// The dbcs are created by one transfer from a genesis dbc, and each is then spent by
+/// a transfer of its own. The spends are not checked by `SpendStorage::try_add`,
+/// so only their dbc ids matter to it.
+pub fn spends(count: usize) -> Vec<SignedSpend> {
+    let key = MainKey::random();
+    let genesis = create_genesis_dbc(&key).expect("Genesis creation to succeed.");
+    let derived_key = genesis.derived_key(&key).expect("Genesis key to derive");
+    let mut rng = rand::thread_rng();
+
+    let recipients = (0..count)
+        .map(|_| (Token::from_nano(100), key.random_dbc_id_src(&mut rng)))
+        .collect();
+    let transfer = create_offline_transfer(
+        vec![(genesis, derived_key)],
+        recipients,
+        key.public_address(),
+    )
+    .expect("Transfer from genesis to succeed.");
+
+    transfer
+        .created_dbcs
+        .into_iter()
+        .map(|created| {
+            let derived_key = created.dbc.derived_key(&key).expect("Dbc key to derive");
+            let recipient = MainKey::random().random_dbc_id_src(&mut rng);
+            let transfer = create_offline_transfer(
+                vec![(created.dbc, derived_key)],
+                vec![(Token::from_nano(10), recipient)],
+                key.public_address(),
+            )
+            .expect("Transfer of a created dbc to succeed.");
+            transfer.created_dbcs[0]
+                .dbc
+                .signed_spends
+                .iter()
+                .next()
+                .cloned()
+                .expect("The transfer to spend the created dbc")
+        })
+        .collect()
+}
+
+/// The disk-backed storage of spends of a node.
+#[derive(Clone)]
+pub struct SpendStorage(storage::SpendStorage);
+
+impl SpendStorage {
+    /// Creates the storage at the root dir.
+    pub async fn new(root_dir: &Path) -> Self {
+        Self(storage::SpendStorage::new(root_dir).await)
+    }
+
+    /// Adds the spend, as a node does once it is validated.
+    pub async fn try_add(&self, signed_spend: &SignedSpend) -> Result<(), TransferError> {
+        self.0.try_add(signed_spend).await
+    }
+}
@@ -12,11 +12,10 @@ use safenode::{
     protocol::{address::ChunkAddress, wallet::LocalWallet},
 };
 
-use bytes::Bytes;
 use clap::Parser;
 use dirs_next::home_dir;
 use eyre::Result;
-use std::{fs, path::PathBuf};
+use std::path::PathBuf;
 use tracing::info;
 use walkdir::WalkDir;
 use xor_name::XorName;
@@ -75,14 +74,16 @@ async fn main() -> Result<()> {
     if let Some(files_path) = opt.upload_chunks {
         for entry in WalkDir::new(files_path).into_iter().flatten() {
             if entry.file_type().is_file() {
-                let file = fs::read(entry.path())?;
-                let bytes = Bytes::from(file);
+                let file = tokio::fs::File::open(entry.path()).await?;
                 let file_name = entry.file_name();
 
-                info!("Storing file {file_name:?} of {} bytes..", bytes.len());
+                info!(
+                    "Storing file {file_name:?} of {} bytes..",
+                    file.metadata().await?.len()
+                );
                 println!("Storing file {file_name:?}.");
 
-                match file_api.upload(bytes).await {
+                match file_api.upload_from_reader(file, true).await {
                     Ok(address) => {
                         info!("Successfully stored file to {address:?}");
                         chunks_to_fetch.push(*address.name());
@@ -106,8 +107,11 @@ async fn main() -> Result<()> {
 
         for xorname in chunks_to_fetch.iter() {
             println!("Downloading file {xorname:?}");
-            match file_api.read_bytes(ChunkAddress::new(*xorname)).await {
-                Ok(bytes) => info!("Successfully got file {xorname} of {} bytes!", bytes.len()),
+            match file_api
+                .read_to(ChunkAddress::new(*xorname), &mut tokio::io::sink())
+                .await
+            {
+                Ok(len) => info!("Successfully got file {xorname} of {len} bytes!"),
                 Err(error) => {
                     panic!("Did not get file {xorname:?} from the network! {error}")
                 }
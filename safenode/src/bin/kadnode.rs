@@ -7,9 +7,14 @@
 // permissions and limitations relating to use of the SAFE Network Software.
 
 use safenode::{
-    log::init_node_logging,
+    log::{init_node_logging, set_log_levels},
     network::Network,
-    node::{Node, NodeEvent},
+    node::{
+        default_root_dir, Node, NodeConfig, NodeEvent, DEFAULT_CHUNK_CACHE_SIZE,
+        DEFAULT_CHUNK_STORE_SIZE, DEFAULT_MAX_CONCURRENT_REQUESTS, DEFAULT_MAX_QUEUED_REQUESTS,
+        DEFAULT_MAX_QUEUED_SPENDS, DEFAULT_REGISTER_CACHE_SIZE, DEFAULT_REGISTER_STORE_SIZE,
+        DEFAULT_SPEND_COMMIT_BATCH_SIZE, DEFAULT_SPEND_COMMIT_RATE,
+    },
 };
 
 use clap::Parser;
@@ -20,17 +25,41 @@ use std::{
     path::PathBuf,
     thread, time,
 };
-use tracing::info;
+use tracing::{info, warn};
 
 #[tokio::main]
 async fn main() -> Result<()> {
     let opt = Opt::parse();
     let _log_appender_guard = init_node_logging(&opt.log_dir)?;
+    if let Some(levels_file) = opt.log_levels_file.clone() {
+        reload_log_levels_on_hangup(levels_file)?;
+    }
 
     let socket_addr = SocketAddr::new(opt.ip, opt.port);
 
+    // Without a specified root dir, the data is kept next to the logs, if any.
+    let root_dir = opt
+        .root_dir
+        .or_else(|| opt.log_dir.clone())
+        .unwrap_or_else(default_root_dir);
+    let config = NodeConfig {
+        root_dir,
+        max_concurrent_requests: opt.max_concurrent_requests,
+        max_queued_requests: opt.max_queued_requests,
+        chunk_store_size: opt.chunk_store_size,
+        chunk_cache_size: opt.chunk_cache_size,
+        register_store_size: opt.register_store_size,
+        register_cache_size: opt.register_cache_size,
+        spend_commit_rate: opt.spend_commit_rate,
+        spend_commit_batch_size: opt.spend_commit_batch_size,
+        max_queued_spends: opt.max_queued_spends,
+        metrics_addr: opt
+            .metrics_port
+            .map(|port| SocketAddr::new(opt.metrics_ip, port)),
+    };
+
     info!("Starting a node...");
-    let node_events_channel = Node::run(socket_addr).await?;
+    let node_events_channel = Node::run(socket_addr, config).await?;
 
     let mut node_events_rx = node_events_channel.subscribe();
     if let Ok(event) = node_events_rx.recv().await {
@@ -53,6 +82,11 @@ struct Opt {
     #[clap(long)]
     log_dir: Option<PathBuf>,
 
+    /// Specify the dir where the node keeps its data.
+    /// Defaults to the log dir, if specified, or to `$HOME/.safe/node` otherwise.
+    #[clap(long)]
+    root_dir: Option<PathBuf>,
+
     /// Specify specific port to listen on.
     /// Defaults to 0, which means any available port.
     #[clap(long, default_value_t = 0)]
@@ -62,6 +96,90 @@ struct Opt {
     /// Defaults to 0.0.0.0, which will bind to all network interfaces.
     #[clap(long, default_value_t = IpAddr::V4(Ipv4Addr::UNSPECIFIED))]
     ip: IpAddr,
+
+    /// The max number of requests the node handles concurrently.
+    #[clap(long, default_value_t = DEFAULT_MAX_CONCURRENT_REQUESTS)]
+    max_concurrent_requests: usize,
+
+    /// The max number of requests waiting to be handled.
+    /// Requests received beyond that are dropped.
+    #[clap(long, default_value_t = DEFAULT_MAX_QUEUED_REQUESTS)]
+    max_queued_requests: usize,
+
+    /// The max number of bytes of chunks the node stores on disk.
+    #[clap(long, default_value_t = DEFAULT_CHUNK_STORE_SIZE)]
+    chunk_store_size: usize,
+
+    /// The max number of bytes of chunks the node caches in memory.
+    #[clap(long, default_value_t = DEFAULT_CHUNK_CACHE_SIZE)]
+    chunk_cache_size: usize,
+
+    /// The max number of bytes of Registers the node stores on disk.
+    #[clap(long, default_value_t = DEFAULT_REGISTER_STORE_SIZE)]
+    register_store_size: usize,
+
+    /// The max number of bytes of Registers the node caches in memory.
+    #[clap(long, default_value_t = DEFAULT_REGISTER_CACHE_SIZE)]
+    register_cache_size: usize,
+
+    /// The number of queued spends the node commits per second.
+    #[clap(long, default_value_t = DEFAULT_SPEND_COMMIT_RATE)]
+    spend_commit_rate: u32,
+
+    /// The max number of queued spends the node commits at a time.
+    #[clap(long, default_value_t = DEFAULT_SPEND_COMMIT_BATCH_SIZE)]
+    spend_commit_batch_size: usize,
+
+    /// The max number of spends the node queues to be committed.
+    /// New spends are refused once it is reached.
+    #[clap(long, default_value_t = DEFAULT_MAX_QUEUED_SPENDS)]
+    max_queued_spends: usize,
+
+    /// Specify the port to serve the metrics of the node on, for Prometheus to scrape.
+    /// The metrics are not served unless a port is specified.
+    #[clap(long)]
+    metrics_port: Option<u16>,
+
+    /// Specify the IP to serve the metrics of the node on.
+    /// Defaults to 127.0.0.1, which only serves them to the local host.
+    #[clap(long, default_value_t = IpAddr::V4(Ipv4Addr::LOCALHOST))]
+    metrics_ip: IpAddr,
+
+    /// Specify a file of the levels to log, per module, e.g. `safenode=info,safenode::network=debug`.
+    /// The levels logged are replaced by those in the file each time the node gets a SIGHUP.
+    /// They are otherwise set by the `SN_LOG` env var at start.
+    #[clap(long)]
+    log_levels_file: Option<PathBuf>,
+}
+
+/// Replaces the levels logged by those in the file, on each SIGHUP,
+/// for them to be changed while the node runs.
+#[cfg(unix)]
+fn reload_log_levels_on_hangup(levels_file: PathBuf) -> Result<()> {
+    use tokio::signal::unix::{signal, SignalKind};
+
+    let mut hangups = signal(SignalKind::hangup())?;
+    let _handle = tokio::spawn(async move {
+        while hangups.recv().await.is_some() {
+            let levels = match tokio::fs::read_to_string(&levels_file).await {
+                Ok(levels) => levels,
+                Err(err) => {
+                    warn!("Failed to read the log levels from {levels_file:?}: {err}");
+                    continue;
+                }
+            };
+            match set_log_levels(&levels) {
+                Ok(()) => info!("Log levels set to {:?}", levels.trim()),
+                Err(err) => warn!("Failed to set the log levels from {levels_file:?}: {err}"),
+            }
+        }
+    });
+    Ok(())
+}
+
+#[cfg(not(unix))]
+fn reload_log_levels_on_hangup(_levels_file: PathBuf) -> Result<()> {
+    Err(eyre!("Log levels can only be reloaded on unix"))
 }
 
 // Todo: Implement node bootstrapping to connect to peers from outside the local network
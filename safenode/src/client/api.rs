@@ -12,22 +12,64 @@ use super::{
 };
 
 use crate::{
-    network::{NetworkEvent, SwarmDriver},
+    network::{
+        close_group_majority, Error as NetworkError, NetworkEvent, SingleFlight, SwarmDriver,
+        TtlCache,
+    },
+    node::NodeId,
     protocol::{
-        address::ChunkAddress,
+        address::{dbc_address, ChunkAddress},
         chunk::Chunk,
-        error::Error as ProtocolError,
-        messages::{Cmd, CmdResponse, Query, QueryResponse, Request, Response},
+        error::{Error as ProtocolError, Result as ProtocolResult},
+        fees::{RequiredFee, SpendPriority},
+        messages::{
+            Cmd, CmdResponse, Query, QueryResponse, Request, Response, SpendQuery,
+            MAX_CHUNK_BATCH_SIZE, MAX_PROBED_CHUNKS, MAX_QUOTED_DBCS,
+        },
     },
 };
 
+use sn_dbc::DbcId;
+
 use bls::{PublicKey, SecretKey, Signature};
-use futures::future::select_all;
+use futures::{future::join_all, stream, StreamExt};
 use libp2p::PeerId;
-use std::time::Duration;
+use std::{
+    collections::{BTreeMap, BTreeSet},
+    time::Duration,
+};
 use tokio::task::spawn;
 use xor_name::XorName;
 
+/// The max number of batches of chunks probed at a time.
+const MAX_CONCURRENT_PROBES: usize = 32;
+/// The max number of bytes of the chunks stored with a single cmd.
+const MAX_STORED_BYTES: usize = 4 * 1024 * 1024;
+/// The max number of fee quotes cached, each for a dbc at a given priority.
+const FEE_QUOTES_CACHE_SIZE: usize = 1024;
+/// How long a fee quote is reused for, so that transfers retried, or built again from the
+/// same inputs, don't query it again. Nodes accept fees a bit below their current one, so a
+/// quote stays good for as long as their fees don't rise much, which they don't within this
+/// window unless spends surge.
+const FEE_QUOTE_TTL: Duration = Duration::from_secs(10);
+
+/// The fees quoted by each node of the close group of a dbc, for spending it.
+pub(crate) type NodeFees = BTreeMap<NodeId, RequiredFee>;
+
+/// Items of chunks sharing their close group, which are sent to it with a single request.
+#[derive(Clone)]
+pub(super) struct ChunkBatch<T> {
+    peers: Vec<PeerId>,
+    items: Vec<T>,
+}
+
+impl<T> ChunkBatch<T> {
+    /// Returns the items of the batch.
+    pub(super) fn into_items(self) -> Vec<T> {
+        self.items
+    }
+}
+
 impl Client {
     /// Instantiate a new client.
     pub fn new(signer: SecretKey) -> Result<Self> {
@@ -39,6 +81,8 @@ impl Client {
             network,
             events_channel,
             signer,
+            chunk_fetches: SingleFlight::default(),
+            fee_quotes: TtlCache::new(FEE_QUOTES_CACHE_SIZE, FEE_QUOTE_TTL),
         };
         let mut client_clone = client.clone();
 
@@ -114,41 +158,226 @@ impl Client {
         RegisterOffline::create(self.clone(), xorname, tag)
     }
 
-    /// Store `Chunk` to its close group.
-    pub(super) async fn store_chunk(&self, chunk: Chunk) -> Result<()> {
-        info!("Store chunk: {:?}", chunk.address());
-        let request = Request::Cmd(Cmd::StoreChunk(chunk));
-        let responses = self.send_to_closest(request).await?;
+    /// Stores the chunks of the batch to their close group, with a single cmd, returning
+    /// the result of storing each: a chunk is stored once a majority of the group stored it.
+    /// If `verify` is set, the chunks stored are also retrieved again, with a single query.
+    ///
+    /// An error is only returned if none of the group responded to the batch.
+    pub(super) async fn store_chunk_batch(
+        &self,
+        batch: ChunkBatch<Chunk>,
+        verify: bool,
+    ) -> Result<Vec<(Chunk, Result<()>)>> {
+        let ChunkBatch { peers, items } = batch;
+        trace!("Storing a batch of {} chunks", items.len());
+        let count = items.len();
+        let request = Request::Cmd(Cmd::StoreChunks(items.clone()));
+        let stored_counts = |responses: &[Result<Response, NetworkError>]| {
+            let mut stored = vec![0; count];
+            for results in stored_results(responses, count) {
+                for (stored, result) in stored.iter_mut().zip(results) {
+                    if result.is_ok() {
+                        *stored += 1;
+                    }
+                }
+            }
+            stored
+        };
+        let responses = self
+            .network
+            .send_and_get_responses(peers.clone(), &request, |responses| {
+                stored_counts(responses)
+                    .iter()
+                    .all(|stored| *stored >= close_group_majority())
+            })
+            .await;
+        if stored_results(&responses, count).next().is_none() {
+            // With no results to the batch, it failed as a whole.
+            if let Some(error) = batch_error(&responses) {
+                return Err(Error::Protocol(error));
+            }
+            for resp in responses {
+                let _ = resp?;
+            }
+            return Err(Error::Protocol(ProtocolError::UnexpectedResponses));
+        }
 
-        let all_ok = responses
-            .iter()
-            .all(|resp| matches!(resp, Ok(Response::Cmd(CmdResponse::StoreChunk(Ok(()))))));
-        if all_ok {
-            return Ok(());
+        let stored = stored_counts(&responses);
+        let mut results: Vec<_> = items
+            .into_iter()
+            .enumerate()
+            .map(|(i, chunk)| {
+                if stored[i] >= close_group_majority() {
+                    return (chunk, Ok(()));
+                }
+                // The first error sent for the chunk, if any.
+                let error = stored_results(&responses, count)
+                    .find_map(|results| results[i].clone().err())
+                    .unwrap_or(ProtocolError::UnexpectedResponses);
+                (chunk, Err(Error::Protocol(error)))
+            })
+            .collect();
+
+        // With no chunk stored, there is nothing to verify.
+        if verify && results.iter().any(|(_, result)| result.is_ok()) {
+            let stored: Vec<_> = results
+                .iter()
+                .filter(|(_, result)| result.is_ok())
+                .map(|(chunk, _)| *chunk.address())
+                .collect();
+            let retrieved = self
+                .get_chunk_batch(ChunkBatch {
+                    peers,
+                    items: stored,
+                })
+                .await?;
+            let mut retrieved = retrieved.into_iter();
+            for (_, result) in results.iter_mut().filter(|(_, result)| result.is_ok()) {
+                if let Some((_, Err(error))) = retrieved.next() {
+                    *result = Err(error);
+                }
+            }
         }
 
-        // If not all were Ok, we will return the first error sent to us.
-        for resp in responses.iter().flatten() {
-            if let Response::Cmd(CmdResponse::StoreChunk(result)) = resp {
-                result.clone()?;
-            };
+        Ok(results)
+    }
+
+    /// Retrieves the chunks of the batch from their close group, with a single query,
+    /// returning the result of retrieving each: the first chunk returned for it.
+    ///
+    /// An error is only returned if none of the group responded to the batch.
+    pub(super) async fn get_chunk_batch(
+        &self,
+        batch: ChunkBatch<ChunkAddress>,
+    ) -> Result<Vec<(ChunkAddress, Result<Chunk>)>> {
+        let ChunkBatch { peers, items } = batch;
+        if items.is_empty() {
+            return Ok(vec![]);
+        }
+        trace!("Retrieving a batch of {} chunks", items.len());
+        let count = items.len();
+        let request = Request::Query(Query::GetChunks(items.clone()));
+        // A chunk in the wrong place of the results is taken as an error.
+        let retrieved_at = |responses: &[Result<Response, NetworkError>], i: usize| {
+            retrieved_results(responses, count).find_map(|results| match &results[i] {
+                Ok(chunk) if *chunk.address() == items[i] => Some(chunk.clone()),
+                _ => None,
+            })
+        };
+        let responses = self
+            .network
+            .send_and_get_responses(peers, &request, |responses| {
+                (0..count).all(|i| retrieved_at(responses, i).is_some())
+            })
+            .await;
+        if retrieved_results(&responses, count).next().is_none() {
+            // With no results to the batch, it failed as a whole.
+            if let Some(error) = batch_error(&responses) {
+                return Err(Error::Protocol(error));
+            }
+            for resp in responses {
+                let _ = resp?;
+            }
+            return Err(Error::Protocol(ProtocolError::UnexpectedResponses));
         }
 
-        // If there were no success or fail to the expected query,
-        // we check if there were any send errors.
-        for resp in responses {
-            let _ = resp?;
+        Ok(items
+            .iter()
+            .enumerate()
+            .map(|(i, address)| {
+                if let Some(chunk) = retrieved_at(&responses, i) {
+                    return (*address, Ok(chunk));
+                }
+                // The first error sent for the chunk, if any.
+                let error = retrieved_results(&responses, count)
+                    .find_map(|results| results[i].clone().err())
+                    .unwrap_or(ProtocolError::UnexpectedResponses);
+                (*address, Err(Error::Protocol(error)))
+            })
+            .collect())
+    }
+
+    /// Groups the items by the close group of their chunk, in batches of at most
+    /// `MAX_CHUNK_BATCH_SIZE` items, and of at most `MAX_STORED_BYTES` as counted by `size`.
+    ///
+    /// The close groups are looked up concurrently. The items whose close group couldn't be
+    /// looked up are returned along with the error.
+    pub(super) async fn batch_by_close_group<T, A, S>(
+        &self,
+        items: Vec<T>,
+        address: A,
+        size: S,
+    ) -> (Vec<ChunkBatch<T>>, Vec<(T, Error)>)
+    where
+        A: Fn(&T) -> ChunkAddress,
+        S: Fn(&T) -> usize,
+    {
+        let address = &address;
+        let lookups = items.into_iter().map(|item| async move {
+            let closest_peers = self
+                .network
+                .client_get_closest_peers(*address(&item).name())
+                .await;
+            (item, closest_peers)
+        });
+        let mut groups: BTreeMap<Vec<PeerId>, Vec<T>> = BTreeMap::new();
+        let mut failed = vec![];
+        for (item, closest_peers) in join_all(lookups).await {
+            match closest_peers {
+                Ok(mut peers) => {
+                    peers.sort();
+                    groups.entry(peers).or_default().push(item);
+                }
+                Err(error) => failed.push((item, Error::Network(error))),
+            }
         }
 
-        // If there were no store chunk errors, then we had unexpected responses.
-        Err(Error::Protocol(ProtocolError::UnexpectedResponses))
+        let mut batches = vec![];
+        for (peers, items) in groups {
+            let mut batch = vec![];
+            let mut batch_size = 0;
+            for item in items {
+                let item_size = size(&item);
+                if !batch.is_empty()
+                    && (batch.len() == MAX_CHUNK_BATCH_SIZE
+                        || batch_size + item_size > MAX_STORED_BYTES)
+                {
+                    batches.push(ChunkBatch {
+                        peers: peers.clone(),
+                        items: std::mem::take(&mut batch),
+                    });
+                    batch_size = 0;
+                }
+                batch.push(item);
+                batch_size += item_size;
+            }
+            batches.push(ChunkBatch {
+                peers,
+                items: batch,
+            });
+        }
+
+        (batches, failed)
     }
 
     /// Retrieve a `Chunk` from the closest peers.
+    /// Concurrent retrievals of the same chunk share a single query.
     pub(super) async fn get_chunk(&self, address: ChunkAddress) -> Result<Chunk> {
+        self.chunk_fetches
+            .run(address, || self.fetch_chunk(address))
+            .await
+    }
+
+    async fn fetch_chunk(&self, address: ChunkAddress) -> Result<Chunk> {
         info!("Get chunk: {address:?}");
         let request = Request::Query(Query::GetChunk(address));
-        let responses = self.send_to_closest(request).await?;
+        let responses = self
+            .send_to_closest(request, |responses| {
+                responses
+                    .iter()
+                    .any(|resp| matches!(resp, Ok(Response::Query(QueryResponse::GetChunk(Ok(_))))))
+            })
+            .await?;
 
         // We will return the first chunk we get.
         for resp in responses.iter().flatten() {
@@ -174,56 +403,233 @@ impl Client {
         Err(Error::Protocol(ProtocolError::UnexpectedResponses))
     }
 
-    pub(crate) async fn send_to_closest(&self, request: Request) -> Result<Vec<Result<Response>>> {
-        info!("Sending {:?} to the closest peers.", request.dst());
-        let closest_peers = self
-            .network
-            .client_get_closest_peers(*request.dst().name())
-            .await?;
-        Ok(self
-            .send_and_get_responses(closest_peers, &request, true)
-            .await)
+    /// Returns the addresses of those chunks held by a majority of the peers they were probed at.
+    ///
+    /// The addresses are probed in batches of those sharing their first byte, each batch at the
+    /// close group of its first address, and up to `MAX_CONCURRENT_PROBES` batches are probed
+    /// at a time.
+    /// In a network big enough for some of the addresses of a batch to have another close group,
+    /// those are taken as not held, which only costs storing them again.
+    pub(super) async fn has_chunks(
+        &self,
+        addresses: Vec<ChunkAddress>,
+    ) -> Result<BTreeSet<ChunkAddress>> {
+        let mut batches: BTreeMap<u8, Vec<ChunkAddress>> = BTreeMap::new();
+        for address in addresses {
+            batches
+                .entry(address.name().0[0])
+                .or_default()
+                .push(address);
+        }
+        let batches = batches
+            .into_values()
+            .flat_map(|batch| {
+                batch
+                    .chunks(MAX_PROBED_CHUNKS)
+                    .map(<[ChunkAddress]>::to_vec)
+                    .collect::<Vec<_>>()
+            })
+            .collect::<Vec<_>>();
+
+        let mut probes = stream::iter(batches)
+            .map(|batch| self.probe_chunks(batch))
+            .buffer_unordered(MAX_CONCURRENT_PROBES);
+        let mut held = BTreeSet::new();
+        while let Some(result) = probes.next().await {
+            held.extend(result?);
+        }
+
+        Ok(held)
+    }
+
+    // Probes the close group of the first of the addresses for the chunks it holds.
+    async fn probe_chunks(&self, addresses: Vec<ChunkAddress>) -> Result<Vec<ChunkAddress>> {
+        trace!(
+            "Probing {} chunks at {:?}",
+            addresses.len(),
+            addresses.first()
+        );
+        let request = Request::Query(Query::HasChunks(addresses.clone()));
+        // Only all the responses tell which chunks are held by a majority.
+        let responses = self.send_to_closest(request, |_| false).await?;
+
+        let mut held_by = vec![0; addresses.len()];
+        for resp in responses.iter().flatten() {
+            if let Response::Query(QueryResponse::HasChunks(Ok(held))) = resp {
+                for (count, held) in held_by.iter_mut().zip(held) {
+                    if *held {
+                        *count += 1;
+                    }
+                }
+            }
+        }
+
+        Ok(addresses
+            .into_iter()
+            .zip(held_by)
+            .filter(|(_, count)| *count >= close_group_majority())
+            .map(|(address, _)| address)
+            .collect())
+    }
+
+    /// Returns the fees quoted by the nodes of the close group of each of the dbcs for spending
+    /// it, leaving out the dbcs whose close group couldn't be queried.
+    ///
+    /// Fees quoted within the last few seconds are reused. The close groups of the other dbcs
+    /// are looked up concurrently, and the fees of the dbcs sharing a close group are quoted
+    /// with a single query, the queries to the different groups all being sent concurrently.
+    pub(crate) async fn get_fees(
+        &self,
+        dbc_ids: BTreeSet<DbcId>,
+        priority: SpendPriority,
+    ) -> BTreeMap<DbcId, NodeFees> {
+        let mut fees = BTreeMap::new();
+        let mut unquoted = vec![];
+        for dbc_id in dbc_ids {
+            match self.fee_quotes.get(&(dbc_address(&dbc_id), priority)) {
+                Some(node_fees) => {
+                    let _ = fees.insert(dbc_id, node_fees);
+                }
+                None => unquoted.push(dbc_id),
+            }
+        }
+
+        let lookups = unquoted.into_iter().map(|dbc_id| async move {
+            let closest_peers = self
+                .network
+                .client_get_closest_peers(*dbc_address(&dbc_id).name())
+                .await;
+            (dbc_id, closest_peers)
+        });
+        let mut groups: BTreeMap<Vec<PeerId>, Vec<DbcId>> = BTreeMap::new();
+        for (dbc_id, closest_peers) in join_all(lookups).await {
+            match closest_peers {
+                Ok(mut peers) => {
+                    peers.sort();
+                    groups.entry(peers).or_default().push(dbc_id);
+                }
+                Err(error) => warn!("Could not find the close group of dbc {dbc_id:?}: {error}"),
+            }
+        }
+
+        let quotes = groups.into_iter().flat_map(|(peers, dbc_ids)| {
+            dbc_ids
+                .chunks(MAX_QUOTED_DBCS)
+                .map(|batch| self.quote_fees(peers.clone(), batch.to_vec(), priority))
+                .collect::<Vec<_>>()
+        });
+        for quoted in join_all(quotes).await {
+            for (dbc_id, node_fees) in quoted {
+                // Quotes from too few nodes are not reused, so that they are queried again.
+                if node_fees.len() >= close_group_majority() {
+                    self.fee_quotes
+                        .insert((dbc_address(&dbc_id), priority), node_fees.clone());
+                }
+                let _ = fees.insert(dbc_id, node_fees);
+            }
+        }
+
+        fees
     }
 
-    // Send a `Request` to the provided set of nodes and wait for their responses concurrently.
-    // If `get_all_responses` is true, we wait for the responses from all the nodes. Will return an
-    // error if the request timeouts.
-    // If `get_all_responses` is false, we return the first successful response that we get.
-    async fn send_and_get_responses(
+    // Queries the peers of the close group shared by the dbcs for the fees of spending them.
+    async fn quote_fees(
         &self,
-        nodes: Vec<PeerId>,
-        req: &Request,
-        get_all_responses: bool,
-    ) -> Vec<Result<Response>> {
-        let mut list_of_futures = Vec::new();
-        for node in nodes {
-            let future = Box::pin(tokio::time::timeout(
-                Duration::from_secs(10),
-                self.network.send_request(req.clone(), node),
-            ));
-            list_of_futures.push(future);
-        }
-
-        let mut responses = Vec::new();
-        while !list_of_futures.is_empty() {
-            match select_all(list_of_futures).await {
-                (Ok(res), _, remaining_futures) => {
-                    let res = res.map_err(Error::Network);
-                    info!("Got response for the req: {req:?}, res: {res:?}");
-                    // return the first successful response
-                    if !get_all_responses && res.is_ok() {
-                        return vec![res];
+        peers: Vec<PeerId>,
+        dbc_ids: Vec<DbcId>,
+        priority: SpendPriority,
+    ) -> Vec<(DbcId, NodeFees)> {
+        trace!("Querying fees for {} dbcs", dbc_ids.len());
+        let request = Request::Query(Query::Spend(SpendQuery::GetFees {
+            dbc_ids: dbc_ids.clone(),
+            priority,
+        }));
+        // Fees are paid to each node in the close group, so all are waited for.
+        let responses = self
+            .network
+            .send_and_get_responses(peers, &request, |_| false)
+            .await;
+
+        // We just want to receive at least a majority of results, we don't care about any errors
+        // so we log them, but return whatever results we get. If not enough for upper layer, it will error there.
+        let mut fees = vec![NodeFees::new(); dbc_ids.len()];
+        for resp in responses {
+            match resp {
+                Ok(Response::Query(QueryResponse::GetFees(Ok((node_id, node_fees))))) => {
+                    if node_fees.len() != dbc_ids.len() {
+                        warn!(
+                            "Fee query to {node_id:?} returned the fees of {} dbcs, instead of {}",
+                            node_fees.len(),
+                            dbc_ids.len()
+                        );
+                        continue;
+                    }
+                    for (fees, fee) in fees.iter_mut().zip(node_fees) {
+                        let _ = fees.insert(node_id, fee);
                     }
-                    responses.push(res);
-                    list_of_futures = remaining_futures;
                 }
-                (Err(timeout_err), _, remaining_futures) => {
-                    responses.push(Err(Error::ResponseTimeout(timeout_err)));
-                    list_of_futures = remaining_futures;
+                Ok(Response::Query(QueryResponse::GetFees(Err(error)))) => {
+                    warn!("Fee query unexpectedly failed: {error}");
                 }
+                Ok(other) => warn!("Unexpected response to fee query: {other:?}"),
+                Err(error) => warn!("Error when querying for fees: {error}"),
             }
         }
 
-        responses
+        dbc_ids.into_iter().zip(fees).collect()
     }
+
+    /// Sends the request to the closest peers of its destination, and returns
+    /// their responses as soon as the ones received so far are `enough`.
+    pub(crate) async fn send_to_closest<F>(
+        &self,
+        request: Request,
+        enough: F,
+    ) -> Result<Vec<Result<Response, NetworkError>>>
+    where
+        F: Fn(&[Result<Response, NetworkError>]) -> bool,
+    {
+        let dst = request.dst()?;
+        info!("Sending {dst:?} to the closest peers.");
+        let closest_peers = self.network.client_get_closest_peers(*dst.name()).await?;
+        Ok(self
+            .network
+            .send_and_get_responses(closest_peers, &request, enough)
+            .await)
+    }
+}
+
+// The results in each of the responses to a `StoreChunks` of `count` chunks.
+fn stored_results(
+    responses: &[Result<Response, NetworkError>],
+    count: usize,
+) -> impl Iterator<Item = &[ProtocolResult<()>]> {
+    responses.iter().filter_map(move |resp| match resp {
+        Ok(Response::Cmd(CmdResponse::StoreChunks(Ok(results)))) if results.len() == count => {
+            Some(results.as_slice())
+        }
+        _ => None,
+    })
+}
+
+// The results in each of the responses to a `GetChunks` of `count` chunks.
+fn retrieved_results(
+    responses: &[Result<Response, NetworkError>],
+    count: usize,
+) -> impl Iterator<Item = &[ProtocolResult<Chunk>]> {
+    responses.iter().filter_map(move |resp| match resp {
+        Ok(Response::Query(QueryResponse::GetChunks(Ok(results)))) if results.len() == count => {
+            Some(results.as_slice())
+        }
+        _ => None,
+    })
+}
+
+// The first error sent for a `StoreChunks` or `GetChunks` batch as a whole, if any.
+fn batch_error(responses: &[Result<Response, NetworkError>]) -> Option<ProtocolError> {
+    responses.iter().flatten().find_map(|resp| match resp {
+        Response::Cmd(CmdResponse::StoreChunks(Err(error)))
+        | Response::Query(QueryResponse::GetChunks(Err(error))) => Some(error.clone()),
+        _ => None,
+    })
 }
@@ -8,6 +8,7 @@
 
 use std::io;
 use thiserror::Error;
+use xor_name::XorName;
 
 pub(crate) type Result<T, E = Error> = std::result::Result<T, E>;
 
@@ -55,6 +56,12 @@ pub enum Error {
         maximum: usize,
     },
 
+    #[error("The chunk at {0:?} does not hold the data map of a segment.")]
+    InvalidSegment(XorName),
+
+    #[error("The encryption of segment {0} was dropped before it returned its chunks.")]
+    SegmentEncryptionDropped(usize),
+
     #[error("Not all chunks were retrieved, expected {expected}, retrieved {retrieved}.")]
     NotEnoughChunksRetrieved {
         /// Number of Chunks expected to be retrieved
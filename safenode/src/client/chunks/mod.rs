@@ -10,7 +10,10 @@ mod error;
 mod pac_man;
 
 pub(crate) use self::error::{Error, Result};
-pub(crate) use pac_man::{encrypt_large, to_chunk, DataMapLevel};
+pub(crate) use pac_man::{
+    encrypt_large, encrypt_segment, next_segment_len, pack, pack_segments, to_chunk, DataMapLevel,
+    SEGMENT_SIZE,
+};
 
 use bytes::Bytes;
 use self_encryption::MIN_ENCRYPTABLE_BYTES;
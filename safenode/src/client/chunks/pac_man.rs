@@ -10,7 +10,7 @@ use super::{Error, Result};
 
 use crate::protocol::chunk::Chunk;
 
-use self_encryption::{DataMap, EncryptedChunk, MAX_CHUNK_SIZE};
+use self_encryption::{DataMap, EncryptedChunk, MAX_CHUNK_SIZE, MIN_ENCRYPTABLE_BYTES};
 
 use bincode::serialize;
 use bytes::Bytes;
@@ -19,6 +19,11 @@ use serde::{Deserialize, Serialize};
 use std::path::Path;
 use xor_name::XorName;
 
+/// The max number of bytes self-encrypted at once. Data larger than this is split into
+/// segments, which are encrypted, stored and fetched one at a time, so that the data never
+/// needs to be held in memory as a whole.
+pub(crate) const SEGMENT_SIZE: usize = 16 * 1024 * 1024;
+
 #[derive(Serialize, Deserialize)]
 pub(crate) enum DataMapLevel {
     // Holds the data map to the source data.
@@ -27,19 +32,74 @@ pub(crate) enum DataMapLevel {
     // resulting from chunking up a previous level data map.
     // This happens when that previous level data map was too big to fit in a chunk itself.
     Additional(DataMap),
+    // Holds the addresses of the data maps of the segments the source data was split into,
+    // in order. Each segment is packed like the source data of its own file.
+    Segments(Vec<XorName>),
 }
 
 #[allow(unused)]
 pub(crate) fn encrypt_from_path(path: &Path) -> Result<(XorName, Vec<Chunk>)> {
-    let (data_map, encrypted_chunks) = encrypt_file(path)?;
-    pack(data_map, encrypted_chunks)
+    let bytes = Bytes::from(std::fs::read(path)?);
+    encrypt_large(bytes)
+}
+
+/// Encrypts the data, split into segments if it is larger than a segment,
+/// and returns the top-most chunk address and all the chunks.
+pub(crate) fn encrypt_large(mut data: Bytes) -> Result<(XorName, Vec<Chunk>)> {
+    if next_segment_len(data.len(), true) == Some(data.len()) {
+        return encrypt_segment(data);
+    }
+
+    let mut segments = vec![];
+    while let Some(len) = next_segment_len(data.len(), true) {
+        segments.push(data.split_to(len));
+    }
+
+    // The segments are encrypted independently of each other, so they are encrypted
+    // in parallel, their results being collected in the order of the segments.
+    let encrypted_segments = segments
+        .into_par_iter()
+        .map(encrypt_segment)
+        .collect::<Result<Vec<_>>>()?;
+
+    let mut names = vec![];
+    let mut all_chunks = vec![];
+    for (name, chunks) in encrypted_segments {
+        names.push(name);
+        all_chunks.extend(chunks);
+    }
+
+    let (address, chunks) = pack_segments(names)?;
+    all_chunks.extend(chunks);
+    Ok((address, all_chunks))
 }
 
-pub(crate) fn encrypt_large(data: Bytes) -> Result<(XorName, Vec<Chunk>)> {
+/// Self-encrypts the data of a single segment, and packs its data map.
+pub(crate) fn encrypt_segment(data: Bytes) -> Result<(XorName, Vec<Chunk>)> {
     let (data_map, encrypted_chunks) = encrypt_data(data)?;
     pack(data_map, encrypted_chunks)
 }
 
+/// Returns the length of the next segment to cut from the start of the `buffered` bytes, or `None`
+/// if more bytes are needed to tell (or there are none left at the end of the data).
+/// Segments are `SEGMENT_SIZE` bytes, except for the last one, which also takes
+/// any trailing bytes that would be too few to be self-encrypted on their own.
+pub(crate) fn next_segment_len(buffered: usize, at_end: bool) -> Option<usize> {
+    if buffered >= SEGMENT_SIZE + MIN_ENCRYPTABLE_BYTES {
+        Some(SEGMENT_SIZE)
+    } else if at_end && buffered > 0 {
+        Some(buffered)
+    } else {
+        None
+    }
+}
+
+/// Packs the addresses of the segments of some data, and returns the
+/// top-most chunk address and the chunks holding the list of segments.
+pub(crate) fn pack_segments(segments: Vec<XorName>) -> Result<(XorName, Vec<Chunk>)> {
+    pack_level(DataMapLevel::Segments(segments))
+}
+
 /// Returns the top-most chunk address through which the entire
 /// data tree can be accessed, and all the other encrypted chunks.
 /// If encryption is provided, the additional `DataMapLevel` chunks are encrypted with it.
@@ -48,16 +108,39 @@ pub(crate) fn pack(
     data_map: DataMap,
     encrypted_chunks: Vec<EncryptedChunk>,
 ) -> Result<(XorName, Vec<Chunk>)> {
-    // Produces a chunk out of the first `DataMap`, which is validated for its size.
+    let (address, additional_chunks) = pack_level(DataMapLevel::First(data_map))?;
+
+    let expected_total = encrypted_chunks.len() + additional_chunks.len();
+    let all_chunks: Vec<_> = encrypted_chunks
+        .into_par_iter()
+        .map(|c| to_chunk(c.content)) // no need to encrypt what is self-encrypted
+        .chain(additional_chunks)
+        .collect();
+
+    if expected_total > all_chunks.len() {
+        // as we flatten above, we need to check outcome here
+        return Err(Error::NotAllDataWasChunked {
+            expected: expected_total,
+            chunked: all_chunks.len(),
+        });
+    }
+
+    Ok((address, all_chunks))
+}
+
+/// Returns the address of the chunk through which the `DataMapLevel` can be accessed,
+/// and the chunks produced to hold it, with that chunk last.
+fn pack_level(level: DataMapLevel) -> Result<(XorName, Vec<Chunk>)> {
+    // Produces a chunk out of the first `DataMapLevel`, which is validated for its size.
     // If the chunk is too big, it is self-encrypted and the resulting (additional level) `DataMap` is put into a chunk.
     // The above step is repeated as many times as required until the chunk size is valid.
     // In other words: If the chunk content is too big, it will be
     // self encrypted into additional chunks, and now we have a new `DataMap`
     // which points to all of those additional chunks.. and so on.
     let mut chunks = vec![];
-    let mut chunk_content = pack_data_map(DataMapLevel::First(data_map))?;
+    let mut chunk_content = pack_data_map(level)?;
 
-    let (address, additional_chunks) = loop {
+    loop {
         let chunk = to_chunk(chunk_content);
         // If datamap chunk is less than `MAX_CHUNK_SIZE` return it so it can be directly sent to the network.
         if MAX_CHUNK_SIZE >= chunk.serialised_size() {
@@ -65,35 +148,18 @@ pub(crate) fn pack(
             chunks.reverse();
             chunks.push(chunk);
             // Returns the address of the last datamap, and all the chunks produced.
-            break (name, chunks);
+            return Ok((name, chunks));
         } else {
             let serialized_chunk = Bytes::from(serialize(&chunk)?);
             let (data_map, next_encrypted_chunks) = self_encryption::encrypt(serialized_chunk)?;
             chunks = next_encrypted_chunks
-                .par_iter()
-                .map(|c| to_chunk(c.content.clone())) // no need to encrypt what is self-encrypted
+                .into_par_iter()
+                .map(|c| to_chunk(c.content)) // no need to encrypt what is self-encrypted
                 .chain(chunks)
                 .collect();
             chunk_content = pack_data_map(DataMapLevel::Additional(data_map))?;
         }
-    };
-
-    let expected_total = encrypted_chunks.len() + additional_chunks.len();
-    let all_chunks: Vec<_> = encrypted_chunks
-        .par_iter()
-        .map(|c| to_chunk(c.content.clone())) // no need to encrypt what is self-encrypted
-        .chain(additional_chunks)
-        .collect();
-
-    if expected_total > all_chunks.len() {
-        // as we flatten above, we need to check outcome here
-        return Err(Error::NotAllDataWasChunked {
-            expected: expected_total,
-            chunked: all_chunks.len(),
-        });
     }
-
-    Ok((address, all_chunks))
 }
 
 pub(crate) fn to_chunk(chunk_content: Bytes) -> Chunk {
@@ -104,13 +170,53 @@ fn pack_data_map(data_map: DataMapLevel) -> Result<Bytes> {
     Ok(Bytes::from(serialize(&data_map)?))
 }
 
-fn encrypt_file(file: &Path) -> Result<(DataMap, Vec<EncryptedChunk>)> {
-    let bytes = Bytes::from(std::fs::read(file)?);
+fn encrypt_data(bytes: Bytes) -> Result<(DataMap, Vec<EncryptedChunk>)> {
     let encrypted_chunk = self_encryption::encrypt(bytes)?;
     Ok(encrypted_chunk)
 }
 
-fn encrypt_data(bytes: Bytes) -> Result<(DataMap, Vec<EncryptedChunk>)> {
-    let encrypted_chunk = self_encryption::encrypt(bytes)?;
-    Ok(encrypted_chunk)
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use bincode::deserialize;
+    use eyre::Result;
+
+    #[test]
+    fn segments_take_trailing_bytes_too_few_to_encrypt() {
+        assert_eq!(next_segment_len(0, true), None);
+        assert_eq!(next_segment_len(SEGMENT_SIZE, false), None);
+        assert_eq!(next_segment_len(SEGMENT_SIZE, true), Some(SEGMENT_SIZE));
+        let tail = MIN_ENCRYPTABLE_BYTES - 1;
+        assert_eq!(
+            next_segment_len(SEGMENT_SIZE + tail, true),
+            Some(SEGMENT_SIZE + tail)
+        );
+        assert_eq!(
+            next_segment_len(SEGMENT_SIZE + MIN_ENCRYPTABLE_BYTES, false),
+            Some(SEGMENT_SIZE)
+        );
+    }
+
+    #[test]
+    fn data_larger_than_a_segment_is_encrypted_per_segment() -> Result<()> {
+        let data = Bytes::from(vec![7u8; 2 * SEGMENT_SIZE + MIN_ENCRYPTABLE_BYTES]);
+        let (address, chunks) = encrypt_large(data)?;
+
+        let head = chunks
+            .iter()
+            .find(|chunk| chunk.name() == &address)
+            .expect("The head chunk to be returned");
+        match deserialize(head.value())? {
+            DataMapLevel::Segments(segments) => {
+                assert_eq!(segments.len(), 2);
+                for segment in &segments {
+                    assert!(chunks.iter().any(|chunk| chunk.name() == segment));
+                }
+            }
+            _ => panic!("Expected the data to be split into segments"),
+        }
+
+        Ok(())
+    }
 }
@@ -32,6 +32,9 @@ pub enum Error {
     #[error("Chunks error {0}.")]
     Chunks(#[from] super::chunks::Error),
 
+    #[error("Batch of chunks failed as a whole: {0}.")]
+    ChunkBatchFailed(String),
+
     #[error("Serialisation error: {0}")]
     BincodeError(#[from] bincode::Error),
 
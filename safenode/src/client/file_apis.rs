@@ -7,35 +7,68 @@
 // permissions and limitations relating to use of the SAFE Network Software.
 
 use super::{
-    chunks::{to_chunk, DataMapLevel, Error, LargeFile, SmallFile},
-    error::Result,
-    Client,
+    chunks::{
+        encrypt_segment, next_segment_len, pack_segments, to_chunk, DataMapLevel, Error, LargeFile,
+        Result as ChunksResult, SmallFile, SEGMENT_SIZE,
+    },
+    error::{Error as ClientError, Result},
+    scheduler::TransferScheduler,
+    Client, FileReader,
 };
 
 use crate::protocol::{address::ChunkAddress, chunk::Chunk};
 
-use self_encryption::{self, ChunkInfo, DataMap, EncryptedChunk};
+use self_encryption::{self, ChunkInfo, DataMap, EncryptedChunk, MIN_ENCRYPTABLE_BYTES};
 
 use bincode::deserialize;
-use bytes::Bytes;
-use futures::future::join_all;
+use bytes::{Bytes, BytesMut};
+use clru::CLruCache;
 use itertools::Itertools;
-use tokio::task;
+use std::{
+    collections::BTreeMap,
+    num::NonZeroUsize,
+    sync::{Arc, Mutex, MutexGuard},
+};
+use tokio::{
+    io::{AsyncRead, AsyncReadExt, AsyncWrite, AsyncWriteExt},
+    sync::oneshot,
+};
 use tracing::trace;
 use xor_name::XorName;
 
-// Maximum number of concurrent chunks to be uploaded/retrieved for a file
-const CHUNKS_BATCH_MAX_SIZE: usize = 5;
+/// The max number of addresses of chunks known to be stored, which are kept across uploads.
+const STORED_CHUNKS_CACHE_SIZE: usize = 64 * 1024;
+/// The number of times the chunks which failed within a batch are batched again and retried.
+const MAX_BATCH_RETRIES: usize = 3;
+
+// The map to the contents of a file, as unpacked from its head chunk.
+pub(super) enum ContentMap {
+    // The data map of all of the contents.
+    Single(DataMap),
+    // The addresses of the data maps of the segments of the contents, in order.
+    Segments(Vec<XorName>),
+}
 
 /// File APIs.
+#[derive(Clone)]
 pub struct Files {
     client: Client,
+    scheduler: TransferScheduler,
+    // The addresses of the chunks known to be stored, which are not stored again.
+    stored_chunks: Arc<Mutex<CLruCache<ChunkAddress, ()>>>,
 }
 
 impl Files {
     /// Create file apis instance.
     pub fn new(client: Client) -> Self {
-        Self { client }
+        Self {
+            client,
+            scheduler: TransferScheduler::default(),
+            stored_chunks: Arc::new(Mutex::new(CLruCache::new(
+                NonZeroUsize::new(STORED_CHUNKS_CACHE_SIZE)
+                    .expect("Failed to create stored chunks cache"),
+            ))),
+        }
     }
 
     #[instrument(skip(self), level = "debug")]
@@ -44,11 +77,54 @@ impl Files {
         let chunk = self.client.get_chunk(address).await?;
 
         // first try to deserialize a LargeFile, if it works, we go and seek it
-        if let Ok(data_map) = self.unpack_chunk(chunk.clone()).await {
-            self.read_all(data_map).await
-        } else {
+        match self.unpack_chunk(chunk.clone()).await {
+            Ok(ContentMap::Single(data_map)) => self.read_all(data_map).await,
+            Ok(ContentMap::Segments(segments)) => {
+                let mut bytes = vec![];
+                let _ = self.write_segments(segments, &mut bytes).await?;
+                Ok(Bytes::from(bytes))
+            }
             // if an error occurs, we assume it's a SmallFile
-            Ok(chunk.value().clone())
+            Err(_) => Ok(chunk.value().clone()),
+        }
+    }
+
+    /// Reads a file from the network, and writes its contents to the `writer` as they are
+    /// fetched and decrypted, returning the number of bytes written.
+    /// Chunks are fetched through a bounded window, so the memory used
+    /// stays the same whatever the size of the file.
+    #[instrument(skip(self, writer), level = "debug")]
+    pub async fn read_to<W: AsyncWrite + Unpin>(
+        &self,
+        address: ChunkAddress,
+        writer: &mut W,
+    ) -> Result<u64> {
+        let chunk = self.client.get_chunk(address).await?;
+
+        let written = match self.unpack_chunk(chunk.clone()).await {
+            Ok(ContentMap::Single(data_map)) => self.write_data_map(data_map, writer).await?,
+            Ok(ContentMap::Segments(segments)) => self.write_segments(segments, writer).await?,
+            // As in `read_bytes`, we assume it's a SmallFile.
+            Err(_) => {
+                writer.write_all(chunk.value()).await.map_err(Error::Io)?;
+                chunk.value().len() as u64
+            }
+        };
+        writer.flush().await.map_err(Error::Io)?;
+
+        Ok(written)
+    }
+
+    /// Opens the file at the address, for reading ranges of its contents repeatedly.
+    /// See [`FileReader`] for what is saved over reading them with `read_from`.
+    #[instrument(skip(self), level = "debug")]
+    pub async fn open(&self, address: ChunkAddress) -> Result<FileReader> {
+        let chunk = self.client.get_chunk(address).await?;
+
+        // As in `read_bytes`, we assume it's a SmallFile if it can't be unpacked.
+        match self.unpack_chunk(chunk.clone()).await {
+            Ok(content) => Ok(FileReader::new(self.clone(), content)),
+            Err(_) => Ok(FileReader::small(self.clone(), chunk.value().clone())),
         }
     }
 
@@ -60,6 +136,9 @@ impl Files {
     /// and the length of bytes to be read.
     /// Passing `0` to position reads the data from the beginning,
     /// and the `length` is just an upper limit.
+    ///
+    /// Every call fetches the data maps of the file again, so use [`Files::open`]
+    /// to read ranges of the same file repeatedly.
     #[instrument(skip_all, level = "trace")]
     pub async fn read_from(
         &self,
@@ -75,8 +154,14 @@ impl Files {
 
         // First try to deserialize a LargeFile, if it works, we go and seek it.
         // If an error occurs, we consider it to be a SmallFile.
-        if let Ok(data_map) = self.unpack_chunk(chunk.clone()).await {
-            return self.seek(data_map, position, length).await;
+        match self.unpack_chunk(chunk.clone()).await {
+            Ok(ContentMap::Single(data_map)) => {
+                return self.seek(data_map, position, length).await;
+            }
+            Ok(ContentMap::Segments(segments)) => {
+                return self.seek_segments(segments, position, length).await;
+            }
+            Err(_) => {}
         }
 
         // The error above is ignored to avoid leaking the storage format detail of SmallFiles and LargeFiles.
@@ -106,19 +191,38 @@ impl Files {
         self.upload_bytes(bytes, true).await
     }
 
+    /// Writes the contents read from the `reader` to the network in the form of immutable chunks.
+    /// The contents are read, encrypted and stored one segment at a time, so the memory used
+    /// stays the same whatever the size of the contents.
+    /// The address returned is the same as that of uploading the contents as [`Bytes`].
+    /// With `verify` set, the data is verified to be stored, as with [`Files::upload_and_verify`].
+    #[instrument(skip(self, reader), level = "debug")]
+    pub async fn upload_from_reader<R: AsyncRead + Unpin>(
+        &self,
+        mut reader: R,
+        verify: bool,
+    ) -> Result<ChunkAddress> {
+        let mut buffer = BytesMut::new();
+        if fill_segment_buffer(&mut reader, &mut buffer).await? {
+            // All the contents fit in a single segment.
+            return self.upload_bytes(buffer.freeze(), verify).await;
+        }
+
+        self.upload_segments(reader, buffer, verify).await
+    }
+
     // --------------------------------------------
     // ---------- Private helpers -----------------
     // --------------------------------------------
 
     #[instrument(skip(self, bytes), level = "trace")]
     async fn upload_bytes(&self, bytes: Bytes, verify: bool) -> Result<ChunkAddress> {
-        match LargeFile::new(bytes.clone()) {
-            Ok(file) => self.upload_large(file, verify).await,
-            Err(Error::TooSmallForSelfEncryption { .. }) => {
-                let file = SmallFile::new(bytes)?;
-                self.upload_small(file, verify).await
-            }
-            Err(error) => Err(error)?,
+        if bytes.len() < MIN_ENCRYPTABLE_BYTES {
+            let file = SmallFile::new(bytes)?;
+            self.upload_small(file, verify).await
+        } else {
+            let file = LargeFile::new(bytes)?;
+            self.upload_large(file, verify).await
         }
     }
 
@@ -128,16 +232,7 @@ impl Files {
     async fn upload_small(&self, small: SmallFile, verify: bool) -> Result<ChunkAddress> {
         let chunk = package_small(small)?;
         let address = *chunk.address();
-
-        if self.verify_chunk_is_stored(address).await.is_ok() {
-            return Ok(address);
-        }
-
-        self.client.store_chunk(chunk).await?;
-
-        if verify {
-            self.verify_chunk_is_stored(address).await?;
-        }
+        self.store_chunks(vec![chunk], verify).await?;
 
         Ok(address)
     }
@@ -146,40 +241,150 @@ impl Files {
     /// form of immutable self encrypted chunks, without any batching.
     #[instrument(skip_all, level = "trace")]
     async fn upload_large(&self, large: LargeFile, verify: bool) -> Result<ChunkAddress> {
+        let bytes = large.bytes();
+        if next_segment_len(bytes.len(), true) != Some(bytes.len()) {
+            // Avoids holding the chunks of all segments at once.
+            return self
+                .upload_segments(bytes.as_ref(), BytesMut::new(), verify)
+                .await;
+        }
+
         let (head_address, all_chunks) = encrypt_large(large)?;
-        for next_batch in all_chunks.chunks(CHUNKS_BATCH_MAX_SIZE) {
-            let tasks = next_batch.iter().cloned().map(|chunk| {
-                let client = self.client.clone();
-
-                task::spawn(async move {
-                    let chunk_addr = *chunk.address();
-                    client.store_chunk(chunk).await?;
-                    if verify {
-                        let _ = client.get_chunk(chunk_addr).await?;
-                    }
-                    Ok::<(), super::error::Error>(())
-                })
-            });
+        self.store_chunks(all_chunks, verify).await?;
 
-            let respones = join_all(tasks)
-                .await
-                .into_iter()
-                .flatten() // swallows errors
-                .collect_vec();
+        Ok(ChunkAddress::new(head_address))
+    }
+
+    /// Encrypts and stores the contents of the `buffer` and the `reader` one segment at a time,
+    /// and then stores the list of segments, whose address is returned.
+    /// Each segment is read and encrypted while the chunks of the previous one are stored.
+    async fn upload_segments<R: AsyncRead + Unpin>(
+        &self,
+        mut reader: R,
+        mut buffer: BytesMut,
+        verify: bool,
+    ) -> Result<ChunkAddress> {
+        let mut segments = vec![];
+        let mut at_end = false;
+        let mut encrypting = None;
+        loop {
+            if !at_end {
+                at_end = fill_segment_buffer(&mut reader, &mut buffer).await?;
+            }
+            let next = next_segment_len(buffer.len(), at_end)
+                .map(|len| spawn_encryption(buffer.split_to(len).freeze()));
+
+            if let Some(encryption) = encrypting.take() {
+                // The sender is only dropped without sending should the encryption panic.
+                let (name, chunks) = encryption
+                    .await
+                    .map_err(|_| Error::SegmentEncryptionDropped(segments.len()))??;
+                self.store_chunks(chunks, verify).await?;
+                trace!("Stored segment {} at {name:?}", segments.len());
+                segments.push(name);
+            }
 
-            for res in respones {
-                // fail with any issue here
-                res?;
+            match next {
+                Some(encryption) => encrypting = Some(encryption),
+                None => break,
             }
         }
 
+        let (head_address, chunks) = pack_segments(segments)?;
+        self.store_chunks(chunks, verify).await?;
+
         Ok(ChunkAddress::new(head_address))
     }
 
-    // Verify a chunk is stored at provided address
-    async fn verify_chunk_is_stored(&self, address: ChunkAddress) -> Result<()> {
-        let _ = self.client.get_chunk(address).await?;
-        Ok(())
+    /// Stores the chunks not known to be stored yet, in batches of chunks sharing their
+    /// close group, sent through the transfer window. The chunks which failed to be stored
+    /// are batched again and retried, up to `MAX_BATCH_RETRIES` times.
+    async fn store_chunks(&self, chunks: Vec<Chunk>, verify: bool) -> Result<()> {
+        let mut pending = self.chunks_not_stored(chunks).await;
+        let mut retries = 0;
+        loop {
+            let (batches, mut failed) = self
+                .client
+                .batch_by_close_group(pending, |chunk| *chunk.address(), Chunk::payload_size)
+                .await;
+            let mut stores = self.scheduler.transfers(batches, |batch| {
+                self.client.store_chunk_batch(batch, verify)
+            });
+
+            while let Some((batch, result)) = stores.next_with_item().await {
+                let results = match result {
+                    Ok(results) => results,
+                    // The chunks of a failed batch are retried like any other failed chunk.
+                    Err(err) => {
+                        warn!("Storing a batch of chunks to network, resulted in error {err:?}.");
+                        let err = err.to_string();
+                        batch
+                            .into_items()
+                            .into_iter()
+                            .map(|chunk| (chunk, Err(ClientError::ChunkBatchFailed(err.clone()))))
+                            .collect()
+                    }
+                };
+                for (chunk, result) in results {
+                    match result {
+                        Ok(()) => {
+                            let _ = self.lock_stored_chunks().put(*chunk.address(), ());
+                        }
+                        Err(err) => failed.push((chunk, err)),
+                    }
+                }
+            }
+
+            if failed.is_empty() {
+                return Ok(());
+            }
+            if retries == MAX_BATCH_RETRIES {
+                return Err(failed.swap_remove(0).1);
+            }
+            retries += 1;
+            trace!("Retrying to store {} chunks", failed.len());
+            pending = failed.into_iter().map(|(chunk, _)| chunk).collect();
+        }
+    }
+
+    // Returns the chunks not known to be stored, either from previous uploads, or
+    // from probing the network for them. Should the probing fail, all are returned.
+    async fn chunks_not_stored(&self, chunks: Vec<Chunk>) -> Vec<Chunk> {
+        let chunks: Vec<_> = {
+            let mut stored_chunks = self.lock_stored_chunks();
+            chunks
+                .into_iter()
+                .filter(|chunk| stored_chunks.get(chunk.address()).is_none())
+                .collect()
+        };
+        if chunks.is_empty() {
+            return chunks;
+        }
+
+        let addresses = chunks.iter().map(|chunk| *chunk.address()).collect();
+        let held = match self.client.has_chunks(addresses).await {
+            Ok(held) => held,
+            Err(err) => {
+                warn!("Failed to probe for the chunks already stored: {err:?}");
+                return chunks;
+            }
+        };
+        trace!("{} of {} chunks already stored", held.len(), chunks.len());
+
+        let mut stored_chunks = self.lock_stored_chunks();
+        for address in &held {
+            let _ = stored_chunks.put(*address, ());
+        }
+        chunks
+            .into_iter()
+            .filter(|chunk| !held.contains(chunk.address()))
+            .collect()
+    }
+
+    fn lock_stored_chunks(&self) -> MutexGuard<'_, CLruCache<ChunkAddress, ()>> {
+        self.stored_chunks
+            .lock()
+            .unwrap_or_else(|err| err.into_inner())
     }
 
     // Gets and decrypts chunks from the network using nothing else but the data map,
@@ -191,20 +396,100 @@ impl Files {
         Ok(bytes)
     }
 
+    // Gets the chunks of the data map through the transfer window, and writes
+    // them decrypted to the writer in order, returning the number of bytes written.
+    async fn write_data_map<W: AsyncWrite + Unpin>(
+        &self,
+        data_map: DataMap,
+        writer: &mut W,
+    ) -> Result<u64> {
+        let mut fetches = self
+            .scheduler
+            .transfers(data_map.infos(), |chunk_info| async move {
+                let src_size = chunk_info.src_size;
+                self.get_encrypted_chunk(chunk_info)
+                    .await
+                    .map(|chunk| (src_size, chunk))
+            })
+            .hedged()
+            .in_order();
+
+        let mut written = 0;
+        while let Some(fetched) = fetches.next().await {
+            let (src_size, encrypted_chunk) = fetched?;
+            let bytes = self_encryption::decrypt_range(&data_map, &[encrypted_chunk], 0, src_size)
+                .map_err(Error::SelfEncryption)?;
+            writer.write_all(&bytes).await.map_err(Error::Io)?;
+            written += bytes.len() as u64;
+        }
+
+        Ok(written)
+    }
+
+    // Writes the contents of each segment to the writer in turn, returning the number of bytes written.
+    async fn write_segments<W: AsyncWrite + Unpin>(
+        &self,
+        segments: Vec<XorName>,
+        writer: &mut W,
+    ) -> Result<u64> {
+        let mut written = 0;
+        for segment in segments {
+            let data_map = self.get_segment_data_map(segment).await?;
+            written += self.write_data_map(data_map, writer).await?;
+        }
+        Ok(written)
+    }
+
+    // Reads `len` bytes starting at `pos` from the segments. As all segments but the last
+    // hold `SEGMENT_SIZE` bytes, only the segments holding the bytes read are fetched.
+    async fn seek_segments(&self, segments: Vec<XorName>, pos: usize, len: usize) -> Result<Bytes> {
+        let first = usize::min(pos / SEGMENT_SIZE, segments.len().saturating_sub(1));
+        let mut relative_pos = pos - first * SEGMENT_SIZE;
+        let mut bytes = BytesMut::new();
+
+        for segment in segments.into_iter().skip(first) {
+            if bytes.len() >= len {
+                break;
+            }
+            let data_map = self.get_segment_data_map(segment).await?;
+            if relative_pos >= data_map.file_size() {
+                break;
+            }
+            let remaining = usize::min(len - bytes.len(), data_map.file_size() - relative_pos);
+            bytes.extend_from_slice(&self.seek(data_map, relative_pos, remaining).await?);
+            relative_pos = 0;
+        }
+
+        Ok(bytes.freeze())
+    }
+
+    // Gets the data map of a segment.
+    pub(super) async fn get_segment_data_map(&self, segment: XorName) -> Result<DataMap> {
+        let chunk = self.client.get_chunk(ChunkAddress::new(segment)).await?;
+        match self.unpack_chunk(chunk).await? {
+            ContentMap::Single(data_map) => Ok(data_map),
+            ContentMap::Segments(_) => Err(Error::InvalidSegment(segment))?,
+        }
+    }
+
     /// Extracts a file DataMapLevel from a chunk.
     /// If the DataMapLevel is not the first level mapping directly to the user's contents,
-    /// the process repeats itself until it obtains the first level DataMapLevel.
+    /// the process repeats itself until it obtains the first level DataMapLevel,
+    /// or the list of segments of the contents.
     #[instrument(skip_all, level = "trace")]
-    async fn unpack_chunk(&self, mut chunk: Chunk) -> Result<DataMap> {
+    async fn unpack_chunk(&self, mut chunk: Chunk) -> Result<ContentMap> {
         loop {
             match deserialize(chunk.value()).map_err(Error::Serialisation)? {
                 DataMapLevel::First(data_map) => {
-                    return Ok(data_map);
+                    return Ok(ContentMap::Single(data_map));
                 }
                 DataMapLevel::Additional(data_map) => {
                     let serialized_chunk = self.read_all(data_map).await?;
                     chunk = deserialize(&serialized_chunk).map_err(Error::Serialisation)?;
                 }
+                DataMapLevel::Segments(segments) => {
+                    return Ok(ContentMap::Segments(segments));
+                }
             }
         }
     }
@@ -232,36 +517,91 @@ impl Files {
         Ok(bytes)
     }
 
+    // Gets a chunk from the network, as the encrypted chunk it was stored from.
+    pub(super) async fn get_encrypted_chunk(
+        &self,
+        chunk_info: ChunkInfo,
+    ) -> Result<EncryptedChunk> {
+        let chunk = self
+            .client
+            .get_chunk(ChunkAddress::new(chunk_info.dst_hash))
+            .await?;
+        Ok(EncryptedChunk {
+            index: chunk_info.index,
+            content: chunk.value().clone(),
+        })
+    }
+
+    // Gets the chunks from the network, in batches of chunks sharing their close group,
+    // fetched through the transfer window. The chunks which failed to be retrieved are
+    // batched again and retried, up to `MAX_BATCH_RETRIES` times. A chunk listed more than
+    // once, as for repeated content, is only fetched once.
     #[instrument(skip_all, level = "trace")]
     async fn try_get_chunks(&self, chunks_info: Vec<ChunkInfo>) -> Result<Vec<EncryptedChunk>> {
         let expected_count = chunks_info.len();
+        let mut infos: BTreeMap<ChunkAddress, Vec<ChunkInfo>> = BTreeMap::new();
+        for chunk_info in chunks_info {
+            infos
+                .entry(ChunkAddress::new(chunk_info.dst_hash))
+                .or_default()
+                .push(chunk_info);
+        }
+
         let mut retrieved_chunks = vec![];
-        for next_batch in chunks_info.chunks(CHUNKS_BATCH_MAX_SIZE) {
-            let tasks = next_batch.iter().cloned().map(|chunk_info| {
-                let client = self.client.clone();
-                task::spawn(async move {
-                    match client
-                        .get_chunk(ChunkAddress::new(chunk_info.dst_hash))
-                        .await
-                    {
-                        Ok(chunk) => Ok(EncryptedChunk {
-                            index: chunk_info.index,
-                            content: chunk.value().clone(),
-                        }),
-                        Err(err) => {
-                            warn!(
-                                "Reading chunk {} from network, resulted in error {err:?}.",
-                                chunk_info.dst_hash
-                            );
-                            Err(err)
-                        }
-                    }
-                })
-            });
+        let mut pending: Vec<_> = infos.keys().copied().collect();
+        for _ in 0..=MAX_BATCH_RETRIES {
+            if pending.is_empty() {
+                break;
+            }
+            let (batches, mut failed) = self
+                .client
+                .batch_by_close_group(pending, |address| *address, |_| 0)
+                .await;
+            let mut fetches = self
+                .scheduler
+                .transfers(batches, |batch| self.client.get_chunk_batch(batch))
+                .hedged();
 
             // This swallowing of errors is basically a compaction into a single
             // error saying "didn't get all chunks".
-            retrieved_chunks.extend(join_all(tasks).await.into_iter().flatten().flatten());
+            while let Some((batch, result)) = fetches.next_with_item().await {
+                let results = match result {
+                    Ok(results) => results,
+                    // The chunks of a failed batch are retried like any other failed chunk.
+                    Err(err) => {
+                        warn!("Reading a batch of chunks from network, resulted in error {err:?}.");
+                        let err = err.to_string();
+                        batch
+                            .into_items()
+                            .into_iter()
+                            .map(|address| {
+                                (address, Err(ClientError::ChunkBatchFailed(err.clone())))
+                            })
+                            .collect()
+                    }
+                };
+                for (address, result) in results {
+                    match result {
+                        Ok(chunk) => {
+                            for chunk_info in infos.get(&address).into_iter().flatten() {
+                                retrieved_chunks.push(EncryptedChunk {
+                                    index: chunk_info.index,
+                                    content: chunk.value().clone(),
+                                });
+                            }
+                        }
+                        Err(err) => failed.push((address, err)),
+                    }
+                }
+            }
+
+            pending = failed
+                .into_iter()
+                .map(|(address, err)| {
+                    warn!("Reading chunk {address:?} from network, resulted in error {err:?}.");
+                    address
+                })
+                .collect();
         }
 
         if expected_count > retrieved_chunks.len() {
@@ -275,6 +615,33 @@ impl Files {
     }
 }
 
+// Starts encrypting the segment on the rayon pool, off the async runtime,
+// and returns the receiver of its chunks.
+fn spawn_encryption(segment: Bytes) -> oneshot::Receiver<ChunksResult<(XorName, Vec<Chunk>)>> {
+    let (sender, receiver) = oneshot::channel();
+    rayon::spawn(move || {
+        // The upload may have been given up on.
+        let _ = sender.send(encrypt_segment(segment));
+    });
+    receiver
+}
+
+/// Reads into the buffer until it holds enough bytes to cut a segment from,
+/// unless the reader runs out first, in which case `true` is returned.
+async fn fill_segment_buffer<R: AsyncRead + Unpin>(
+    reader: &mut R,
+    buffer: &mut BytesMut,
+) -> Result<bool> {
+    let target = SEGMENT_SIZE + MIN_ENCRYPTABLE_BYTES;
+    buffer.reserve(target.saturating_sub(buffer.len()));
+    while buffer.len() < target {
+        if reader.read_buf(buffer).await.map_err(Error::Io)? == 0 {
+            return Ok(true);
+        }
+    }
+    Ok(false)
+}
+
 /// Calculates a LargeFile's/SmallFile's address from self encrypted chunks,
 /// without storing them onto the network.
 #[instrument(skip(bytes), level = "debug")]
@@ -285,14 +652,12 @@ pub fn calculate_address(bytes: Bytes) -> Result<XorName> {
 /// Tries to chunk the bytes, returning an address and chunks, without storing anything to network.
 #[instrument(skip_all, level = "trace")]
 pub fn chunk_bytes(bytes: Bytes) -> Result<(XorName, Vec<Chunk>)> {
-    match LargeFile::new(bytes.clone()) {
-        Ok(file) => encrypt_large(file),
-        Err(Error::TooSmallForSelfEncryption { .. }) => {
-            let file = SmallFile::new(bytes)?;
-            let chunk = package_small(file)?;
-            Ok((*chunk.name(), vec![chunk]))
-        }
-        Err(error) => Err(error)?,
+    if bytes.len() < MIN_ENCRYPTABLE_BYTES {
+        let file = SmallFile::new(bytes)?;
+        let chunk = package_small(file)?;
+        Ok((*chunk.name(), vec![chunk]))
+    } else {
+        encrypt_large(LargeFile::new(bytes)?)
     }
 }
 
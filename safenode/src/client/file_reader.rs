@@ -0,0 +1,350 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use super::{
+    chunks::{Error, SEGMENT_SIZE},
+    error::Result,
+    file_apis::{ContentMap, Files},
+};
+
+use self_encryption::{ChunkInfo, DataMap};
+
+use bytes::{Bytes, BytesMut};
+use clru::CLruCache;
+use futures::future::{join_all, BoxFuture, FutureExt, Shared};
+use std::{
+    collections::BTreeMap,
+    num::NonZeroUsize,
+    sync::{Arc, Mutex, MutexGuard},
+};
+use xor_name::XorName;
+
+/// The max number of decrypted chunks cached by a reader.
+const CACHED_CHUNKS: usize = 64;
+/// The number of chunks fetched ahead of the last one read.
+const READ_AHEAD_CHUNKS: usize = 8;
+
+// The decrypted contents of a chunk, as fetched once for all of its readers.
+type ChunkFetch = Shared<BoxFuture<'static, Option<Bytes>>>;
+
+/// A file opened for reading ranges of its contents repeatedly, as with [`Files::open`].
+///
+/// The data maps of the file are only fetched once, and the decrypted chunks read are kept in
+/// a cache of bounded size. Reading a range also fetches the chunks following it, so that the
+/// next sequential read finds them fetched already. Concurrent reads of the same chunks share
+/// the fetch of each of them.
+pub struct FileReader {
+    files: Files,
+    content: Content,
+    chunks: Arc<Mutex<CLruCache<XorName, ChunkFetch>>>,
+}
+
+enum Content {
+    // The contents of a file too small to be self-encrypted.
+    Small(Bytes),
+    // The contents of all of the file.
+    Single(Arc<MappedData>),
+    // The segments of the file, whose data maps are fetched when first read.
+    Segments {
+        names: Vec<XorName>,
+        mapped: Mutex<BTreeMap<usize, Arc<MappedData>>>,
+    },
+}
+
+// A data map, along with the position of each of its chunks in the contents it maps.
+struct MappedData {
+    data_map: DataMap,
+    infos: Vec<ChunkInfo>,
+    offsets: Vec<usize>,
+}
+
+impl MappedData {
+    fn new(data_map: DataMap) -> Self {
+        let infos = data_map.infos();
+        let mut offsets = Vec::with_capacity(infos.len());
+        let mut offset = 0;
+        for info in &infos {
+            offsets.push(offset);
+            offset += info.src_size;
+        }
+        Self {
+            data_map,
+            infos,
+            offsets,
+        }
+    }
+
+    fn size(&self) -> usize {
+        self.data_map.file_size()
+    }
+}
+
+impl FileReader {
+    pub(super) fn new(files: Files, content: ContentMap) -> Self {
+        let content = match content {
+            ContentMap::Single(data_map) => Content::Single(Arc::new(MappedData::new(data_map))),
+            ContentMap::Segments(names) => Content::Segments {
+                names,
+                mapped: Mutex::new(BTreeMap::new()),
+            },
+        };
+        Self::with_content(files, content)
+    }
+
+    pub(super) fn small(files: Files, bytes: Bytes) -> Self {
+        Self::with_content(files, Content::Small(bytes))
+    }
+
+    fn with_content(files: Files, content: Content) -> Self {
+        let cache_size =
+            NonZeroUsize::new(CACHED_CHUNKS).expect("Failed to create file reader chunks cache");
+        Self {
+            files,
+            content,
+            chunks: Arc::new(Mutex::new(CLruCache::new(cache_size))),
+        }
+    }
+
+    /// Reads `len` bytes of the contents starting at `pos`, or fewer if the contents end before.
+    pub async fn read(&self, pos: usize, len: usize) -> Result<Bytes> {
+        match &self.content {
+            Content::Small(bytes) => {
+                let start = usize::min(pos, bytes.len());
+                let end = usize::min(pos.saturating_add(len), bytes.len());
+                Ok(bytes.slice(start..end))
+            }
+            Content::Single(mapped) => self.read_mapped(mapped, pos, len).await,
+            Content::Segments { names, mapped } => {
+                self.read_segments(names, mapped, pos, len).await
+            }
+        }
+    }
+
+    // As all segments but the last hold `SEGMENT_SIZE` bytes,
+    // only the segments holding the bytes read are fetched.
+    async fn read_segments(
+        &self,
+        names: &[XorName],
+        mapped: &Mutex<BTreeMap<usize, Arc<MappedData>>>,
+        pos: usize,
+        len: usize,
+    ) -> Result<Bytes> {
+        let mut bytes = BytesMut::new();
+        for (index, relative_pos, len) in segment_reads(names.len(), pos, len) {
+            let segment = self.segment(names, mapped, index).await?;
+            bytes.extend_from_slice(&self.read_mapped(&segment, relative_pos, len).await?);
+        }
+
+        Ok(bytes.freeze())
+    }
+
+    // Returns the data map of the segment at the index, fetching it when first read.
+    // The lock isn't held while fetching, so that reads of the segments already
+    // mapped aren't held up. Should another read map the segment meanwhile,
+    // the data map it fetched is kept.
+    async fn segment(
+        &self,
+        names: &[XorName],
+        mapped: &Mutex<BTreeMap<usize, Arc<MappedData>>>,
+        index: usize,
+    ) -> Result<Arc<MappedData>> {
+        if let Some(segment) = lock(mapped).get(&index) {
+            return Ok(segment.clone());
+        }
+
+        let data_map = self.files.get_segment_data_map(names[index]).await?;
+        let segment = Arc::new(MappedData::new(data_map));
+        Ok(lock(mapped).entry(index).or_insert(segment).clone())
+    }
+
+    // Reads the bytes off the chunks of the data map holding them,
+    // and starts fetching the chunks following them.
+    async fn read_mapped(&self, mapped: &Arc<MappedData>, pos: usize, len: usize) -> Result<Bytes> {
+        let end = usize::min(pos.saturating_add(len), mapped.size());
+        if pos >= end {
+            return Ok(Bytes::new());
+        }
+
+        let (first, last) = chunk_span(&mapped.offsets, pos, end);
+
+        let fetches: Vec<_> = (first..=last)
+            .map(|index| self.fetch(mapped, index).0)
+            .collect();
+        for index in (last + 1..mapped.infos.len()).take(READ_AHEAD_CHUNKS) {
+            let (fetch, started) = self.fetch(mapped, index);
+            if started {
+                // Driven in the background, as nothing awaits it yet.
+                let _ = tokio::spawn(fetch);
+            }
+        }
+
+        let expected = fetches.len();
+        let chunks: Vec<Bytes> = join_all(fetches).await.into_iter().flatten().collect();
+        if chunks.len() < expected {
+            return Err(Error::NotEnoughChunksRetrieved {
+                expected,
+                retrieved: chunks.len(),
+            })?;
+        }
+
+        let mut bytes = BytesMut::with_capacity(end - pos);
+        for (chunk, offset) in chunks.iter().zip(&mapped.offsets[first..=last]) {
+            let from = usize::max(pos, *offset) - offset;
+            let to = usize::min(end, offset + chunk.len()) - offset;
+            bytes.extend_from_slice(&chunk[from..to]);
+        }
+
+        Ok(bytes.freeze())
+    }
+
+    // Returns the fetch of the decrypted chunk at the index of the data map, starting it unless
+    // it's cached, in which case it may have completed already. Also returns whether it was started.
+    fn fetch(&self, mapped: &Arc<MappedData>, index: usize) -> (ChunkFetch, bool) {
+        let info = mapped.infos[index].clone();
+        let name = info.dst_hash;
+        let mut chunks = self.lock_chunks();
+        if let Some(fetch) = chunks.get(&name) {
+            return (fetch.clone(), false);
+        }
+
+        let files = self.files.clone();
+        let mapped = mapped.clone();
+        let cache = self.chunks.clone();
+        let fetch = async move {
+            let src_size = info.src_size;
+            let result = files
+                .get_encrypted_chunk(info)
+                .await
+                .and_then(|encrypted_chunk| {
+                    self_encryption::decrypt_range(
+                        &mapped.data_map,
+                        &[encrypted_chunk],
+                        0,
+                        src_size,
+                    )
+                    .map_err(|err| Error::SelfEncryption(err).into())
+                });
+            match result {
+                Ok(bytes) => Some(bytes),
+                Err(err) => {
+                    warn!("Reading chunk {name} from network, resulted in error {err:?}.");
+                    // Not kept in the cache, so that it's fetched again when next read.
+                    let _ = cache
+                        .lock()
+                        .unwrap_or_else(|err| err.into_inner())
+                        .pop(&name);
+                    None
+                }
+            }
+        }
+        .boxed()
+        .shared();
+
+        let _ = chunks.put(name, fetch.clone());
+        (fetch, true)
+    }
+
+    fn lock_chunks(&self) -> MutexGuard<'_, CLruCache<XorName, ChunkFetch>> {
+        lock(&self.chunks)
+    }
+}
+
+fn lock<T>(mutex: &Mutex<T>) -> MutexGuard<'_, T> {
+    mutex.lock().unwrap_or_else(|err| err.into_inner())
+}
+
+// Returns the reads of `len` bytes from `pos` off the segments holding them, each as the index
+// of a segment of the `count` segments, and the position and length of the bytes read off it.
+// All the segments but the last hold `SEGMENT_SIZE` bytes, the last one holds any bytes past them,
+// so the read off it isn't bounded here, but by its size once its data map is fetched.
+fn segment_reads(count: usize, pos: usize, len: usize) -> Vec<(usize, usize, usize)> {
+    let last = match count.checked_sub(1) {
+        Some(last) => last,
+        None => return vec![],
+    };
+    let mut index = usize::min(pos / SEGMENT_SIZE, last);
+    let mut relative_pos = pos - index * SEGMENT_SIZE;
+    let mut remaining = len;
+
+    let mut reads = vec![];
+    while remaining > 0 {
+        if index == last {
+            reads.push((index, relative_pos, remaining));
+            break;
+        }
+        if relative_pos < SEGMENT_SIZE {
+            let read = usize::min(remaining, SEGMENT_SIZE - relative_pos);
+            reads.push((index, relative_pos, read));
+            remaining -= read;
+        }
+        index += 1;
+        relative_pos = 0;
+    }
+    reads
+}
+
+// Returns the indices of the first and last chunks holding the bytes from `pos` to `end`,
+// given the offset of each chunk in the contents, with `pos` before `end`.
+fn chunk_span(offsets: &[usize], pos: usize, end: usize) -> (usize, usize) {
+    // The offset of the first chunk is 0, so there is at least one chunk starting at or before `pos`.
+    let first = offsets.partition_point(|offset| *offset <= pos) - 1;
+    let last = offsets.partition_point(|offset| *offset < end) - 1;
+    (first, last)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn reads_within_a_segment_only_read_off_it() {
+        assert_eq!(segment_reads(3, 0, 10), vec![(0, 0, 10)]);
+        // Seeking to any segment starts reading at the position within it.
+        assert_eq!(segment_reads(3, SEGMENT_SIZE + 5, 10), vec![(1, 5, 10)]);
+        assert_eq!(segment_reads(3, 5, 0), vec![]);
+        assert_eq!(segment_reads(0, 5, 10), vec![]);
+    }
+
+    #[test]
+    fn reads_spanning_segments_read_off_each_of_them() {
+        assert_eq!(
+            segment_reads(3, SEGMENT_SIZE - 5, SEGMENT_SIZE + 10),
+            vec![(0, SEGMENT_SIZE - 5, 5), (1, 0, SEGMENT_SIZE), (2, 0, 5)]
+        );
+        // Reading to the end of a segment doesn't read off the next one.
+        assert_eq!(
+            segment_reads(3, SEGMENT_SIZE - 5, 5),
+            vec![(0, SEGMENT_SIZE - 5, 5)]
+        );
+    }
+
+    #[test]
+    fn reads_past_the_last_segment_are_left_to_its_size() {
+        // Anything from the start of the last segment on is read off it, up to its actual size.
+        assert_eq!(
+            segment_reads(2, 3 * SEGMENT_SIZE, 10),
+            vec![(1, 2 * SEGMENT_SIZE, 10)]
+        );
+        assert_eq!(
+            segment_reads(2, SEGMENT_SIZE / 2, 4 * SEGMENT_SIZE),
+            vec![
+                (0, SEGMENT_SIZE / 2, SEGMENT_SIZE / 2),
+                (1, 0, 3 * SEGMENT_SIZE + SEGMENT_SIZE / 2)
+            ]
+        );
+    }
+
+    #[test]
+    fn chunk_spans_hold_the_bytes_read() {
+        let offsets = [0, 10, 20];
+        assert_eq!(chunk_span(&offsets, 0, 10), (0, 0));
+        assert_eq!(chunk_span(&offsets, 9, 11), (0, 1));
+        assert_eq!(chunk_span(&offsets, 15, 25), (1, 2));
+        assert_eq!(chunk_span(&offsets, 25, 100), (2, 2));
+    }
+}
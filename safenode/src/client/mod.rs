@@ -11,20 +11,33 @@ mod chunks;
 mod error;
 mod event;
 mod file_apis;
+mod file_reader;
 mod register;
+mod scheduler;
 mod wallet;
 
 pub use self::{
     error::Error,
     event::{ClientEvent, ClientEventsReceiver},
     file_apis::Files,
+    file_reader::FileReader,
     register::{Register, RegisterOffline},
     wallet::WalletClient,
 };
 
-use self::event::ClientEventsChannel;
+#[cfg(feature = "bench")]
+pub(crate) use self::{chunks::pack, file_apis::chunk_bytes};
 
-use crate::network::Network;
+use self::{api::NodeFees, event::ClientEventsChannel};
+
+use crate::{
+    network::{Network, SingleFlight, TtlCache},
+    protocol::{
+        address::{ChunkAddress, DbcAddress},
+        chunk::Chunk,
+        fees::SpendPriority,
+    },
+};
 
 /// Client API implementation to store and get data.
 #[derive(Clone)]
@@ -32,4 +45,6 @@ pub struct Client {
     network: Network,
     events_channel: ClientEventsChannel,
     signer: bls::SecretKey,
+    chunk_fetches: SingleFlight<ChunkAddress, Chunk>,
+    fee_quotes: TtlCache<(DbcAddress, SpendPriority), NodeFees>,
 }
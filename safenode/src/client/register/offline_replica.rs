@@ -11,21 +11,30 @@ use super::{
     Client, Register,
 };
 
-use crate::protocol::{
-    address::RegisterAddress,
-    authority::DataAuthority,
-    error::Error as ProtocolError,
-    messages::{
-        Cmd, CmdResponse, CreateRegister, EditRegister, Query, QueryResponse, RegisterCmd,
-        RegisterQuery, Request, Response, SignedRegisterCreate, SignedRegisterEdit,
+use crate::{
+    network::Error as NetworkError,
+    protocol::{
+        address::RegisterAddress,
+        authority::DataAuthority,
+        error::Error as ProtocolError,
+        messages::{
+            Cmd, CmdResponse, CreateRegister, EditRegister, Query, QueryResponse, RegisterCmd,
+            RegisterQuery, Request, Response, SignedRegisterCreate, SignedRegisterEdit,
+        },
+        register::{
+            Action, Entry, EntryHash, Permissions, Policy, Register as RegisterReplica, User,
+        },
     },
-    register::{Action, Entry, EntryHash, Permissions, Policy, Register as RegisterReplica, User},
 };
 
 use bincode::serialize;
+use futures::stream::{self, StreamExt};
 use std::collections::{BTreeSet, LinkedList};
 use xor_name::XorName;
 
+/// The max number of Register cmds being pushed at a time.
+const MAX_PUSHES_IN_FLIGHT: usize = 32;
+
 /// Ops made to an offline Register instance are applied locally only,
 /// and accumulated till the user explicitly calls 'sync'. The user can
 /// switch back to sync with the network for every op by invoking `online` API.
@@ -156,38 +165,95 @@ impl RegisterOffline {
     pub async fn sync(&mut self) -> Result<()> {
         debug!("Syncing Register at {}, {}!", self.name(), self.tag(),);
         // FIXME: handle the scenario where the Register doesn't exist on the network yet
-        let remote_replica = Self::get_register(&self.client, *self.name(), self.tag()).await?;
-        self.register.merge(remote_replica);
+        // Only the entries we are missing are fetched, rather than the whole remote replica.
+        let known_heads = self.register.heads();
+        let delta =
+            Self::get_register_delta(&self.client, *self.register.address(), known_heads).await?;
+        debug!(
+            "Applying {} missing Register cmds at {}, {}",
+            delta.len(),
+            self.name(),
+            self.tag()
+        );
+        for cmd in delta {
+            if let RegisterCmd::Edit(SignedRegisterEdit { op, .. }) = cmd {
+                self.register.apply_op(op.edit)?;
+            }
+        }
         self.push().await
     }
 
     /// Push all operations made locally to the replicas of this Register on the network.
+    ///
+    /// The Register create cmd, if not pushed yet, is pushed first, and then the edit cmds are
+    /// all pushed concurrently, up to `MAX_PUSHES_IN_FLIGHT` at a time. The cmds which failed
+    /// to be pushed are kept for the next push, and the first error is returned.
     pub async fn push(&mut self) -> Result<()> {
         let ops_len = self.ops.len();
-        if ops_len > 0 {
-            let name = *self.name();
-            let tag = self.tag();
-            debug!("Pushing {ops_len} cached Register cmds at {name}, {tag}!",);
-
-            // TODO: send them all concurrently
-            while let Some(cmd) = self.ops.pop_back() {
-                let result = match cmd {
-                    RegisterCmd::Create { .. } => self.publish_register_create(cmd.clone()).await,
-                    RegisterCmd::Edit { .. } => self.publish_register_edit(cmd.clone()).await,
-                };
-
-                if let Err(err) = result {
-                    warn!("Did not push Register cmd on all nodes in the close group!: {err}");
-                    // We keep the cmd for next sync to retry
-                    self.ops.push_back(cmd);
-                    return Err(err);
-                }
+        if ops_len == 0 {
+            return Ok(());
+        }
+
+        let name = *self.name();
+        let tag = self.tag();
+        debug!("Pushing {ops_len} cached Register cmds at {name}, {tag}!",);
+
+        // The cmds are taken in the order they were made.
+        let (creates, edits): (Vec<_>, Vec<_>) = std::mem::take(&mut self.ops)
+            .into_iter()
+            .rev()
+            .partition(|cmd| matches!(cmd, RegisterCmd::Create(_)));
+
+        let mut create_error = None;
+        for cmd in &creates {
+            if let Err(err) = Self::publish_register_create(&self.client, cmd.clone()).await {
+                warn!("Did not push Register cmd on all nodes in the close group!: {err}");
+                create_error = Some(err);
+                break;
             }
+        }
+        if let Some(err) = create_error {
+            // We keep all the cmds for next sync to retry
+            for cmd in creates.into_iter().chain(edits) {
+                self.ops.push_front(cmd);
+            }
+            return Err(err);
+        }
 
-            debug!("Successfully pushed {ops_len} Register cmds at {name}, {tag}!",);
+        let client = &self.client;
+        let mut pushes = stream::iter(edits)
+            .map(|cmd| async move {
+                let result = Self::publish_register_edit(client, cmd.clone()).await;
+                (cmd, result)
+            })
+            .buffered(MAX_PUSHES_IN_FLIGHT);
+
+        let mut first_error = None;
+        let mut failed = Vec::new();
+        while let Some((cmd, result)) = pushes.next().await {
+            if let Err(err) = result {
+                warn!("Did not push Register cmd on all nodes in the close group!: {err}");
+                failed.push(cmd);
+                let _ = first_error.get_or_insert(err);
+            }
         }
 
-        Ok(())
+        // We keep the failed cmds for next sync to retry
+        let failed_len = failed.len();
+        for cmd in failed {
+            self.ops.push_front(cmd);
+        }
+
+        match first_error {
+            Some(err) => {
+                debug!("Failed to push {failed_len} of {ops_len} Register cmds at {name}, {tag}");
+                Err(err)
+            }
+            None => {
+                debug!("Successfully pushed {ops_len} Register cmds at {name}, {tag}!",);
+                Ok(())
+            }
+        }
     }
 
     // ********* Private helpers  *********
@@ -225,14 +291,20 @@ impl RegisterOffline {
     }
 
     // Publish a `Register` creation command on the network.
-    async fn publish_register_create(&self, cmd: RegisterCmd) -> Result<()> {
+    async fn publish_register_create(client: &Client, cmd: RegisterCmd) -> Result<()> {
         debug!("Publishing Register create cmd: {:?}", cmd.dst());
         let request = Request::Cmd(Cmd::Register(cmd));
-        let responses = self.client.send_to_closest(request).await?;
-
-        let all_ok = responses
-            .iter()
-            .all(|resp| matches!(resp, Ok(Response::Cmd(CmdResponse::CreateRegister(Ok(()))))));
+        let is_ok = |resp: &Result<Response, NetworkError>| {
+            matches!(resp, Ok(Response::Cmd(CmdResponse::CreateRegister(Ok(())))))
+        };
+        // All need to be Ok, so there is no need to wait for others once one isn't.
+        let responses = client
+            .send_to_closest(request, |responses| {
+                responses.iter().any(|resp| !is_ok(resp))
+            })
+            .await?;
+
+        let all_ok = responses.iter().all(is_ok);
         if all_ok {
             return Ok(());
         }
@@ -255,14 +327,20 @@ impl RegisterOffline {
     }
 
     // Publish a `Register` edit command in the network.
-    async fn publish_register_edit(&self, cmd: RegisterCmd) -> Result<()> {
+    async fn publish_register_edit(client: &Client, cmd: RegisterCmd) -> Result<()> {
         debug!("Publishing Register edit cmd: {:?}", cmd.dst());
         let request = Request::Cmd(Cmd::Register(cmd));
-        let responses = self.client.send_to_closest(request).await?;
-
-        let all_ok = responses
-            .iter()
-            .all(|resp| matches!(resp, Ok(Response::Cmd(CmdResponse::EditRegister(Ok(()))))));
+        let is_ok = |resp: &Result<Response, NetworkError>| {
+            matches!(resp, Ok(Response::Cmd(CmdResponse::EditRegister(Ok(())))))
+        };
+        // All need to be Ok, so there is no need to wait for others once one isn't.
+        let responses = client
+            .send_to_closest(request, |responses| {
+                responses.iter().any(|resp| !is_ok(resp))
+            })
+            .await?;
+
+        let all_ok = responses.iter().all(is_ok);
         if all_ok {
             return Ok(());
         }
@@ -284,12 +362,65 @@ impl RegisterOffline {
         Err(Error::Protocol(ProtocolError::UnexpectedResponses))
     }
 
+    // Retrieve the cmds of a `Register` missing to a replica with the given latest entries,
+    // from the closest peers.
+    async fn get_register_delta(
+        client: &Client,
+        address: RegisterAddress,
+        known_heads: BTreeSet<EntryHash>,
+    ) -> Result<Vec<RegisterCmd>> {
+        debug!("Retrieving Register delta from: {address:?}");
+        let request = Request::Query(Query::Register(RegisterQuery::GetDelta {
+            address,
+            known_heads,
+        }));
+        let responses = client
+            .send_to_closest(request, |responses| {
+                responses.iter().any(|resp| {
+                    matches!(
+                        resp,
+                        Ok(Response::Query(QueryResponse::GetRegisterDelta(Ok(_))))
+                    )
+                })
+            })
+            .await?;
+
+        // We will return the first delta we get.
+        for resp in responses.iter().flatten() {
+            if let Response::Query(QueryResponse::GetRegisterDelta(Ok(delta))) = resp {
+                return Ok(delta.op_log.clone());
+            };
+        }
+
+        // If no delta was gotten, we will return the first error sent to us.
+        for resp in responses.iter().flatten() {
+            if let Response::Query(QueryResponse::GetRegisterDelta(result)) = resp {
+                let _ = result.clone()?;
+            };
+        }
+
+        // If there were no success or fail to the expected query,
+        // we check if there were any send errors.
+        for resp in responses {
+            let _ = resp?;
+        }
+
+        // If there was none of the above, then we had unexpected responses.
+        Err(Error::Protocol(ProtocolError::UnexpectedResponses))
+    }
+
     // Retrieve a `Register` from the closest peers.
     async fn get_register(client: &Client, name: XorName, tag: u64) -> Result<RegisterReplica> {
         let address = RegisterAddress { name, tag };
         debug!("Retrieving Register from: {address:?}");
         let request = Request::Query(Query::Register(RegisterQuery::Get(address)));
-        let responses = client.send_to_closest(request).await?;
+        let responses = client
+            .send_to_closest(request, |responses| {
+                responses.iter().any(|resp| {
+                    matches!(resp, Ok(Response::Query(QueryResponse::GetRegister(Ok(_)))))
+                })
+            })
+            .await?;
 
         // We will return the first register we get.
         for resp in responses.iter().flatten() {
@@ -0,0 +1,382 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use super::error::Result;
+
+use futures::{
+    future::{BoxFuture, Future, FutureExt},
+    stream::{FuturesUnordered, StreamExt},
+};
+use std::{
+    collections::{BTreeMap, VecDeque},
+    sync::{Arc, Mutex, MutexGuard},
+    time::{Duration, Instant},
+};
+
+/// The number of transfers kept in flight before any have completed.
+const INITIAL_WINDOW: f64 = 5.0;
+/// The least number of transfers kept in flight.
+const MIN_WINDOW: f64 = 1.0;
+/// The most number of transfers kept in flight.
+const MAX_WINDOW: f64 = 64.0;
+/// A transfer taking this many times the fastest one seen is taken as a sign of congestion.
+const CONGESTED_RTT_FACTOR: u32 = 4;
+/// The number of times a failed transfer is retried.
+const MAX_RETRIES: u32 = 3;
+/// The wait before a retry, multiplied by the number of retries so far.
+const RETRY_BACKOFF: Duration = Duration::from_millis(250);
+/// Bounds of the wait before a slow transfer is hedged with a second attempt.
+const MIN_HEDGE_DELAY: Duration = Duration::from_millis(100);
+const MAX_HEDGE_DELAY: Duration = Duration::from_secs(5);
+
+type Op<'a, I, T> = dyn Fn(I) -> BoxFuture<'a, Result<T>> + Send + Sync + 'a;
+
+/// Schedules chunk transfers through a window of transfers in flight, whose size adapts
+/// to the observed round trip times and errors: it grows by one per window of transfers
+/// that succeed, and halves on a failed or congested transfer (at most once per round trip).
+///
+/// Clones share the same window, so that all the transfers of a client adapt together.
+#[derive(Clone)]
+pub(super) struct TransferScheduler {
+    state: Arc<Mutex<WindowState>>,
+}
+
+struct WindowState {
+    size: f64,
+    smoothed_rtt: Option<Duration>,
+    min_rtt: Option<Duration>,
+    last_decrease: Option<Instant>,
+}
+
+/// A set of transfers being run by a `TransferScheduler`. The results are returned by `next`,
+/// either in the order the items were given, or as soon as they complete.
+pub(super) struct Transfers<'a, I, T> {
+    scheduler: TransferScheduler,
+    op: Arc<Op<'a, I, T>>,
+    hedged: bool,
+    in_order: bool,
+    pending: VecDeque<(usize, I)>,
+    in_flight: FuturesUnordered<BoxFuture<'a, (usize, I, Result<T>)>>,
+    // Results completed ahead of those before them, when returned in order.
+    completed: BTreeMap<usize, (I, Result<T>)>,
+    next_index: usize,
+}
+
+impl Default for TransferScheduler {
+    fn default() -> Self {
+        Self {
+            state: Arc::new(Mutex::new(WindowState {
+                size: INITIAL_WINDOW,
+                smoothed_rtt: None,
+                min_rtt: None,
+                last_decrease: None,
+            })),
+        }
+    }
+}
+
+impl TransferScheduler {
+    /// Returns the transfers of the items through `op`, with the results returned as
+    /// they complete. Nothing is started until the results are polled with `next`.
+    pub(super) fn transfers<'a, I, T, F, Fut>(&self, items: Vec<I>, op: F) -> Transfers<'a, I, T>
+    where
+        I: Clone + Send + Sync + 'a,
+        T: Send + 'a,
+        F: Fn(I) -> Fut + Send + Sync + 'a,
+        Fut: Future<Output = Result<T>> + Send + 'a,
+    {
+        Transfers {
+            scheduler: self.clone(),
+            op: Arc::new(move |item| op(item).boxed()),
+            hedged: false,
+            in_order: false,
+            pending: items.into_iter().enumerate().collect(),
+            in_flight: FuturesUnordered::new(),
+            completed: BTreeMap::new(),
+            next_index: 0,
+        }
+    }
+
+    /// The number of transfers to keep in flight.
+    pub(super) fn window(&self) -> usize {
+        self.lock().size as usize
+    }
+
+    // Records the outcome of a transfer attempt, and adapts the window to it.
+    fn record(&self, succeeded: bool, rtt: Duration) {
+        let mut state = self.lock();
+        if succeeded {
+            let min_rtt = state.min_rtt.map_or(rtt, |min_rtt| min_rtt.min(rtt));
+            state.min_rtt = Some(min_rtt);
+            state.smoothed_rtt = Some(match state.smoothed_rtt {
+                Some(smoothed_rtt) => (smoothed_rtt * 7 + rtt) / 8,
+                None => rtt,
+            });
+            if rtt <= min_rtt * CONGESTED_RTT_FACTOR {
+                let size = state.size;
+                state.size = f64::min(MAX_WINDOW, size + 1.0 / size);
+                return;
+            }
+        }
+
+        // Only decrease once per round trip, as the transfers in flight
+        // were all started before the decrease could take effect.
+        let smoothed_rtt = state.smoothed_rtt.unwrap_or(rtt);
+        let recently_decreased = state
+            .last_decrease
+            .map(|last_decrease| last_decrease.elapsed() < smoothed_rtt)
+            .unwrap_or(false);
+        if !recently_decreased {
+            state.size = f64::max(MIN_WINDOW, state.size / 2.0);
+            state.last_decrease = Some(Instant::now());
+            trace!("Transfer window decreased to {}", state.size);
+        }
+    }
+
+    // The wait before a slow transfer is hedged, twice the smoothed round trip time.
+    fn hedge_delay(&self) -> Duration {
+        match self.lock().smoothed_rtt {
+            Some(smoothed_rtt) => (smoothed_rtt * 2).clamp(MIN_HEDGE_DELAY, MAX_HEDGE_DELAY),
+            None => MAX_HEDGE_DELAY,
+        }
+    }
+
+    fn lock(&self) -> MutexGuard<'_, WindowState> {
+        self.state.lock().unwrap_or_else(|err| err.into_inner())
+    }
+}
+
+impl<'a, I, T> Transfers<'a, I, T>
+where
+    I: Clone + Send + Sync + 'a,
+    T: Send + 'a,
+{
+    /// Starts a second attempt of any transfer not completed after a while, and uses the
+    /// result of whichever attempt succeeds first. Only meant for idempotent transfers.
+    pub(super) fn hedged(mut self) -> Self {
+        self.hedged = true;
+        self
+    }
+
+    /// Returns the results in the order of the items. The results completed ahead of the
+    /// next one keep their place in the window, so that at most a window of them is held.
+    pub(super) fn in_order(mut self) -> Self {
+        self.in_order = true;
+        self
+    }
+
+    /// Returns the next result, or `None` once all transfers have been returned.
+    /// A transfer is only failed once its retries have failed too.
+    pub(super) async fn next(&mut self) -> Option<Result<T>> {
+        self.next_with_item().await.map(|(_, result)| result)
+    }
+
+    /// Returns the next result along with the item it is the result of, as `next` does,
+    /// so that the items of failed transfers can be handled.
+    pub(super) async fn next_with_item(&mut self) -> Option<(I, Result<T>)> {
+        loop {
+            if let Some(completed) = self.completed.remove(&self.next_index) {
+                self.next_index += 1;
+                return Some(completed);
+            }
+
+            self.start_transfers();
+            let (index, item, result) = self.in_flight.next().await?;
+            if self.in_order {
+                let _ = self.completed.insert(index, (item, result));
+            } else {
+                return Some((item, result));
+            }
+        }
+    }
+
+    fn start_transfers(&mut self) {
+        let window = self.scheduler.window();
+        while self.in_flight.len() + self.completed.len() < window {
+            let (index, item) = match self.pending.pop_front() {
+                Some(next) => next,
+                None => return,
+            };
+            let transfer = transfer(self.scheduler.clone(), self.op.clone(), item, self.hedged);
+            self.in_flight.push(
+                transfer
+                    .map(move |(item, result)| (index, item, result))
+                    .boxed(),
+            );
+        }
+    }
+}
+
+// Runs the transfer of an item, retrying it on failure, and returns the item with its result.
+async fn transfer<'a, I: Clone, T>(
+    scheduler: TransferScheduler,
+    op: Arc<Op<'a, I, T>>,
+    item: I,
+    hedged: bool,
+) -> (I, Result<T>) {
+    let mut retries = 0;
+    loop {
+        let result = if hedged {
+            hedged_attempt(&scheduler, &op, &item).await
+        } else {
+            attempt(&scheduler, &op, item.clone()).await
+        };
+
+        match result {
+            Err(error) if retries < MAX_RETRIES => {
+                retries += 1;
+                warn!("Transfer failed with {error:?}, retrying ({retries}/{MAX_RETRIES})");
+                tokio::time::sleep(RETRY_BACKOFF * retries).await;
+            }
+            result => return (item, result),
+        }
+    }
+}
+
+// Runs an attempt, and starts a second one if the first hasn't completed within the hedge delay.
+async fn hedged_attempt<'a, I: Clone, T>(
+    scheduler: &TransferScheduler,
+    op: &Op<'a, I, T>,
+    item: &I,
+) -> Result<T> {
+    let first = attempt(scheduler, op, item.clone());
+    tokio::pin!(first);
+    tokio::select! {
+        result = &mut first => return result,
+        _ = tokio::time::sleep(scheduler.hedge_delay()) => {}
+    }
+
+    trace!(
+        "Transfer slower than {:?}, hedging it",
+        scheduler.hedge_delay()
+    );
+    let second = attempt(scheduler, op, item.clone());
+    tokio::pin!(second);
+    tokio::select! {
+        result = &mut first => match result {
+            Ok(value) => Ok(value),
+            Err(_) => second.await,
+        },
+        result = &mut second => match result {
+            Ok(value) => Ok(value),
+            Err(_) => first.await,
+        },
+    }
+}
+
+async fn attempt<'a, I, T>(scheduler: &TransferScheduler, op: &Op<'a, I, T>, item: I) -> Result<T> {
+    let start = Instant::now();
+    let result = op(item).await;
+    scheduler.record(result.is_ok(), start.elapsed());
+    result
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::client::{chunks::Error as ChunksError, Error};
+
+    use std::sync::atomic::{AtomicUsize, Ordering};
+
+    fn failure() -> Error {
+        Error::Chunks(ChunksError::EmptyFileProvided)
+    }
+
+    #[test]
+    fn window_grows_on_success_and_halves_on_failure() {
+        let scheduler = TransferScheduler::default();
+        for _ in 0..100 {
+            scheduler.record(true, Duration::from_millis(10));
+        }
+        let grown = scheduler.window();
+        assert!(grown > INITIAL_WINDOW as usize);
+
+        scheduler.record(false, Duration::from_millis(10));
+        assert_eq!(scheduler.window(), grown / 2);
+
+        // Failures within the same round trip only decrease it once.
+        scheduler.record(false, Duration::from_millis(10));
+        assert_eq!(scheduler.window(), grown / 2);
+    }
+
+    #[tokio::test]
+    async fn results_are_returned_in_order() {
+        let scheduler = TransferScheduler::default();
+        let items: Vec<u64> = (0..20).collect();
+        let mut transfers = scheduler
+            .transfers(items.clone(), |item| async move {
+                // The earlier items complete last.
+                tokio::time::sleep(Duration::from_millis(20 - item)).await;
+                Ok(item)
+            })
+            .in_order();
+
+        let mut results = vec![];
+        while let Some(result) = transfers.next().await {
+            results.push(result.expect("Transfer to succeed"));
+        }
+        assert_eq!(results, items);
+    }
+
+    #[tokio::test]
+    async fn failed_transfers_are_retried() {
+        let scheduler = TransferScheduler::default();
+        let attempts = AtomicUsize::new(0);
+        let mut transfers = scheduler.transfers(vec![()], |()| {
+            let attempt = attempts.fetch_add(1, Ordering::SeqCst);
+            async move {
+                if attempt < MAX_RETRIES as usize {
+                    Err(failure())
+                } else {
+                    Ok(attempt)
+                }
+            }
+        });
+
+        let result = transfers.next().await.expect("A result");
+        assert_eq!(result.ok(), Some(MAX_RETRIES as usize));
+        assert!(transfers.next().await.is_none());
+    }
+
+    #[tokio::test]
+    async fn failed_transfers_return_their_items() {
+        let scheduler = TransferScheduler::default();
+        let mut transfers = scheduler.transfers(vec![7u8], |_| async { Err::<(), _>(failure()) });
+
+        let (item, result) = transfers.next_with_item().await.expect("A result");
+        assert_eq!(item, 7);
+        assert!(result.is_err());
+        assert!(transfers.next_with_item().await.is_none());
+    }
+
+    #[tokio::test]
+    async fn slow_transfers_are_hedged() {
+        let scheduler = TransferScheduler::default();
+        scheduler.record(true, Duration::from_millis(10));
+
+        let attempts = AtomicUsize::new(0);
+        let start = Instant::now();
+        let mut transfers = scheduler
+            .transfers(vec![()], |()| {
+                let attempt = attempts.fetch_add(1, Ordering::SeqCst);
+                async move {
+                    if attempt == 0 {
+                        // The first attempt stalls.
+                        tokio::time::sleep(Duration::from_secs(60)).await;
+                    }
+                    Ok(attempt)
+                }
+            })
+            .hedged();
+
+        let result = transfers.next().await.expect("A result");
+        assert_eq!(result.ok(), Some(1));
+        assert!(start.elapsed() < Duration::from_secs(60));
+    }
+}
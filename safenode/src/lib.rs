@@ -42,10 +42,16 @@
 #[macro_use]
 extern crate tracing;
 
+/// Internals exposed to the benchmarks, which are not part of the API.
+#[cfg(feature = "bench")]
+#[doc(hidden)]
+pub mod bench;
 /// SAFE Client
 pub mod client;
 /// Logging.
 pub mod log;
+/// Metrics of the node, served over HTTP.
+mod metrics;
 /// The main logic of the network.
 pub mod network;
 /// Transfer fees, queues, validation and storage.
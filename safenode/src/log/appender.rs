@@ -51,7 +51,8 @@ pub(super) fn file_rotater(
 
     non_blocking_builder
         // lose lines and keep perf, or exert backpressure?
-        .lossy(false)
+        // Lines are dropped when the writer falls behind, rather than blocking the node's threads.
+        .lossy(true)
         // optionally change buffered lines limit
         // .buffered_lines_limit(buffered_lines_limit)
         .finish(file_appender)
@@ -8,11 +8,17 @@
 
 mod appender;
 
-use std::path::PathBuf;
+use std::{
+    path::PathBuf,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Mutex,
+    },
+};
 use tracing_appender::non_blocking::WorkerGuard;
 use tracing_core::{Event, Subscriber};
 use tracing_subscriber::{
-    filter::Targets,
+    filter::{ParseError, Targets},
     fmt as tracing_fmt,
     fmt::{
         format::Writer,
@@ -22,9 +28,61 @@ use tracing_subscriber::{
     layer::Filter,
     prelude::*,
     registry::LookupSpan,
-    Layer, Registry,
+    reload, Layer, Registry,
 };
 
+/// The env var setting the levels logged at start, per module, e.g. `safenode=info,safenode::network=debug`.
+pub const LOG_LEVELS_ENV: &str = "SN_LOG";
+
+/// Only one in that many of the events logged for each request, at its hot path, is kept.
+pub(crate) const REQUEST_LOG_SAMPLING: u64 = 100;
+
+// The handle to change the levels logged at runtime, set once logging is started.
+static LOG_LEVELS: Mutex<Option<reload::Handle<Targets, Registry>>> = Mutex::new(None);
+
+/// Errors of the logging setup.
+#[derive(Debug, thiserror::Error)]
+pub enum Error {
+    /// The levels are not of the form `target=level,...`.
+    #[error("Invalid log levels: {0}")]
+    InvalidLevels(#[from] ParseError),
+    /// Logging was not started, so has no levels to change.
+    #[error("Logging was not started")]
+    NotStarted,
+    /// The levels could not be replaced.
+    #[error("Could not change the log levels: {0}")]
+    Reload(#[from] reload::Error),
+}
+
+/// Keeps one in `every` of the events logged at a callsite, for those
+/// logged too often to be kept in full, e.g. for each request handled.
+///
+/// ```ignore
+/// static SAMPLER: LogSampler = LogSampler::new(REQUEST_LOG_SAMPLING);
+/// if SAMPLER.sample() {
+///     trace!("Handling request: {request:?}");
+/// }
+/// ```
+#[derive(Debug)]
+pub(crate) struct LogSampler {
+    every: u64,
+    count: AtomicU64,
+}
+
+impl LogSampler {
+    pub(crate) const fn new(every: u64) -> Self {
+        Self {
+            every,
+            count: AtomicU64::new(0),
+        }
+    }
+
+    /// Returns whether the event at hand is to be logged.
+    pub(crate) fn sample(&self) -> bool {
+        self.count.fetch_add(1, Ordering::Relaxed) % self.every == 0
+    }
+}
+
 #[derive(Default, Debug)]
 /// Tracing log formatter setup for easier span viewing
 pub struct LogFormatter;
@@ -66,10 +124,11 @@ pub struct TracingLayers {
 }
 
 impl TracingLayers {
-    fn fmt_layer(&mut self, optional_log_dir: &Option<PathBuf>) {
-        // Filter by log level of this crate only
-        let target_filters: Box<dyn Filter<Registry> + Send + Sync> =
-            Box::new(Targets::new().with_target(current_crate_str(), tracing::Level::TRACE));
+    fn fmt_layer(&mut self, optional_log_dir: &Option<PathBuf>, levels: Targets) {
+        // The levels can be changed at runtime, see `set_log_levels`.
+        let (levels, handle) = reload::Layer::new(levels);
+        *LOG_LEVELS.lock().unwrap_or_else(|err| err.into_inner()) = Some(handle);
+        let target_filters: Box<dyn Filter<Registry> + Send + Sync> = Box::new(levels);
         let fmt_layer = tracing_fmt::layer().with_ansi(false);
 
         if let Some(log_dir) = optional_log_dir {
@@ -99,7 +158,12 @@ impl TracingLayers {
         } else {
             println!("Starting logging to stdout");
 
+            // Writes to stdout block, so are moved off the threads logging, as with the files.
+            let (non_blocking, worker_guard) = tracing_appender::non_blocking(std::io::stdout());
+            self.guard = Some(worker_guard);
+
             let layer = fmt_layer
+                .with_writer(non_blocking)
                 .with_target(false)
                 .event_format(LogFormatter::default())
                 .with_filter(target_filters)
@@ -112,19 +176,68 @@ impl TracingLayers {
 /// Inits node logging, returning the global node guard if required.
 /// This guard should be held for the life of the program.
 ///
+/// The levels logged are read from the `SN_LOG` env var, if set,
+/// and otherwise all levels of this crate are logged.
+/// They can be changed later on with `set_log_levels`.
+///
 /// Logging should be instantiated only once.
 pub fn init_node_logging(log_dir: &Option<PathBuf>) -> Result<Option<WorkerGuard>, std::io::Error> {
+    let levels = match std::env::var(LOG_LEVELS_ENV) {
+        Ok(levels) => parse_log_levels(&levels)
+            .map_err(|err| std::io::Error::new(std::io::ErrorKind::InvalidInput, err))?,
+        Err(_) => Targets::new().with_target(current_crate_str(), tracing::Level::TRACE),
+    };
+
     let mut layers = TracingLayers::default();
-    layers.fmt_layer(log_dir);
+    layers.fmt_layer(log_dir, levels);
 
     tracing_subscriber::registry().with(layers.layers).init();
 
     Ok(layers.guard)
 }
 
+/// Replaces the levels logged, per module, with those given in the form
+/// `target=level,...`, e.g. `safenode=info,safenode::network=debug`.
+pub fn set_log_levels(levels: &str) -> Result<(), Error> {
+    let levels = parse_log_levels(levels)?;
+    let handle = LOG_LEVELS.lock().unwrap_or_else(|err| err.into_inner());
+    handle.as_ref().ok_or(Error::NotStarted)?.reload(levels)?;
+    Ok(())
+}
+
+fn parse_log_levels(levels: &str) -> Result<Targets, ParseError> {
+    levels.trim().parse()
+}
+
 /// Get current root module name (e.g. "sn_node")
 fn current_crate_str() -> &'static str {
     // Grab root from module path ("sn_node::log::etc" -> "sn_node")
     let m = module_path!();
     &m[..m.find(':').unwrap_or(m.len())]
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use tracing::Level;
+
+    #[test]
+    fn log_levels_are_parsed_per_module() -> eyre::Result<()> {
+        let levels = parse_log_levels("safenode=info,safenode::network=debug\n")?;
+        assert!(levels.would_enable("safenode::node", &Level::INFO));
+        assert!(!levels.would_enable("safenode::node", &Level::DEBUG));
+        assert!(levels.would_enable("safenode::network::msg", &Level::DEBUG));
+        assert!(!levels.would_enable("libp2p", &Level::ERROR));
+
+        assert!(parse_log_levels("safenode=loud").is_err());
+        Ok(())
+    }
+
+    #[test]
+    fn sampler_keeps_one_in_every() {
+        let sampler = LogSampler::new(10);
+        let kept = (0..100).filter(|_| sampler.sample()).count();
+        assert_eq!(kept, 10);
+    }
+}
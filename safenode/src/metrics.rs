@@ -0,0 +1,475 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use crate::{
+    network_transfers::SpendQueueMetrics,
+    protocol::fees::{SpendPriority, SpendQStats},
+};
+
+use clru::{CLruCache, WeightScale};
+use prometheus_client::{
+    encoding::{text::encode, EncodeLabelSet},
+    metrics::{
+        counter::Counter,
+        family::Family,
+        gauge::Gauge,
+        histogram::{exponential_buckets, Histogram},
+    },
+    registry::Registry,
+};
+use std::{
+    hash::{BuildHasher, Hash},
+    io,
+    net::SocketAddr,
+    sync::{atomic::AtomicU64, Arc},
+    time::Duration,
+};
+use tokio::{
+    io::{AsyncReadExt, AsyncWriteExt},
+    net::{TcpListener, TcpStream},
+    time::{sleep, timeout},
+};
+
+/// The prefix of the names of all metrics of a node.
+const METRICS_PREFIX: &str = "safenode";
+/// The max number of bytes of a scrape request read, the rest of it is ignored.
+const MAX_REQUEST_SIZE: usize = 1024;
+/// How long a scrape is given to be read and responded to, before its connection is dropped.
+const SCRAPE_TIMEOUT: Duration = Duration::from_secs(10);
+/// How long to wait before accepting connections again after failing to, e.g. when
+/// out of file descriptors, for the failures not to spin the loop.
+const ACCEPT_RETRY_DELAY: Duration = Duration::from_millis(100);
+
+type DurationFamily<L> = Family<L, Histogram, fn() -> Histogram>;
+
+// Buckets from 1ms to about 30s, which covers from a local read to a request timing out.
+fn duration_histogram() -> Histogram {
+    Histogram::new(exponential_buckets(0.001, 2.0, 16))
+}
+
+/// Labels a metric with the kind of request it was measured for.
+#[derive(Clone, Debug, Hash, PartialEq, Eq, EncodeLabelSet)]
+pub(crate) struct RequestLabels {
+    kind: String,
+}
+
+/// Labels a metric with the spend priority it was measured for.
+#[derive(Clone, Debug, Hash, PartialEq, Eq, EncodeLabelSet)]
+pub(crate) struct PriorityLabels {
+    priority: String,
+}
+
+/// Hits, misses and evictions of an in-memory cache.
+///
+/// Cloning it is cheap, and all the clones count into the same metrics.
+#[derive(Clone, Debug, Default)]
+pub(crate) struct CacheMetrics {
+    hits: Counter,
+    misses: Counter,
+    evictions: Counter,
+}
+
+impl CacheMetrics {
+    /// Counts a lookup that found the item in the cache.
+    pub(crate) fn hit(&self) {
+        let _ = self.hits.inc();
+    }
+
+    /// Counts a lookup that didn't find the item in the cache.
+    pub(crate) fn miss(&self) {
+        let _ = self.misses.inc();
+    }
+
+    /// Puts the item in the cache as with `CLruCache::put_with_weight`,
+    /// counting the items evicted to make room for it.
+    pub(crate) fn put_with_weight<K, V, S, W>(
+        &self,
+        cache: &mut CLruCache<K, V, S, W>,
+        key: K,
+        value: V,
+    ) -> Result<Option<V>, (K, V)>
+    where
+        K: Clone + Eq + Hash,
+        S: BuildHasher,
+        W: WeightScale<K, V>,
+    {
+        let len_before = cache.len();
+        let replaces = cache.peek(&key).is_some();
+        let result = cache.put_with_weight(key, value);
+        if result.is_ok() {
+            let len_expected = if replaces { len_before } else { len_before + 1 };
+            let evicted = len_expected.saturating_sub(cache.len());
+            if evicted > 0 {
+                let _ = self.evictions.inc_by(evicted as u64);
+            }
+        }
+        result
+    }
+
+    /// Registers the metrics under the name of the cache.
+    pub(crate) fn register(&self, registry: &mut Registry, cache_name: &str) {
+        let registry = registry.sub_registry_with_prefix(cache_name);
+        registry.register(
+            "cache_hits",
+            "Lookups that found the item in the cache",
+            self.hits.clone(),
+        );
+        registry.register(
+            "cache_misses",
+            "Lookups that didn't find the item in the cache",
+            self.misses.clone(),
+        );
+        registry.register(
+            "cache_evictions",
+            "Items evicted from the cache to make room for others",
+            self.evictions.clone(),
+        );
+    }
+}
+
+/// Metrics of the requests sent to peers, of the lookups of peers, and of the
+/// channels between the `Network` handles and the `SwarmDriver`.
+///
+/// Cloning it is cheap, and all the clones count into the same metrics.
+#[derive(Clone, Debug)]
+pub(crate) struct NetworkMetrics {
+    // Not labelled by peer, as the series of the peers that left would be kept forever.
+    response_time: Histogram,
+    timeouts: Counter,
+    closest_peers_lookup_time: Histogram,
+    pending_cmds: Gauge,
+    pending_events: Gauge,
+}
+
+impl Default for NetworkMetrics {
+    fn default() -> Self {
+        Self {
+            response_time: duration_histogram(),
+            timeouts: Default::default(),
+            closest_peers_lookup_time: duration_histogram(),
+            pending_cmds: Default::default(),
+            pending_events: Default::default(),
+        }
+    }
+}
+
+impl NetworkMetrics {
+    /// Records how long a peer took to respond to a request, or that it timed out.
+    pub(crate) fn record_response(&self, elapsed: Duration, timed_out: bool) {
+        if timed_out {
+            let _ = self.timeouts.inc();
+        } else {
+            self.response_time.observe(elapsed.as_secs_f64());
+        }
+    }
+
+    /// Records how long a lookup of the closest peers to a name took.
+    pub(crate) fn record_closest_peers_lookup(&self, elapsed: Duration) {
+        self.closest_peers_lookup_time
+            .observe(elapsed.as_secs_f64());
+    }
+
+    /// Counts a cmd sent to the `SwarmDriver`.
+    pub(crate) fn cmd_sent(&self) {
+        let _ = self.pending_cmds.inc();
+    }
+
+    /// Counts a cmd received by the `SwarmDriver`.
+    pub(crate) fn cmd_received(&self) {
+        let _ = self.pending_cmds.dec();
+    }
+
+    /// Sets the number of events sent by the `SwarmDriver` and not received yet.
+    pub(crate) fn set_pending_events(&self, pending: usize) {
+        let _ = self.pending_events.set(pending as i64);
+    }
+
+    /// Registers the metrics.
+    pub(crate) fn register(&self, registry: &mut Registry) {
+        registry.register(
+            "peer_response_time_seconds",
+            "How long peers took to respond to the requests sent to them",
+            self.response_time.clone(),
+        );
+        registry.register(
+            "peer_timeouts",
+            "Requests sent to peers that they didn't respond to in time",
+            self.timeouts.clone(),
+        );
+        registry.register(
+            "closest_peers_lookup_time_seconds",
+            "How long lookups of the closest peers to a name took",
+            self.closest_peers_lookup_time.clone(),
+        );
+        registry.register(
+            "pending_swarm_cmds",
+            "Cmds sent to the swarm driver and not handled yet",
+            self.pending_cmds.clone(),
+        );
+        registry.register(
+            "pending_network_events",
+            "Events sent by the swarm driver and not handled yet",
+            self.pending_events.clone(),
+        );
+    }
+}
+
+/// Metrics of the requests handled by a node, and of its queue of spends.
+///
+/// Cloning it is cheap, and all the clones count into the same metrics.
+#[derive(Clone, Debug)]
+pub(crate) struct NodeMetrics {
+    requests: Family<RequestLabels, Counter>,
+    request_duration: DurationFamily<RequestLabels>,
+    spends_queued: Gauge,
+    spends_committed: Counter,
+    spend_max_wait: Gauge<f64, AtomicU64>,
+    spend_avg_wait: Gauge<f64, AtomicU64>,
+    spend_fees: Family<PriorityLabels, Gauge>,
+    spend_fees_std_dev: Gauge,
+}
+
+impl Default for NodeMetrics {
+    fn default() -> Self {
+        Self {
+            requests: Default::default(),
+            request_duration: Family::new_with_constructor(duration_histogram),
+            spends_queued: Default::default(),
+            spends_committed: Default::default(),
+            spend_max_wait: Default::default(),
+            spend_avg_wait: Default::default(),
+            spend_fees: Default::default(),
+            spend_fees_std_dev: Default::default(),
+        }
+    }
+}
+
+impl NodeMetrics {
+    /// Records a request of the kind, handled in `elapsed`.
+    pub(crate) fn record_request(&self, kind: &str, elapsed: Duration) {
+        let labels = RequestLabels {
+            kind: kind.to_string(),
+        };
+        let _ = self.requests.get_or_create(&labels).inc();
+        self.request_duration
+            .get_or_create(&labels)
+            .observe(elapsed.as_secs_f64());
+    }
+
+    /// Records the state of the spend queue, and the fees it currently maps priorities to.
+    pub(crate) fn record_spend_queue(&self, metrics: &SpendQueueMetrics, stats: &SpendQStats) {
+        let _ = self.spends_queued.set(metrics.queued as i64);
+        // The queue counts the spends committed so far, of which only those new are added.
+        let committed = metrics
+            .committed
+            .saturating_sub(self.spends_committed.get());
+        let _ = self.spends_committed.inc_by(committed);
+        let _ = self
+            .spend_max_wait
+            .set(metrics.last_batch_max_wait.as_secs_f64());
+        let _ = self.spend_avg_wait.set(metrics.avg_wait.as_secs_f64());
+        for priority in [
+            SpendPriority::Highest,
+            SpendPriority::High,
+            SpendPriority::MediumHigh,
+            SpendPriority::Normal,
+            SpendPriority::MediumLow,
+            SpendPriority::Low,
+            SpendPriority::Lowest,
+        ] {
+            let labels = PriorityLabels {
+                priority: format!("{priority:?}"),
+            };
+            let _ = self
+                .spend_fees
+                .get_or_create(&labels)
+                .set(stats.map_to_fee(priority) as i64);
+        }
+        let _ = self.spend_fees_std_dev.set(stats.std_dev as i64);
+    }
+
+    /// Registers the metrics.
+    pub(crate) fn register(&self, registry: &mut Registry) {
+        registry.register(
+            "requests",
+            "Requests handled, by kind",
+            self.requests.clone(),
+        );
+        registry.register(
+            "request_duration_seconds",
+            "How long requests took to be handled, by kind",
+            self.request_duration.clone(),
+        );
+        registry.register(
+            "spends_queued",
+            "Spends queued to be committed to storage",
+            self.spends_queued.clone(),
+        );
+        registry.register(
+            "spends_committed",
+            "Spends committed to storage since the node started",
+            self.spends_committed.clone(),
+        );
+        registry.register(
+            "spend_max_wait_seconds",
+            "The longest a spend of the last committed batch was queued for",
+            self.spend_max_wait.clone(),
+        );
+        registry.register(
+            "spend_avg_wait_seconds",
+            "A moving average of how long spends are queued for",
+            self.spend_avg_wait.clone(),
+        );
+        registry.register(
+            "spend_fees_nanos",
+            "The fee currently required of a spend, by priority",
+            self.spend_fees.clone(),
+        );
+        registry.register(
+            "spend_fees_std_dev_nanos",
+            "The standard deviation of the fees of the queued spends",
+            self.spend_fees_std_dev.clone(),
+        );
+    }
+}
+
+/// Returns a registry for the metrics of a node to be registered into.
+pub(crate) fn registry() -> Registry {
+    Registry::with_prefix(METRICS_PREFIX)
+}
+
+/// Serves the metrics of the registry over HTTP at the address, for Prometheus to scrape.
+///
+/// Every request is responded to with the metrics, in the OpenMetrics text format,
+/// whatever its path. A scrape not served within `SCRAPE_TIMEOUT` is dropped.
+/// This only returns if the address can't be listened on, failures to accept a
+/// connection are logged and the next one is waited for.
+pub(crate) async fn serve(addr: SocketAddr, registry: Registry) -> io::Result<()> {
+    let listener = TcpListener::bind(addr).await?;
+    info!(
+        "Serving metrics at http://{}/metrics",
+        listener.local_addr()?
+    );
+
+    let registry = Arc::new(registry);
+    loop {
+        let (mut stream, peer_addr) = match listener.accept().await {
+            Ok(accepted) => accepted,
+            Err(err) => {
+                warn!("Failed to accept a metrics connection: {err}");
+                sleep(ACCEPT_RETRY_DELAY).await;
+                continue;
+            }
+        };
+        let registry = registry.clone();
+        let _handle = tokio::spawn(async move {
+            match timeout(SCRAPE_TIMEOUT, respond(&mut stream, &registry)).await {
+                Ok(Ok(())) => {}
+                Ok(Err(err)) => debug!("Failed to serve metrics to {peer_addr}: {err}"),
+                Err(_) => debug!("Timed out serving metrics to {peer_addr}"),
+            }
+        });
+    }
+}
+
+async fn respond(stream: &mut TcpStream, registry: &Registry) -> io::Result<()> {
+    // The request is only read for it not to be reset, none of it is needed to respond.
+    let mut request = [0; MAX_REQUEST_SIZE];
+    let _ = stream.read(&mut request).await?;
+
+    let mut body = String::new();
+    encode(&mut body, registry).map_err(|err| io::Error::new(io::ErrorKind::Other, err))?;
+    let header = format!(
+        "HTTP/1.1 200 OK\r\n\
+         Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n\
+         Content-Length: {}\r\n\
+         Connection: close\r\n\r\n",
+        body.len()
+    );
+    stream.write_all(header.as_bytes()).await?;
+    stream.write_all(body.as_bytes()).await?;
+    stream.shutdown().await
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::protocol::fees::SpendQ;
+
+    use clru::CLruCacheConfig;
+    use eyre::Result;
+    use std::{collections::hash_map::RandomState, num::NonZeroUsize};
+
+    struct Len;
+
+    impl WeightScale<u8, Vec<u8>> for Len {
+        fn weight(&self, _key: &u8, value: &Vec<u8>) -> usize {
+            value.len()
+        }
+    }
+
+    #[test]
+    fn evictions_are_counted_when_putting_into_a_cache() -> Result<()> {
+        let metrics = CacheMetrics::default();
+        let size = NonZeroUsize::new(10).ok_or_else(|| eyre::eyre!("Zero cache size"))?;
+        let mut cache: CLruCache<u8, Vec<u8>, RandomState, Len> =
+            CLruCache::with_config(CLruCacheConfig::new(size).with_scale(Len));
+
+        for key in 0..3 {
+            assert!(metrics.put_with_weight(&mut cache, key, vec![0; 3]).is_ok());
+        }
+        assert_eq!(metrics.evictions.get(), 0);
+
+        // Replacing an item evicts none.
+        assert!(metrics.put_with_weight(&mut cache, 2, vec![0; 3]).is_ok());
+        assert_eq!(metrics.evictions.get(), 0);
+
+        // Making room for 9 bytes evicts the three items.
+        assert!(metrics.put_with_weight(&mut cache, 3, vec![0; 9]).is_ok());
+        assert_eq!(metrics.evictions.get(), 3);
+
+        // An item too big for the cache evicts none.
+        assert!(metrics.put_with_weight(&mut cache, 4, vec![0; 11]).is_err());
+        assert_eq!(metrics.evictions.get(), 3);
+
+        Ok(())
+    }
+
+    #[test]
+    fn registered_metrics_are_encoded() -> Result<()> {
+        let cache = CacheMetrics::default();
+        let network = NetworkMetrics::default();
+        let node = NodeMetrics::default();
+        let mut registry = registry();
+        cache.register(&mut registry, "chunks");
+        network.register(&mut registry);
+        node.register(&mut registry);
+
+        cache.hit();
+        network.record_response(Duration::from_millis(5), false);
+        node.record_request("get_chunk", Duration::from_millis(1));
+        let stats = SpendQ::<u8>::with_fee(0).snapshot().stats();
+        for committed in [1, 3] {
+            let queue = SpendQueueMetrics {
+                committed,
+                ..Default::default()
+            };
+            node.record_spend_queue(&queue, &stats);
+        }
+
+        let mut text = String::new();
+        encode(&mut text, &registry)?;
+        assert!(text.contains("safenode_chunks_cache_hits_total 1"));
+        assert!(text.contains("safenode_peer_response_time_seconds_count 1"));
+        assert!(text.contains("safenode_requests_total{kind=\"get_chunk\"} 1"));
+        assert!(text.contains("safenode_spends_committed_total 3"));
+
+        Ok(())
+    }
+}
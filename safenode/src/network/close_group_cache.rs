@@ -0,0 +1,340 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use super::CLOSE_GROUP_SIZE;
+
+use libp2p::{
+    kad::{KBucketKey, K_VALUE},
+    PeerId,
+};
+use std::{
+    collections::{BTreeMap, HashSet, VecDeque},
+    time::{Duration, Instant},
+};
+use xor_name::XorName;
+
+/// The max number of lookups kept in the cache.
+const MAX_ENTRIES: usize = 256;
+/// How long a lookup is used for, unless invalidated earlier by changes to the routing table.
+const ENTRY_TTL: Duration = Duration::from_secs(5 * 60);
+/// The radius of a lookup which found every peer in the network. It is beyond the radius of
+/// any other lookup, which is at most 256, the highest bit of a distance having all bits set.
+const FULL_RADIUS: u32 = u32::MAX;
+
+/// Caches the results of `GetClosestPeers` lookups, so that requests to addresses
+/// sharing a prefix don't each need a Kademlia walk.
+///
+/// A lookup for a target returns the `K_VALUE` closest peers to it, which means that any
+/// other peer is at a distance of at least that of the farthest one, `dist_max`.
+/// For XOR distances, this tells that for any address whose distance to the target has its
+/// highest bit below the one of `dist_max` (i.e. that shares a long enough prefix with the
+/// target, in the Kademlia key space), every other peer also has a distance with a highest bit
+/// of at least the one of `dist_max`. The lookup thus holds the actual closest peers to all such
+/// addresses, whenever `CLOSE_GROUP_SIZE` of them are closer than that bound.
+#[derive(Default)]
+pub(super) struct CloseGroupCache {
+    entries: VecDeque<Entry>,
+}
+
+struct Entry {
+    target: XorName,
+    target_key: KBucketKey<Vec<u8>>,
+    peers: Vec<KBucketKey<PeerId>>,
+    /// The farthest of the peers from the target.
+    farthest: KBucketKey<PeerId>,
+    /// The highest bit of the distance to the farthest peer,
+    /// or `FULL_RADIUS` if all peers in the network were found.
+    radius: u32,
+    inserted: Instant,
+}
+
+impl CloseGroupCache {
+    /// Returns the peers of a cached lookup, if they are known to include the
+    /// `CLOSE_GROUP_SIZE` closest peers to the given name.
+    pub(super) fn get(&mut self, name: &XorName) -> Option<HashSet<PeerId>> {
+        self.entries
+            .retain(|entry| entry.inserted.elapsed() < ENTRY_TTL);
+
+        let key = KBucketKey::new(name.0.to_vec());
+        self.entries
+            .iter()
+            .find(|entry| entry.covers(name, &key))
+            .map(|entry| entry.peers.iter().map(|peer| *peer.preimage()).collect())
+    }
+
+    /// Caches the peers found by a completed lookup of the target.
+    pub(super) fn insert(&mut self, target: XorName, peers: &HashSet<PeerId>) {
+        let target_key = KBucketKey::new(target.0.to_vec());
+        let peers: Vec<_> = peers.iter().map(|peer| KBucketKey::from(*peer)).collect();
+        let farthest = match peers
+            .iter()
+            .max_by_key(|peer| target_key.distance(*peer))
+            .cloned()
+        {
+            Some(farthest) => farthest,
+            None => return,
+        };
+
+        let radius = if peers.len() < usize::from(K_VALUE) {
+            FULL_RADIUS
+        } else {
+            highest_bit(target_key.distance(&farthest).ilog2())
+        };
+
+        self.entries.retain(|entry| entry.target != target);
+        if self.entries.len() >= MAX_ENTRIES {
+            let _ = self.entries.pop_front();
+        }
+        self.entries.push_back(Entry {
+            target,
+            target_key,
+            peers,
+            farthest,
+            radius,
+            inserted: Instant::now(),
+        });
+    }
+
+    /// Drops the lookups which the new peer would have been part of.
+    pub(super) fn peer_added(&mut self, peer: PeerId) {
+        let peer = KBucketKey::from(peer);
+        self.entries.retain(|entry| {
+            entry.radius != FULL_RADIUS
+                && entry.target_key.distance(&peer) >= entry.target_key.distance(&entry.farthest)
+        });
+    }
+
+    /// Drops the lookups which the peer was part of.
+    pub(super) fn peer_removed(&mut self, peer: &PeerId) {
+        self.entries
+            .retain(|entry| !entry.peers.iter().any(|key| key.preimage() == peer));
+    }
+}
+
+impl Entry {
+    fn covers(&self, name: &XorName, key: &KBucketKey<Vec<u8>>) -> bool {
+        if &self.target == name {
+            return true;
+        }
+        if self.radius != FULL_RADIUS
+            && highest_bit(self.target_key.distance(key).ilog2()) >= self.radius
+        {
+            return false;
+        }
+
+        let mut distances: Vec<_> = self.peers.iter().map(|peer| key.distance(peer)).collect();
+        distances.sort();
+        match distances.get(CLOSE_GROUP_SIZE - 1) {
+            Some(distance) => highest_bit(distance.ilog2()) < self.radius,
+            // Not enough peers to be of use.
+            None => false,
+        }
+    }
+}
+
+/// Returns the peers of the routing table which include the `CLOSE_GROUP_SIZE` closest peers
+/// to the given name, if the table is known to hold all of those, and they are all connected.
+///
+/// Each bucket of the routing table holds the peers whose distance to us has a given highest
+/// bit, and a bucket with fewer than `K_VALUE` peers holds all the peers of its range. If the
+/// distance from us to the name has its highest bit `b`, the peers of bucket `b` are the closest
+/// to the name, followed by those of all the buckets below `b`, then those of each bucket above
+/// `b` in turn. So once enough peers are found in such ranges, each of whose buckets are not
+/// full, they include the closest ones, and no Kademlia walk is needed to find them.
+pub(super) fn closest_in_routing_table(
+    our_id: PeerId,
+    name: &XorName,
+    routing_peers: &[(PeerId, bool)],
+) -> Option<HashSet<PeerId>> {
+    let our_key = KBucketKey::from(our_id);
+    let mut buckets: BTreeMap<u32, Vec<(PeerId, bool)>> = BTreeMap::new();
+    for (peer, connected) in routing_peers {
+        let bucket = highest_bit(our_key.distance(&KBucketKey::from(*peer)).ilog2());
+        buckets.entry(bucket).or_default().push((*peer, *connected));
+    }
+
+    let name_bucket = highest_bit(our_key.distance(&KBucketKey::new(name.0.to_vec())).ilog2());
+    let ranges = [name_bucket..=name_bucket, 1..=name_bucket.saturating_sub(1)]
+        .into_iter()
+        .chain((name_bucket + 1..=256).map(|bucket| bucket..=bucket))
+        .filter(|range| !range.is_empty());
+    let mut found = HashSet::new();
+    for range in ranges {
+        for peers in buckets.range(range).map(|(_, peers)| peers) {
+            if peers.len() >= usize::from(K_VALUE) || peers.iter().any(|(_, connected)| !connected)
+            {
+                return None;
+            }
+            found.extend(peers.iter().map(|(peer, _)| *peer));
+        }
+        if found.len() >= CLOSE_GROUP_SIZE {
+            return Some(found);
+        }
+    }
+    // Too few peers for a close group, which a lookup is left to confirm.
+    None
+}
+
+// The position of the highest bit set in a distance, where a distance of zero
+// (when `ilog2` returns `None`) sorts below all others.
+fn highest_bit(ilog2: Option<u32>) -> u32 {
+    ilog2.map(|bit| bit + 1).unwrap_or(0)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use libp2p::kad::kbucket::Distance;
+
+    fn random_peers(count: usize) -> HashSet<PeerId> {
+        (0..count).map(|_| PeerId::random()).collect()
+    }
+
+    fn closest(name: &XorName, peers: &HashSet<PeerId>) -> Vec<PeerId> {
+        let key = KBucketKey::new(name.0.to_vec());
+        let mut peers: Vec<_> = peers.iter().cloned().collect();
+        peers.sort_by_cached_key(|peer| key.distance(&KBucketKey::from(*peer)));
+        peers.into_iter().take(CLOSE_GROUP_SIZE).collect()
+    }
+
+    #[test]
+    fn hits_hold_the_actual_closest_peers() {
+        let mut rng = rand::thread_rng();
+        let all_peers = random_peers(500);
+
+        let mut cache = CloseGroupCache::default();
+        for _ in 0..200 {
+            let name = XorName::random(&mut rng);
+            match cache.get(&name) {
+                Some(cached) => {
+                    assert_eq!(closest(&name, &cached), closest(&name, &all_peers));
+                }
+                None => {
+                    // Simulate a lookup returning the K_VALUE closest peers.
+                    let key = KBucketKey::new(name.0.to_vec());
+                    let mut found: Vec<_> = all_peers.iter().cloned().collect();
+                    found.sort_by_cached_key(|peer| key.distance(&KBucketKey::from(*peer)));
+                    let found = found.into_iter().take(usize::from(K_VALUE)).collect();
+                    cache.insert(name, &found);
+                }
+            }
+        }
+        // Each lookup is exact for its own target.
+        let name = XorName::random(&mut rng);
+        cache.insert(name, &all_peers);
+        assert!(cache.get(&name).is_some());
+    }
+
+    #[test]
+    fn lookups_of_small_networks_cover_every_name() {
+        let mut rng = rand::thread_rng();
+        let peers = random_peers(usize::from(K_VALUE) - 1);
+
+        let mut cache = CloseGroupCache::default();
+        cache.insert(XorName::random(&mut rng), &peers);
+        for _ in 0..10 {
+            assert_eq!(cache.get(&XorName::random(&mut rng)), Some(peers.clone()));
+        }
+
+        // Any new peer could be among the closest to a name.
+        cache.peer_added(PeerId::random());
+        assert_eq!(cache.get(&XorName::random(&mut rng)), None);
+    }
+
+    #[test]
+    fn lookups_spanning_the_key_space_are_not_taken_as_full() {
+        let mut rng = rand::thread_rng();
+        let name = XorName::random(&mut rng);
+        let key = KBucketKey::new(name.0.to_vec());
+        let top_bit = |distance: Distance| highest_bit(distance.ilog2()) == 256;
+
+        // A lookup of K_VALUE peers, the farthest of which has a distance of the highest radius.
+        let peers = loop {
+            let peers = random_peers(usize::from(K_VALUE));
+            if peers
+                .iter()
+                .any(|peer| top_bit(key.distance(&KBucketKey::from(*peer))))
+            {
+                break peers;
+            }
+        };
+        let mut cache = CloseGroupCache::default();
+        cache.insert(name, &peers);
+
+        // A name at a distance of the highest bit is beyond the radius of the lookup.
+        let far_name = loop {
+            let far_name = XorName::random(&mut rng);
+            if top_bit(key.distance(&KBucketKey::new(far_name.0.to_vec()))) {
+                break far_name;
+            }
+        };
+        assert_eq!(cache.get(&far_name), None);
+    }
+
+    #[test]
+    fn routing_tables_with_complete_buckets_hold_the_closest_peers() {
+        let mut rng = rand::thread_rng();
+        let our_id = PeerId::random();
+        // No bucket can be full, so each of them holds all the peers of its range.
+        let all_peers = random_peers(usize::from(K_VALUE) - 1);
+        let routing_peers: Vec<_> = all_peers.iter().map(|peer| (*peer, true)).collect();
+
+        for _ in 0..50 {
+            let name = XorName::random(&mut rng);
+            let found = closest_in_routing_table(our_id, &name, &routing_peers)
+                .expect("The routing table to hold the closest peers");
+            assert_eq!(closest(&name, &found), closest(&name, &all_peers));
+        }
+
+        // The peers of a full bucket may not all be known.
+        let our_key = KBucketKey::from(our_id);
+        let mut full_bucket = vec![];
+        while full_bucket.len() < usize::from(K_VALUE) {
+            let peer = PeerId::random();
+            if highest_bit(our_key.distance(&KBucketKey::from(peer)).ilog2()) == 256 {
+                full_bucket.push((peer, true));
+            }
+        }
+        let name = loop {
+            let name = XorName::random(&mut rng);
+            if highest_bit(our_key.distance(&KBucketKey::new(name.0.to_vec())).ilog2()) == 256 {
+                break name;
+            }
+        };
+        assert_eq!(closest_in_routing_table(our_id, &name, &full_bucket), None);
+    }
+
+    #[test]
+    fn routing_tables_with_disconnected_peers_are_not_used() {
+        let mut rng = rand::thread_rng();
+        let routing_peers: Vec<_> = random_peers(usize::from(K_VALUE))
+            .into_iter()
+            .map(|peer| (peer, false))
+            .collect();
+        let name = XorName::random(&mut rng);
+        assert_eq!(
+            closest_in_routing_table(PeerId::random(), &name, &routing_peers),
+            None
+        );
+    }
+
+    #[test]
+    fn removed_peers_invalidate_their_lookups() {
+        let mut rng = rand::thread_rng();
+        let peers = random_peers(usize::from(K_VALUE));
+        let name = XorName::random(&mut rng);
+
+        let mut cache = CloseGroupCache::default();
+        cache.insert(name, &peers);
+        assert_eq!(cache.get(&name), Some(peers.clone()));
+
+        let removed = peers.iter().next().cloned().expect("There to be peers");
+        cache.peer_removed(&removed);
+        assert_eq!(cache.get(&name), None);
+    }
+}
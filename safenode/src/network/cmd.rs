@@ -11,7 +11,7 @@ use crate::{
     protocol::messages::{Request, Response},
 };
 
-use super::{error::Error, SwarmDriver};
+use super::{close_group_cache::closest_in_routing_table, error::Error, SwarmDriver};
 use libp2p::{multiaddr::Protocol, request_response::ResponseChannel, Multiaddr, PeerId};
 use std::collections::{hash_map, HashSet};
 use tokio::sync::oneshot;
@@ -43,6 +43,9 @@ pub enum SwarmCmd {
         resp: Response,
         channel: ResponseChannel<Response>,
     },
+    GetRoutingPeers {
+        sender: oneshot::Sender<Vec<PeerId>>,
+    },
 }
 
 impl SwarmDriver {
@@ -81,11 +84,29 @@ impl SwarmDriver {
                 }
             }
             SwarmCmd::GetClosestPeers { xor_name, sender } => {
-                let key = xor_name.0.to_vec();
-                let query_id = self.swarm.behaviour_mut().kademlia.get_closest_peers(key);
-                let _ = self
-                    .pending_get_closest_peers
-                    .insert(query_id, (sender, Default::default()));
+                let our_id = *self.swarm.local_peer_id();
+                if let Some(peers) = self.close_group_cache.get(&xor_name) {
+                    trace!("Got closest peers to {xor_name:?} from the cache");
+                    let _ = sender.send((our_id, peers));
+                } else if let Some(peers) = self.closest_routing_peers(&xor_name) {
+                    trace!("Got closest peers to {xor_name:?} from the routing table");
+                    let _ = sender.send((our_id, peers));
+                } else {
+                    let key = xor_name.0.to_vec();
+                    let query_id = self.swarm.behaviour_mut().kademlia.get_closest_peers(key);
+                    let _ = self
+                        .pending_get_closest_peers
+                        .insert(query_id, (xor_name, Some(sender), Default::default()));
+                }
+            }
+            SwarmCmd::GetRoutingPeers { sender } => {
+                let mut peers = vec![];
+                for bucket in self.swarm.behaviour_mut().kademlia.kbuckets() {
+                    for entry in bucket.iter() {
+                        peers.push(*entry.node.key.preimage());
+                    }
+                }
+                let _ = sender.send(peers);
             }
             SwarmCmd::SendRequest { req, peer, sender } => {
                 let request_id = self
@@ -105,4 +126,20 @@ impl SwarmDriver {
         }
         Ok(())
     }
+
+    // The closest peers to the name, if the routing table is known to hold them.
+    fn closest_routing_peers(&mut self, xor_name: &XorName) -> Option<HashSet<PeerId>> {
+        let our_id = *self.swarm.local_peer_id();
+        let mut peers = vec![];
+        for bucket in self.swarm.behaviour_mut().kademlia.kbuckets() {
+            for entry in bucket.iter() {
+                peers.push(*entry.node.key.preimage());
+            }
+        }
+        let routing_peers: Vec<_> = peers
+            .into_iter()
+            .map(|peer| (peer, self.swarm.is_connected(&peer)))
+            .collect();
+        closest_in_routing_table(our_id, xor_name, &routing_peers)
+    }
 }
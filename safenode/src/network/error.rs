@@ -14,7 +14,7 @@ use libp2p::{
     kad,
     request_response::{OutboundFailure, RequestId},
     swarm::DialError,
-    TransportError,
+    PeerId, TransportError,
 };
 use std::io;
 use thiserror::Error;
@@ -38,6 +38,9 @@ pub enum Error {
     #[error("I/O error: {0}")]
     Io(#[from] io::Error),
 
+    #[error("Failed to (de)serialise the peer cache: {0}")]
+    PeerCacheSerialisation(#[from] bincode::Error),
+
     #[error("Transport Error")]
     TransportError(#[from] TransportError<std::io::Error>),
 
@@ -64,4 +67,7 @@ pub enum Error {
 
     #[error("Could not get CLOSE_GROUP_SIZE number of peers.")]
     NotEnoughPeers,
+
+    #[error("No response from {0:?} within the request timeout.")]
+    ResponseTimeout(PeerId),
 }
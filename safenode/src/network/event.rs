@@ -62,6 +62,8 @@ impl From<mdns::Event> for NodeEvent {
 pub enum NetworkEvent {
     /// Incoming `Request` from a peer
     RequestReceived {
+        /// The peer which sent the request
+        peer: PeerId,
         /// Request
         req: Request,
         /// The channel to send the `Response` through
@@ -94,7 +96,7 @@ impl SwarmDriver {
                 } => {
                     trace!("Query task {id:?} returned with peers {closest_peers:?}, {stats:?} - {step:?}");
 
-                    let (sender, mut current_closest) =
+                    let (target, mut sender, mut current_closest) =
                         self.pending_get_closest_peers.remove(id).ok_or_else(|| {
                             trace!("Can't locate query task {id:?}, shall be completed already.");
                             Error::ReceivedKademliaEventDropped(event.clone())
@@ -108,23 +110,42 @@ impl SwarmDriver {
                         closest_peers.peers.clone().into_iter().collect();
                     current_closest.extend(new_peers);
                     if current_closest.len() >= usize::from(K_VALUE) || step.last {
-                        let our_id = *self.swarm.local_peer_id();
-                        sender
-                            .send((our_id, current_closest))
-                            .map_err(|_| Error::InternalMsgChannelDropped)?;
+                        if let Some(sender) = sender.take() {
+                            let our_id = *self.swarm.local_peer_id();
+                            // The caller may have stopped waiting, yet the lookup is still
+                            // tracked until its last step, for its peers to be cached.
+                            if sender.send((our_id, current_closest.clone())).is_err() {
+                                trace!("Caller of query task {id:?} no longer waits for its peers");
+                            }
+                        }
+                    }
+
+                    // Only the result of a completed lookup is known to hold the closest peers.
+                    if step.last {
+                        self.close_group_cache.insert(target, &current_closest);
                     } else {
                         let _ = self
                             .pending_get_closest_peers
-                            .insert(*id, (sender, current_closest));
+                            .insert(*id, (target, sender, current_closest));
                     }
                 }
-                KademliaEvent::RoutingUpdated { is_new_peer, .. } => {
+                KademliaEvent::RoutingUpdated {
+                    peer,
+                    is_new_peer,
+                    old_peer,
+                    ..
+                } => {
+                    if let Some(old_peer) = old_peer {
+                        self.close_group_cache.peer_removed(old_peer);
+                    }
                     if *is_new_peer {
+                        self.close_group_cache.peer_added(*peer);
+                        self.routing_updated = true;
                         self.event_sender.send(NetworkEvent::PeerAdded).await?;
                     }
                 }
                 KademliaEvent::InboundRequest { request } => {
-                    info!("got inbound request: {request:?}");
+                    trace!("got inbound request: {request:?}");
                 }
                 todo => {
                     error!("KademliaEvent has not been implemented: {todo:?}");
@@ -164,7 +185,15 @@ impl SwarmDriver {
                     }
                 }
             }
-            SwarmEvent::ConnectionClosed { .. } => {}
+            SwarmEvent::ConnectionClosed {
+                peer_id,
+                num_established,
+                ..
+            } => {
+                if num_established == 0 {
+                    self.close_group_cache.peer_removed(&peer_id);
+                }
+            }
             SwarmEvent::OutgoingConnectionError { peer_id, error, .. } => {
                 if let Some(peer_id) = peer_id {
                     if let Some(sender) = self.pending_dial.remove(&peer_id) {
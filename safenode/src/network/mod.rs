@@ -6,23 +6,35 @@
 // KIND, either express or implied. Please review the Licences for the specific language governing
 // permissions and limitations relating to use of the SAFE Network Software.
 
+mod close_group_cache;
 mod cmd;
 mod error;
 mod event;
 mod msg;
-
-use crate::protocol::messages::{Request, Response};
+mod peer_cache;
+mod single_flight;
+mod ttl_cache;
+
+use crate::{
+    log::{LogSampler, REQUEST_LOG_SAMPLING},
+    metrics::NetworkMetrics,
+    protocol::messages::{Request, Response},
+};
 
 pub use self::{error::Error, event::NetworkEvent};
 
-use self::{
-    cmd::SwarmCmd,
-    error::Result,
-    event::NodeBehaviour,
+pub(crate) use self::{
     msg::{MsgCodec, MsgProtocol},
+    single_flight::SingleFlight,
+    ttl_cache::TtlCache,
+};
+
+use self::{
+    close_group_cache::CloseGroupCache, cmd::SwarmCmd, error::Result, event::NodeBehaviour,
+    peer_cache::PeerCache,
 };
 
-use futures::StreamExt;
+use futures::{stream::FuturesUnordered, StreamExt};
 use libp2p::{
     core::muxing::StreamMuxerBox,
     identity,
@@ -30,7 +42,7 @@ use libp2p::{
     mdns,
     multiaddr::Protocol,
     request_response::{self, ProtocolSupport, RequestId, ResponseChannel},
-    swarm::{Swarm, SwarmBuilder},
+    swarm::{dial_opts::DialOpts, Swarm, SwarmBuilder},
     Multiaddr, PeerId, Transport,
 };
 use rand::Rng;
@@ -38,10 +50,15 @@ use std::{
     collections::{HashMap, HashSet},
     env, iter,
     net::SocketAddr,
+    path::Path,
     process::{self, Command, Stdio},
-    time::Duration,
+    time::{Duration, Instant},
+};
+use tokio::{
+    sync::{mpsc, oneshot},
+    task::JoinHandle,
+    time::interval,
 };
-use tokio::sync::{mpsc, oneshot};
 use tracing::warn;
 use xor_name::XorName;
 
@@ -50,14 +67,33 @@ use xor_name::XorName;
 /// an item in the network.
 pub(crate) const CLOSE_GROUP_SIZE: usize = 8;
 
+/// The time after which a request sent to a peer is given up on.
+const REQUEST_TIMEOUT: Duration = Duration::from_secs(10);
+/// The response time after which a peer is reported as slow.
+const SLOW_RESPONSE: Duration = Duration::from_secs(2);
+/// The capacity of the channels of cmds to, and of events from, the `SwarmDriver`.
+const CHANNEL_SIZE: usize = 100;
+/// The interval at which the routing table is refreshed, by one lookup, if peers were added to it.
+const ROUTING_REFRESH_INTERVAL: Duration = Duration::from_secs(10);
+/// The interval at which the peers of the routing table are stored, to be dialed on restart.
+const PEER_CACHE_STORE_INTERVAL: Duration = Duration::from_secs(60);
+
 /// Majority of a given group (i.e. > 1/2).
 #[inline]
 pub const fn close_group_majority() -> usize {
     CLOSE_GROUP_SIZE / 2 + 1
 }
 
-type PendingGetClosest =
-    HashMap<QueryId, (oneshot::Sender<(PeerId, HashSet<PeerId>)>, HashSet<PeerId>)>;
+// Pending lookups, with the sender to respond on (which is taken once responded),
+// and the peers found so far. A lookup is tracked until it completes, to cache its result.
+type PendingGetClosest = HashMap<
+    QueryId,
+    (
+        XorName,
+        Option<oneshot::Sender<(PeerId, HashSet<PeerId>)>>,
+        HashSet<PeerId>,
+    ),
+>;
 
 /// `SwarmDriver` is responsible for managing the swarm of peers, handling
 /// swarm events, processing commands, and maintaining the state of pending
@@ -68,7 +104,14 @@ pub struct SwarmDriver {
     event_sender: mpsc::Sender<NetworkEvent>,
     pending_dial: HashMap<PeerId, oneshot::Sender<Result<()>>>,
     pending_get_closest_peers: PendingGetClosest,
+    close_group_cache: CloseGroupCache,
     pending_requests: HashMap<RequestId, oneshot::Sender<Result<Response>>>,
+    metrics: NetworkMetrics,
+    peer_cache: Option<PeerCache>,
+    /// The write of the peer cache last spawned, which is awaited before the next one.
+    peer_cache_write: Option<JoinHandle<()>>,
+    /// Whether peers were added to the routing table since it was last refreshed.
+    routing_updated: bool,
 }
 
 impl SwarmDriver {
@@ -110,6 +153,35 @@ impl SwarmDriver {
         Ok((network, events_receiver, swarm_driver))
     }
 
+    /// Keeps the peers of the routing table in the root dir, storing them periodically
+    /// and once the driver stops, and dials the peers stored by a previous run right away.
+    ///
+    /// The peers are dialed all at once, along with a lookup to fill up the routing table,
+    /// for a restarted node to rejoin the network without waiting on mDNS discovery.
+    pub fn with_peer_cache(mut self, root_dir: &Path) -> Self {
+        let peer_cache = PeerCache::new(root_dir);
+        let peers = peer_cache.load();
+        info!("Dialing {} peers from the peer cache", peers.len());
+
+        for (peer_id, addrs) in peers {
+            for addr in &addrs {
+                let _routing_update = self
+                    .swarm
+                    .behaviour_mut()
+                    .kademlia
+                    .add_address(&peer_id, addr.clone());
+            }
+            let opts = DialOpts::peer_id(peer_id).addresses(addrs).build();
+            if let Err(err) = self.swarm.dial(opts) {
+                warn!("Failed to dial cached peer {peer_id:?}: {err}");
+            }
+            self.routing_updated = true;
+        }
+
+        self.peer_cache = Some(peer_cache);
+        self
+    }
+
     /// Same as `new` API but creates the network components in client mode
     pub fn new_client() -> Result<(Network, mpsc::Receiver<NetworkEvent>, SwarmDriver)> {
         // Create a Kademlia behaviour for client mode, i.e. set req/resp protocol
@@ -154,21 +226,28 @@ impl SwarmDriver {
 
         let swarm = SwarmBuilder::with_tokio_executor(transport, behaviour, peer_id).build();
 
-        let (swarm_cmd_sender, swarm_cmd_receiver) = mpsc::channel(100);
-        let (network_event_sender, network_event_receiver) = mpsc::channel(100);
+        let (swarm_cmd_sender, swarm_cmd_receiver) = mpsc::channel(CHANNEL_SIZE);
+        let (network_event_sender, network_event_receiver) = mpsc::channel(CHANNEL_SIZE);
+        let metrics = NetworkMetrics::default();
         let swarm_driver = Self {
             swarm,
             cmd_receiver: swarm_cmd_receiver,
             event_sender: network_event_sender,
             pending_dial: Default::default(),
             pending_get_closest_peers: Default::default(),
+            close_group_cache: Default::default(),
             pending_requests: Default::default(),
+            metrics: metrics.clone(),
+            peer_cache: None,
+            peer_cache_write: None,
+            routing_updated: false,
         };
 
         Ok((
             Network {
                 swarm_cmd_sender,
                 peer_id,
+                metrics,
             },
             network_event_receiver,
             swarm_driver,
@@ -182,7 +261,13 @@ impl SwarmDriver {
     /// The `tokio::select` macro is used to concurrently process swarm events
     /// and command receiver messages, ensuring efficient handling of multiple
     /// asynchronous tasks.
+    ///
+    /// Alongside, the routing table is refreshed by at most one lookup every
+    /// `ROUTING_REFRESH_INTERVAL`, and its peers stored every `PEER_CACHE_STORE_INTERVAL`,
+    /// if the driver has a peer cache.
     pub async fn run(mut self) {
+        let mut refresh = interval(ROUTING_REFRESH_INTERVAL);
+        let mut store_peers = interval(PEER_CACHE_STORE_INTERVAL);
         loop {
             tokio::select! {
                 some_event = self.swarm.next() => {
@@ -194,17 +279,85 @@ impl SwarmDriver {
                 },
                 some_cmd = self.cmd_receiver.recv() => match some_cmd {
                     Some(cmd) => {
+                        self.metrics.cmd_received();
                         if let Err(err) = self.handle_cmd(cmd) {
                             warn!("Error while handling cmd: {err}");
                         }
                     },
-                    None =>  return,
+                    None => {
+                        // The peers are stored one last time before returning, once written out.
+                        self.store_peer_cache();
+                        if let Some(write) = self.peer_cache_write.take() {
+                            let _ = write.await;
+                        }
+                        return;
+                    }
                 },
+                _ = refresh.tick() => self.refresh_routing_table(),
+                _ = store_peers.tick() => self.store_peer_cache(),
             }
+            self.metrics
+                .set_pending_events(CHANNEL_SIZE - self.event_sender.capacity());
         }
     }
 }
 
+impl SwarmDriver {
+    // Looks up a random target, which finds peers across the buckets of the routing table,
+    // though only if peers were added since the last refresh. This runs at a fixed interval,
+    // rather than once per peer added, for the many peers added as a node (re)joins not to
+    // each cost a lookup across the network.
+    fn refresh_routing_table(&mut self) {
+        if !std::mem::take(&mut self.routing_updated) {
+            return;
+        }
+        let target = XorName::random(&mut rand::thread_rng());
+        trace!("Refreshing the routing table with a lookup of {target:?}");
+        let query_id = self
+            .swarm
+            .behaviour_mut()
+            .kademlia
+            .get_closest_peers(target.0.to_vec());
+        let _ = self
+            .pending_get_closest_peers
+            .insert(query_id, (target, None, Default::default()));
+    }
+
+    // Stores the peers of the routing table, with their addresses, in the peer cache, if any.
+    // Nothing is stored while the routing table is empty, e.g. before the cached peers are
+    // dialed, for them not to be lost to a restart at that point.
+    //
+    // Only the peers are read here: they are written out by a task of their own, for the
+    // swarm not to wait on the disk. Each write follows the previous one, so that an older
+    // set of peers can't replace a newer one.
+    fn store_peer_cache(&mut self) {
+        if self.peer_cache.is_none() {
+            return;
+        }
+        let mut peers = vec![];
+        for bucket in self.swarm.behaviour_mut().kademlia.kbuckets() {
+            for entry in bucket.iter() {
+                let addrs: Vec<_> = entry.node.value.iter().cloned().collect();
+                peers.push((*entry.node.key.preimage(), addrs));
+            }
+        }
+        let peer_cache = match &self.peer_cache {
+            Some(peer_cache) if !peers.is_empty() => peer_cache.clone(),
+            _ => return,
+        };
+        let previous = self.peer_cache_write.take();
+        self.peer_cache_write = Some(tokio::spawn(async move {
+            if let Some(previous) = previous {
+                let _ = previous.await;
+            }
+            match peer_cache.store(&peers).await {
+                Ok(()) => trace!("Stored {} peers in the peer cache", peers.len()),
+                Err(err) => warn!("Failed to store the peer cache: {err}"),
+            }
+        }));
+    }
+}
+
 /// Restarts the whole program.
 /// It does this at random, one in X times called.
 ///
@@ -246,11 +399,16 @@ fn restart_at_random(peer_id: &PeerId) {
 /// API to interact with the underlying Swarm
 pub struct Network {
     pub(super) swarm_cmd_sender: mpsc::Sender<SwarmCmd>,
-    #[allow(dead_code)]
     pub(super) peer_id: PeerId,
+    metrics: NetworkMetrics,
 }
 
 impl Network {
+    /// Returns the metrics of the requests sent, and of the lookups made, through the network.
+    pub(crate) fn metrics(&self) -> &NetworkMetrics {
+        &self.metrics
+    }
+
     ///  Listen for incoming connections on the given address.
     pub async fn start_listening(&self, addr: Multiaddr) -> Result<()> {
         let (sender, receiver) = oneshot::channel();
@@ -286,10 +444,12 @@ impl Network {
     /// Returns the closest peers to the given `XorName`, sorted by their distance to the xor_name.
     /// If `client` is false, then include `self` among the `closest_peers`
     async fn get_closest_peers(&self, xor_name: XorName, client: bool) -> Result<Vec<PeerId>> {
+        let start = Instant::now();
         let (sender, receiver) = oneshot::channel();
         self.send_swarm_cmd(SwarmCmd::GetClosestPeers { xor_name, sender })
             .await?;
         let (our_id, k_bucket_peers) = receiver.await?;
+        self.metrics.record_closest_peers_lookup(start.elapsed());
 
         // Count self in if among the CLOSE_GROUP_SIZE closest and sort the result
         let mut closest_peers: Vec<_> = k_bucket_peers.into_iter().collect();
@@ -297,11 +457,7 @@ impl Network {
             closest_peers.push(our_id);
         }
         let target = KBucketKey::new(xor_name.0.to_vec());
-        closest_peers.sort_by(|a, b| {
-            let a = KBucketKey::new(a.to_bytes());
-            let b = KBucketKey::new(b.to_bytes());
-            target.distance(&a).cmp(&target.distance(&b))
-        });
+        closest_peers.sort_by_cached_key(|peer| target.distance(&KBucketKey::from(*peer)));
         let closest_peers: Vec<PeerId> = closest_peers
             .iter()
             .take(CLOSE_GROUP_SIZE)
@@ -321,6 +477,14 @@ impl Network {
         Ok(closest_peers)
     }
 
+    /// Returns all the peers in our routing table.
+    pub async fn routing_peers(&self) -> Result<Vec<PeerId>> {
+        let (sender, receiver) = oneshot::channel();
+        self.send_swarm_cmd(SwarmCmd::GetRoutingPeers { sender })
+            .await?;
+        Ok(receiver.await?)
+    }
+
     /// Send `Request` to the the given `PeerId`
     pub async fn send_request(&self, req: Request, peer: PeerId) -> Result<Response> {
         let (sender, receiver) = oneshot::channel();
@@ -329,6 +493,88 @@ impl Network {
         receiver.await?
     }
 
+    /// Sends the `Request` to the peers concurrently, and returns their responses as soon as
+    /// the ones received so far are `enough`, or once all peers have responded or timed out.
+    ///
+    /// The requests not responded to yet are left to complete in the background,
+    /// where peers that are slow to respond, or fail to, are reported.
+    pub async fn send_and_get_responses<F>(
+        &self,
+        peers: Vec<PeerId>,
+        req: &Request,
+        enough: F,
+    ) -> Vec<Result<Response>>
+    where
+        F: Fn(&[Result<Response>]) -> bool,
+    {
+        let start = Instant::now();
+        // Only logged, as the peers were found for it by the caller.
+        let dst = req.dst().ok();
+        let mut pending: FuturesUnordered<_> = peers
+            .into_iter()
+            .map(|peer| {
+                let network = self.clone();
+                let req = req.clone();
+                async move {
+                    let result = match tokio::time::timeout(
+                        REQUEST_TIMEOUT,
+                        network.send_request(req, peer),
+                    )
+                    .await
+                    {
+                        Ok(result) => result,
+                        Err(_elapsed) => Err(Error::ResponseTimeout(peer)),
+                    };
+                    let timed_out = matches!(result, Err(Error::ResponseTimeout(_)));
+                    network.metrics.record_response(start.elapsed(), timed_out);
+                    (peer, result)
+                }
+            })
+            .collect();
+
+        let mut responses = Vec::new();
+        while let Some((peer, res)) = pending.next().await {
+            let elapsed = start.elapsed();
+            static SAMPLER: LogSampler = LogSampler::new(REQUEST_LOG_SAMPLING);
+            if SAMPLER.sample() {
+                trace!(
+                    "Got response from {peer:?} in {elapsed:?} for the req: {req:?}, res: {res:?}"
+                );
+            }
+            if elapsed > SLOW_RESPONSE {
+                warn!("Peer {peer:?} was slow to respond to {dst:?}: {elapsed:?}");
+            }
+            responses.push(res);
+            if enough(&responses) {
+                break;
+            }
+        }
+
+        if !pending.is_empty() {
+            trace!(
+                "Got enough responses for {dst:?} in {:?}, leaving {} peers in the background",
+                start.elapsed(),
+                pending.len()
+            );
+            let _handle = tokio::spawn(async move {
+                while let Some((peer, res)) = pending.next().await {
+                    let elapsed = start.elapsed();
+                    match res {
+                        Ok(_) if elapsed <= SLOW_RESPONSE => {}
+                        Ok(_) => warn!("Peer {peer:?} was slow to respond to {dst:?}: {elapsed:?}"),
+                        Err(err) => {
+                            warn!(
+                                "Peer {peer:?} failed to respond to {dst:?} in {elapsed:?}: {err}"
+                            )
+                        }
+                    }
+                }
+            });
+        }
+
+        responses
+    }
+
     /// Send a `Response` through the channel opened by the requester.
     pub async fn send_response(
         &self,
@@ -342,7 +588,12 @@ impl Network {
     // Helper to send SwarmCmd
     async fn send_swarm_cmd(&self, cmd: SwarmCmd) -> Result<()> {
         let swarm_cmd_sender = self.swarm_cmd_sender.clone();
-        swarm_cmd_sender.send(cmd).await?;
+        // Counted before it's sent, for the driver never to receive it before it's counted.
+        self.metrics.cmd_sent();
+        if let Err(err) = swarm_cmd_sender.send(cmd).await {
+            self.metrics.cmd_received();
+            return Err(err.into());
+        }
         Ok(())
     }
 }
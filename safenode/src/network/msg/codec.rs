@@ -6,15 +6,28 @@
 // KIND, either express or implied. Please review the Licences for the specific language governing
 // permissions and limitations relating to use of the SAFE Network Software.
 
-use crate::protocol::messages::{Request, Response};
-use async_trait::async_trait;
-use futures::{AsyncRead, AsyncWrite, AsyncWriteExt};
-use libp2p::{
-    core::upgrade::{read_length_prefixed, write_length_prefixed},
-    request_response::{self, ProtocolName},
+use crate::protocol::{
+    chunk::Chunk,
+    error::Result as ProtocolResult,
+    messages::{
+        Cmd, QueryResponse, ReplicatedData, Request, Response, MAX_CHUNK_BATCH_SIZE,
+        MAX_REPLICATION_BATCH_SIZE,
+    },
 };
+use async_trait::async_trait;
+use bytes::{Bytes, BytesMut};
+use futures::{AsyncRead, AsyncReadExt, AsyncWrite, AsyncWriteExt};
+use libp2p::request_response::{self, ProtocolName};
+use self_encryption::MAX_CHUNK_SIZE;
 use serde::{de::DeserializeOwned, Serialize};
-use std::io;
+use std::io::{self, IoSlice};
+
+/// The max length of a payload. Self-encrypted chunks can be slightly
+/// larger than `MAX_CHUNK_SIZE`, because of compression and padding.
+const MAX_PAYLOAD_LEN: usize = 2 * MAX_CHUNK_SIZE;
+/// The length of the fixed part of a frame header:
+/// the kind, the metadata length, and the number of payloads.
+const HEADER_LEN: usize = 1 + 4 + 4;
 
 #[derive(Debug, Clone)]
 pub(crate) struct MsgProtocol();
@@ -23,7 +36,7 @@ pub(crate) struct MsgCodec();
 
 impl ProtocolName for MsgProtocol {
     fn protocol_name(&self) -> &[u8] {
-        "/safe/1".as_bytes()
+        "/safe/2".as_bytes()
     }
 }
 
@@ -76,29 +89,422 @@ impl request_response::Codec for MsgCodec {
     }
 }
 
-// Encodes the Response/Response using rmp_serde
-async fn encode_and_write<IO, T>(io: &mut IO, data: T) -> io::Result<()>
+/// The limits on a frame of a given kind of message,
+/// checked before anything is allocated for it.
+struct Limits {
+    max_meta_len: usize,
+    max_payloads: usize,
+}
+
+/// A message sent as a frame of the serialised message (the metadata), and of the
+/// raw bytes of the chunks it carries (the payloads), which are taken out of the
+/// metadata so they can be written and read without being copied.
+///
+/// A frame is laid out as:
+/// `kind: u8 | meta_len: u32 | payload count: u32 | payload lens: u32.. | meta | payloads..`
+trait Framed: Serialize + DeserializeOwned + Sized {
+    /// The kind of the message, which its limits are chosen by.
+    fn kind(&self) -> u8;
+    /// The limits of a kind of message, or `None` if it is not a known kind.
+    fn limits(kind: u8) -> Option<Limits>;
+    /// Takes the payloads out of the message, leaving empty placeholders in their place.
+    fn take_payloads(&mut self) -> Vec<Bytes>;
+    /// Puts the payloads back in the placeholders of the message.
+    fn put_payloads(&mut self, payloads: Vec<Bytes>) -> io::Result<()>;
+}
+
+impl Framed for Request {
+    fn kind(&self) -> u8 {
+        match self {
+            Request::Cmd(Cmd::StoreChunk(_)) => 0,
+            Request::Cmd(Cmd::Replicate(_)) => 4,
+            Request::Cmd(Cmd::StoreChunks(_)) => 5,
+            Request::Cmd(_) => 1,
+            Request::Query(_) => 2,
+            Request::Event(_) => 3,
+        }
+    }
+
+    fn limits(kind: u8) -> Option<Limits> {
+        let (max_meta_len, max_payloads) = match kind {
+            0 => (1024, 1),
+            1 => (4 * 1024 * 1024, 0),
+            2 => (64 * 1024, 0),
+            3 => (4 * 1024 * 1024, 0),
+            // Registers are replicated with their whole log.
+            4 => (16 * 1024 * 1024, MAX_REPLICATION_BATCH_SIZE),
+            5 => (MAX_CHUNK_BATCH_SIZE * 1024, MAX_CHUNK_BATCH_SIZE),
+            _ => return None,
+        };
+        Some(Limits {
+            max_meta_len,
+            max_payloads,
+        })
+    }
+
+    fn take_payloads(&mut self) -> Vec<Bytes> {
+        match self {
+            Request::Cmd(Cmd::StoreChunk(chunk)) => vec![take_chunk_value(chunk)],
+            Request::Cmd(Cmd::StoreChunks(chunks)) => {
+                chunks.iter_mut().map(take_chunk_value).collect()
+            }
+            Request::Cmd(Cmd::Replicate(batch)) => {
+                replicated_chunks(batch).map(take_chunk_value).collect()
+            }
+            _ => vec![],
+        }
+    }
+
+    fn put_payloads(&mut self, payloads: Vec<Bytes>) -> io::Result<()> {
+        match self {
+            Request::Cmd(Cmd::StoreChunk(chunk)) => put_chunk_value(chunk, payloads),
+            Request::Cmd(Cmd::StoreChunks(chunks)) => put_chunk_values(chunks.iter_mut(), payloads),
+            Request::Cmd(Cmd::Replicate(batch)) => {
+                put_chunk_values(replicated_chunks(batch), payloads)
+            }
+            _ => expect_no_payloads(payloads),
+        }
+    }
+}
+
+impl Framed for Response {
+    fn kind(&self) -> u8 {
+        match self {
+            Response::Query(QueryResponse::GetChunk(Ok(_))) => 0,
+            Response::Query(QueryResponse::GetChunks(_)) => 3,
+            Response::Query(_) => 1,
+            Response::Cmd(_) => 2,
+        }
+    }
+
+    fn limits(kind: u8) -> Option<Limits> {
+        let (max_meta_len, max_payloads) = match kind {
+            0 => (1024, 1),
+            // Registers are returned whole.
+            1 => (16 * 1024 * 1024, 0),
+            2 => (64 * 1024, 0),
+            3 => (64 * 1024, MAX_CHUNK_BATCH_SIZE),
+            _ => return None,
+        };
+        Some(Limits {
+            max_meta_len,
+            max_payloads,
+        })
+    }
+
+    fn take_payloads(&mut self) -> Vec<Bytes> {
+        match self {
+            Response::Query(QueryResponse::GetChunk(Ok(chunk))) => vec![take_chunk_value(chunk)],
+            Response::Query(QueryResponse::GetChunks(Ok(results))) => {
+                retrieved_chunks(results).map(take_chunk_value).collect()
+            }
+            _ => vec![],
+        }
+    }
+
+    fn put_payloads(&mut self, payloads: Vec<Bytes>) -> io::Result<()> {
+        match self {
+            Response::Query(QueryResponse::GetChunk(Ok(chunk))) => put_chunk_value(chunk, payloads),
+            Response::Query(QueryResponse::GetChunks(Ok(results))) => {
+                put_chunk_values(retrieved_chunks(results), payloads)
+            }
+            _ => expect_no_payloads(payloads),
+        }
+    }
+}
+
+// The chunks of a replicated batch, in the order their values are framed in.
+fn replicated_chunks(batch: &mut [ReplicatedData]) -> impl Iterator<Item = &mut Chunk> {
+    batch.iter_mut().filter_map(|data| match data {
+        ReplicatedData::Chunk(chunk) => Some(chunk),
+        _ => None,
+    })
+}
+
+// The chunks retrieved of a batch, in the order their values are framed in.
+fn retrieved_chunks(results: &mut [ProtocolResult<Chunk>]) -> impl Iterator<Item = &mut Chunk> {
+    results.iter_mut().filter_map(|result| result.as_mut().ok())
+}
+
+fn take_chunk_value(chunk: &mut Chunk) -> Bytes {
+    let value = chunk.value().clone();
+    *chunk = Chunk::new(Bytes::new());
+    value
+}
+
+fn put_chunk_value(chunk: &mut Chunk, payloads: Vec<Bytes>) -> io::Result<()> {
+    let mut payloads = payloads.into_iter();
+    match (payloads.next(), payloads.next()) {
+        (Some(value), None) if chunk.value().is_empty() => {
+            // The address is derived from the value again, so it is checked as well.
+            *chunk = Chunk::new(value);
+            Ok(())
+        }
+        _ => Err(invalid_data("Expected the value of a single chunk")),
+    }
+}
+
+// Puts a payload back in each of the chunks, in order.
+fn put_chunk_values<'a>(
+    chunks: impl Iterator<Item = &'a mut Chunk>,
+    payloads: Vec<Bytes>,
+) -> io::Result<()> {
+    let chunks: Vec<_> = chunks.collect();
+    if chunks.len() != payloads.len() {
+        return Err(invalid_data("Expected the value of each chunk"));
+    }
+    for (chunk, value) in chunks.into_iter().zip(payloads) {
+        put_chunk_value(chunk, vec![value])?;
+    }
+    Ok(())
+}
+
+fn expect_no_payloads(payloads: Vec<Bytes>) -> io::Result<()> {
+    if payloads.is_empty() {
+        Ok(())
+    } else {
+        Err(invalid_data("Unexpected payloads"))
+    }
+}
+
+// Encodes the Request/Response as a frame, writing the payloads straight from their `Bytes`.
+async fn encode_and_write<IO, T>(io: &mut IO, mut data: T) -> io::Result<()>
 where
     IO: AsyncWrite + Unpin,
-    T: Serialize,
+    T: Framed,
 {
-    let bytes = rmp_serde::to_vec(&data)
-        .map_err(|e| io::Error::new(io::ErrorKind::Other, e.to_string()))?;
-    write_length_prefixed(io, bytes).await?;
+    let kind = data.kind();
+    let payloads = data.take_payloads();
+    let meta = rmp_serde::to_vec(&data).map_err(|e| io::Error::new(io::ErrorKind::Other, e))?;
+
+    let mut header = Vec::with_capacity(HEADER_LEN + 4 * payloads.len());
+    header.push(kind);
+    header.extend_from_slice(&encode_len(meta.len())?);
+    header.extend_from_slice(&encode_len(payloads.len())?);
+    for payload in &payloads {
+        header.extend_from_slice(&encode_len(payload.len())?);
+    }
+
+    let mut bufs = vec![header.as_slice(), meta.as_slice()];
+    bufs.extend(payloads.iter().map(|payload| payload.as_ref()));
+    write_all_vectored(io, bufs).await?;
     io.close().await?;
     Ok(())
 }
 
-// Decodes the Response/Response using rmp_serde
+// Decodes the Request/Response from a frame, with each payload read into a buffer of its
+// own, so that a chunk taken out of the message only holds on to its own bytes. The lengths
+// are checked against the limits of the kind of message before anything is allocated.
 async fn read_and_decode<IO, T>(io: &mut IO) -> io::Result<T>
 where
     IO: AsyncRead + Unpin,
-    T: DeserializeOwned,
+    T: Framed,
+{
+    let mut header = [0; HEADER_LEN];
+    io.read_exact(&mut header).await?;
+    let kind = header[0];
+    let meta_len = decode_len(&header[1..5]);
+    let payload_count = decode_len(&header[5..9]);
+
+    let limits =
+        T::limits(kind).ok_or_else(|| invalid_data(format!("Unknown message kind {kind}")))?;
+    if meta_len > limits.max_meta_len || payload_count > limits.max_payloads {
+        return Err(invalid_data(format!(
+            "Message of kind {kind} exceeds its limits, with {meta_len} bytes and {payload_count} payloads"
+        )));
+    }
+
+    let mut payload_lens = vec![0; 4 * payload_count];
+    io.read_exact(&mut payload_lens).await?;
+    let payload_lens: Vec<usize> = payload_lens.chunks(4).map(decode_len).collect();
+    if let Some(len) = payload_lens.iter().find(|len| **len > MAX_PAYLOAD_LEN) {
+        return Err(invalid_data(format!("Payload of {len} bytes is too large")));
+    }
+
+    let mut meta = vec![0; meta_len];
+    io.read_exact(&mut meta).await?;
+    let mut data: T = rmp_serde::from_slice(&meta).map_err(invalid_data)?;
+    if data.kind() != kind {
+        return Err(invalid_data(format!("Message is not of kind {kind}")));
+    }
+
+    let mut payloads = Vec::with_capacity(payload_lens.len());
+    for len in payload_lens {
+        let mut payload = BytesMut::zeroed(len);
+        io.read_exact(&mut payload).await?;
+        payloads.push(payload.freeze());
+    }
+    data.put_payloads(payloads)?;
+
+    Ok(data)
+}
+
+// Writes all the buffers, as few of them at a time as the writer accepts.
+async fn write_all_vectored<IO>(io: &mut IO, mut bufs: Vec<&[u8]>) -> io::Result<()>
+where
+    IO: AsyncWrite + Unpin,
 {
-    let vec = read_length_prefixed(io, 500_000_000).await?; // update transfer maximum
-    if vec.is_empty() {
-        return Err(io::ErrorKind::UnexpectedEof.into());
+    bufs.retain(|buf| !buf.is_empty());
+    let mut first = 0;
+    while first < bufs.len() {
+        let slices: Vec<_> = bufs[first..].iter().map(|buf| IoSlice::new(buf)).collect();
+        let mut written = io.write_vectored(&slices).await?;
+        if written == 0 {
+            return Err(io::ErrorKind::WriteZero.into());
+        }
+        while first < bufs.len() && written >= bufs[first].len() {
+            written -= bufs[first].len();
+            first += 1;
+        }
+        if written > 0 {
+            bufs[first] = &bufs[first][written..];
+        }
+    }
+    Ok(())
+}
+
+fn encode_len(len: usize) -> io::Result<[u8; 4]> {
+    let len = u32::try_from(len).map_err(|_| invalid_data("Length does not fit in a frame"))?;
+    Ok(len.to_be_bytes())
+}
+
+fn decode_len(bytes: &[u8]) -> usize {
+    let mut len = [0; 4];
+    len.copy_from_slice(bytes);
+    u32::from_be_bytes(len) as usize
+}
+
+fn invalid_data<E>(error: E) -> io::Error
+where
+    E: Into<Box<dyn std::error::Error + Send + Sync>>,
+{
+    io::Error::new(io::ErrorKind::InvalidData, error)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::protocol::{address::ChunkAddress, error::Error as ProtocolError, messages::Query};
+
+    use eyre::Result;
+    use futures::io::Cursor;
+    use xor_name::XorName;
+
+    async fn round_trip<T: Framed>(data: T) -> io::Result<T> {
+        let mut io = Cursor::new(Vec::new());
+        encode_and_write(&mut io, data).await?;
+        io.set_position(0);
+        read_and_decode(&mut io).await
+    }
+
+    fn random_chunk() -> Chunk {
+        let value: Vec<u8> = (0..1024).map(|_| rand::random()).collect();
+        Chunk::new(Bytes::from(value))
+    }
+
+    #[tokio::test]
+    async fn chunks_are_framed_as_payloads() -> Result<()> {
+        let chunk = random_chunk();
+
+        let request = Request::Cmd(Cmd::StoreChunk(chunk.clone()));
+        assert_eq!(round_trip(request.clone()).await?, request);
+
+        let response = Response::Query(QueryResponse::GetChunk(Ok(chunk.clone())));
+        assert_eq!(round_trip(response.clone()).await?, response);
+
+        let replicate = Request::Cmd(Cmd::Replicate(vec![
+            ReplicatedData::Chunk(chunk),
+            ReplicatedData::Chunk(random_chunk()),
+        ]));
+        assert_eq!(round_trip(replicate.clone()).await?, replicate);
+
+        let store_chunks = Request::Cmd(Cmd::StoreChunks(vec![random_chunk(), random_chunk()]));
+        assert_eq!(round_trip(store_chunks.clone()).await?, store_chunks);
+
+        // Only the chunks retrieved carry a payload.
+        let get_chunks = Response::Query(QueryResponse::GetChunks(Ok(vec![
+            Ok(random_chunk()),
+            Err(ProtocolError::ChunkNotFound(*random_chunk().address())),
+            Ok(random_chunk()),
+        ])));
+        assert_eq!(round_trip(get_chunks.clone()).await?, get_chunks);
+
+        let invalid_batch = Response::Query(QueryResponse::GetChunks(Err(
+            ProtocolError::InvalidBatchSize { len: 0, max: 16 },
+        )));
+        assert_eq!(round_trip(invalid_batch.clone()).await?, invalid_batch);
+
+        let query = Request::Query(Query::GetChunk(ChunkAddress::new(XorName::random(
+            &mut rand::thread_rng(),
+        ))));
+        assert_eq!(round_trip(query.clone()).await?, query);
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn frames_over_the_limits_are_rejected() -> Result<()> {
+        // A query claiming a huge metadata length.
+        let mut frame = vec![2];
+        frame.extend_from_slice(&(500_000_000u32).to_be_bytes());
+        frame.extend_from_slice(&0u32.to_be_bytes());
+        let result = read_and_decode::<_, Request>(&mut Cursor::new(frame)).await;
+        assert_eq!(
+            result.map_err(|err| err.kind()).err(),
+            Some(io::ErrorKind::InvalidData)
+        );
+
+        // A chunk payload too large.
+        let mut frame = vec![0];
+        frame.extend_from_slice(&16u32.to_be_bytes());
+        frame.extend_from_slice(&1u32.to_be_bytes());
+        frame.extend_from_slice(&(MAX_PAYLOAD_LEN as u32 + 1).to_be_bytes());
+        let result = read_and_decode::<_, Request>(&mut Cursor::new(frame)).await;
+        assert_eq!(
+            result.map_err(|err| err.kind()).err(),
+            Some(io::ErrorKind::InvalidData)
+        );
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn frames_of_the_wrong_kind_are_rejected() -> Result<()> {
+        let mut io = Cursor::new(Vec::new());
+        let query = Request::Query(Query::GetChunk(ChunkAddress::new(XorName::random(
+            &mut rand::thread_rng(),
+        ))));
+        encode_and_write(&mut io, query).await?;
+
+        // Claim the kind of a cmd, whose limits the query is within.
+        let mut frame = io.into_inner();
+        frame[0] = 1;
+        let result = read_and_decode::<_, Request>(&mut Cursor::new(frame)).await;
+        assert_eq!(
+            result.map_err(|err| err.to_string()).err(),
+            Some("Message is not of kind 1".to_string())
+        );
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn frames_of_unknown_kinds_are_rejected() -> Result<()> {
+        let mut io = Cursor::new(Vec::new());
+        let query = Request::Query(Query::GetChunk(ChunkAddress::new(XorName::random(
+            &mut rand::thread_rng(),
+        ))));
+        encode_and_write(&mut io, query).await?;
+
+        let mut frame = io.into_inner();
+        frame[0] = 255;
+        let result = read_and_decode::<_, Request>(&mut Cursor::new(frame)).await;
+        assert_eq!(
+            result.map_err(|err| err.to_string()).err(),
+            Some("Unknown message kind 255".to_string())
+        );
+
+        Ok(())
     }
-    rmp_serde::from_slice::<T>(vec.as_slice())
-        .map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))
 }
@@ -9,11 +9,15 @@
 mod codec;
 pub(crate) use codec::{MsgCodec, MsgProtocol};
 
+use crate::log::{LogSampler, REQUEST_LOG_SAMPLING};
 use crate::network::{error::Error, NetworkEvent, SwarmDriver};
 use crate::protocol::messages::{Request, Response};
 use libp2p::request_response::{self, Message};
 use tracing::{trace, warn};
 
+static REQUEST_SAMPLER: LogSampler = LogSampler::new(REQUEST_LOG_SAMPLING);
+static RESPONSE_SAMPLER: LogSampler = LogSampler::new(REQUEST_LOG_SAMPLING);
+
 impl SwarmDriver {
     /// Forwards `Request` to the upper layers using `Sender<NetworkEvent>`. Sends `Response` to the peers
     pub async fn handle_msg(
@@ -21,16 +25,19 @@ impl SwarmDriver {
         event: request_response::Event<Request, Response>,
     ) -> Result<(), Error> {
         match event {
-            request_response::Event::Message { message, .. } => match message {
+            request_response::Event::Message { peer, message } => match message {
                 Message::Request {
                     request,
                     channel,
                     request_id,
                     ..
                 } => {
-                    trace!("Received request with id: {request_id:?}, req: {request:?}");
+                    if REQUEST_SAMPLER.sample() {
+                        trace!("Received request with id: {request_id:?}, req: {request:?}");
+                    }
                     self.event_sender
                         .send(NetworkEvent::RequestReceived {
+                            peer,
                             req: request,
                             channel,
                         })
@@ -40,22 +47,29 @@ impl SwarmDriver {
                     request_id,
                     response,
                 } => {
-                    trace!("Got response for id: {request_id:?}, res: {response:?} ");
-                    self.pending_requests
+                    if RESPONSE_SAMPLER.sample() {
+                        trace!("Got response for id: {request_id:?}, res: {response:?} ");
+                    }
+                    let sender = self
+                        .pending_requests
                         .remove(&request_id)
-                        .ok_or(Error::ReceivedResponseDropped(request_id))?
-                        .send(Ok(response))
-                        .map_err(|_| Error::InternalMsgChannelDropped)?;
+                        .ok_or(Error::ReceivedResponseDropped(request_id))?;
+                    // The requester may have stopped waiting, e.g. on a timeout.
+                    if sender.send(Ok(response)).is_err() {
+                        trace!("Requester of {request_id:?} no longer waits for the response");
+                    }
                 }
             },
             request_response::Event::OutboundFailure {
                 request_id, error, ..
             } => {
-                self.pending_requests
+                let sender = self
+                    .pending_requests
                     .remove(&request_id)
-                    .ok_or(Error::ReceivedResponseDropped(request_id))?
-                    .send(Err(error.into()))
-                    .map_err(|_| Error::InternalMsgChannelDropped)?;
+                    .ok_or(Error::ReceivedResponseDropped(request_id))?;
+                if sender.send(Err(error.into())).is_err() {
+                    trace!("Requester of {request_id:?} no longer waits for the failure");
+                }
             }
             request_response::Event::InboundFailure {
                 peer,
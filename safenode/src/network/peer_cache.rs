@@ -0,0 +1,128 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use super::error::Result;
+
+use crate::storage::write_atomically;
+
+use libp2p::{Multiaddr, PeerId};
+use std::path::{Path, PathBuf};
+
+// Filename for storing the peers of the routing table.
+const PEER_CACHE_FILENAME: &str = "peer_cache";
+
+// A peer as stored, its id and addresses in their binary form.
+type StoredPeer = (Vec<u8>, Vec<Vec<u8>>);
+
+/// The peers of the routing table of a node, along with their addresses,
+/// kept on disk for the node to dial them again once restarted, rather than
+/// to rediscover the network from scratch.
+#[derive(Clone)]
+pub(super) struct PeerCache {
+    path: PathBuf,
+}
+
+impl PeerCache {
+    /// Creates the cache of peers at the root dir.
+    pub(super) fn new(root_dir: &Path) -> Self {
+        Self {
+            path: root_dir.join(PEER_CACHE_FILENAME),
+        }
+    }
+
+    /// Returns the peers stored, or none if there are none or they can't be read.
+    ///
+    /// This is read once, before the node connects to any peer, so it reads the file in place.
+    pub(super) fn load(&self) -> Vec<(PeerId, Vec<Multiaddr>)> {
+        let bytes = match std::fs::read(&self.path) {
+            Ok(bytes) => bytes,
+            Err(err) => {
+                if err.kind() != std::io::ErrorKind::NotFound {
+                    warn!("Failed to read the peer cache at {:?}: {err}", self.path);
+                }
+                return vec![];
+            }
+        };
+        let stored: Vec<StoredPeer> = match bincode::deserialize(&bytes) {
+            Ok(stored) => stored,
+            Err(err) => {
+                warn!(
+                    "Failed to deserialise the peer cache at {:?}: {err}",
+                    self.path
+                );
+                return vec![];
+            }
+        };
+
+        // Peers or addresses which don't parse are skipped, the others are still of use.
+        stored
+            .into_iter()
+            .filter_map(|(peer, addrs)| {
+                let peer = PeerId::from_bytes(&peer).ok()?;
+                let addrs: Vec<_> = addrs
+                    .into_iter()
+                    .filter_map(|addr| Multiaddr::try_from(addr).ok())
+                    .collect();
+                (!addrs.is_empty()).then_some((peer, addrs))
+            })
+            .collect()
+    }
+
+    /// Replaces the peers stored with the given ones.
+    pub(super) async fn store(&self, peers: &[(PeerId, Vec<Multiaddr>)]) -> Result<()> {
+        let stored: Vec<StoredPeer> = peers
+            .iter()
+            .map(|(peer, addrs)| {
+                (
+                    peer.to_bytes(),
+                    addrs.iter().map(|addr| addr.to_vec()).collect(),
+                )
+            })
+            .collect();
+        let bytes = bincode::serialize(&stored)?;
+        // The previous cache is replaced at once, so that a failure never leaves a partial one.
+        write_atomically(&self.path, &bytes).await?;
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use eyre::Result;
+
+    #[tokio::test]
+    async fn stored_peers_are_loaded() -> Result<()> {
+        let root_dir = tempfile::tempdir()?;
+        let cache = PeerCache::new(root_dir.path());
+        assert!(cache.load().is_empty());
+
+        let peers: Vec<_> = (0..3)
+            .map(|i| {
+                let addr: Multiaddr = format!("/ip4/10.0.0.{i}/udp/12000/quic-v1").parse()?;
+                Ok((PeerId::random(), vec![addr]))
+            })
+            .collect::<Result<_>>()?;
+        cache.store(&peers).await?;
+        assert_eq!(PeerCache::new(root_dir.path()).load(), peers);
+
+        // A later store replaces the peers stored.
+        cache.store(&peers[..1]).await?;
+        assert_eq!(cache.load(), peers[..1]);
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn unreadable_cache_is_ignored() -> Result<()> {
+        let root_dir = tempfile::tempdir()?;
+        std::fs::write(root_dir.path().join(PEER_CACHE_FILENAME), b"not a cache")?;
+        assert!(PeerCache::new(root_dir.path()).load().is_empty());
+        Ok(())
+    }
+}
@@ -0,0 +1,214 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use std::{
+    collections::HashMap,
+    future::Future,
+    hash::Hash,
+    sync::{Arc, Mutex},
+};
+use tokio::sync::watch;
+
+type InFlight<K, T> = HashMap<K, watch::Receiver<Option<T>>>;
+
+/// Merges concurrent identical operations into one, fanning its result out to all callers.
+///
+/// The first caller for a key runs the operation, and any caller for the same key arriving
+/// while it's in flight waits for its result instead of running another one.
+/// Only successes are shared: if the operation fails, or its caller gives up on it, one of
+/// the waiting callers runs the operation in its place, with the others waiting on it in
+/// turn, so that an error is never served to a caller that didn't get it from its own attempt.
+/// An operation is only kept around while it is in flight, nothing is cached past it.
+pub(crate) struct SingleFlight<K, T> {
+    in_flight: Arc<Mutex<InFlight<K, T>>>,
+}
+
+// Runs the operation for a key, and takes the key out of the in flight operations once
+// it has completed, or once its caller gives up on it by dropping it.
+struct Leader<K: Eq + Hash, T> {
+    key: K,
+    in_flight: Arc<Mutex<InFlight<K, T>>>,
+    sender: watch::Sender<Option<T>>,
+    done: bool,
+}
+
+impl<K: Eq + Hash, T> Leader<K, T> {
+    // Callers arriving from now on run their own operation, after which
+    // those that were waiting get the value.
+    fn complete(mut self, value: T) {
+        self.finish();
+        let _ = self.sender.send(Some(value));
+    }
+
+    // Only removes the key once, as another operation may be in flight for it by the time
+    // this one is dropped.
+    fn finish(&mut self) {
+        if !self.done {
+            self.done = true;
+            let _ = self
+                .in_flight
+                .lock()
+                .unwrap_or_else(|err| err.into_inner())
+                .remove(&self.key);
+        }
+    }
+}
+
+impl<K: Eq + Hash, T> Drop for Leader<K, T> {
+    fn drop(&mut self) {
+        self.finish();
+    }
+}
+
+impl<K, T> Clone for SingleFlight<K, T> {
+    fn clone(&self) -> Self {
+        Self {
+            in_flight: self.in_flight.clone(),
+        }
+    }
+}
+
+impl<K, T> Default for SingleFlight<K, T> {
+    fn default() -> Self {
+        Self {
+            in_flight: Arc::new(Mutex::new(HashMap::new())),
+        }
+    }
+}
+
+impl<K: Eq + Hash + Clone, T: Clone> SingleFlight<K, T> {
+    /// Returns the result of the operation in flight for the key, or else runs `op` for it.
+    pub(crate) async fn run<F, Fut, E>(&self, key: K, op: F) -> Result<T, E>
+    where
+        F: FnOnce() -> Fut,
+        Fut: Future<Output = Result<T, E>>,
+    {
+        loop {
+            let leader = {
+                let mut in_flight = self.in_flight.lock().unwrap_or_else(|err| err.into_inner());
+                match in_flight.get(&key) {
+                    Some(receiver) => Err(receiver.clone()),
+                    None => {
+                        let (sender, receiver) = watch::channel(None);
+                        let _ = in_flight.insert(key.clone(), receiver);
+                        Ok(Leader {
+                            key: key.clone(),
+                            in_flight: self.in_flight.clone(),
+                            sender,
+                            done: false,
+                        })
+                    }
+                }
+            };
+
+            match leader {
+                Ok(leader) => {
+                    let result = op().await;
+                    if let Ok(value) = &result {
+                        leader.complete(value.clone());
+                    }
+                    return result;
+                }
+                Err(mut receiver) => {
+                    // An error here means the leader is gone without a result,
+                    // in which case the first of the waiting callers to get back
+                    // in line runs the operation in its place.
+                    if receiver.changed().await.is_ok() {
+                        let value = receiver.borrow().clone();
+                        if let Some(value) = value {
+                            return Ok(value);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use eyre::Result;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use tokio::{sync::Notify, time::Duration};
+
+    #[tokio::test]
+    async fn concurrent_calls_for_a_key_share_one_operation() -> Result<()> {
+        let flights = SingleFlight::<u8, u64>::default();
+        let runs = Arc::new(AtomicUsize::new(0));
+        let release = Arc::new(Notify::new());
+
+        let calls = (0..10).map(|_| {
+            let runs = runs.clone();
+            let release = release.clone();
+            flights.run(1, move || async move {
+                let _ = runs.fetch_add(1, Ordering::SeqCst);
+                release.notified().await;
+                Ok::<_, ()>(42)
+            })
+        });
+        let all = futures::future::join_all(calls);
+        tokio::pin!(all);
+
+        // Let all the calls register before the operation completes.
+        assert!(tokio::time::timeout(Duration::from_millis(50), &mut all)
+            .await
+            .is_err());
+        release.notify_one();
+
+        let results = all.await;
+        assert!(results.iter().all(|result| *result == Ok(42)));
+        assert_eq!(runs.load(Ordering::SeqCst), 1);
+        assert!(flights.in_flight.lock().expect("Lock").is_empty());
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn waiting_calls_share_a_new_operation_when_the_first_one_fails() -> Result<()> {
+        let flights = SingleFlight::<u8, u64>::default();
+        let runs = Arc::new(AtomicUsize::new(0));
+        let release = Arc::new(Notify::new());
+
+        let failing = {
+            let runs = runs.clone();
+            let release = release.clone();
+            flights.run(1, move || async move {
+                let _ = runs.fetch_add(1, Ordering::SeqCst);
+                release.notified().await;
+                Err(())
+            })
+        };
+        let waiting = (0..10).map(|_| {
+            let runs = runs.clone();
+            flights.run(1, move || async move {
+                let _ = runs.fetch_add(1, Ordering::SeqCst);
+                // Still in flight when the other waiting calls get back in line.
+                tokio::task::yield_now().await;
+                Ok(7)
+            })
+        });
+        let all = futures::future::join(failing, futures::future::join_all(waiting));
+        tokio::pin!(all);
+
+        assert!(tokio::time::timeout(Duration::from_millis(50), &mut all)
+            .await
+            .is_err());
+        release.notify_one();
+
+        // Only one of the waiting calls runs the operation again, for all of them.
+        let (failed, waited) = all.await;
+        assert_eq!(failed, Err(()));
+        assert!(waited.iter().all(|result| *result == Ok(7)));
+        assert_eq!(runs.load(Ordering::SeqCst), 2);
+        assert!(flights.in_flight.lock().expect("Lock").is_empty());
+
+        Ok(())
+    }
+}
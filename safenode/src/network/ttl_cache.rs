@@ -0,0 +1,95 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use clru::CLruCache;
+use std::{
+    hash::Hash,
+    num::NonZeroUsize,
+    sync::{Arc, Mutex, MutexGuard},
+    time::{Duration, Instant},
+};
+
+/// Caches the results of network queries for a short while, for them not to be queried
+/// again within that time. At most `capacity` values are held, the least recently used
+/// being evicted first, and a value is only returned within `ttl` of being inserted.
+///
+/// Clones share the same cache.
+pub(crate) struct TtlCache<K, V> {
+    cache: Arc<Mutex<CLruCache<K, (V, Instant)>>>,
+    ttl: Duration,
+}
+
+impl<K: Eq + Hash, V: Clone> TtlCache<K, V> {
+    /// Creates a cache of at most `capacity` values, each returned within `ttl` of being inserted.
+    pub(crate) fn new(capacity: usize, ttl: Duration) -> Self {
+        let capacity = NonZeroUsize::new(capacity.max(1)).expect("Failed to create a TTL cache");
+        Self {
+            cache: Arc::new(Mutex::new(CLruCache::new(capacity))),
+            ttl,
+        }
+    }
+
+    /// Returns the value of the key, if inserted within the TTL.
+    pub(crate) fn get(&self, key: &K) -> Option<V> {
+        let mut cache = self.lock();
+        match cache.get(key) {
+            Some((value, inserted)) if inserted.elapsed() < self.ttl => Some(value.clone()),
+            Some(_) => {
+                let _ = cache.pop(key);
+                None
+            }
+            None => None,
+        }
+    }
+
+    /// Caches the value of the key, replacing any previous one.
+    pub(crate) fn insert(&self, key: K, value: V) {
+        let _ = self.lock().put(key, (value, Instant::now()));
+    }
+
+    fn lock(&self) -> MutexGuard<'_, CLruCache<K, (V, Instant)>> {
+        self.cache.lock().unwrap_or_else(|err| err.into_inner())
+    }
+}
+
+impl<K, V> Clone for TtlCache<K, V> {
+    fn clone(&self) -> Self {
+        Self {
+            cache: self.cache.clone(),
+            ttl: self.ttl,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn values_expire_after_the_ttl() {
+        let cache = TtlCache::new(2, Duration::from_millis(50));
+        cache.insert(1u8, "one");
+        assert_eq!(cache.get(&1), Some("one"));
+
+        std::thread::sleep(Duration::from_millis(60));
+        assert_eq!(cache.get(&1), None);
+    }
+
+    #[test]
+    fn least_recently_used_values_are_evicted() {
+        let cache = TtlCache::new(2, Duration::from_secs(60));
+        cache.insert(1u8, "one");
+        cache.insert(2, "two");
+        assert_eq!(cache.get(&1), Some("one"));
+
+        cache.insert(3, "three");
+        assert_eq!(cache.get(&2), None);
+        assert_eq!(cache.get(&1), Some("one"));
+        assert_eq!(cache.get(&3), Some("three"));
+    }
+}
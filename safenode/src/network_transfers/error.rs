@@ -26,6 +26,10 @@ pub enum Error {
     InvalidFeeBlindedAmount,
     #[error("Too low amount for the transfer fee: {paid}. Min required: {required}.")]
     FeeTooLow { paid: Token, required: Token },
+    /// The queue of spends to commit is full, so no spend is accepted, whatever its fee,
+    /// until some of those queued are committed.
+    #[error("The spend queue is full, with {0} spends. Retry the spend later.")]
+    SpendQueueFull(usize),
     #[error(transparent)]
     Fees(#[from] fees::Error),
     #[error("Contacting close group of parent spends failed: {0}.")]
@@ -83,9 +87,21 @@ pub enum Error {
         "A parent tx of a requested spend could not be confirmed as valid. All parent signed spends of that tx {0:?}"
     )]
     InvalidSpendParent(BTreeSet<Box<SignedSpend>>),
+    /// The signatures of a spend and of its parents could not be checked.
+    #[error("Spend verification failed: {0}")]
+    SpendVerification(String),
+    /// A replicated spend was not the one returned by a majority of its close group.
+    #[error("Replicated spend could not be confirmed by its close group: {0:?}")]
+    ReplicatedSpendNotConfirmed(DbcAddress),
     /// Not enough space to store the value.
     #[error("Not enough space")]
     NotEnoughSpace,
+    /// Failed to read or write a spend on disk.
+    #[error("Spend storage I/O error: {0}")]
+    SpendStorageIo(String),
+    /// Failed to encode or decode a stored spend.
+    #[error("Spend serialisation error: {0}")]
+    SpendSerialisation(String),
 }
 
 impl From<DbcError> for Error {
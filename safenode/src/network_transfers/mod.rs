@@ -14,32 +14,61 @@ use crate::{
     node::NodeId,
     protocol::{
         address::DbcAddress,
-        fees::{FeeCiphers, RequiredFee, SpendPriority, SpendQ},
+        fees::{FeeCiphers, RequiredFee, SpendPriority, SpendQ, SpendQStats},
     },
-    storage::SpendStorage,
+    storage::{verify_batch, SpendStorage},
 };
 
-use sn_dbc::{DbcId, DbcTransaction, MainKey, SignedSpend, Token};
+use sn_dbc::{DbcId, DbcTransaction, Error as DbcError, MainKey, SignedSpend, Token};
 
-use std::collections::{BTreeMap, BTreeSet};
+use futures::future::join_all;
+use std::{
+    collections::{BTreeMap, BTreeSet},
+    path::Path,
+    sync::{Mutex, MutexGuard},
+    time::Duration,
+};
 
 const STARTING_FEE: u64 = 4000; // 0.000004 SNT
 
 pub(super) struct Transfers {
     node_id: NodeId,
     node_reward_key: MainKey,
-    spend_queue: SpendQ<SignedSpend>,
+    spend_queue: Mutex<SpendQ<SignedSpend>>,
+    max_queued_spends: usize,
     storage: SpendStorage,
+    metrics: Mutex<SpendQueueMetrics>,
+}
+
+/// Metrics of the spends queued to be committed to storage.
+#[derive(Clone, Copy, Debug, Default)]
+pub(crate) struct SpendQueueMetrics {
+    /// The number of spends queued.
+    pub(crate) queued: usize,
+    /// The number of spends committed so far.
+    pub(crate) committed: u64,
+    /// The longest a spend of the last batch committed was queued for.
+    pub(crate) last_batch_max_wait: Duration,
+    /// A moving average of how long spends are queued for.
+    pub(crate) avg_wait: Duration,
 }
 
 impl Transfers {
-    /// Create a new instance of `Transfers`.
-    pub(crate) fn new(node_id: NodeId, node_reward_key: MainKey) -> Self {
+    /// Create a new instance of `Transfers`, storing the spends under the root dir,
+    /// and queueing at most `max_queued_spends` of them to be committed.
+    pub(crate) async fn new(
+        node_id: NodeId,
+        node_reward_key: MainKey,
+        root_dir: &Path,
+        max_queued_spends: usize,
+    ) -> Self {
         Self {
             node_id,
             node_reward_key,
-            spend_queue: SpendQ::with_fee(STARTING_FEE),
-            storage: SpendStorage::new(),
+            spend_queue: Mutex::new(SpendQ::with_fee(STARTING_FEE)),
+            max_queued_spends,
+            storage: SpendStorage::new(root_dir).await,
+            metrics: Mutex::new(SpendQueueMetrics::default()),
         }
     }
 
@@ -48,49 +77,89 @@ impl Transfers {
         self.storage.get(address).await
     }
 
-    /// Get the required fee for the specified spend priority.
-    pub(crate) fn get_required_fee(
+    /// Get the pair of spends the dbc at the address was found double spent with, if any.
+    pub(crate) async fn get_double(
+        &self,
+        address: DbcAddress,
+    ) -> Result<Option<(SignedSpend, SignedSpend)>> {
+        self.storage.get_double(address).await
+    }
+
+    /// Returns the addresses of all the spends and double spends stored.
+    pub(crate) async fn addrs(&self) -> Result<Vec<DbcAddress>> {
+        self.storage.addrs().await
+    }
+
+    /// Get the required fee for spending each of the dbcs, for the specified spend priority.
+    pub(crate) fn get_required_fees(
         &self,
-        dbc_id: DbcId,
+        dbc_ids: Vec<DbcId>,
         priority: SpendPriority,
-    ) -> (NodeId, RequiredFee) {
+    ) -> (NodeId, Vec<RequiredFee>) {
         let amount = self.current_fee(priority);
 
-        debug!("Returned amount for priority {priority:?}: {amount}");
+        debug!(
+            "Returned amount for priority {priority:?}: {amount}, for {} dbcs",
+            dbc_ids.len()
+        );
 
-        let required_fee =
-            RequiredFee::new(Token::from_nano(amount), dbc_id, &self.node_reward_key);
+        let required_fees = dbc_ids
+            .into_iter()
+            .map(|dbc_id| RequiredFee::new(Token::from_nano(amount), dbc_id, &self.node_reward_key))
+            .collect();
 
-        (self.node_id, required_fee)
+        (self.node_id, required_fees)
     }
 
     /// Get the current fee for the specified spend priority.
     fn current_fee(&self, priority: SpendPriority) -> u64 {
-        let spend_q_snapshot = self.spend_queue.snapshot();
+        let spend_q_snapshot = self.spend_queue().snapshot();
         let spend_q_stats = spend_q_snapshot.stats();
         spend_q_stats.map_to_fee(priority)
     }
 
     /// Tries to add a double spend that was detected by the network.
+    ///
+    /// Both spends are verified to be signed by the owner of the dbc, for a dbc to be
+    /// marked as unspendable only on the proof of its owner having spent it twice.
     pub(crate) async fn try_add_double(
-        &mut self,
+        &self,
         a_spend: &SignedSpend,
         b_spend: &SignedSpend,
     ) -> Result<()> {
+        verify_spend(a_spend)?;
+        verify_spend(b_spend)?;
         self.storage.try_add_double(a_spend, b_spend).await
     }
 
+    /// Tries to add a spend replicated by another node, once the caller has confirmed it is
+    /// the spend held by a majority of its close group, which validated it in full.
+    ///
+    /// Its signature is verified again, but neither its fee nor its parents are: the fee was
+    /// paid to the close group the spend was sent to, and the parents were checked by it.
+    /// It is stored right away, rather than queued, as it is no new spend to the network.
+    pub(crate) async fn try_add_replicated(&self, signed_spend: &SignedSpend) -> Result<()> {
+        verify_spend(signed_spend)?;
+        self.storage.try_add(signed_spend).await
+    }
+
     /// Tries to add a new spend to the queue.
     ///
     /// All the provided data will be validated, and
-    /// if it is valid, the spend will be pushed onto the queue.
+    /// if it is valid, the spend will be pushed onto the queue,
+    /// to be committed to storage by `commit_queued`.
+    /// Spends of unrelated dbcs are validated in parallel.
+    /// Spends are refused while the queue is full.
     pub(crate) async fn try_add(
-        &mut self,
+        &self,
         signed_spend: Box<SignedSpend>,
         source_tx: Box<DbcTransaction>,
         fee_ciphers: BTreeMap<NodeId, FeeCiphers>,
         parent_spends: BTreeSet<SignedSpend>,
     ) -> Result<()> {
+        // A spend which can't be queued isn't validated at all.
+        self.ensure_queue_has_room(&self.spend_queue())?;
+
         // 1. Validate the tx hash.
         // Ensure that the provided src tx is the same as the
         // one we have the hash of in the signed spend.
@@ -107,29 +176,88 @@ impl Transfers {
         // 2. Try extract the fee paid for this spend, and validate it.
         let paid_fee = self.validate_fee(source_tx.as_ref(), fee_ciphers)?;
 
-        // 3. Validate the spend itself.
+        // 3. Verify the signatures of the spend and of its parents.
+        verify_spends(signed_spend.as_ref(), &parent_spends).await?;
+
+        // 4. Validate the spend itself.
         self.storage.validate(signed_spend.as_ref()).await?;
 
-        // 4. Validate the parents of the spend.
+        // 5. Validate the parents of the spend.
         // This also ensures that all parent's dst tx's are the same as the src tx of this spend.
         validate_parent_spends(signed_spend.as_ref(), source_tx.as_ref(), parent_spends)?;
 
         // This spend is valid and goes into the queue.
-        self.spend_queue.push(*signed_spend, paid_fee.as_nano());
-
-        // If the rate limit has elapsed..
-        if self.spend_queue.elapsed() {
-            // .. we process one from the queue.
-            // NB: This works for now. We can look at
-            // a timeout backstop in coming iterations.
-            if let Some((signed_spend, _)) = self.spend_queue.pop() {
-                return self.storage.try_add(&signed_spend).await;
-            }
-        }
+        self.queue(*signed_spend, paid_fee)
+    }
+
+    // The queue may have filled up while the spend was validated, so it is checked again
+    // under the same lock as the spend is pushed.
+    fn queue(&self, signed_spend: SignedSpend, paid_fee: Token) -> Result<()> {
+        let mut spend_queue = self.spend_queue();
+        self.ensure_queue_has_room(&spend_queue)?;
+        spend_queue.push(signed_spend, paid_fee.as_nano());
+        Ok(())
+    }
 
+    fn ensure_queue_has_room(&self, spend_queue: &SpendQ<SignedSpend>) -> Result<()> {
+        if spend_queue.len() >= self.max_queued_spends {
+            return Err(Error::SpendQueueFull(spend_queue.len()));
+        }
         Ok(())
     }
 
+    /// Commits up to `max` of the queued spends to storage, the highest fees first.
+    /// The spends of the batch are committed concurrently, only those of the same shard
+    /// of the storage waiting on each other.
+    /// Returns the results of the commits, which is where double spend attempts are detected.
+    pub(crate) async fn commit_queued(&self, max: usize) -> Vec<Result<()>> {
+        let batch = self.spend_queue().pop_batch(max);
+        if batch.is_empty() {
+            return vec![];
+        }
+
+        let waits: Vec<_> = batch.iter().map(|(_, _, waited)| *waited).collect();
+        let commits = batch
+            .iter()
+            .map(|(signed_spend, _, _)| self.storage.try_add(signed_spend));
+        let results = join_all(commits).await;
+
+        let mut metrics = self.metrics();
+        for waited in &waits {
+            metrics.avg_wait = (metrics.avg_wait * 7 + *waited) / 8;
+        }
+        metrics.last_batch_max_wait = waits.into_iter().max().unwrap_or_default();
+        metrics.committed += results.iter().filter(|result| result.is_ok()).count() as u64;
+
+        results
+    }
+
+    /// Returns the metrics of the spends queued to be committed.
+    pub(crate) fn queue_metrics(&self) -> SpendQueueMetrics {
+        SpendQueueMetrics {
+            queued: self.spend_queue().len(),
+            ..*self.metrics()
+        }
+    }
+
+    /// Returns the stats of the fees of the queued spends.
+    pub(crate) fn queue_stats(&self) -> SpendQStats {
+        self.spend_queue().snapshot().stats()
+    }
+
+    // The queue is only locked for as long as it takes to read or update it.
+    fn spend_queue(&self) -> MutexGuard<'_, SpendQ<SignedSpend>> {
+        self.spend_queue
+            .lock()
+            .unwrap_or_else(|err| err.into_inner())
+    }
+
+    // Like the queue, the metrics are only locked for as long as it takes to update them,
+    // so that spends are committed under a shared lock of `Transfers`.
+    fn metrics(&self) -> MutexGuard<'_, SpendQueueMetrics> {
+        self.metrics.lock().unwrap_or_else(|err| err.into_inner())
+    }
+
     fn validate_fee(
         &self,
         tx: &DbcTransaction,
@@ -137,7 +265,7 @@ impl Transfers {
     ) -> Result<Token> {
         let fee_paid = decipher_fee(&self.node_reward_key, tx, self.node_id, fee_ciphers)?;
 
-        let spend_q_snapshot = self.spend_queue.snapshot();
+        let spend_q_snapshot = self.spend_queue().snapshot();
         let spend_q_stats = spend_q_snapshot.stats();
 
         let (valid, lowest) = spend_q_stats.validate_fee(fee_paid.as_nano());
@@ -153,6 +281,39 @@ impl Transfers {
     }
 }
 
+/// Verifies the signatures of the spend and of its parents, all in one batch.
+async fn verify_spends(
+    signed_spend: &SignedSpend,
+    parent_spends: &BTreeSet<SignedSpend>,
+) -> Result<()> {
+    let spends = std::iter::once(signed_spend.clone())
+        .chain(parent_spends.iter().cloned())
+        .collect();
+    let mut results = verify_batch(spends, verify_spend)
+        .await
+        .map_err(|error| Error::SpendVerification(error.to_string()))?
+        .into_iter();
+
+    if let Some((_, Err(error))) = results.next() {
+        return Err(error.into());
+    }
+    if results.any(|(_, result)| result.is_err()) {
+        return Err(Error::InvalidSpendParent(
+            parent_spends.iter().cloned().map(Box::new).collect(),
+        ));
+    }
+
+    Ok(())
+}
+
+// This hash input is pointless, since it will compare with
+// the same hash in the verify fn.
+// It does however verify that the derived key corresponding to
+// the dbc id signed this spend.
+fn verify_spend(signed_spend: &SignedSpend) -> std::result::Result<(), DbcError> {
+    signed_spend.verify(signed_spend.dst_tx_hash())
+}
+
 /// The src_tx is the tx where the dbc to spend, was created.
 /// The signed_spend.dbc_id() shall exist among its outputs.
 fn validate_parent_spends(
@@ -220,3 +381,62 @@ fn decipher_fee(
     // also is what we expect the amount to be (done in the calling function).
     Ok(paid)
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::protocol::{dbc_genesis::create_genesis_dbc, transfers::create_offline_transfer};
+
+    use eyre::Result;
+
+    // Returns `count` different spends of the same dbc, each sending to a new recipient.
+    fn spends(count: usize) -> Result<Vec<SignedSpend>> {
+        let key = MainKey::random();
+        let genesis = create_genesis_dbc(&key).expect("Genesis creation to succeed.");
+        let derived_key = genesis.derived_key(&key)?;
+
+        (0..count)
+            .map(|_| -> Result<SignedSpend> {
+                let recipient = MainKey::random().random_dbc_id_src(&mut rand::thread_rng());
+                let transfer = create_offline_transfer(
+                    vec![(genesis.clone(), derived_key.clone())],
+                    vec![(Token::from_nano(100), recipient)],
+                    key.public_address(),
+                )?;
+                Ok(transfer.created_dbcs[0]
+                    .dbc
+                    .signed_spends
+                    .iter()
+                    .next()
+                    .cloned()
+                    .expect("The transfer to spend the genesis dbc"))
+            })
+            .collect()
+    }
+
+    #[tokio::test]
+    async fn spends_are_refused_once_the_queue_is_full() -> Result<()> {
+        let root_dir = tempfile::tempdir()?;
+        let transfers =
+            Transfers::new(NodeId::default(), MainKey::random(), root_dir.path(), 2).await;
+        let mut spends = spends(3)?.into_iter();
+        let fee = Token::from_nano(STARTING_FEE);
+
+        for spend in spends.by_ref().take(2) {
+            transfers.queue(spend, fee)?;
+        }
+        let spend = spends.next().expect("Three spends");
+        assert_eq!(
+            transfers.queue(spend.clone(), fee),
+            Err(Error::SpendQueueFull(2))
+        );
+
+        // Once a spend is committed, there is room for another one.
+        let _ = transfers.commit_queued(1).await;
+        transfers.queue(spend, fee)?;
+        assert_eq!(transfers.queue_metrics().queued, 2);
+
+        Ok(())
+    }
+}
@@ -9,11 +9,16 @@
 use super::{
     error::{Error, Result},
     event::NodeEventsChannel,
-    Node, NodeEvent,
+    Node, NodeConfig, NodeEvent,
 };
 
 use crate::{
-    network::{close_group_majority, NetworkEvent, SwarmDriver},
+    log::{LogSampler, REQUEST_LOG_SAMPLING},
+    metrics::{self, NodeMetrics},
+    network::{
+        close_group_majority, Error as NetworkError, NetworkEvent, SingleFlight, SwarmDriver,
+        TtlCache,
+    },
     network_transfers::{Error as TransferError, Transfers},
     protocol::{
         address::{dbc_address, DbcAddress},
@@ -24,16 +29,38 @@ use crate::{
         },
         register::User,
     },
-    storage::{ChunkStorage, RegisterStorage},
+    storage::{AddressLocks, ChunkStorage, RegisterStorage},
 };
 
 use sn_dbc::{DbcTransaction, MainKey, SignedSpend};
 
-use futures::future::select_all;
+use futures::{
+    future::join_all,
+    stream::{self, StreamExt},
+};
 use libp2p::{request_response::ResponseChannel, PeerId};
-use std::{collections::BTreeSet, net::SocketAddr, time::Duration};
-use tokio::task::spawn;
-use xor_name::XorName;
+use std::{
+    collections::{BTreeMap, BTreeSet},
+    net::SocketAddr,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc,
+    },
+    time::{Duration, Instant},
+};
+use tokio::{
+    sync::{mpsc, Notify, RwLock, Semaphore},
+    task::spawn,
+    time::{interval, MissedTickBehavior},
+};
+
+/// The max number of parent spends of a spend fetched at a time.
+const MAX_CONCURRENT_PARENT_FETCHES: usize = 8;
+/// The max number of parent spends cached.
+const PARENT_SPENDS_CACHE_SIZE: usize = 1024;
+/// How long a parent spend a majority of its close group agreed on is served from the cache,
+/// so that the spends of the sibling outputs of a transaction don't fetch it again.
+const PARENT_SPEND_TTL: Duration = Duration::from_secs(30);
 
 impl Node {
     /// Asynchronously runs a new node instance, setting up the swarm driver,
@@ -41,6 +68,9 @@ impl Node {
     /// created node and a `NodeEventsChannel` for listening to node-related
     /// events.
     ///
+    /// Requests are handled concurrently, bounded by the limits in the
+    /// provided `NodeConfig`.
+    ///
     /// # Returns
     ///
     /// A tuple containing a `Node` instance and a `NodeEventsChannel`.
@@ -48,75 +78,207 @@ impl Node {
     /// # Errors
     ///
     /// Returns an error if there is a problem initializing the `SwarmDriver`.
-    pub async fn run(addr: SocketAddr) -> Result<NodeEventsChannel> {
-        let (network, mut network_event_receiver, swarm_driver) = SwarmDriver::new(addr)?;
+    pub async fn run(addr: SocketAddr, config: NodeConfig) -> Result<NodeEventsChannel> {
+        let (network, network_event_receiver, swarm_driver) = SwarmDriver::new(addr)?;
+        let swarm_driver = swarm_driver.with_peer_cache(&config.root_dir);
         let node_events_channel = NodeEventsChannel::default();
         let node_id = super::to_node_id(network.peer_id);
 
-        let mut node = Self {
+        let node = Self {
             network,
-            chunks: ChunkStorage::new(),
-            registers: RegisterStorage::new(),
-            transfers: Transfers::new(node_id, MainKey::random()),
+            chunks: ChunkStorage::new(
+                &config.root_dir,
+                config.chunk_cache_size,
+                config.chunk_store_size,
+            )
+            .await,
+            registers: RegisterStorage::new(
+                &config.root_dir,
+                config.register_cache_size,
+                config.register_store_size,
+            )
+            .await,
+            transfers: Arc::new(RwLock::new(
+                Transfers::new(
+                    node_id,
+                    MainKey::random(),
+                    &config.root_dir,
+                    config.max_queued_spends,
+                )
+                .await,
+            )),
+            spend_locks: AddressLocks::default(),
+            parent_spends: TtlCache::new(PARENT_SPENDS_CACHE_SIZE, PARENT_SPEND_TTL),
+            spend_fetches: SingleFlight::default(),
+            metrics: NodeMetrics::default(),
             events_channel: node_events_channel.clone(),
+            routing_changes: Arc::new(Notify::new()),
         };
 
-        let _handle = spawn(swarm_driver.run());
-        let _handle = spawn(async move {
-            loop {
-                let event = match network_event_receiver.recv().await {
-                    Some(event) => event,
-                    None => {
-                        error!("The `NetworkEvent` channel has been closed");
-                        continue;
-                    }
-                };
-                if let Err(err) = node.handle_network_event(event).await {
-                    warn!("Error handling network event: {err}");
+        if let Some(metrics_addr) = config.metrics_addr {
+            let mut registry = metrics::registry();
+            node.metrics.register(&mut registry);
+            node.network.metrics().register(&mut registry);
+            node.chunks
+                .cache_metrics()
+                .register(&mut registry, "chunks");
+            node.registers
+                .cache_metrics()
+                .register(&mut registry, "registers");
+            let _handle = spawn(async move {
+                if let Err(err) = metrics::serve(metrics_addr, registry).await {
+                    error!("Failed to serve metrics at {metrics_addr}: {err}");
                 }
-            }
-        });
+            });
+        }
+
+        let _handle = spawn(swarm_driver.run());
+        let _handle = spawn(node.clone().drain_spend_queue(config.clone()));
+        let _handle = spawn(node.clone().replicate_on_churn());
+        let _handle = spawn(node.handle_network_events(network_event_receiver, config));
 
         Ok(node_events_channel)
     }
 
-    async fn handle_network_event(&mut self, event: NetworkEvent) -> Result<()> {
-        match event {
-            NetworkEvent::RequestReceived { req, channel } => {
-                self.handle_request(req, channel).await?
+    // Reads the network events off the channel, without waiting for the
+    // handling of any previous request to finish.
+    // At most `config.max_concurrent_requests` requests are handled at the same time,
+    // and at most `config.max_queued_requests` wait for their turn. Any request received
+    // beyond that is dropped, which the requester will see as a failed request.
+    async fn handle_network_events(
+        self,
+        mut network_event_receiver: mpsc::Receiver<NetworkEvent>,
+        config: NodeConfig,
+    ) {
+        let permits = Arc::new(Semaphore::new(config.max_concurrent_requests));
+        let queued = Arc::new(AtomicUsize::new(0));
+
+        loop {
+            let event = match network_event_receiver.recv().await {
+                Some(event) => event,
+                None => {
+                    error!("The `NetworkEvent` channel has been closed");
+                    return;
+                }
+            };
+
+            match event {
+                NetworkEvent::RequestReceived { peer, req, channel } => {
+                    let permit = match permits.clone().try_acquire_owned() {
+                        Ok(permit) => Some(permit),
+                        Err(_) if queued.load(Ordering::Relaxed) < config.max_queued_requests => {
+                            let _ = queued.fetch_add(1, Ordering::Relaxed);
+                            None
+                        }
+                        Err(_) => {
+                            warn!(
+                                "Request queue is full, dropping {} request from {peer:?}",
+                                request_kind(&req)
+                            );
+                            continue;
+                        }
+                    };
+
+                    let node = self.clone();
+                    let permits = permits.clone();
+                    let queued = queued.clone();
+                    let _handle = spawn(async move {
+                        let _permit = match permit {
+                            Some(permit) => permit,
+                            None => {
+                                let permit = permits.acquire_owned().await;
+                                let _ = queued.fetch_sub(1, Ordering::Relaxed);
+                                match permit {
+                                    Ok(permit) => permit,
+                                    Err(_) => return, // The semaphore is never closed.
+                                }
+                            }
+                        };
+                        let kind = request_kind(&req);
+                        let start = Instant::now();
+                        if let Err(err) = node.handle_request(peer, req, channel).await {
+                            warn!("Error handling request: {err}");
+                        }
+                        node.metrics.record_request(kind, start.elapsed());
+                    });
+                }
+                NetworkEvent::PeerAdded => self.handle_peer_added(),
             }
-            NetworkEvent::PeerAdded => {
-                self.events_channel.broadcast(NodeEvent::ConnectedToNetwork);
-                let target = {
-                    let mut rng = rand::thread_rng();
-                    XorName::random(&mut rng)
-                };
+        }
+    }
 
-                let network = self.network.clone();
-                let _handle = spawn(async move {
-                    trace!("Getting closest peers for target {target:?}");
-                    let result = network.node_get_closest_peers(target).await;
-                    trace!("For target {target:?}, get closest peers {result:?}");
-                });
+    // Commits the queued spends to storage at `config.spend_commit_rate`, in batches of at most
+    // `config.spend_commit_batch_size`, spread out evenly. This keeps the committed throughput
+    // independent from how the spends arrive, and commits spends also when no more arrive.
+    async fn drain_spend_queue(self, config: NodeConfig) {
+        let batch_size = config.spend_commit_batch_size.max(1);
+        let rate = config.spend_commit_rate.max(1);
+        let mut ticks = interval(Duration::from_secs_f64(batch_size as f64 / rate as f64));
+        ticks.set_missed_tick_behavior(MissedTickBehavior::Delay);
+
+        loop {
+            let _ = ticks.tick().await;
+
+            let (results, metrics) = {
+                let transfers = self.transfers.read().await;
+                let results = transfers.commit_queued(batch_size).await;
+                let metrics = transfers.queue_metrics();
+                self.metrics
+                    .record_spend_queue(&metrics, &transfers.queue_stats());
+                (results, metrics)
+            };
+            if results.is_empty() {
+                continue;
+            }
+            debug!("Committed {} queued spends: {metrics:?}", results.len());
+
+            for result in results {
+                match result {
+                    Ok(()) => {}
+                    Err(TransferError::DoubleSpendAttempt { new, existing }) => {
+                        self.broadcast_double_spend(new, existing).await;
+                    }
+                    Err(err) => warn!("Failed to commit queued spend: {err:?}"),
+                }
             }
         }
+    }
 
-        Ok(())
+    // The routing table is refreshed by the `SwarmDriver` itself, at a limited rate.
+    // The data held is replicated to the peer, if it is now in the close group of any of it.
+    fn handle_peer_added(&self) {
+        self.events_channel.broadcast(NodeEvent::ConnectedToNetwork);
+        self.routing_changes.notify_one();
     }
 
     async fn handle_request(
-        &mut self,
+        &self,
+        peer: PeerId,
         request: Request,
         response_channel: ResponseChannel<Response>,
     ) -> Result<()> {
-        trace!("Handling request: {request:?}");
+        static SAMPLER: LogSampler = LogSampler::new(REQUEST_LOG_SAMPLING);
+        if SAMPLER.sample() {
+            trace!("Handling request: {request:?}");
+        }
+        // Batches are checked before any of their items is handled, so that a peer
+        // can't have more items read or stored than fit in a response. The peer is
+        // told of an invalid batch, instead of being left to time out waiting.
+        if let Err(error) = request.dst() {
+            if let Some(response) = invalid_batch_response(&request, error.clone()) {
+                self.send_response(response, response_channel).await;
+            }
+            return Err(error.into());
+        }
         let response = match request {
-            Request::Cmd(cmd) => Response::Cmd(self.handle_cmd(cmd).await),
+            Request::Cmd(cmd) => Response::Cmd(self.handle_cmd(peer, cmd).await),
             Request::Query(query) => Response::Query(self.handle_query(query).await),
             Request::Event(event) => {
                 match event {
                     Event::DoubleSpendAttempted(a_spend, b_spend) => {
                         self.transfers
+                            .read()
+                            .await
                             .try_add_double(a_spend.as_ref(), b_spend.as_ref())
                             .await
                             .map_err(ProtocolError::Transfers)?;
@@ -131,25 +293,42 @@ impl Node {
         Ok(())
     }
 
-    async fn handle_query(&mut self, query: Query) -> QueryResponse {
+    async fn handle_query(&self, query: Query) -> QueryResponse {
         match query {
             Query::Register(query) => self.registers.read(&query, User::Anyone).await,
             Query::GetChunk(address) => {
                 let resp = self.chunks.get(&address).await;
                 QueryResponse::GetChunk(resp)
             }
+            Query::GetChunks(addresses) => {
+                let reads = addresses.iter().map(|address| self.chunks.get(address));
+                QueryResponse::GetChunks(Ok(join_all(reads).await))
+            }
+            Query::HasChunks(addresses) => {
+                let mut held = Vec::with_capacity(addresses.len());
+                for address in &addresses {
+                    held.push(self.chunks.contains(address).await);
+                }
+                QueryResponse::HasChunks(Ok(held))
+            }
             Query::Spend(query) => {
                 match query {
-                    SpendQuery::GetFees { dbc_id, priority } => {
-                        // The client is asking for the fee to spend a specific dbc, and including the id of that dbc.
-                        // The required fee content is encrypted to that dbc id, and so only the holder of the dbc secret
+                    SpendQuery::GetFees { dbc_ids, priority } => {
+                        // The client is asking for the fees to spend specific dbcs, and including the ids of those dbcs.
+                        // Each required fee content is encrypted to its dbc id, and so only the holder of the dbc secret
                         // key can unlock the contents.
-                        let required_fee = self.transfers.get_required_fee(dbc_id, priority);
-                        QueryResponse::GetFees(Ok(required_fee))
+                        let required_fees = self
+                            .transfers
+                            .read()
+                            .await
+                            .get_required_fees(dbc_ids, priority);
+                        QueryResponse::GetFees(Ok(required_fees))
                     }
                     SpendQuery::GetDbcSpend(address) => {
                         let res = self
                             .transfers
+                            .read()
+                            .await
                             .get(address)
                             .await
                             .map_err(ProtocolError::Transfers);
@@ -160,12 +339,15 @@ impl Node {
         }
     }
 
-    async fn handle_cmd(&mut self, cmd: Cmd) -> CmdResponse {
+    async fn handle_cmd(&self, peer: PeerId, cmd: Cmd) -> CmdResponse {
         match cmd {
             Cmd::StoreChunk(chunk) => {
                 let resp = self.chunks.store(&chunk).await;
                 CmdResponse::StoreChunk(resp)
             }
+            Cmd::StoreChunks(chunks) => {
+                CmdResponse::StoreChunks(Ok(self.chunks.store_batch(&chunks).await))
+            }
             Cmd::Register(cmd) => {
                 let result = self.registers.write(&cmd).await;
                 match cmd {
@@ -178,6 +360,13 @@ impl Node {
                 source_tx,
                 fee_ciphers,
             } => {
+                // Spends of the same dbc are handled one at a time, while
+                // spends of other dbcs proceed in parallel.
+                let _spend_guard = self
+                    .spend_locks
+                    .lock(dbc_address(signed_spend.dbc_id()))
+                    .await;
+
                 // First we fetch all parent spends from the network.
                 // They shall naturally all exist as valid spends for this current
                 // spend attempt to be valid.
@@ -193,24 +382,18 @@ impl Node {
 
                 // Then we try to add the spend to the transfers.
                 // This will validate all the necessary components of the spend.
-                let res = match self
+                // Spends of unrelated dbcs are validated in parallel, only sharing the
+                // read lock on the transfers, which is released before we act on the result.
+                let result = self
                     .transfers
-                    .try_add(signed_spend, source_tx, fee_ciphers, parent_spends)
+                    .read()
                     .await
-                {
+                    .try_add(signed_spend, source_tx, fee_ciphers, parent_spends)
+                    .await;
+                let res = match result {
                     Err(TransferError::DoubleSpendAttempt { new, existing }) => {
-                        warn!("Double spend attempted! New: {new:?}. Existing:  {existing:?}");
-                        if let Ok(event) =
-                            Event::double_spend_attempt(new.clone(), existing.clone())
-                        {
-                            match self.send_to_closest(&Request::Event(event)).await {
-                                Ok(_) => {}
-                                Err(err) => {
-                                    warn!("Failed to send double spend event to closest peers: {err:?}");
-                                }
-                            }
-                        }
-
+                        self.broadcast_double_spend(new.clone(), existing.clone())
+                            .await;
                         Err(ProtocolError::Transfers(
                             TransferError::DoubleSpendAttempt { new, existing },
                         ))
@@ -220,6 +403,22 @@ impl Node {
 
                 CmdResponse::Spend(res)
             }
+            Cmd::Replicate(batch) => {
+                CmdResponse::Replicate(self.store_replicated(peer, batch).await)
+            }
+        }
+    }
+
+    // Notifies the close group of the spends of a double spend attempt.
+    async fn broadcast_double_spend(&self, new: Box<SignedSpend>, existing: Box<SignedSpend>) {
+        warn!("Double spend attempted! New: {new:?}. Existing:  {existing:?}");
+        if let Ok(event) = Event::double_spend_attempt(new, existing) {
+            if let Err(err) = self
+                .send_to_closest(&Request::Event(event), |_| false)
+                .await
+            {
+                warn!("Failed to send double spend event to closest peers: {err:?}");
+            }
         }
     }
 
@@ -234,37 +433,65 @@ impl Node {
         // First we fetch all parent spends from the network.
         // They shall naturally all exist as valid spends for this current
         // spend attempt to be valid.
-        for parent_input in &source_tx.inputs {
-            let parent_address = dbc_address(&parent_input.dbc_id());
-            // This call makes sure we get the same spend from all in the close group.
-            // If we receive a spend here, it is assumed to be valid. But we will verify
-            // that anyway, in the code right after this for loop.
-            let parent_spend = self.get_spend(parent_address).await?;
-            let _ = all_parent_spends.insert(parent_spend);
+        // The inputs are fetched concurrently, each address once.
+        let parent_addresses: BTreeSet<_> = source_tx
+            .inputs
+            .iter()
+            .map(|parent_input| dbc_address(&parent_input.dbc_id()))
+            .collect();
+        let mut fetches = stream::iter(parent_addresses)
+            .map(|parent_address| self.get_parent_spend(parent_address))
+            .buffer_unordered(MAX_CONCURRENT_PARENT_FETCHES);
+        while let Some(parent_spend) = fetches.next().await {
+            let _ = all_parent_spends.insert(parent_spend?);
         }
 
         Ok(all_parent_spends)
     }
 
-    /// Retrieve a `Spend` from the closest peers
-    async fn get_spend(&self, address: DbcAddress) -> Result<SignedSpend> {
-        let request = Request::Query(Query::Spend(SpendQuery::GetDbcSpend(address)));
-        info!("Getting the closest peers to {:?}", request.dst());
+    // Retrieve a parent `Spend`, from the cache of recently gotten parents if there.
+    async fn get_parent_spend(&self, address: DbcAddress) -> Result<SignedSpend> {
+        if let Some(spend) = self.parent_spends.get(&address) {
+            trace!("Got parent spend {address:?} from the cache");
+            return Ok(spend);
+        }
 
-        let responses = self.send_to_closest(&request).await?;
+        // This call makes sure we get the same spend from a majority of the close group.
+        // If we receive a spend here, it is assumed to be valid. But we will verify
+        // that anyway, along with the spend it is the parent of.
+        let spend = self.get_spend(address).await?;
+        self.parent_spends.insert(address, spend.clone());
+        Ok(spend)
+    }
 
-        // Get all Ok results of the expected response type `GetDbcSpend`.
-        let spends: Vec<_> = responses
-            .iter()
-            .flatten()
-            .flat_map(|resp| {
-                if let Response::Query(QueryResponse::GetDbcSpend(Ok(signed_spend))) = resp {
-                    Some(signed_spend.clone())
-                } else {
-                    None
+    /// Retrieve a `Spend` from the closest peers
+    // Concurrent retrievals of the same spend, e.g. the parent shared by several spends
+    // being validated, share a single query.
+    pub(super) async fn get_spend(&self, address: DbcAddress) -> Result<SignedSpend> {
+        self.spend_fetches
+            .run(address, || self.fetch_spend(address))
+            .await
+    }
+
+    async fn fetch_spend(&self, address: DbcAddress) -> Result<SignedSpend> {
+        let request = Request::Query(Query::Spend(SpendQuery::GetDbcSpend(address)));
+        info!("Getting the closest peers to {address:?}");
+
+        // Stop waiting for responses once a majority has returned the same spend.
+        let responses = self
+            .send_to_closest(&request, |responses| {
+                let mut counts = BTreeMap::new();
+                for spend in gotten_spends(responses) {
+                    *counts.entry(spend).or_insert(0) += 1;
                 }
+                counts
+                    .values()
+                    .any(|count| *count >= close_group_majority())
             })
-            .collect();
+            .await?;
+
+        // Get all Ok results of the expected response type `GetDbcSpend`.
+        let spends: Vec<_> = gotten_spends(&responses).cloned().collect();
 
         // As to not have a single rogue node deliver a bogus spend,
         // and thereby have us fail the check here
@@ -315,58 +542,76 @@ impl Node {
         }
     }
 
-    async fn send_to_closest(&self, request: &Request) -> Result<Vec<Result<Response>>> {
-        info!("Sending {:?} to the closest peers.", request.dst());
+    // Sends the request to the closest peers of its destination, and returns
+    // their responses as soon as the ones received so far are `enough`.
+    async fn send_to_closest<F>(
+        &self,
+        request: &Request,
+        enough: F,
+    ) -> Result<Vec<Result<Response, NetworkError>>>
+    where
+        F: Fn(&[Result<Response, NetworkError>]) -> bool,
+    {
+        let dst = request.dst()?;
+        info!("Sending {dst:?} to the closest peers.");
         // todo: if `self` is present among the closest peers, the request should be routed to self?
-        let closest_peers = self
-            .network
-            .node_get_closest_peers(*request.dst().name())
-            .await?;
+        let closest_peers = self.network.node_get_closest_peers(*dst.name()).await?;
 
         Ok(self
-            .send_and_get_responses(closest_peers, request, true)
+            .network
+            .send_and_get_responses(closest_peers, request, enough)
             .await)
     }
+}
 
-    // Send a `Request` to the provided set of peers and wait for their responses concurrently.
-    // If `get_all_responses` is true, we wait for the responses from all the peers. Will return an
-    // error if the request timeouts.
-    // If `get_all_responses` is false, we return the first successful response that we get
-    async fn send_and_get_responses(
-        &self,
-        peers: Vec<PeerId>,
-        req: &Request,
-        get_all_responses: bool,
-    ) -> Vec<Result<Response>> {
-        let mut list_of_futures = Vec::new();
-        for peer in peers {
-            let future = Box::pin(tokio::time::timeout(
-                Duration::from_secs(10),
-                self.network.send_request(req.clone(), peer),
-            ));
-            list_of_futures.push(future);
+// Returns the spends of the Ok responses of the expected type `GetDbcSpend`.
+fn gotten_spends(
+    responses: &[Result<Response, NetworkError>],
+) -> impl Iterator<Item = &SignedSpend> {
+    responses.iter().flatten().filter_map(|resp| {
+        if let Response::Query(QueryResponse::GetDbcSpend(Ok(signed_spend))) = resp {
+            Some(signed_spend)
+        } else {
+            None
         }
+    })
+}
 
-        let mut responses = Vec::new();
-        while !list_of_futures.is_empty() {
-            match select_all(list_of_futures).await {
-                (Ok(res), _, remaining_futures) => {
-                    let res = res.map_err(super::Error::Network);
-                    info!("Got response for the req: {req:?}, res: {res:?}");
-                    // return the first successful response
-                    if !get_all_responses && res.is_ok() {
-                        return vec![res];
-                    }
-                    responses.push(res);
-                    list_of_futures = remaining_futures;
-                }
-                (Err(timeout_err), _, remaining_futures) => {
-                    responses.push(Err(super::Error::ResponseTimeout(timeout_err)));
-                    list_of_futures = remaining_futures;
-                }
-            }
+// Returns the response telling the peer that the batch of its request is invalid,
+// or `None` if the kind of request is not sent in batches.
+fn invalid_batch_response(request: &Request, error: ProtocolError) -> Option<Response> {
+    let response = match request {
+        Request::Cmd(Cmd::StoreChunks(_)) => Response::Cmd(CmdResponse::StoreChunks(Err(error))),
+        Request::Cmd(Cmd::Replicate(_)) => Response::Cmd(CmdResponse::Replicate(Err(error))),
+        Request::Query(Query::GetChunks(_)) => {
+            Response::Query(QueryResponse::GetChunks(Err(error)))
+        }
+        Request::Query(Query::HasChunks(_)) => {
+            Response::Query(QueryResponse::HasChunks(Err(error)))
         }
+        Request::Query(Query::Spend(SpendQuery::GetFees { .. })) => {
+            Response::Query(QueryResponse::GetFees(Err(error)))
+        }
+        _ => return None,
+    };
+    Some(response)
+}
 
-        responses
+// Returns the name of the kind of the request, by which its metrics are labelled.
+fn request_kind(request: &Request) -> &'static str {
+    match request {
+        Request::Cmd(Cmd::StoreChunk(_)) => "store_chunk",
+        Request::Cmd(Cmd::StoreChunks(_)) => "store_chunks",
+        Request::Cmd(Cmd::Register(RegisterCmd::Create(_))) => "register_create",
+        Request::Cmd(Cmd::Register(RegisterCmd::Edit(_))) => "register_edit",
+        Request::Cmd(Cmd::SpendDbc { .. }) => "spend_dbc",
+        Request::Cmd(Cmd::Replicate(_)) => "replicate",
+        Request::Query(Query::GetChunk(_)) => "get_chunk",
+        Request::Query(Query::GetChunks(_)) => "get_chunks",
+        Request::Query(Query::HasChunks(_)) => "has_chunks",
+        Request::Query(Query::Register(_)) => "register_query",
+        Request::Query(Query::Spend(SpendQuery::GetFees { .. })) => "get_fees",
+        Request::Query(Query::Spend(SpendQuery::GetDbcSpend(_))) => "get_dbc_spend",
+        Request::Event(Event::DoubleSpendAttempted(..)) => "double_spend_attempted",
     }
 }
@@ -0,0 +1,95 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use std::{net::SocketAddr, path::PathBuf};
+
+/// The default number of requests the node will handle concurrently.
+pub const DEFAULT_MAX_CONCURRENT_REQUESTS: usize = 64;
+/// The default number of requests that can wait for a free handler,
+/// before new requests start being dropped.
+pub const DEFAULT_MAX_QUEUED_REQUESTS: usize = 1024;
+
+/// The default max number of bytes of chunks a node stores on disk.
+pub const DEFAULT_CHUNK_STORE_SIZE: usize = 2 * 1024 * 1024 * 1024;
+/// The default max number of bytes of chunks a node caches in memory.
+pub const DEFAULT_CHUNK_CACHE_SIZE: usize = 20 * 1024 * 1024;
+/// The default max number of bytes of Registers a node stores on disk.
+pub const DEFAULT_REGISTER_STORE_SIZE: usize = 200 * 1024 * 1024;
+/// The default max number of bytes of Registers a node caches in memory.
+pub const DEFAULT_REGISTER_CACHE_SIZE: usize = 20 * 1024 * 1024;
+/// The default number of queued spends a node commits per second.
+///
+/// As the network grows, the total capacity grows as well.
+/// For example, 10 spends per second for a close group of 8 gives
+/// -> 128000 spends per second with 102400 nodes
+/// -> 384000 spends per second with 307200 nodes
+pub const DEFAULT_SPEND_COMMIT_RATE: u32 = 10;
+/// The default max number of queued spends a node commits at a time.
+pub const DEFAULT_SPEND_COMMIT_BATCH_SIZE: usize = 10;
+/// The default max number of spends a node queues to be committed.
+/// At the default commit rate, the last of them is committed within 100 seconds.
+pub const DEFAULT_MAX_QUEUED_SPENDS: usize = 1000;
+
+/// Configuration of a `Node`.
+#[derive(Clone, Debug)]
+pub struct NodeConfig {
+    /// The dir where the node keeps its data.
+    pub root_dir: PathBuf,
+    /// The max number of requests handled concurrently.
+    pub max_concurrent_requests: usize,
+    /// The max number of requests waiting for a free handler.
+    /// Requests received when the queue is full are dropped.
+    pub max_queued_requests: usize,
+    /// The max number of bytes of chunks stored on disk.
+    /// Chunks are refused once it is reached.
+    pub chunk_store_size: usize,
+    /// The max number of bytes of chunks cached in memory.
+    pub chunk_cache_size: usize,
+    /// The max number of bytes of Registers stored on disk.
+    /// Register writes are refused once it is reached.
+    pub register_store_size: usize,
+    /// The max number of bytes of Registers cached in memory.
+    pub register_cache_size: usize,
+    /// The number of queued spends committed per second.
+    pub spend_commit_rate: u32,
+    /// The max number of queued spends committed at a time.
+    /// The batches are spread out so as to keep to the `spend_commit_rate`.
+    pub spend_commit_batch_size: usize,
+    /// The max number of spends queued to be committed.
+    /// New spends are refused once it is reached, whatever the fee paid.
+    pub max_queued_spends: usize,
+    /// The address to serve the metrics of the node at, over HTTP.
+    /// The metrics are not served if none is set.
+    pub metrics_addr: Option<SocketAddr>,
+}
+
+impl Default for NodeConfig {
+    fn default() -> Self {
+        Self {
+            root_dir: default_root_dir(),
+            max_concurrent_requests: DEFAULT_MAX_CONCURRENT_REQUESTS,
+            max_queued_requests: DEFAULT_MAX_QUEUED_REQUESTS,
+            chunk_store_size: DEFAULT_CHUNK_STORE_SIZE,
+            chunk_cache_size: DEFAULT_CHUNK_CACHE_SIZE,
+            register_store_size: DEFAULT_REGISTER_STORE_SIZE,
+            register_cache_size: DEFAULT_REGISTER_CACHE_SIZE,
+            spend_commit_rate: DEFAULT_SPEND_COMMIT_RATE,
+            spend_commit_batch_size: DEFAULT_SPEND_COMMIT_BATCH_SIZE,
+            max_queued_spends: DEFAULT_MAX_QUEUED_SPENDS,
+            metrics_addr: None,
+        }
+    }
+}
+
+/// Returns `$HOME/.safe/node`, or a dir under the system temp dir if there is no home dir.
+pub fn default_root_dir() -> PathBuf {
+    let mut root_dir = dirs_next::home_dir().unwrap_or_else(std::env::temp_dir);
+    root_dir.push(".safe");
+    root_dir.push("node");
+    root_dir
+}
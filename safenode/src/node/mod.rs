@@ -7,32 +7,57 @@
 // permissions and limitations relating to use of the SAFE Network Software.
 
 mod api;
+mod config;
 mod error;
 mod event;
+mod replication;
 
-pub use self::event::NodeEvent;
+pub use self::{
+    config::{
+        default_root_dir, NodeConfig, DEFAULT_CHUNK_CACHE_SIZE, DEFAULT_CHUNK_STORE_SIZE,
+        DEFAULT_MAX_CONCURRENT_REQUESTS, DEFAULT_MAX_QUEUED_REQUESTS, DEFAULT_MAX_QUEUED_SPENDS,
+        DEFAULT_REGISTER_CACHE_SIZE, DEFAULT_REGISTER_STORE_SIZE, DEFAULT_SPEND_COMMIT_BATCH_SIZE,
+        DEFAULT_SPEND_COMMIT_RATE,
+    },
+    event::NodeEvent,
+};
 
 use self::{error::Error, event::NodeEventsChannel};
 
 use crate::{
-    network::Network,
+    metrics::NodeMetrics,
+    network::{Network, SingleFlight, TtlCache},
     network_transfers::Transfers,
-    storage::{ChunkStorage, RegisterStorage},
+    protocol::address::DbcAddress,
+    storage::{AddressLocks, ChunkStorage, RegisterStorage},
 };
 
+use sn_dbc::SignedSpend;
+
 use libp2p::PeerId;
 use serde::{Deserialize, Serialize};
+use std::sync::Arc;
+use tokio::sync::{Notify, RwLock};
 use xor_name::{XorName, XOR_NAME_LEN};
 
 /// `Node` represents a single node in the distributed network. It handles
 /// network events, processes incoming requests, interacts with the data
 /// storage, and broadcasts node-related events.
+///
+/// Cloning a `Node` is cheap, and all the clones share the same state,
+/// which allows requests to be handled concurrently.
+#[derive(Clone)]
 pub struct Node {
     network: Network,
     chunks: ChunkStorage,
     registers: RegisterStorage,
-    transfers: Transfers,
+    transfers: Arc<RwLock<Transfers>>,
+    spend_locks: AddressLocks<DbcAddress>,
+    parent_spends: TtlCache<DbcAddress, SignedSpend>,
+    spend_fetches: SingleFlight<DbcAddress, SignedSpend>,
+    metrics: NodeMetrics,
     events_channel: NodeEventsChannel,
+    routing_changes: Arc<Notify>,
 }
 
 /// A unique identifier for a node in the network,
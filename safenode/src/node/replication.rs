@@ -0,0 +1,544 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use super::{error::Result, Node};
+
+use crate::{
+    network::CLOSE_GROUP_SIZE,
+    network_transfers::Error as TransferError,
+    protocol::{
+        address::{dbc_address, ChunkAddress, DataAddress},
+        error::{Error as ProtocolError, Result as ProtocolResult},
+        messages::{
+            Cmd, CmdResponse, Query, QueryResponse, ReplicatedData, Request, Response,
+            MAX_PROBED_CHUNKS, MAX_REPLICATION_BATCH_SIZE,
+        },
+    },
+};
+
+use sn_dbc::SignedSpend;
+
+use futures::stream::{self, StreamExt};
+use libp2p::{kad::KBucketKey, PeerId};
+use std::{
+    collections::{BTreeMap, BTreeSet},
+    iter,
+    time::Duration,
+};
+use tokio::{
+    task::spawn_blocking,
+    time::{sleep, timeout},
+};
+
+/// The time waited once the routing table changed, before replicating,
+/// for the changes of the same churn to be handled together.
+const SETTLE_DELAY: Duration = Duration::from_secs(5);
+/// The interval at which the routing table is checked for changes also without notice of one,
+/// e.g. for the peers Kademlia dropped, and the replications which failed are retried.
+const ROUND_INTERVAL: Duration = Duration::from_secs(5 * 60);
+/// The max number of peers data is replicated to at a time.
+const MAX_CONCURRENT_TARGETS: usize = 2;
+/// The max number of bytes of data in a batch, chunks making up the bulk of it.
+const MAX_BATCH_BYTES: usize = 4 * 1024 * 1024;
+/// The min time between two batches sent to a peer. Along with the max size of a batch,
+/// and the number of peers replicated to at a time, this bounds the bandwidth taken.
+const BATCH_INTERVAL: Duration = Duration::from_secs(1);
+/// The time after which a request to a peer replicated to is given up on.
+const REPLICATION_TIMEOUT: Duration = Duration::from_secs(30);
+/// The number of the nodes closest to an address, as seen from our routing table, which data
+/// replicated to us is accepted from. It is larger than the close group, for the sender may
+/// have been pushed out of it by the very churn it replicates on.
+const REPLICATION_SENDER_RANGE: usize = 2 * CLOSE_GROUP_SIZE;
+
+impl Node {
+    /// Replicates the data held to the peers which joined the close group of it, each time
+    /// the routing table changes, as notified through `routing_changes`.
+    ///
+    /// A peer leaving a close group is replaced in it by the next closest peer, which is then
+    /// replicated to in the same way. The data is sent to each peer in batches, one at a time,
+    /// so that the replication proceeds at the pace the peer stores it, and at a bounded rate,
+    /// for the requests handled meanwhile not to be slowed down.
+    pub(super) async fn replicate_on_churn(self) {
+        let our_id = self.network.peer_id;
+        // The routing table, as of the last round.
+        let mut known_peers: Option<Vec<PeerId>> = None;
+        // The addresses which could not be replicated to each peer, to be retried.
+        let mut retries: BTreeMap<PeerId, Vec<DataAddress>> = BTreeMap::new();
+
+        loop {
+            // A change notified while a round runs starts the next one right away.
+            let _ = timeout(ROUND_INTERVAL, self.routing_changes.notified()).await;
+            sleep(SETTLE_DELAY).await;
+
+            let mut peers = match self.network.routing_peers().await {
+                Ok(peers) => peers,
+                Err(err) => {
+                    warn!("Failed to get the routing table to replicate data: {err}");
+                    continue;
+                }
+            };
+            peers.sort();
+            retries.retain(|peer, _| peers.binary_search(peer).is_ok());
+            let old_peers = match known_peers.replace(peers.clone()) {
+                Some(old_peers) => old_peers,
+                None => {
+                    // The first table seen is the one the data held is taken to be replicated
+                    // with already, rather than sending all of it again on every start.
+                    trace!("Replication seeded with {} routing peers", peers.len());
+                    continue;
+                }
+            };
+            if peers == old_peers && retries.is_empty() {
+                continue;
+            }
+
+            let mut targets = if peers == old_peers {
+                BTreeMap::new()
+            } else {
+                let addrs = self.held_addrs().await;
+                // The close groups of all the addresses are computed away from the async threads.
+                match spawn_blocking(move || replication_targets(our_id, &old_peers, &peers, addrs))
+                    .await
+                {
+                    Ok(targets) => targets,
+                    Err(err) => {
+                        error!("Failed to compute the replication targets: {err}");
+                        continue;
+                    }
+                }
+            };
+            for (peer, addrs) in std::mem::take(&mut retries) {
+                targets.entry(peer).or_default().extend(addrs);
+            }
+
+            let count: usize = targets.values().map(Vec::len).sum();
+            info!("Replicating {count} items to {} peers", targets.len());
+            let mut replications = stream::iter(targets)
+                .map(|(peer, addrs)| self.replicate_to(peer, addrs))
+                .buffer_unordered(MAX_CONCURRENT_TARGETS);
+            while let Some((peer, unsent)) = replications.next().await {
+                if !unsent.is_empty() {
+                    let _ = retries.insert(peer, unsent);
+                }
+            }
+        }
+    }
+
+    /// Stores the data replicated to us by another node, returning
+    /// the first error storing an item, if any.
+    ///
+    /// Only the items the sender is among the closest nodes to, as seen from our routing table,
+    /// are taken, for clients and far away nodes not to store data through replication.
+    /// Items held already are skipped by the storage, as are the cmds of a Register log.
+    pub(super) async fn store_replicated(
+        &self,
+        sender: PeerId,
+        batch: Vec<ReplicatedData>,
+    ) -> ProtocolResult<()> {
+        let peers = match self.network.routing_peers().await {
+            Ok(peers) => peers,
+            Err(err) => {
+                warn!("Failed to get the routing table to check replicated data: {err}");
+                vec![]
+            }
+        };
+        let keys = peer_keys(self.network.peer_id, &peers);
+
+        let mut result = Ok(());
+        for data in batch {
+            let address = data.dst();
+            let key = KBucketKey::new(data.name().0.to_vec());
+            let stored = if !closest(&key, &keys, REPLICATION_SENDER_RANGE).contains(&sender) {
+                Err(ProtocolError::ReplicationFromOutsideCloseGroup(address))
+            } else {
+                self.store_replicated_item(data).await
+            };
+            if let Err(err) = stored {
+                warn!("Failed to store the data replicated by {sender:?} at {address:?}: {err}");
+                if result.is_ok() {
+                    result = Err(err);
+                }
+            }
+        }
+        result
+    }
+
+    async fn store_replicated_item(&self, data: ReplicatedData) -> ProtocolResult<()> {
+        match data {
+            ReplicatedData::Chunk(chunk) => self.chunks.store(&chunk).await,
+            ReplicatedData::RegisterWrite(cmd) => self.registers.write(&cmd).await,
+            ReplicatedData::RegisterLog(log) => self.registers.update(&log).await,
+            ReplicatedData::ValidSpend(signed_spend) => {
+                self.store_replicated_spend(signed_spend).await
+            }
+            // The signatures of both spends are verified by the transfers.
+            ReplicatedData::DoubleSpend((_, spends)) => {
+                let mut spends = spends.iter();
+                match (spends.next(), spends.next()) {
+                    (Some(a_spend), Some(b_spend)) => self
+                        .transfers
+                        .read()
+                        .await
+                        .try_add_double(a_spend, b_spend)
+                        .await
+                        .map_err(ProtocolError::Transfers),
+                    _ => Ok(()),
+                }
+            }
+        }
+    }
+
+    // Stores the replicated spend once it is confirmed to be the spend held by a majority of
+    // its close group. None of the checks of a new spend can be made again on it, as its source
+    // tx and fee are not kept, and a single node can't be trusted to vouch for them.
+    async fn store_replicated_spend(&self, signed_spend: SignedSpend) -> ProtocolResult<()> {
+        let address = dbc_address(signed_spend.dbc_id());
+        if let Ok(held) = self.transfers.read().await.get(address).await {
+            if held == signed_spend {
+                return Ok(());
+            }
+        }
+
+        match self.get_spend(address).await {
+            Ok(confirmed) if confirmed == signed_spend => {}
+            Ok(_) | Err(_) => {
+                return Err(ProtocolError::Transfers(
+                    TransferError::ReplicatedSpendNotConfirmed(address),
+                ))
+            }
+        }
+        self.transfers
+            .read()
+            .await
+            .try_add_replicated(&signed_spend)
+            .await
+            .map_err(ProtocolError::Transfers)
+    }
+
+    // Returns the addresses of all the data held.
+    async fn held_addrs(&self) -> Vec<DataAddress> {
+        let mut addrs = vec![];
+        match self.chunks.addrs().await {
+            Ok(chunks) => addrs.extend(chunks.into_iter().map(DataAddress::Chunk)),
+            Err(err) => warn!("Failed to list the chunks held: {err}"),
+        }
+        match self.registers.addrs().await {
+            Ok(registers) => addrs.extend(registers.into_iter().map(DataAddress::Register)),
+            Err(err) => warn!("Failed to list the Registers held: {err}"),
+        }
+        match self.transfers.read().await.addrs().await {
+            Ok(spends) => addrs.extend(spends.into_iter().map(DataAddress::Spend)),
+            Err(err) => warn!("Failed to list the spends held: {err}"),
+        }
+        addrs
+    }
+
+    // Sends the data at the addresses to the peer, leaving out the chunks it holds already.
+    // Returns the peer along with the addresses not replicated to it, for those to be retried,
+    // which are all the ones left once a request to the peer fails.
+    async fn replicate_to(
+        &self,
+        peer: PeerId,
+        addrs: Vec<DataAddress>,
+    ) -> (PeerId, Vec<DataAddress>) {
+        let mut chunk_addrs = vec![];
+        let mut to_send = vec![];
+        for address in addrs {
+            match address {
+                DataAddress::Chunk(address) => chunk_addrs.push(address),
+                address => to_send.push(address),
+            }
+        }
+        for (i, checked) in chunk_addrs.chunks(MAX_PROBED_CHUNKS).enumerate() {
+            match self.missing_chunks(peer, checked).await {
+                Ok(missing) => to_send.extend(missing.into_iter().map(DataAddress::Chunk)),
+                Err(err) => {
+                    warn!("Failed to check the chunks held by {peer:?}: {err}");
+                    let unchecked = chunk_addrs[i * MAX_PROBED_CHUNKS..]
+                        .iter()
+                        .copied()
+                        .map(DataAddress::Chunk);
+                    to_send.extend(unchecked);
+                    return (peer, to_send);
+                }
+            }
+        }
+
+        let mut batch = vec![];
+        let mut batch_bytes = 0;
+        // The index in `to_send` of the first item of the batch.
+        let mut batch_start = 0;
+        for (i, address) in to_send.iter().enumerate() {
+            let data = match self.replicated_data(address).await {
+                Ok(data) => data,
+                Err(err) => {
+                    // E.g. the data was removed meanwhile.
+                    trace!("Not replicating {address:?} to {peer:?}: {err}");
+                    continue;
+                }
+            };
+            let size = replicated_size(&data);
+            if !batch.is_empty()
+                && (batch.len() == MAX_REPLICATION_BATCH_SIZE
+                    || batch_bytes + size > MAX_BATCH_BYTES)
+            {
+                if let Err(err) = self.send_batch(peer, std::mem::take(&mut batch)).await {
+                    warn!("Failed to replicate data to {peer:?}: {err}");
+                    return (peer, to_send[batch_start..].to_vec());
+                }
+                batch_bytes = 0;
+                batch_start = i;
+                sleep(BATCH_INTERVAL).await;
+            }
+            batch.push(data);
+            batch_bytes += size;
+        }
+
+        if !batch.is_empty() {
+            if let Err(err) = self.send_batch(peer, batch).await {
+                warn!("Failed to replicate data to {peer:?}: {err}");
+                return (peer, to_send[batch_start..].to_vec());
+            }
+        }
+        (peer, vec![])
+    }
+
+    // Returns which of the chunks the peer doesn't hold.
+    async fn missing_chunks(
+        &self,
+        peer: PeerId,
+        addrs: &[ChunkAddress],
+    ) -> Result<Vec<ChunkAddress>> {
+        let request = Request::Query(Query::HasChunks(addrs.to_vec()));
+        let response = timeout(
+            REPLICATION_TIMEOUT,
+            self.network.send_request(request, peer),
+        )
+        .await??;
+        match response {
+            Response::Query(QueryResponse::HasChunks(Ok(held))) if held.len() == addrs.len() => {
+                Ok(addrs
+                    .iter()
+                    .zip(held)
+                    .filter(|(_, held)| !held)
+                    .map(|(address, _)| *address)
+                    .collect())
+            }
+            _ => Err(ProtocolError::UnexpectedResponses.into()),
+        }
+    }
+
+    async fn send_batch(&self, peer: PeerId, batch: Vec<ReplicatedData>) -> Result<()> {
+        let count = batch.len();
+        let request = Request::Cmd(Cmd::Replicate(batch));
+        let response = timeout(
+            REPLICATION_TIMEOUT,
+            self.network.send_request(request, peer),
+        )
+        .await??;
+        match response {
+            Response::Cmd(CmdResponse::Replicate(Ok(()))) => {
+                trace!("Replicated {count} items to {peer:?}");
+                Ok(())
+            }
+            // The peer got the batch, and won't do better with it again.
+            Response::Cmd(CmdResponse::Replicate(Err(err))) => {
+                warn!("Peer {peer:?} failed to store some of the data replicated to it: {err}");
+                Ok(())
+            }
+            _ => Err(ProtocolError::UnexpectedResponses.into()),
+        }
+    }
+
+    // Reads the data at the address as it is replicated.
+    async fn replicated_data(&self, address: &DataAddress) -> Result<ReplicatedData> {
+        let data = match address {
+            // The chunks are read past the cache, for it to keep the chunks being served.
+            DataAddress::Chunk(address) => {
+                ReplicatedData::Chunk(self.chunks.get_uncached(address).await?)
+            }
+            DataAddress::Register(address) => {
+                ReplicatedData::RegisterLog(self.registers.get_register_replica(address).await?)
+            }
+            DataAddress::Spend(address) => {
+                let transfers = self.transfers.read().await;
+                let double = transfers
+                    .get_double(*address)
+                    .await
+                    .map_err(ProtocolError::Transfers)?;
+                match double {
+                    Some((a_spend, b_spend)) => {
+                        ReplicatedData::DoubleSpend((*address, BTreeSet::from([a_spend, b_spend])))
+                    }
+                    None => ReplicatedData::ValidSpend(
+                        transfers
+                            .get(*address)
+                            .await
+                            .map_err(ProtocolError::Transfers)?,
+                    ),
+                }
+            }
+        };
+        Ok(data)
+    }
+}
+
+// The size of the data as sent, which is counted against the max size of a batch.
+fn replicated_size(data: &ReplicatedData) -> usize {
+    match data {
+        ReplicatedData::Chunk(chunk) => chunk.payload_size(),
+        data => bincode::serialized_size(data).unwrap_or(0) as usize,
+    }
+}
+
+// Returns the addresses to replicate to each peer, which are the addresses it is in the close
+// group of with the `new_peers` in the routing table, but was not with the `old_peers`.
+fn replication_targets(
+    our_id: PeerId,
+    old_peers: &[PeerId],
+    new_peers: &[PeerId],
+    addrs: Vec<DataAddress>,
+) -> BTreeMap<PeerId, Vec<DataAddress>> {
+    let old_keys = peer_keys(our_id, old_peers);
+    let new_keys = peer_keys(our_id, new_peers);
+
+    let mut targets: BTreeMap<PeerId, Vec<DataAddress>> = BTreeMap::new();
+    for address in addrs {
+        let key = KBucketKey::new(address.name().0.to_vec());
+        let old_group = close_group(&key, &old_keys);
+        for peer in close_group(&key, &new_keys) {
+            if peer != our_id && !old_group.contains(&peer) {
+                targets.entry(peer).or_default().push(address);
+            }
+        }
+    }
+    targets
+}
+
+// The keys of the peers of the routing table, along with ours, hashed once
+// rather than for every address they are compared to.
+fn peer_keys(our_id: PeerId, peers: &[PeerId]) -> Vec<KBucketKey<PeerId>> {
+    peers
+        .iter()
+        .chain(iter::once(&our_id))
+        .map(|peer| KBucketKey::from(*peer))
+        .collect()
+}
+
+// Returns the `CLOSE_GROUP_SIZE` closest of the peers to the key, as a lookup of it finds.
+fn close_group(key: &KBucketKey<Vec<u8>>, peers: &[KBucketKey<PeerId>]) -> Vec<PeerId> {
+    closest(key, peers, CLOSE_GROUP_SIZE)
+}
+
+// Returns the `count` closest of the peers to the key, in no particular order.
+fn closest(key: &KBucketKey<Vec<u8>>, peers: &[KBucketKey<PeerId>], count: usize) -> Vec<PeerId> {
+    let mut group: Vec<_> = peers
+        .iter()
+        .map(|peer| (key.distance(peer), *peer.preimage()))
+        .collect();
+    if group.len() > count {
+        let _ = group.select_nth_unstable(count);
+        group.truncate(count);
+    }
+    group.into_iter().map(|(_, peer)| peer).collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::protocol::address::ChunkAddress;
+
+    use xor_name::XorName;
+
+    fn random_addrs(count: usize) -> Vec<DataAddress> {
+        let mut rng = rand::thread_rng();
+        (0..count)
+            .map(|_| DataAddress::Chunk(ChunkAddress::new(XorName::random(&mut rng))))
+            .collect()
+    }
+
+    #[test]
+    fn data_is_replicated_to_the_peers_joining_its_close_group() {
+        let our_id = PeerId::random();
+        let old_peers: Vec<_> = (0..20).map(|_| PeerId::random()).collect();
+        let joined = PeerId::random();
+        let new_peers: Vec<_> = old_peers.iter().copied().chain([joined]).collect();
+        let addrs = random_addrs(100);
+
+        let targets = replication_targets(our_id, &old_peers, &new_peers, addrs.clone());
+
+        // Only the peer which joined is replicated to, and only the addresses it is close to.
+        assert!(targets.keys().all(|peer| *peer == joined));
+        let new_keys: Vec<_> = new_peers
+            .iter()
+            .chain([&our_id])
+            .map(|peer| KBucketKey::from(*peer))
+            .collect();
+        let expected: Vec<_> = addrs
+            .into_iter()
+            .filter(|address| {
+                let key = KBucketKey::new(address.name().0.to_vec());
+                close_group(&key, &new_keys).contains(&joined)
+            })
+            .collect();
+        assert_eq!(targets.get(&joined).cloned().unwrap_or_default(), expected);
+    }
+
+    #[test]
+    fn data_is_replicated_to_the_peers_replacing_those_which_left() {
+        let our_id = PeerId::random();
+        let old_peers: Vec<_> = (0..20).map(|_| PeerId::random()).collect();
+        let left = old_peers[0];
+        let new_peers = &old_peers[1..];
+        let addrs = random_addrs(100);
+
+        let targets = replication_targets(our_id, &old_peers, new_peers, addrs.clone());
+
+        // Each address the peer which left was close to goes to one peer, the next closest,
+        // unless that is us, as we don't replicate to ourselves.
+        let old_keys = peer_keys(our_id, &old_peers);
+        let new_keys = peer_keys(our_id, new_peers);
+        let left_from: Vec<_> = addrs
+            .iter()
+            .filter(|address| {
+                let key = KBucketKey::new(address.name().0.to_vec());
+                let old_group = close_group(&key, &old_keys);
+                let we_joined =
+                    !old_group.contains(&our_id) && close_group(&key, &new_keys).contains(&our_id);
+                old_group.contains(&left) && !we_joined
+            })
+            .collect();
+        let mut replicated: Vec<_> = targets.values().flatten().collect();
+        replicated.sort();
+        let mut expected = left_from;
+        expected.sort();
+        assert_eq!(replicated, expected);
+        assert!(!targets.contains_key(&left));
+        assert!(!targets.contains_key(&our_id));
+    }
+
+    #[test]
+    fn close_group_holds_the_closest_peers() {
+        let peers: Vec<_> = (0..30)
+            .map(|_| KBucketKey::from(PeerId::random()))
+            .collect();
+        let key = KBucketKey::new(XorName::random(&mut rand::thread_rng()).0.to_vec());
+
+        let mut sorted = peers.clone();
+        sorted.sort_by_key(|peer| key.distance(peer));
+        let expected: BTreeSet<_> = sorted
+            .iter()
+            .take(CLOSE_GROUP_SIZE)
+            .map(|peer| *peer.preimage())
+            .collect();
+
+        let group: BTreeSet<_> = close_group(&key, &peers).into_iter().collect();
+        assert_eq!(group, expected);
+    }
+}
@@ -7,7 +7,7 @@
 // permissions and limitations relating to use of the SAFE Network Software.
 
 use super::{
-    address::{ChunkAddress, RegisterAddress},
+    address::{ChunkAddress, DataAddress, RegisterAddress},
     authority::PublicKey,
     register::{EntryHash, User},
 };
@@ -31,6 +31,14 @@ pub enum Error {
     /// Unexpected responses.
     #[error("Unexpected responses")]
     UnexpectedResponses,
+    /// A batch of items is empty, or holds more items than its kind of message allows.
+    #[error("Batch of {len} items is empty or larger than its max of {max}")]
+    InvalidBatchSize {
+        /// The number of items in the batch
+        len: usize,
+        /// The max number of items allowed
+        max: usize,
+    },
     /// Chunk not found.
     #[error("Chunk not found: {0:?}")]
     ChunkNotFound(ChunkAddress),
@@ -95,4 +103,20 @@ pub enum Error {
     /// Failed to write file, likely due to a system Io error
     #[error("Failed to write file")]
     FailedToWriteFile,
+    /// The checks of a batch of items were dropped before returning their results.
+    #[error("Verification of a batch of {0} items was aborted")]
+    BatchVerificationAborted(usize),
+    /// A complete cmd of the ops log of a Register on disk doesn't decode.
+    #[error("Ops log of Register {address:?} is corrupt at byte {offset}: {error}")]
+    RegisterLogCorrupt {
+        /// The address of the Register
+        address: RegisterAddress,
+        /// The position of the cmd in the log
+        offset: usize,
+        /// The decoding error
+        error: String,
+    },
+    /// Replicated data was sent by a peer which isn't among the closest nodes to it.
+    #[error("Replicated data not sent by a node close to it: {0:?}")]
+    ReplicationFromOutsideCloseGroup(DataAddress),
 }
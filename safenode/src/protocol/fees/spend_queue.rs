@@ -26,11 +26,11 @@
 use super::SpendPriority;
 
 use priority_queue::PriorityQueue;
-use std::{hash::Hash, time::Duration};
+use std::{cmp::Reverse, collections::BTreeMap, hash::Hash, time::Duration};
 use tokio::time::Instant;
 
 /// The queue of pending spends, sorted by
-/// the fee paid.
+/// the fee paid, and then by the time they were queued, oldest first.
 ///
 /// Implemented with generic arg to simplify testing,
 /// as the `SignedSpend` type, that we know spend queue will
@@ -38,10 +38,21 @@ use tokio::time::Instant;
 #[derive(custom_debug::Debug)]
 pub struct SpendQ<T: Eq + Hash> {
     #[debug(skip)]
-    queue: PriorityQueue<T, u64>,
+    queue: PriorityQueue<T, (u64, Reverse<Instant>)>,
+    #[debug(skip)]
+    fees: FeeSet,
     #[debug(skip)]
     snapshot: SpendQSnapshot,
-    last_pop: Instant,
+}
+
+/// The fees of the queued spends, kept sorted along with their
+/// running sums, so that the stats are updated without going over them all.
+#[derive(Default)]
+struct FeeSet {
+    counts: BTreeMap<u64, usize>,
+    len: usize,
+    sum: u128,
+    sum_of_squares: u128,
 }
 
 /// A snapshot of the sorted fees in the spend queue.
@@ -129,6 +140,18 @@ impl SpendQSnapshot {
         let low = queue.last().copied().unwrap_or(default_val / 2);
         let (avg, std_dev, len) = calc_stats(&queue);
 
+        #[allow(unused_mut)]
+        let mut snapshot = Self::with_stats(high, low, avg, std_dev, len);
+        #[cfg(test)]
+        {
+            snapshot.queue = queue;
+        }
+        snapshot
+    }
+
+    // Derives the stats of a queue from its highest and lowest fees, and the avg and
+    // std dev of all of them.
+    fn with_stats(high: u64, low: u64, avg: u64, std_dev: u64, len: usize) -> Self {
         let medium_high = (high + avg) / 2;
         let medium_low = (low + avg) / 2;
         let highest = high + std_dev;
@@ -140,13 +163,12 @@ impl SpendQSnapshot {
         };
 
         debug!(
-            "stats: highest {highest}, high {high}, medium_high {medium_high}, avg {avg}, medium_low {medium_low}, low {low}, lowest {lowest}, std_dev {std_dev}, len {len}, queue {:?}",
-            queue
+            "stats: highest {highest}, high {high}, medium_high {medium_high}, avg {avg}, medium_low {medium_low}, low {low}, lowest {lowest}, std_dev {std_dev}, len {len}",
         );
 
         Self {
             #[cfg(test)]
-            queue,
+            queue: vec![],
             stats: SpendQStats {
                 highest,
                 high,
@@ -182,27 +204,11 @@ impl<T: Eq + Hash> SpendQ<T> {
         let default_val = u64::max(4, current_fee);
         Self {
             queue: PriorityQueue::new(),
+            fees: FeeSet::default(),
             snapshot: SpendQSnapshot::new(vec![2 * default_val, default_val, default_val / 2]),
-            last_pop: Instant::now(),
         }
     }
 
-    /// We set a limit on how many tx will be processed per s.
-    /// As the network grows, the total capacity will grow as well.
-    ///
-    /// Example:
-    /// 1 tps for a group of 4 gives
-    /// -> 25600 tps with 102400 nodes
-    /// -> 76800 tps with 307200 nodes
-    /// -> etc..
-    /// ..and for a group of 8 gives
-    /// -> 12800 tps with 102400 nodes
-    /// -> 38400 tps with 307200 nodes
-    /// -> etc..
-    pub fn elapsed(&self) -> bool {
-        Instant::now() - self.last_pop > Duration::from_secs(1)
-    }
-
     /// Return a snapshot of the fees in the queue, with preserved order.
     pub fn snapshot(&self) -> SpendQSnapshot {
         self.snapshot.clone()
@@ -211,60 +217,136 @@ impl<T: Eq + Hash> SpendQ<T> {
     /// This requires all validation of the fee to have already been made.
     /// There is no validation here!
     pub fn push(&mut self, item: T, priority: u64) {
-        let _ = self.queue.push(item, priority);
+        // An item already queued has its priority replaced.
+        if let Some((replaced, _)) = self.queue.push(item, (priority, Reverse(Instant::now()))) {
+            self.fees.remove(replaced);
+        }
+        self.fees.insert(priority);
         // We update our snapshot after every change to the queue.
         self.set_snapshot();
     }
 
     /// Pop the highest priority item from the queue.
     pub fn pop(&mut self) -> Option<(T, u64)> {
-        let item = self.queue.pop();
+        self.pop_queued()
+            .map(|(item, priority, _)| (item, priority))
+    }
+
+    /// Pop up to `max` of the highest priority items from the queue,
+    /// along with how long they were queued for.
+    pub fn pop_batch(&mut self, max: usize) -> Vec<(T, u64, Duration)> {
+        std::iter::from_fn(|| self.pop_queued()).take(max).collect()
+    }
+
+    /// The number of items in the queue.
+    pub fn len(&self) -> usize {
+        self.queue.len()
+    }
+
+    /// Whether the queue is empty.
+    pub fn is_empty(&self) -> bool {
+        self.queue.is_empty()
+    }
+
+    fn pop_queued(&mut self) -> Option<(T, u64, Duration)> {
+        let (item, (priority, Reverse(queued_at))) = self.queue.pop()?;
+        self.fees.remove(priority);
 
         // Preserve last 3 items in snapshot, as to preserve the current fee.
         if self.queue.len() > 3 {
             // We update our snapshot after every change to the queue, except when only 3 left.
             self.set_snapshot();
         }
-        // To achieve our desired tsp, we set the `last_pop` time to now.
-        self.last_pop = Instant::now();
 
-        item
+        Some((item, priority, queued_at.elapsed()))
     }
 
-    // Populate the snapshot with the fees only, and
-    // sort them, so that stats are properly calculated over them.
-    // Makes sure at least 3 items are in the snapshot.
+    // Populate the snapshot with the stats of the fees.
+    // Makes sure at least 3 fees are counted in the snapshot.
     fn set_snapshot(&mut self) {
-        let mut queue: Vec<_> = self.queue.iter().map(|(_, fee)| *fee).collect();
-
-        queue.sort();
-        queue.reverse(); // highest first
+        let (highest, lowest) = match (self.fees.highest(), self.fees.lowest()) {
+            (Some(highest), Some(lowest)) => (highest, lowest),
+            _ => {
+                // this should be unreachable
+                let default_val = 4;
+                self.snapshot =
+                    SpendQSnapshot::new(vec![2 * default_val, default_val, default_val / 2]);
+                return;
+            }
+        };
 
-        let queue = if self.queue.is_empty() {
-            // this should be unreachable
-            let default_val = 4;
-            vec![2 * default_val, default_val, default_val / 2]
-        } else if queue.len() == 1 {
+        self.snapshot = match self.fees.len {
             // with one value, the spread is large
-            vec![2 * queue[0], queue[0], queue[0] / 2]
-        } else if self.queue.len() == 2 {
+            1 => SpendQSnapshot::new(vec![2 * highest, highest, highest / 2]),
             // with two values, the spread is lower
-            vec![queue[0], (queue[0] + queue[1]) / 2, queue[1]]
-        } else {
-            queue
+            2 => SpendQSnapshot::new(vec![highest, (highest + lowest) / 2, lowest]),
+            len => {
+                let (avg, std_dev) = self.fees.avg_and_std_dev();
+                #[allow(unused_mut)]
+                let mut snapshot = SpendQSnapshot::with_stats(highest, lowest, avg, std_dev, len);
+                #[cfg(test)]
+                {
+                    snapshot.queue = self.fees.sorted_highest_first();
+                }
+                snapshot
+            }
         };
+    }
+}
 
-        self.snapshot = SpendQSnapshot::new(queue);
+impl FeeSet {
+    fn insert(&mut self, fee: u64) {
+        *self.counts.entry(fee).or_default() += 1;
+        self.len += 1;
+        self.sum += fee as u128;
+        self.sum_of_squares += fee as u128 * fee as u128;
     }
 
-    #[cfg(test)]
-    fn is_empty(&self) -> bool {
-        self.queue.is_empty()
+    fn remove(&mut self, fee: u64) {
+        match self.counts.get_mut(&fee) {
+            Some(count) if *count > 1 => *count -= 1,
+            Some(_) => {
+                let _ = self.counts.remove(&fee);
+            }
+            None => return,
+        }
+        self.len -= 1;
+        self.sum -= fee as u128;
+        self.sum_of_squares -= fee as u128 * fee as u128;
+    }
+
+    fn highest(&self) -> Option<u64> {
+        self.counts.keys().next_back().copied()
+    }
+
+    fn lowest(&self) -> Option<u64> {
+        self.counts.keys().next().copied()
+    }
+
+    // The avg fee, and the standard deviation from it, as calculated by `calc_stats`.
+    // The sum of squared differences is expanded into the running sums:
+    // sum((avg - fee)^2) = sum(fee^2) - 2 * avg * sum(fee) + len * avg^2
+    fn avg_and_std_dev(&self) -> (u64, u64) {
+        if self.len == 0 {
+            return (0, 0);
+        }
+
+        let avg = (self.sum as f64 / self.len as f64).round() as u64;
+        let (avg_wide, len) = (avg as i128, self.len as i128);
+        let squared_diffs = self.sum_of_squares as i128 - 2 * avg_wide * self.sum as i128
+            + len * avg_wide * avg_wide;
+        let variance = squared_diffs.max(0) as f64 / self.len as f64;
+
+        (avg, variance.sqrt().round() as u64)
     }
 
     #[cfg(test)]
-    fn len(&self) -> usize {
-        self.queue.len()
+    fn sorted_highest_first(&self) -> Vec<u64> {
+        self.counts
+            .iter()
+            .rev()
+            .flat_map(|(fee, count)| std::iter::repeat(*fee).take(*count))
+            .collect()
     }
 }
 
@@ -318,7 +400,7 @@ mod tests {
 
         let snapshot = spendq.snapshot();
 
-        let non_sorted_vec: Vec<_> = spendq.queue.iter().map(|(_, fee)| *fee).collect();
+        let non_sorted_vec: Vec<_> = spendq.queue.iter().map(|(_, (fee, _))| *fee).collect();
         let sorted_vec = snapshot.queue;
 
         // This shall show that we are required to sort the vec,
@@ -598,4 +680,62 @@ mod tests {
 
         Ok(())
     }
+
+    #[test]
+    #[allow(clippy::result_large_err)]
+    fn batches_are_popped_highest_fee_first_then_oldest_first() -> Result<()> {
+        let mut spendq = SpendQ::<usize>::with_fee(0);
+
+        spendq.push(1, 10);
+        spendq.push(2, 20);
+        // The item of the same fee is queued later.
+        std::thread::sleep(Duration::from_millis(1));
+        spendq.push(3, 10);
+        spendq.push(4, 30);
+
+        let batch: Vec<_> = spendq
+            .pop_batch(3)
+            .into_iter()
+            .map(|(item, fee, _)| (item, fee))
+            .collect();
+        assert_eq!(batch, vec![(4, 30), (2, 20), (1, 10)]);
+        assert_eq!(spendq.len(), 1);
+
+        let batch = spendq.pop_batch(3);
+        assert_eq!(batch.len(), 1);
+        assert!(spendq.is_empty());
+        assert!(spendq.pop_batch(3).is_empty());
+
+        Ok(())
+    }
+
+    #[test]
+    #[allow(clippy::result_large_err)]
+    fn incremental_stats_match_stats_of_the_sorted_queue() -> Result<()> {
+        let mut spendq = SpendQ::<usize>::with_fee(0);
+
+        for item in 0..1000 {
+            spendq.push(item, rand::random::<u64>() % 1_000_000);
+            // Replacing the fee of a queued item replaces it in the stats.
+            if item % 7 == 0 {
+                spendq.push(item / 2, rand::random::<u64>() % 1_000_000);
+            }
+            if item % 3 == 0 {
+                let _ = spendq.pop();
+            }
+
+            if spendq.len() > 3 {
+                let mut fees: Vec<_> = spendq.queue.iter().map(|(_, (fee, _))| *fee).collect();
+                fees.sort();
+                fees.reverse();
+                let expected = SpendQSnapshot::new(fees.clone());
+
+                let snapshot = spendq.snapshot();
+                assert_eq!(snapshot.queue, fees);
+                assert_eq!(snapshot.stats(), expected.stats());
+            }
+        }
+
+        Ok(())
+    }
 }
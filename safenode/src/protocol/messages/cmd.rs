@@ -6,13 +6,16 @@
 // KIND, either express or implied. Please review the Licences for the specific language governing
 // permissions and limitations relating to use of the SAFE Network Software.
 
-use super::RegisterCmd;
+use super::{
+    first_of_batch, RegisterCmd, ReplicatedData, MAX_CHUNK_BATCH_SIZE, MAX_REPLICATION_BATCH_SIZE,
+};
 
 use crate::{
     node::NodeId,
     protocol::{
         address::{dbc_address, ChunkAddress, DataAddress},
         chunk::Chunk,
+        error::Result,
         fees::FeeCiphers,
     },
 };
@@ -35,6 +38,14 @@ pub enum Cmd {
     ///
     /// [`Chunk`]: crate::protocol::chunk::Chunk
     StoreChunk(Chunk),
+    /// [`Chunk`] write operation of several chunks at once, with a result for each of them.
+    ///
+    /// The cmd is sent to the close group of the first chunk, so it is meant for chunks
+    /// sharing their close group. It holds at most [`MAX_CHUNK_BATCH_SIZE`] chunks.
+    ///
+    /// [`Chunk`]: crate::protocol::chunk::Chunk
+    /// [`MAX_CHUNK_BATCH_SIZE`]: super::MAX_CHUNK_BATCH_SIZE
+    StoreChunks(Vec<Chunk>),
     /// [`Register`] write operation.
     ///
     /// [`Register`]: crate::protocol::register::Register
@@ -55,17 +66,30 @@ pub enum Cmd {
         #[debug(skip)]
         fee_ciphers: BTreeMap<NodeId, FeeCiphers>,
     },
+    /// Data held by a node, sent to the peer which joined the close group of it.
+    ///
+    /// The data is sent in batches of at most [`MAX_REPLICATION_BATCH_SIZE`] items,
+    /// which are meant for addresses the peer is responsible for.
+    ///
+    /// [`MAX_REPLICATION_BATCH_SIZE`]: super::MAX_REPLICATION_BATCH_SIZE
+    Replicate(Vec<ReplicatedData>),
 }
 
 impl Cmd {
     /// Used to send a cmd to the close group of the address.
-    pub fn dst(&self) -> DataAddress {
-        match self {
+    /// Fails for a batch which is empty, or larger than its kind of cmd allows.
+    pub fn dst(&self) -> Result<DataAddress> {
+        let address = match self {
             Cmd::StoreChunk(chunk) => DataAddress::Chunk(ChunkAddress::new(*chunk.name())),
+            Cmd::StoreChunks(chunks) => {
+                DataAddress::Chunk(*first_of_batch(chunks, MAX_CHUNK_BATCH_SIZE)?.address())
+            }
             Cmd::Register(cmd) => DataAddress::Register(cmd.dst()),
             Cmd::SpendDbc { signed_spend, .. } => {
                 DataAddress::Spend(dbc_address(signed_spend.dbc_id()))
             }
-        }
+            Cmd::Replicate(batch) => first_of_batch(batch, MAX_REPLICATION_BATCH_SIZE)?.dst(),
+        };
+        Ok(address)
     }
 }
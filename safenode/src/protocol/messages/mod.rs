@@ -29,6 +29,7 @@ pub use self::{
 use super::{
     address::{dbc_address, dbc_name, DataAddress, DbcAddress},
     chunk::Chunk,
+    error::{Error, Result},
 };
 
 use sn_dbc::SignedSpend;
@@ -57,6 +58,20 @@ pub enum Response {
     Query(QueryResponse),
 }
 
+/// The max number of items replicated to a peer in one [`Cmd::Replicate`].
+pub const MAX_REPLICATION_BATCH_SIZE: usize = 16;
+
+/// The max number of chunks stored or retrieved in one [`Cmd::StoreChunks`] or [`Query::GetChunks`].
+pub const MAX_CHUNK_BATCH_SIZE: usize = 16;
+
+/// The max number of chunks checked in one [`Query::HasChunks`]. Their addresses fit well
+/// within the limits of a query frame, and no chunk is read to answer it.
+pub const MAX_PROBED_CHUNKS: usize = 1024;
+
+/// The max number of dbcs whose fees are quoted in one [`SpendQuery::GetFees`]. Each fee
+/// quoted is encrypted to its dbc id, so this bounds the work a single query can ask for.
+pub const MAX_QUOTED_DBCS: usize = 64;
+
 /// Messages to replicated data among nodes on the network
 #[allow(clippy::large_enum_variant)]
 #[derive(Debug, Eq, PartialEq, Clone, Serialize, Deserialize)]
@@ -75,15 +90,28 @@ pub enum ReplicatedData {
 
 impl Request {
     /// Used to send a request to the close group of the address.
-    pub fn dst(&self) -> DataAddress {
+    /// Fails for a batch which is empty, or larger than its kind of request allows.
+    pub fn dst(&self) -> Result<DataAddress> {
         match self {
             Request::Cmd(cmd) => cmd.dst(),
             Request::Query(query) => query.dst(),
-            Request::Event(event) => event.dst(),
+            Request::Event(event) => Ok(event.dst()),
         }
     }
 }
 
+// Returns the first item of the batch, to whose close group the batch is sent,
+// unless the batch is empty, or holds more than `max` items.
+fn first_of_batch<T>(items: &[T], max: usize) -> Result<&T> {
+    match items.first() {
+        Some(first) if items.len() <= max => Ok(first),
+        _ => Err(Error::InvalidBatchSize {
+            len: items.len(),
+            max,
+        }),
+    }
+}
+
 impl ReplicatedData {
     /// Return the name.
     pub fn name(&self) -> XorName {
@@ -6,10 +6,11 @@
 // KIND, either express or implied. Please review the Licences for the specific language governing
 // permissions and limitations relating to use of the SAFE Network Software.
 
-use super::spend::SpendQuery;
+use super::{first_of_batch, spend::SpendQuery, MAX_CHUNK_BATCH_SIZE, MAX_PROBED_CHUNKS};
 
 use crate::protocol::{
     address::{ChunkAddress, DataAddress},
+    error::Result,
     messages::RegisterQuery,
 };
 
@@ -31,6 +32,26 @@ pub enum Query {
     /// [`Chunk`]:  crate::protocol::chunk::Chunk
     /// [`GetChunk`]: super::QueryResponse::GetChunk
     GetChunk(ChunkAddress),
+    /// Retrieve the [`Chunk`]s at the given addresses.
+    ///
+    /// The query is sent to the close group of the first address, so it is meant for
+    /// addresses sharing their close group. It holds at most [`MAX_CHUNK_BATCH_SIZE`]
+    /// addresses. This should eventually lead to a [`GetChunks`] response.
+    ///
+    /// [`Chunk`]:  crate::protocol::chunk::Chunk
+    /// [`MAX_CHUNK_BATCH_SIZE`]: super::MAX_CHUNK_BATCH_SIZE
+    /// [`GetChunks`]: super::QueryResponse::GetChunks
+    GetChunks(Vec<ChunkAddress>),
+    /// Check which of the [`Chunk`]s at the given addresses are held.
+    ///
+    /// The query is sent to the close group of the first address, so it is meant for
+    /// addresses close to each other. It holds at most [`MAX_PROBED_CHUNKS`] addresses.
+    /// This should eventually lead to a [`HasChunks`] response.
+    ///
+    /// [`Chunk`]:  crate::protocol::chunk::Chunk
+    /// [`MAX_PROBED_CHUNKS`]: super::MAX_PROBED_CHUNKS
+    /// [`HasChunks`]: super::QueryResponse::HasChunks
+    HasChunks(Vec<ChunkAddress>),
     /// [`Register`] read operation.
     ///
     /// [`Register`]: crate::protocol::register::Register
@@ -43,11 +64,19 @@ pub enum Query {
 
 impl Query {
     /// Used to send a query to the close group of the address.
-    pub fn dst(&self) -> DataAddress {
-        match self {
+    /// Fails for a batch of addresses which is empty, or larger than its kind of query allows.
+    pub fn dst(&self) -> Result<DataAddress> {
+        let address = match self {
             Query::GetChunk(address) => DataAddress::Chunk(*address),
+            Query::GetChunks(addresses) => {
+                DataAddress::Chunk(*first_of_batch(addresses, MAX_CHUNK_BATCH_SIZE)?)
+            }
+            Query::HasChunks(addresses) => {
+                DataAddress::Chunk(*first_of_batch(addresses, MAX_PROBED_CHUNKS)?)
+            }
             Query::Register(query) => DataAddress::Register(query.dst()),
-            Query::Spend(query) => DataAddress::Spend(query.dst()),
-        }
+            Query::Spend(query) => DataAddress::Spend(query.dst()?),
+        };
+        Ok(address)
     }
 }
@@ -15,6 +15,7 @@ use crate::protocol::{
 use crate::protocol::{messages::QueryResponse, register::Register};
 
 use serde::{Deserialize, Serialize};
+use std::collections::BTreeSet;
 use xor_name::XorName;
 
 /// Register data exchange among replicas on the network.
@@ -22,7 +23,8 @@ use xor_name::XorName;
 pub struct ReplicatedRegisterLog {
     /// Register address
     pub address: RegisterAddress,
-    /// Register ops log
+    /// Register ops log, or the part of it another replica is missing,
+    /// when sent in response to a [`RegisterQuery::GetDelta`].
     pub op_log: Vec<RegisterCmd>,
 }
 
@@ -76,6 +78,18 @@ pub enum RegisterQuery {
     ///
     /// [`GetRegisterOwner`]: QueryResponse::GetRegisterOwner
     GetOwner(RegisterAddress),
+    /// Retrieve the cmds of the entries of the [`Register`] at the given address, which a replica
+    /// holding the given latest entries is missing, along with the entries they were written atop.
+    ///
+    /// This should eventually lead to a [`GetRegisterDelta`] response.
+    ///
+    /// [`GetRegisterDelta`]: QueryResponse::GetRegisterDelta
+    GetDelta {
+        /// Register address.
+        address: RegisterAddress,
+        /// The hashes of the latest entries of the replica, as returned by [`Register::heads`].
+        known_heads: BTreeSet<EntryHash>,
+    },
 }
 
 /// A [`Register`] cmd that is stored in a log on Adults.
@@ -168,7 +182,8 @@ impl RegisterQuery {
             | Self::GetPolicy(ref address)
             | Self::GetUserPermissions { ref address, .. }
             | Self::GetEntry { ref address, .. }
-            | Self::GetOwner(ref address) => *address,
+            | Self::GetOwner(ref address)
+            | Self::GetDelta { ref address, .. } => *address,
         }
     }
 }
@@ -12,6 +12,7 @@ use crate::{
         chunk::Chunk,
         error::Result,
         fees::RequiredFee,
+        messages::ReplicatedRegisterLog,
         register::{Entry, EntryHash, Permissions, Policy, Register, User},
     },
 };
@@ -22,19 +23,23 @@ use crate::protocol::messages::RegisterQuery;
 use sn_dbc::SignedSpend;
 
 use serde::{Deserialize, Serialize};
-use std::{collections::BTreeSet, fmt::Debug};
+use std::{
+    collections::BTreeSet,
+    fmt::{self, Debug, Formatter},
+    sync::Arc,
+};
 
 /// The response to a query, containing the query result.
 #[allow(clippy::large_enum_variant)]
-#[derive(Debug, Clone, PartialEq, Eq, Serialize, Deserialize)]
+#[derive(custom_debug::Debug, Clone, PartialEq, Eq, Serialize, Deserialize)]
 pub enum QueryResponse {
     //
     // ===== DBC Data =====
     //
-    /// Response to [`GetFees`].
+    /// Response to [`GetFees`], with the fee for each of the queried ids, in the order they were given.
     ///
     /// [`GetFees`]: crate::protocol::messages::SpendQuery::GetFees
-    GetFees(Result<(NodeId, RequiredFee)>),
+    GetFees(Result<(NodeId, Vec<RequiredFee>)>),
     /// If the queried node has validated a corresponding spend
     /// request, it will return the SignedSpend.
     /// It is up to the Client to get this SignedSpend from enough
@@ -52,21 +57,62 @@ pub enum QueryResponse {
     ///
     /// [`GetChunk`]: crate::protocol::messages::Query::GetChunk
     GetChunk(Result<Chunk>),
+    /// Response to [`GetChunks`], with the result of retrieving each of the chunks,
+    /// in the order of their addresses, or an error if the batch itself was invalid.
+    ///
+    /// [`GetChunks`]: crate::protocol::messages::Query::GetChunks
+    GetChunks(Result<Vec<Result<Chunk>>>),
+    /// Response to [`HasChunks`], telling whether each of the chunks queried is held,
+    /// in the order of their addresses, or an error if the batch itself was invalid.
+    ///
+    /// [`HasChunks`]: crate::protocol::messages::Query::HasChunks
+    HasChunks(Result<Vec<bool>>),
     //
     // ===== Register Data =====
     //
     /// Response to [`RegisterQuery::Get`].
     GetRegister(Result<Register>),
     /// Response to [`RegisterQuery::GetEntry`].
-    GetRegisterEntry(Result<Entry>),
+    GetRegisterEntry(#[debug(with = "fmt_entry")] Result<Entry>),
     /// Response to [`RegisterQuery::GetOwner`].
     GetRegisterOwner(Result<User>),
-    /// Response to [`RegisterQuery::Read`].
-    ReadRegister(Result<BTreeSet<(EntryHash, Entry)>>),
+    /// Response to [`RegisterQuery::Read`], with the entries shared with the other readers.
+    ReadRegister(#[debug(with = "fmt_entries")] Result<Arc<BTreeSet<(EntryHash, Entry)>>>),
     /// Response to [`RegisterQuery::GetPolicy`].
     GetRegisterPolicy(Result<Policy>),
     /// Response to [`RegisterQuery::GetUserPermissions`].
     GetRegisterUserPermissions(Result<Permissions>),
+    /// Response to [`RegisterQuery::GetDelta`], with the missing cmds as a partial ops log.
+    GetRegisterDelta(Result<ReplicatedRegisterLog>),
+}
+
+// Entries are logged by their size, not their bytes.
+fn fmt_entry(entry: &Result<Entry>, f: &mut Formatter) -> fmt::Result {
+    match entry {
+        Ok(entry) => write!(f, "Ok(<{} bytes>)", entry.len()),
+        Err(err) => write!(f, "Err({err:?})"),
+    }
+}
+
+// Entries are logged by their hash and size, not their bytes.
+fn fmt_entries(
+    entries: &Result<Arc<BTreeSet<(EntryHash, Entry)>>>,
+    f: &mut Formatter,
+) -> fmt::Result {
+    match entries {
+        Ok(entries) => {
+            write!(f, "Ok(")?;
+            f.debug_map()
+                .entries(
+                    entries
+                        .iter()
+                        .map(|(hash, entry)| (hash, format_args!("<{} bytes>", entry.len()))),
+                )
+                .finish()?;
+            write!(f, ")")
+        }
+        Err(err) => write!(f, "Err({err:?})"),
+    }
 }
 
 /// The response to a Cmd, containing the query result.
@@ -82,6 +128,9 @@ pub enum CmdResponse {
     //
     /// Response to Cmd::StoreChunk
     StoreChunk(Result<()>),
+    /// Response to Cmd::StoreChunks, with the result of storing each of the chunks,
+    /// in the order they were given, or an error if the batch itself was invalid.
+    StoreChunks(Result<Vec<Result<()>>>),
     //
     // ===== Register Data =====
     //
@@ -89,4 +138,9 @@ pub enum CmdResponse {
     CreateRegister(Result<()>),
     /// Response to RegisterCmd::Edit.
     EditRegister(Result<()>),
+    //
+    // ===== Replication =====
+    //
+    /// Response to Cmd::Replicate, with the first error storing the items, if any.
+    Replicate(Result<()>),
 }
@@ -6,8 +6,11 @@
 // KIND, either express or implied. Please review the Licences for the specific language governing
 // permissions and limitations relating to use of the SAFE Network Software.
 
+use super::{first_of_batch, MAX_QUOTED_DBCS};
+
 use crate::protocol::{
     address::{dbc_address, DbcAddress},
+    error::Result,
     fees::SpendPriority,
 };
 
@@ -18,10 +21,14 @@ use serde::{Deserialize, Serialize};
 /// A spend related query to the network.
 #[derive(Eq, PartialEq, PartialOrd, Clone, Serialize, Deserialize, Debug)]
 pub enum SpendQuery {
-    /// Query for the current fee for processing a `Spend` of a Dbc with the given id.
+    /// Query for the current fees for processing a `Spend` of each of the Dbcs with the given ids.
+    /// The Dbcs of a query are expected to share their close group, and there are at most
+    /// [`MAX_QUOTED_DBCS`] of them.
+    ///
+    /// [`MAX_QUOTED_DBCS`]: super::MAX_QUOTED_DBCS
     GetFees {
-        /// The id of the Dbc to spend.
-        dbc_id: DbcId,
+        /// The ids of the Dbcs to spend.
+        dbc_ids: Vec<DbcId>,
         /// The priority of the spend.
         priority: SpendPriority,
     },
@@ -31,10 +38,15 @@ pub enum SpendQuery {
 
 impl SpendQuery {
     /// Returns the dst address for the query.
-    pub fn dst(&self) -> DbcAddress {
+    /// Fails for a batch of dbc ids which is empty, or larger than [`MAX_QUOTED_DBCS`].
+    ///
+    /// [`MAX_QUOTED_DBCS`]: super::MAX_QUOTED_DBCS
+    pub fn dst(&self) -> Result<DbcAddress> {
         match self {
-            Self::GetFees { dbc_id, .. } => dbc_address(dbc_id),
-            Self::GetDbcSpend(ref address) => *address,
+            Self::GetFees { dbc_ids, .. } => {
+                Ok(dbc_address(first_of_batch(dbc_ids, MAX_QUOTED_DBCS)?))
+            }
+            Self::GetDbcSpend(ref address) => Ok(*address),
         }
     }
 }
@@ -35,7 +35,7 @@ use xor_name::XorName;
 const MAX_REG_ENTRY_SIZE: usize = MIN_ENCRYPTABLE_BYTES / 3; // 1024 bytes
 
 /// Maximum number of entries of a register.
-const MAX_REG_NUM_ENTRIES: u16 = 1024;
+pub const MAX_REG_NUM_ENTRIES: u16 = 1024;
 
 /// Register mutation operation to apply to Register.
 pub type RegisterOp<T> = CrdtOperation<T>;
@@ -112,6 +112,18 @@ impl Register {
         self.crdt.read()
     }
 
+    /// Return the hashes of the last entries, which summarise all the entries held,
+    /// as every other entry is one they were written atop, directly or not.
+    pub fn heads(&self) -> BTreeSet<EntryHash> {
+        self.crdt.heads()
+    }
+
+    /// Return the hashes of the entries missing to a replica whose last entries are `known_heads`.
+    /// Entries of branches forked before them may be returned, though already held.
+    pub fn missing_from(&self, known_heads: &BTreeSet<EntryHash>) -> BTreeSet<EntryHash> {
+        self.crdt.missing_from(known_heads)
+    }
+
     /// Return user permissions, if applicable.
     pub fn permissions(&self, user: User) -> Result<Permissions> {
         self.policy.permissions(user).ok_or(Error::NoSuchUser(user))
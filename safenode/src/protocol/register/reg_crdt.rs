@@ -46,7 +46,7 @@ impl Display for EntryHash {
 }
 
 /// CRDT Data operation applicable to other Register replica.
-#[derive(Debug, Clone, Serialize, Deserialize, PartialEq, Eq)]
+#[derive(Clone, Serialize, Deserialize, PartialEq, Eq)]
 pub struct CrdtOperation<T> {
     /// Address of a Register object on the network.
     pub address: RegisterAddress,
@@ -58,8 +58,21 @@ pub struct CrdtOperation<T> {
     pub signature: Option<Signature>,
 }
 
+// Logs the size of the entry rather than its bytes, which are logged along with every op.
+impl<T: AsRef<[u8]>> Debug for CrdtOperation<T> {
+    fn fmt(&self, f: &mut Formatter) -> FmtResult {
+        f.debug_struct("CrdtOperation")
+            .field("address", &self.address)
+            .field("entry_size", &self.crdt_op.value.as_ref().len())
+            .field("children", &self.crdt_op.children.len())
+            .field("source", &self.source)
+            .field("signed", &self.signature.is_some())
+            .finish()
+    }
+}
+
 /// Register data type as a CRDT with Access Control
-#[derive(Clone, Debug, Serialize, Deserialize, PartialEq, Eq, Hash, PartialOrd)]
+#[derive(Clone, Serialize, Deserialize, PartialEq, Eq, Hash, PartialOrd)]
 pub(crate) struct RegisterCrdt {
     /// Address on the network of this piece of data
     address: RegisterAddress,
@@ -67,6 +80,17 @@ pub(crate) struct RegisterCrdt {
     data: MerkleReg<Entry>,
 }
 
+// Logs the number of entries rather than all of them, use `Display` for those.
+impl Debug for RegisterCrdt {
+    fn fmt(&self, f: &mut Formatter) -> FmtResult {
+        f.debug_struct("RegisterCrdt")
+            .field("address", &self.address)
+            .field("size", &self.size())
+            .field("heads", &self.heads())
+            .finish()
+    }
+}
+
 impl Display for RegisterCrdt {
     fn fmt(&self, f: &mut Formatter) -> fmt::Result {
         write!(f, "(")?;
@@ -159,6 +183,35 @@ impl RegisterCrdt {
             .map(|(hash, node)| (EntryHash(hash), node.value.clone()))
             .collect()
     }
+
+    /// Returns the hashes of the current entries, the heads of the DAG of entries.
+    pub(crate) fn heads(&self) -> BTreeSet<EntryHash> {
+        self.data
+            .read()
+            .hashes_and_nodes()
+            .map(|(hash, _)| EntryHash(hash))
+            .collect()
+    }
+
+    /// Returns the hashes of the entries missing to a replica whose heads are `known_heads`.
+    ///
+    /// The DAG is walked back from our heads, and not past the known heads, as the other
+    /// replica holds them along with all the entries they were written atop. So the cost
+    /// is that of the entries it is missing, but for the entries of a branch forked off
+    /// before the known heads, which are returned down to the root, as they may be missing.
+    pub(crate) fn missing_from(&self, known_heads: &BTreeSet<EntryHash>) -> BTreeSet<EntryHash> {
+        let mut missing = BTreeSet::new();
+        let mut to_visit: Vec<EntryHash> = self.heads().into_iter().collect();
+        while let Some(hash) = to_visit.pop() {
+            if known_heads.contains(&hash) || !missing.insert(hash) {
+                continue;
+            }
+            if let Some(node) = self.data.node(hash.0) {
+                to_visit.extend(node.children.iter().map(|child| EntryHash(*child)));
+            }
+        }
+        missing
+    }
 }
 
 #[cfg(test)]
@@ -31,7 +31,7 @@ mod error;
 mod offline;
 mod online;
 
-#[cfg(test)]
+#[cfg(any(test, feature = "bench"))]
 pub(crate) use self::offline::create_transfer as create_offline_transfer;
 
 pub(crate) use self::{
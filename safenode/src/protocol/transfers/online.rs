@@ -8,19 +8,11 @@
 
 use super::{CreatedDbc, Error, Inputs, Outputs, Result};
 
-use crate::{
-    client::Client,
-    network::close_group_majority,
-    node::NodeId,
-    protocol::{
-        fees::{RequiredFee, SpendPriority},
-        messages::{Query, QueryResponse, Request, Response, SpendQuery},
-    },
-};
+use crate::{client::Client, network::close_group_majority, protocol::fees::SpendPriority};
 
 use sn_dbc::{
-    rng, Dbc, DbcId, DbcIdSource, DerivedKey, Hash, InputHistory, PublicAddress, RevealedInput,
-    Token, TransactionBuilder,
+    rng, Dbc, DbcIdSource, DerivedKey, Hash, InputHistory, PublicAddress, RevealedInput, Token,
+    TransactionBuilder,
 };
 
 use std::collections::{BTreeMap, BTreeSet};
@@ -81,25 +73,38 @@ async fn select_inputs(
     let mut all_fee_cipher_params = BTreeMap::new();
     let mut fees_paid = Token::zero();
 
-    for (dbc, derived_key) in available_dbcs {
-        let dbc_id = dbc.id();
-
-        let dbc_balance = match dbc.revealed_amount(&derived_key) {
-            Ok(revealed_amount) => Token::from_nano(revealed_amount.value()),
+    let spendable_dbcs: Vec<_> = available_dbcs
+        .into_iter()
+        .filter_map(|(dbc, derived_key)| match dbc.revealed_amount(&derived_key) {
+            Ok(revealed_amount) => {
+                let dbc_balance = Token::from_nano(revealed_amount.value());
+                Some((dbc, derived_key, dbc_balance))
+            }
             Err(err) => {
-                warn!("Ignoring input dbc (id: {dbc_id:?}) due to not having correct derived key: {err:?}");
-                continue;
+                warn!("Ignoring input dbc (id: {:?}) due to not having correct derived key: {err:?}", dbc.id());
+                None
             }
-        };
+        })
+        .collect();
+
+    // The fees of all the inputs are queried at once, rather than one input after the other.
+    #[cfg(not(feature = "data-network"))]
+    let mut all_node_fees = {
+        let dbc_ids = spendable_dbcs.iter().map(|(dbc, ..)| dbc.id()).collect();
+        client.get_fees(dbc_ids, SpendPriority::Normal).await
+    };
+
+    for (dbc, derived_key, dbc_balance) in spendable_dbcs {
+        let dbc_id = dbc.id();
 
         // ------------ fee part start ----------------
         #[cfg(not(feature = "data-network"))]
         let fee_per_input = {
             // Each section will have CLOSE_GROUP_SIZE instances to pay individually.
-            let node_fees = match get_fees(dbc_id, client).await {
-                Ok(fees) => fees,
-                Err(error) => {
-                    error!("Could not get fees for input dbc: {dbc_id:?}: {error}");
+            let node_fees = match all_node_fees.remove(&dbc_id) {
+                Some(fees) => fees,
+                None => {
+                    error!("Could not get fees for input dbc: {dbc_id:?}");
                     continue;
                 }
             };
@@ -307,46 +312,3 @@ fn create_transfer_with(selected_inputs: Inputs) -> Result<Outputs> {
         change_dbc,
     })
 }
-
-async fn get_fees(dbc_id: DbcId, client: &Client) -> Result<BTreeMap<NodeId, RequiredFee>> {
-    let request = Request::Query(Query::Spend(SpendQuery::GetFees {
-        dbc_id,
-        priority: SpendPriority::Normal,
-    }));
-    let responses = client
-        .send_to_closest(request)
-        .await
-        .map_err(|e| Error::CouldNotGetFees(e.to_string()))?;
-
-    // We just want to receive at least a majority of results, we don't care about any errors
-    // so we log them, but return whatever results we get. If not enough for upper layer, it will error there.
-    let results: BTreeMap<_, _> = responses
-        .into_iter()
-        .flat_map(|res| {
-            if let Err(error) = &res {
-                warn!("Error when querying for fees: {error}");
-            }
-            res
-        })
-        .filter_map(|resp| match resp {
-            Response::Query(resp) => Some(resp),
-            other => {
-                warn!("Unexpected response to fee query: {other:?}");
-                None
-            }
-        })
-        .filter_map(|resp| match resp {
-            QueryResponse::GetFees(Ok((node_id, fee))) => Some((node_id, fee)),
-            QueryResponse::GetFees(Err(error)) => {
-                warn!("Fee query unexpectedly failed: {error}");
-                None
-            }
-            other => {
-                warn!("Unexpected response to fee query: {other:?}");
-                None
-            }
-        })
-        .collect();
-
-    Ok(results)
-}
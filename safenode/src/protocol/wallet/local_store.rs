@@ -8,13 +8,13 @@
 
 use super::{
     keys::{get_main_key, store_new_keypair},
-    wallet_file::{get_wallet, store_wallet},
+    wallet_file::{append_to_journal, get_journal, get_wallet, store_wallet, WalletChange},
     DepositWallet, KeyLessWallet, Result, SendClient, SendWallet, Wallet,
 };
 
 use crate::protocol::transfers::{CreatedDbc, Outputs as TransferDetails};
 
-use sn_dbc::{Dbc, DbcIdSource, MainKey, PublicAddress, Token};
+use sn_dbc::{Dbc, DbcId, DbcIdSource, DerivedKey, MainKey, PublicAddress, Token};
 
 use async_trait::async_trait;
 use std::{
@@ -22,6 +22,10 @@ use std::{
     path::{Path, PathBuf},
 };
 
+/// The number of changes journaled before the whole wallet is stored again,
+/// bounding the journal replayed when loading the wallet.
+const MAX_JOURNALED_CHANGES: usize = 1024;
+
 /// A wallet that can only receive tokens.
 pub struct LocalWallet {
     /// The secret key with which we can access
@@ -31,21 +35,45 @@ pub struct LocalWallet {
     wallet: KeyLessWallet,
     /// The dir of the wallet file.
     root_dir: PathBuf,
+    /// The changes made to the wallet since it was last stored.
+    unstored: Vec<WalletChange>,
+    /// The number of changes in the journal on disk.
+    journaled: usize,
 }
 
 impl LocalWallet {
     /// Stores the wallet to disk.
-    pub async fn store(&self) -> Result<()> {
-        store_wallet(&self.root_dir, &self.wallet).await
+    ///
+    /// Only the changes made since it was last stored are written, appended to a journal,
+    /// which is folded into the wallet file once it holds enough changes.
+    pub async fn store(&mut self) -> Result<()> {
+        if self.journaled + self.unstored.len() > MAX_JOURNALED_CHANGES {
+            store_wallet(&self.root_dir, &self.wallet).await?;
+            self.journaled = 0;
+        } else if !self.unstored.is_empty() {
+            append_to_journal(&self.root_dir, &self.unstored).await?;
+            self.journaled += self.unstored.len();
+        }
+        self.unstored.clear();
+        Ok(())
     }
 
     /// Loads a serialized wallet from a path.
     pub async fn load_from(root_dir: &Path) -> Result<Self> {
-        let (key, wallet) = load_from_path(root_dir).await?;
+        let (key, mut wallet) = load_from_path(root_dir).await?;
+        let journal = get_journal(root_dir).await?;
+        let journaled = journal.len();
+        for change in journal {
+            wallet.apply(change);
+        }
+        wallet.index(&key);
+
         Ok(Self {
             key,
             wallet,
             root_dir: root_dir.to_path_buf(),
+            unstored: vec![],
+            journaled,
         })
     }
 }
@@ -78,6 +106,8 @@ impl KeyLessWallet {
             balance: Token::zero(),
             spent_dbcs: BTreeMap::new(),
             available_dbcs: BTreeMap::new(),
+            spendable: BTreeMap::new(),
+            by_amount: BTreeSet::new(),
             dbcs_created_for_others: vec![],
         }
     }
@@ -86,30 +116,117 @@ impl KeyLessWallet {
         self.balance
     }
 
-    fn deposit(&mut self, dbcs: Vec<Dbc>, key: &MainKey) {
-        if dbcs.is_empty() {
-            return;
+    /// Adds those of the dbcs that belong to us and that we don't have yet,
+    /// and returns them.
+    fn deposit(&mut self, dbcs: Vec<Dbc>, key: &MainKey) -> Vec<Dbc> {
+        let mut deposited = vec![];
+        for dbc in dbcs {
+            let id = dbc.id();
+            if self.spent_dbcs.contains_key(&id) || self.available_dbcs.contains_key(&id) {
+                continue;
+            }
+            let (derived_key, amount) = match derive_spendable(&dbc, key) {
+                Some(spendable) => spendable,
+                None => continue,
+            };
+            self.add_spendable(id, derived_key, amount);
+            let _ = self.available_dbcs.insert(id, dbc.clone());
+            deposited.push(dbc);
         }
+        deposited
+    }
 
-        let mut received_dbcs = dbcs
-            .into_iter()
-            .filter_map(|dbc| {
-                let id = dbc.id();
-                (!self.spent_dbcs.contains_key(&id)).then_some((id, dbc))
-            })
-            .filter_map(|(id, dbc)| dbc.derived_key(key).is_ok().then_some((id, dbc)))
-            .collect();
+    /// Moves the dbcs with the ids from the available dbcs to the spent ones.
+    fn spend(&mut self, ids: &[DbcId]) {
+        for id in ids {
+            if let Some(dbc) = self.available_dbcs.remove(id) {
+                if let Some((_, amount)) = self.spendable.remove(id) {
+                    let _ = self.by_amount.remove(&(amount, *id));
+                    self.balance = Token::from_nano(self.balance.as_nano() - amount.as_nano());
+                }
+                let _ = self.spent_dbcs.insert(*id, dbc);
+            }
+        }
+    }
 
-        self.available_dbcs.append(&mut received_dbcs);
+    /// Applies a change from the journal, as read on load, before the wallet is indexed.
+    fn apply(&mut self, change: WalletChange) {
+        match change {
+            WalletChange::Deposited(dbcs) => {
+                for dbc in dbcs {
+                    let id = dbc.id();
+                    if !self.spent_dbcs.contains_key(&id) {
+                        let _ = self.available_dbcs.insert(id, dbc);
+                    }
+                }
+            }
+            WalletChange::Sent {
+                spent,
+                created_for_others,
+            } => {
+                // A send always spends some dbc, so if those are all spent already, the change
+                // was also stored with the wallet file, after which its journal wasn't removed.
+                if spent.iter().all(|id| self.spent_dbcs.contains_key(id)) {
+                    return;
+                }
+                for id in spent {
+                    if let Some(dbc) = self.available_dbcs.remove(&id) {
+                        let _ = self.spent_dbcs.insert(id, dbc);
+                    }
+                }
+                self.dbcs_created_for_others.extend(created_for_others);
+            }
+        }
+    }
 
-        let new_balance = self
+    /// Derives the key and amount of each of the available dbcs, and the balance they add up to.
+    fn index(&mut self, key: &MainKey) {
+        self.spendable.clear();
+        self.by_amount.clear();
+        self.balance = Token::zero();
+        let available: Vec<_> = self
             .available_dbcs
             .iter()
-            .flat_map(|(_, dbc)| dbc.derived_key(key).map(|derived_key| (dbc, derived_key)))
-            .flat_map(|(dbc, derived_key)| dbc.revealed_input(&derived_key))
-            .fold(0, |total, amount| total + amount.revealed_amount().value());
+            .filter_map(|(id, dbc)| derive_spendable(dbc, key).map(|spendable| (*id, spendable)))
+            .collect();
+        for (id, (derived_key, amount)) in available {
+            self.add_spendable(id, derived_key, amount);
+        }
+    }
+
+    fn add_spendable(&mut self, id: DbcId, derived_key: DerivedKey, amount: Token) {
+        let _ = self.by_amount.insert((amount, id));
+        let _ = self.spendable.insert(id, (derived_key, amount));
+        self.balance = Token::from_nano(self.balance.as_nano() + amount.as_nano());
+    }
+
+    /// Returns the available dbcs along with their derived keys, the largest ones first,
+    /// so that a send spends as few of them, and pays as few fees, as possible.
+    fn spendable_dbcs(&self) -> Vec<(Dbc, DerivedKey)> {
+        self.by_amount
+            .iter()
+            .rev()
+            .filter_map(|(_, id)| {
+                let dbc = self.available_dbcs.get(id)?;
+                let (derived_key, _) = self.spendable.get(id)?;
+                Some((dbc.clone(), derived_key.clone()))
+            })
+            .collect()
+    }
+}
 
-        self.balance = Token::from_nano(new_balance);
+// Returns the derived key and amount of the dbc, if it belongs to the key.
+fn derive_spendable(dbc: &Dbc, key: &MainKey) -> Option<(DerivedKey, Token)> {
+    let derived_key = dbc.derived_key(key).ok()?;
+    match dbc.revealed_amount(&derived_key) {
+        Ok(revealed_amount) => Some((derived_key, Token::from_nano(revealed_amount.value()))),
+        Err(err) => {
+            warn!(
+                "Ignoring dbc {:?}, as its amount couldn't be revealed: {err:?}",
+                dbc.id()
+            );
+            None
+        }
     }
 }
 
@@ -129,7 +246,10 @@ impl DepositWallet for LocalWallet {
     }
 
     fn deposit(&mut self, dbcs: Vec<Dbc>) {
-        self.wallet.deposit(dbcs, &self.key);
+        let deposited = self.wallet.deposit(dbcs, &self.key);
+        if !deposited.is_empty() {
+            self.unstored.push(WalletChange::Deposited(deposited));
+        }
     }
 }
 
@@ -153,39 +273,30 @@ impl SendWallet for LocalWallet {
             return Ok(vec![]);
         }
 
-        let mut available_dbcs = vec![];
-        for dbc in self.wallet.available_dbcs.values() {
-            if let Ok(derived_key) = dbc.derived_key(&self.key) {
-                available_dbcs.push((dbc.clone(), derived_key));
-            } else {
-                warn!(
-                    "Skipping DBC {:?} because we don't have the key to spend it",
-                    dbc.id()
-                );
-            }
-        }
+        let available_dbcs = self.wallet.spendable_dbcs();
 
         let TransferDetails {
             change_dbc,
             created_dbcs,
         } = client.send(available_dbcs, to, self.address()).await?;
 
-        let spent_dbc_ids: BTreeSet<_> = created_dbcs
+        let spent_dbc_ids: Vec<_> = created_dbcs
             .iter()
             .flat_map(|created| &created.dbc.signed_spends)
-            .map(|spend| spend.dbc_id())
-            .collect();
-
-        let mut spent_dbcs = spent_dbc_ids
+            .map(|spend| *spend.dbc_id())
+            .collect::<BTreeSet<_>>()
             .into_iter()
-            .filter_map(|id| self.wallet.available_dbcs.remove(id).map(|dbc| (*id, dbc)))
             .collect();
 
-        self.deposit(change_dbc.into_iter().collect());
-        self.wallet.spent_dbcs.append(&mut spent_dbcs);
+        self.wallet.spend(&spent_dbc_ids);
         self.wallet
             .dbcs_created_for_others
             .extend(created_dbcs.clone());
+        self.unstored.push(WalletChange::Sent {
+            spent: spent_dbc_ids,
+            created_for_others: created_dbcs.clone(),
+        });
+        self.deposit(change_dbc.into_iter().collect());
 
         Ok(created_dbcs)
     }
@@ -193,7 +304,7 @@ impl SendWallet for LocalWallet {
 
 #[cfg(test)]
 mod tests {
-    use super::{get_wallet, store_wallet, LocalWallet};
+    use super::{get_journal, get_wallet, store_wallet, LocalWallet, MAX_JOURNALED_CHANGES};
 
     use crate::protocol::{
         dbc_genesis::{create_genesis_dbc, GENESIS_DBC_AMOUNT},
@@ -215,7 +326,7 @@ mod tests {
         let dir = create_temp_dir()?;
         let root_dir = dir.path().to_path_buf();
 
-        wallet.deposit(vec![genesis], &key);
+        let _ = wallet.deposit(vec![genesis], &key);
 
         store_wallet(&root_dir, &wallet).await?;
 
@@ -242,6 +353,8 @@ mod tests {
             key,
             wallet: KeyLessWallet::new(),
             root_dir: dir.path().to_path_buf(),
+            unstored: vec![],
+            journaled: 0,
         };
 
         assert_eq!(public_address, deposit_only.address());
@@ -273,6 +386,8 @@ mod tests {
             key: MainKey::random(),
             wallet: KeyLessWallet::new(),
             root_dir: dir.path().to_path_buf(),
+            unstored: vec![],
+            journaled: 0,
         };
 
         deposit_only.deposit(vec![]);
@@ -300,6 +415,8 @@ mod tests {
             key,
             wallet: KeyLessWallet::new(),
             root_dir: dir.path().to_path_buf(),
+            unstored: vec![],
+            journaled: 0,
         };
 
         deposit_only.deposit(vec![genesis]);
@@ -322,6 +439,8 @@ mod tests {
             key: MainKey::random(),
             wallet: KeyLessWallet::new(),
             root_dir: dir.path().to_path_buf(),
+            unstored: vec![],
+            journaled: 0,
         };
 
         local_wallet.deposit(vec![genesis]);
@@ -495,6 +614,79 @@ mod tests {
         Ok(())
     }
 
+    #[tokio::test]
+    async fn journaled_changes_are_folded_into_the_wallet_file() -> Result<()> {
+        // Bring in the necessary traits.
+        use super::{DepositWallet, SendWallet, Wallet};
+
+        let dir = create_temp_dir()?;
+        let root_dir = dir.path().to_path_buf();
+
+        let mut sender = LocalWallet::load_from(&root_dir).await?;
+        let sender_dbc = create_genesis_dbc(&sender.key).expect("Genesis creation to succeed.");
+        sender.deposit(vec![sender_dbc]);
+        sender.store().await?;
+
+        assert_eq!(1, get_journal(&root_dir).await?.len());
+        let stored = get_wallet(&root_dir)
+            .await?
+            .expect("There to be a wallet on disk.");
+        assert_eq!(Token::zero(), stored.balance());
+
+        // The next store folds all the changes into the wallet file.
+        sender.journaled = MAX_JOURNALED_CHANGES;
+        let send_amount = 100;
+        let to = vec![(
+            Token::from_nano(send_amount),
+            MainKey::random().public_address(),
+        )];
+        let _created_dbcs = sender.send(to, &MockSendClient).await?;
+        sender.store().await?;
+
+        assert!(get_journal(&root_dir).await?.is_empty());
+        let stored = get_wallet(&root_dir)
+            .await?
+            .expect("There to be a wallet on disk.");
+        assert_eq!(GENESIS_DBC_AMOUNT - send_amount, stored.balance().as_nano());
+
+        let deserialized = LocalWallet::load_from(&root_dir).await?;
+        assert_eq!(
+            GENESIS_DBC_AMOUNT - send_amount,
+            deserialized.balance().as_nano()
+        );
+        assert_eq!(1, deserialized.wallet.available_dbcs.len());
+        assert_eq!(1, deserialized.wallet.spent_dbcs.len());
+        assert_eq!(1, deserialized.wallet.dbcs_created_for_others.len());
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn incomplete_journal_change_is_dropped() -> Result<()> {
+        // Bring in the necessary traits.
+        use super::{DepositWallet, Wallet};
+
+        let dir = create_temp_dir()?;
+        let root_dir = dir.path().to_path_buf();
+
+        let mut depositor = LocalWallet::load_from(&root_dir).await?;
+        let genesis = create_genesis_dbc(&depositor.key).expect("Genesis creation to succeed.");
+        depositor.deposit(vec![genesis]);
+        depositor.store().await?;
+
+        // As if the wallet was stopped while appending a change.
+        let journal_path = root_dir.join("wallet_journal");
+        let mut journal = std::fs::read(&journal_path)?;
+        journal.extend_from_slice(&[1, 2, 3]);
+        std::fs::write(&journal_path, journal)?;
+
+        let deserialized = LocalWallet::load_from(&root_dir).await?;
+        assert_eq!(GENESIS_DBC_AMOUNT, deserialized.balance().as_nano());
+        assert_eq!(1, get_journal(&root_dir).await?.len());
+
+        Ok(())
+    }
+
     fn create_temp_dir() -> Result<TempDir> {
         tempdir().map_err(|e| eyre!("Failed to create temp dir: {}", e))
     }
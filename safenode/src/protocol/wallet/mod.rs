@@ -118,6 +118,13 @@ pub(super) struct KeyLessWallet {
     spent_dbcs: std::collections::BTreeMap<sn_dbc::DbcId, Dbc>,
     /// These are the dbcs we own that are not yet spent.
     available_dbcs: std::collections::BTreeMap<sn_dbc::DbcId, Dbc>,
+    /// The derived key and amount of each of the available dbcs, derived once when the dbc
+    /// is deposited or the wallet is loaded, as deriving them is costly.
+    #[serde(skip)]
+    spendable: std::collections::BTreeMap<sn_dbc::DbcId, (DerivedKey, Token)>,
+    /// The available dbcs ordered by amount, from which the inputs of a send are selected.
+    #[serde(skip)]
+    by_amount: std::collections::BTreeSet<(Token, sn_dbc::DbcId)>,
     /// These are the dbcs we've created by
     /// sending tokens to other addresses.
     /// They are not owned by us, but we
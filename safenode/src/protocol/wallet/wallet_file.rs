@@ -8,17 +8,62 @@
 
 use super::{error::Result, KeyLessWallet};
 
+use crate::{protocol::transfers::CreatedDbc, storage::write_atomically};
+
+use sn_dbc::{Dbc, DbcId};
+
+use serde::{Deserialize, Serialize};
 use std::path::Path;
-use tokio::fs;
+use tokio::{fs, io::AsyncWriteExt};
 
 // Filename for storing a wallet.
 const WALLET_FILENAME: &str = "wallet";
+// Filename for the changes made to a wallet since it was last stored in full.
+const JOURNAL_FILENAME: &str = "wallet_journal";
+// The size of the length prefix of each change in the journal.
+const LEN_PREFIX_SIZE: usize = 8;
+
+/// A change made to a wallet, as recorded in its journal.
+#[derive(Debug, Serialize, Deserialize)]
+pub(super) enum WalletChange {
+    /// The dbcs were deposited to the wallet.
+    Deposited(Vec<Dbc>),
+    /// The dbcs with the ids were spent, creating the dbcs to others.
+    Sent {
+        spent: Vec<DbcId>,
+        created_for_others: Vec<CreatedDbc>,
+    },
+}
 
-/// Writes the `KeyLessWallet` to the specified path.
+/// Writes the `KeyLessWallet` to the specified path, replacing the
+/// wallet stored there along with the journal of its changes.
 pub(super) async fn store_wallet(root_dir: &Path, wallet: &KeyLessWallet) -> Result<()> {
-    let wallet_path = root_dir.join(WALLET_FILENAME);
     let bytes = bincode::serialize(&wallet)?;
-    fs::write(wallet_path, bytes).await?;
+    // The previous wallet is replaced at once, so that a failure never leaves a partial one.
+    write_atomically(&root_dir.join(WALLET_FILENAME), &bytes).await?;
+    // The rename is on disk before the journal is removed, else both could be lost on a crash.
+    sync_dir(root_dir).await?;
+
+    // All changes journaled so far are in the wallet just written.
+    // Were we to fail before the journal is removed, replaying it is detected on load.
+    if let Err(err) = fs::remove_file(root_dir.join(JOURNAL_FILENAME)).await {
+        if err.kind() != std::io::ErrorKind::NotFound {
+            return Err(err.into());
+        }
+    }
+    Ok(())
+}
+
+// Flushes the entries of the dir, e.g. a rename into it, to disk.
+#[cfg(unix)]
+async fn sync_dir(dir: &Path) -> Result<()> {
+    fs::File::open(dir).await?.sync_all().await?;
+    Ok(())
+}
+
+// Dirs can't be opened as files on other platforms, so their entries are left to the OS to flush.
+#[cfg(not(unix))]
+async fn sync_dir(_dir: &Path) -> Result<()> {
     Ok(())
 }
 
@@ -34,3 +79,56 @@ pub(super) async fn get_wallet(root_dir: &Path) -> Result<Option<KeyLessWallet>>
 
     Ok(Some(wallet))
 }
+
+/// Appends the changes to the journal of the wallet, each prefixed by its length.
+pub(super) async fn append_to_journal(root_dir: &Path, changes: &[WalletChange]) -> Result<()> {
+    let mut bytes = vec![];
+    for change in changes {
+        let change = bincode::serialize(change)?;
+        bytes.extend_from_slice(&(change.len() as u64).to_le_bytes());
+        bytes.extend_from_slice(&change);
+    }
+
+    let mut journal = fs::OpenOptions::new()
+        .create(true)
+        .append(true)
+        .open(root_dir.join(JOURNAL_FILENAME))
+        .await?;
+    journal.write_all(&bytes).await?;
+    journal.sync_data().await?;
+    Ok(())
+}
+
+/// Returns the changes in the journal of the wallet, in the order they were made.
+pub(super) async fn get_journal(root_dir: &Path) -> Result<Vec<WalletChange>> {
+    let path = root_dir.join(JOURNAL_FILENAME);
+    if !path.is_file() {
+        return Ok(vec![]);
+    }
+
+    let bytes = fs::read(&path).await?;
+    let mut changes = vec![];
+    let mut rest = &bytes[..];
+    while rest.len() >= LEN_PREFIX_SIZE {
+        let (len, remaining) = rest.split_at(LEN_PREFIX_SIZE);
+        let mut len_bytes = [0; LEN_PREFIX_SIZE];
+        len_bytes.copy_from_slice(len);
+        let len = u64::from_le_bytes(len_bytes) as usize;
+        if remaining.len() < len {
+            break;
+        }
+        let (change, remaining) = remaining.split_at(len);
+        changes.push(bincode::deserialize(change)?);
+        rest = remaining;
+    }
+
+    if !rest.is_empty() {
+        // The last append didn't complete, so the change it held was never acknowledged.
+        // It's cut off, for the changes appended next not to follow it.
+        warn!("Dropping the incomplete last change of the wallet journal at {path:?}");
+        let journal = fs::OpenOptions::new().write(true).open(&path).await?;
+        journal.set_len((bytes.len() - rest.len()) as u64).await?;
+    }
+
+    Ok(changes)
+}
@@ -0,0 +1,80 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use std::{
+    collections::BTreeMap,
+    sync::{Arc, Mutex},
+};
+use tokio::sync::{Mutex as AsyncMutex, OwnedMutexGuard};
+
+type Locks<A> = BTreeMap<A, Arc<AsyncMutex<()>>>;
+
+/// Serialises the handling of data per address.
+/// Data at different addresses is handled in parallel, while
+/// data at the same address is handled one at a time.
+/// A lock is only kept around while it is held or waited for.
+pub(crate) struct AddressLocks<A> {
+    locks: Arc<Mutex<Locks<A>>>,
+}
+
+/// Holds the lock of an address until dropped.
+pub(crate) struct AddressGuard<A: Ord> {
+    address: A,
+    locks: Arc<Mutex<Locks<A>>>,
+    guard: Option<OwnedMutexGuard<()>>,
+}
+
+impl<A> Clone for AddressLocks<A> {
+    fn clone(&self) -> Self {
+        Self {
+            locks: self.locks.clone(),
+        }
+    }
+}
+
+impl<A> Default for AddressLocks<A> {
+    fn default() -> Self {
+        Self {
+            locks: Arc::new(Mutex::new(BTreeMap::new())),
+        }
+    }
+}
+
+impl<A: Ord + Copy> AddressLocks<A> {
+    /// Waits for any other handling of the data at the address to finish,
+    /// and returns a guard that holds the lock of the address until dropped.
+    pub(crate) async fn lock(&self, address: A) -> AddressGuard<A> {
+        let lock = {
+            let mut locks = self.locks.lock().unwrap_or_else(|err| err.into_inner());
+            locks.entry(address).or_default().clone()
+        };
+
+        AddressGuard {
+            address,
+            locks: self.locks.clone(),
+            guard: Some(lock.lock_owned().await),
+        }
+    }
+}
+
+impl<A: Ord> Drop for AddressGuard<A> {
+    fn drop(&mut self) {
+        let mut locks = self.locks.lock().unwrap_or_else(|err| err.into_inner());
+        // Release the address before deciding on cleanup,
+        // so that a waiter can't be left behind on a removed lock.
+        drop(self.guard.take());
+        // The map holds one reference, any other is held by a waiter.
+        let unused = locks
+            .get(&self.address)
+            .map(|lock| Arc::strong_count(lock) == 1)
+            .unwrap_or(false);
+        if unused {
+            let _ = locks.remove(&self.address);
+        }
+    }
+}
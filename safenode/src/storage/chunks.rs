@@ -6,88 +6,414 @@
 // KIND, either express or implied. Please review the Licences for the specific language governing
 // permissions and limitations relating to use of the SAFE Network Software.
 
-use crate::protocol::{
-    address::ChunkAddress,
-    chunk::Chunk,
-    error::{Error, Result},
+use super::{
+    address_locks::AddressLocks,
+    files::{count_stored_bytes, list_sharded_names, sharded_path, write_atomically},
+    used_space::UsedSpace,
 };
 
-use clru::CLruCache;
-use std::{num::NonZeroUsize, sync::Arc};
-use tokio::sync::RwLock;
+use crate::{
+    metrics::CacheMetrics,
+    protocol::{
+        address::ChunkAddress,
+        chunk::Chunk,
+        error::{Error, Result},
+    },
+};
+
+use bytes::Bytes;
+use clru::{CLruCache, CLruCacheConfig, WeightScale};
+use futures::future::join_all;
+use std::{
+    collections::{hash_map::RandomState, BTreeSet},
+    io::ErrorKind,
+    num::NonZeroUsize,
+    path::{Path, PathBuf},
+    sync::Arc,
+};
+use tokio::{fs, sync::RwLock};
 use tracing::trace;
 
-const CHUNKS_CACHE_SIZE: usize = 20 * 1024 * 1024;
+/// The name of the dir under the node root dir, where chunks are stored.
+const CHUNKS_DIR_NAME: &str = "chunks";
+
+type ChunkCache = CLruCache<ChunkAddress, Chunk, RandomState, ChunkWeight>;
+
+/// Charges each chunk in the cache its size in bytes.
+struct ChunkWeight;
+
+impl WeightScale<ChunkAddress, Chunk> for ChunkWeight {
+    fn weight(&self, _address: &ChunkAddress, chunk: &Chunk) -> usize {
+        chunk.serialised_size()
+    }
+}
 
-/// Operations on data chunks.
+/// Disk-backed storage of chunks.
+///
+/// Every chunk is stored in its own file, in a dir sharded by the prefix of its name.
+/// Recently stored or read chunks are kept in an in-memory cache of bounded size in bytes.
+/// The bytes stored on disk are accounted for in `used_space`, and chunks are refused
+/// once the capacity is reached. A chunk is stored or removed by one call at a time.
 #[derive(Clone)]
 pub(crate) struct ChunkStorage {
-    cache: Arc<RwLock<CLruCache<ChunkAddress, Chunk>>>,
+    chunks_dir: PathBuf,
+    cache: Arc<RwLock<ChunkCache>>,
+    cache_metrics: CacheMetrics,
+    locks: AddressLocks<ChunkAddress>,
+    used_space: UsedSpace,
 }
 
 impl ChunkStorage {
-    pub(crate) fn new() -> Self {
-        let capacity =
-            NonZeroUsize::new(CHUNKS_CACHE_SIZE).expect("Failed to create in-memory Chunk storage");
+    /// Creates a new `ChunkStorage` at the given root dir, storing at most `capacity`
+    /// bytes of chunks on disk, and caching at most `cache_size` bytes of them in memory.
+    /// Chunks previously stored at the same root dir are served again.
+    pub(crate) async fn new(root_dir: &Path, cache_size: usize, capacity: usize) -> Self {
+        let cache_size =
+            NonZeroUsize::new(cache_size.max(1)).expect("Failed to create in-memory Chunk cache");
+        let chunks_dir = root_dir.join(CHUNKS_DIR_NAME);
+
+        let used_space = UsedSpace::new(capacity);
+        used_space.increase(count_stored_bytes(&chunks_dir).await);
+
         Self {
-            cache: Arc::new(RwLock::new(CLruCache::new(capacity))),
+            chunks_dir,
+            cache: Arc::new(RwLock::new(CLruCache::with_config(
+                CLruCacheConfig::new(cache_size).with_scale(ChunkWeight),
+            ))),
+            cache_metrics: CacheMetrics::default(),
+            locks: AddressLocks::default(),
+            used_space,
         }
     }
 
+    /// Returns the metrics of the in-memory cache of chunks.
+    pub(crate) fn cache_metrics(&self) -> &CacheMetrics {
+        &self.cache_metrics
+    }
+
     // Read chunk from local store
     pub(crate) async fn get(&self, address: &ChunkAddress) -> Result<Chunk> {
         trace!("Getting Chunk: {address:?}");
+        if let Some(chunk) = self.cache.write().await.get(address) {
+            self.cache_metrics.hit();
+            return Ok(chunk.clone());
+        }
+        self.cache_metrics.miss();
+
+        let chunk = self.read(address).await?;
+        let _ = self.cache_metrics.put_with_weight(
+            &mut *self.cache.write().await,
+            *address,
+            chunk.clone(),
+        );
+
+        Ok(chunk)
+    }
+
+    /// Returns the chunk without caching it, nor counting it as recently used, for reads
+    /// that would otherwise evict the chunks being served, e.g. to replicate all chunks held.
+    pub(crate) async fn get_uncached(&self, address: &ChunkAddress) -> Result<Chunk> {
         if let Some(chunk) = self.cache.read().await.peek(address) {
-            Ok(chunk.clone())
-        } else {
-            Err(Error::ChunkNotFound(*address))
+            return Ok(chunk.clone());
+        }
+        self.read(address).await
+    }
+
+    // Reads the chunk from disk, removing it if its content doesn't match its address.
+    async fn read(&self, address: &ChunkAddress) -> Result<Chunk> {
+        let path = self.chunk_path(address);
+        let bytes = match fs::read(&path).await {
+            // The read buffer is handed over to the chunk as is, without copying.
+            Ok(bytes) => Bytes::from(bytes),
+            Err(err) if err.kind() == ErrorKind::NotFound => {
+                return Err(Error::ChunkNotFound(*address))
+            }
+            Err(err) => return Err(Error::Io(err.to_string())),
+        };
+
+        let size = bytes.len();
+        let chunk = Chunk::new(bytes);
+        if chunk.address() != address {
+            warn!("Stored Chunk content doesn't match its address, removing it: {address:?}");
+            // Only the read which removes the file releases its space.
+            if fs::remove_file(&path).await.is_ok() {
+                self.used_space.decrease(size);
+            }
+            return Err(Error::ChunkNotFound(*address));
+        }
+
+        Ok(chunk)
+    }
+
+    /// Returns whether the chunk is in the local store, without reading it.
+    pub(crate) async fn contains(&self, address: &ChunkAddress) -> bool {
+        if self.cache.read().await.peek(address).is_some() {
+            return true;
         }
+        fs::metadata(self.chunk_path(address)).await.is_ok()
     }
 
-    /// Store a chunk in the local in-memory store unless it is already there
+    /// Store a chunk in the local store unless it is already there
     pub(crate) async fn store(&self, chunk: &Chunk) -> Result<()> {
         let address = chunk.address();
         trace!("About to store Chunk: {address:?}");
 
-        let _ = self.cache.write().await.try_put_or_modify(
+        // Concurrent stores of the same chunk would otherwise each write it, and account for it.
+        let _guard = self.locks.lock(*address).await;
+        if self.contains(address).await {
+            trace!("Chunk data already exists, not storing: {address:?}");
+            return Ok(());
+        }
+
+        let size = chunk.value().len();
+        if !self.used_space.try_reserve(size) {
+            return Err(Error::NotEnoughSpace);
+        }
+
+        if let Err(err) = write_atomically(&self.chunk_path(address), chunk.value()).await {
+            self.used_space.decrease(size);
+            return Err(Error::Io(err.to_string()));
+        }
+        trace!("Chunk successfully stored: {address:?}");
+
+        let _ = self.cache_metrics.put_with_weight(
+            &mut *self.cache.write().await,
             *address,
-            |addr, _| {
-                trace!("Chunk successfully stored: {addr:?}");
-                Ok::<Chunk, Error>(chunk.clone())
-            },
-            |addr, _, _| {
-                trace!("Chunk data already exists in cache, not storing: {addr:?}");
-                Ok(())
-            },
-            (),
-        )?;
+            chunk.clone(),
+        );
 
         Ok(())
     }
 
-    #[allow(dead_code)]
-    pub(super) async fn addrs(&self) -> Vec<ChunkAddress> {
-        self.cache
-            .read()
-            .await
+    /// Stores the chunks not already in the local store, in a single pass: those held are
+    /// skipped, space is reserved for each of the others, and those fitting in it are
+    /// written concurrently, then cached at once.
+    ///
+    /// Returns the result of storing each of the chunks, in the order given.
+    pub(crate) async fn store_batch(&self, chunks: &[Chunk]) -> Vec<Result<()>> {
+        // The addresses are locked in order, so that batches sharing chunks can't deadlock.
+        let addresses: BTreeSet<_> = chunks.iter().map(|chunk| *chunk.address()).collect();
+        let mut _guards = Vec::with_capacity(addresses.len());
+        for address in &addresses {
+            _guards.push(self.locks.lock(*address).await);
+        }
+        let held = join_all(chunks.iter().map(|chunk| self.contains(chunk.address()))).await;
+
+        let mut results = vec![Ok(()); chunks.len()];
+        let mut to_write = vec![];
+        let mut batched = BTreeSet::new();
+        for (i, (chunk, held)) in chunks.iter().zip(held).enumerate() {
+            // A chunk given more than once is only written once.
+            if held || !batched.insert(*chunk.address()) {
+                continue;
+            }
+            if self.used_space.try_reserve(chunk.value().len()) {
+                to_write.push((i, chunk));
+            } else {
+                results[i] = Err(Error::NotEnoughSpace);
+            }
+        }
+        let writes = to_write
             .iter()
-            .map(|(addr, _)| *addr)
-            .collect()
+            .map(|(_, chunk)| write_atomically(&self.chunk_path(chunk.address()), chunk.value()));
+        let written = join_all(writes).await;
+
+        let mut cache = self.cache.write().await;
+        for ((i, chunk), result) in to_write.into_iter().zip(written) {
+            match result {
+                Ok(()) => {
+                    let _ = self.cache_metrics.put_with_weight(
+                        &mut *cache,
+                        *chunk.address(),
+                        chunk.clone(),
+                    );
+                }
+                Err(err) => {
+                    self.used_space.decrease(chunk.value().len());
+                    results[i] = Err(Error::Io(err.to_string()));
+                }
+            }
+        }
+        trace!("Stored a batch of {} Chunks", chunks.len());
+
+        results
+    }
+
+    /// Returns the addresses of all the chunks stored.
+    pub(crate) async fn addrs(&self) -> Result<Vec<ChunkAddress>> {
+        let names = list_sharded_names(&self.chunks_dir)
+            .await
+            .map_err(|err| Error::Io(err.to_string()))?;
+        Ok(names.into_iter().map(ChunkAddress::new).collect())
     }
 
     #[allow(dead_code)]
     pub(super) async fn remove_chunk(&self, address: &ChunkAddress) -> Result<()> {
         trace!("Removing Chunk: {address:?}");
-        if self.cache.write().await.pop(address).is_some() {
-            Ok(())
-        } else {
-            Err(Error::ChunkNotFound(*address))
+        let _guard = self.locks.lock(*address).await;
+        let _ = self.cache.write().await.pop(address);
+        let path = self.chunk_path(address);
+        let size = fs::metadata(&path).await.map(|metadata| metadata.len());
+        match fs::remove_file(&path).await {
+            Ok(()) => {
+                if let Ok(size) = size {
+                    self.used_space.decrease(size as usize);
+                }
+                Ok(())
+            }
+            Err(err) if err.kind() == ErrorKind::NotFound => Err(Error::ChunkNotFound(*address)),
+            Err(err) => Err(Error::Io(err.to_string())),
         }
     }
+
+    fn chunk_path(&self, address: &ChunkAddress) -> PathBuf {
+        sharded_path(&self.chunks_dir, address.name())
+    }
 }
 
-impl Default for ChunkStorage {
-    fn default() -> Self {
-        Self::new()
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use eyre::Result;
+    use rand::RngCore;
+
+    const CACHE_SIZE: usize = 4 * 1024;
+    const CAPACITY: usize = 1024 * 1024;
+
+    fn random_chunk() -> Chunk {
+        let mut bytes = vec![0u8; 1024];
+        rand::thread_rng().fill_bytes(&mut bytes);
+        Chunk::new(Bytes::from(bytes))
+    }
+
+    #[tokio::test]
+    async fn stored_chunks_survive_a_restart() -> Result<()> {
+        let root_dir = tempfile::tempdir()?;
+        let chunk = random_chunk();
+
+        let storage = ChunkStorage::new(root_dir.path(), CACHE_SIZE, CAPACITY).await;
+        storage.store(&chunk).await?;
+        assert_eq!(storage.get(chunk.address()).await?, chunk);
+
+        // A new instance starts with an empty cache, and reads the chunk from disk.
+        let storage = ChunkStorage::new(root_dir.path(), CACHE_SIZE, CAPACITY).await;
+        assert_eq!(storage.get(chunk.address()).await?, chunk);
+        assert_eq!(storage.addrs().await?, vec![*chunk.address()]);
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn removed_chunks_are_not_found() -> Result<()> {
+        let root_dir = tempfile::tempdir()?;
+        let chunk = random_chunk();
+
+        let storage = ChunkStorage::new(root_dir.path(), CACHE_SIZE, CAPACITY).await;
+        storage.store(&chunk).await?;
+        assert!(storage.contains(chunk.address()).await);
+        storage.remove_chunk(chunk.address()).await?;
+        assert!(!storage.contains(chunk.address()).await);
+
+        assert_eq!(
+            storage.get(chunk.address()).await,
+            Err(Error::ChunkNotFound(*chunk.address()))
+        );
+        assert!(storage.addrs().await?.is_empty());
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn chunks_are_refused_when_capacity_is_reached() -> Result<()> {
+        let root_dir = tempfile::tempdir()?;
+        let chunk = random_chunk();
+
+        let storage = ChunkStorage::new(root_dir.path(), CACHE_SIZE, chunk.value().len()).await;
+        storage.store(&chunk).await?;
+
+        // The used space of the stored chunk is accounted for after a restart.
+        let storage = ChunkStorage::new(root_dir.path(), CACHE_SIZE, chunk.value().len()).await;
+        assert_eq!(
+            storage.store(&random_chunk()).await,
+            Err(Error::NotEnoughSpace)
+        );
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn corrupted_chunks_release_their_space() -> Result<()> {
+        let root_dir = tempfile::tempdir()?;
+        let chunk = random_chunk();
+
+        let storage = ChunkStorage::new(root_dir.path(), CACHE_SIZE, chunk.value().len()).await;
+        storage.store(&chunk).await?;
+        fs::write(storage.chunk_path(chunk.address()), random_chunk().value()).await?;
+
+        // A new instance reads the corrupted chunk from disk, and removes it.
+        let storage = ChunkStorage::new(root_dir.path(), CACHE_SIZE, chunk.value().len()).await;
+        assert_eq!(
+            storage.get(chunk.address()).await,
+            Err(Error::ChunkNotFound(*chunk.address()))
+        );
+        storage.store(&random_chunk()).await?;
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn batches_are_stored_up_to_capacity() -> Result<()> {
+        let root_dir = tempfile::tempdir()?;
+        let held = random_chunk();
+        let size = held.value().len();
+
+        let storage = ChunkStorage::new(root_dir.path(), CACHE_SIZE, 3 * size).await;
+        storage.store(&held).await?;
+
+        // The chunk held, and the one given twice, take no more space.
+        let chunks = vec![held, random_chunk(), random_chunk(), random_chunk()];
+        let batch = vec![
+            chunks[0].clone(),
+            chunks[1].clone(),
+            chunks[1].clone(),
+            chunks[2].clone(),
+            chunks[3].clone(),
+        ];
+        assert_eq!(
+            storage.store_batch(&batch).await,
+            vec![Ok(()), Ok(()), Ok(()), Ok(()), Err(Error::NotEnoughSpace)]
+        );
+
+        for chunk in &chunks[..3] {
+            assert_eq!(&storage.get(chunk.address()).await?, chunk);
+        }
+        assert!(!storage.contains(chunks[3].address()).await);
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn cache_is_bounded_by_bytes() -> Result<()> {
+        let root_dir = tempfile::tempdir()?;
+        let storage = ChunkStorage::new(root_dir.path(), CACHE_SIZE, CAPACITY).await;
+
+        let chunks: Vec<_> = (0..10).map(|_| random_chunk()).collect();
+        for chunk in &chunks {
+            storage.store(chunk).await?;
+        }
+
+        // Only as many chunks as fit in the byte budget are kept in memory..
+        let cache = storage.cache.read().await;
+        assert!(cache.len() < CACHE_SIZE / chunks[0].serialised_size());
+        assert!(cache.weight() <= CACHE_SIZE);
+        drop(cache);
+
+        // .. while all of them are still served from disk.
+        for chunk in &chunks {
+            assert_eq!(&storage.get(chunk.address()).await?, chunk);
+        }
+
+        Ok(())
     }
 }
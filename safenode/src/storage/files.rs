@@ -0,0 +1,215 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use std::{
+    io::{self, ErrorKind},
+    path::{Path, PathBuf},
+};
+use tokio::{
+    fs::{self, OpenOptions},
+    io::AsyncWriteExt,
+    task,
+};
+use walkdir::WalkDir;
+use xor_name::{XorName, XOR_NAME_LEN};
+
+/// Number of hex chars of a name used for the shard dir it is stored in.
+/// With two chars, the files are spread over 256 dirs.
+const SHARD_PREFIX_LEN: usize = 2;
+/// Extension of the temporary files written to by `write_atomically`, followed by a random number.
+const TMP_EXTENSION: &str = "tmp";
+
+/// Returns the path of the file for the name, under
+/// the shard dir of its prefix, e.g. `<dir>/ab/ab12..ef`.
+pub(super) fn sharded_path(dir: &Path, name: &XorName) -> PathBuf {
+    let hex_name = hex::encode(name.0);
+    dir.join(&hex_name[..SHARD_PREFIX_LEN]).join(hex_name)
+}
+
+/// Returns the names of all the files stored in the shard dirs under `dir`.
+/// Any file not named after a hex encoded `XorName` is skipped.
+pub(super) async fn list_sharded_names(dir: &Path) -> io::Result<Vec<XorName>> {
+    let mut names = Vec::new();
+    let mut shards = match fs::read_dir(dir).await {
+        Ok(shards) => shards,
+        Err(err) if err.kind() == ErrorKind::NotFound => return Ok(names),
+        Err(err) => return Err(err),
+    };
+
+    while let Some(shard) = shards.next_entry().await? {
+        if !shard.file_type().await?.is_dir() {
+            continue;
+        }
+        let mut entries = fs::read_dir(shard.path()).await?;
+        while let Some(entry) = entries.next_entry().await? {
+            if let Some(name) = entry.file_name().to_str().and_then(decode_name) {
+                names.push(name);
+            }
+        }
+    }
+
+    Ok(names)
+}
+
+/// Writes the bytes to a temporary file next to `path`, and then renames it to `path`.
+/// A reader will thus either see the complete file, or no file at all, even if
+/// the node is stopped in the middle of a write.
+pub(crate) async fn write_atomically(path: &Path, bytes: &[u8]) -> io::Result<()> {
+    if let Some(dir) = path.parent() {
+        fs::create_dir_all(dir).await?;
+    }
+
+    let tmp_path = path.with_extension(format!("{TMP_EXTENSION}{}", rand::random::<u64>()));
+    let result = write_and_rename(&tmp_path, path, bytes).await;
+    if result.is_err() {
+        let _ = fs::remove_file(&tmp_path).await;
+    }
+
+    result
+}
+
+/// Appends the bytes to the file at `path`, creating it if needed.
+/// The bytes are synced to disk before returning.
+pub(super) async fn append(path: &Path, bytes: &[u8]) -> io::Result<()> {
+    if let Some(dir) = path.parent() {
+        fs::create_dir_all(dir).await?;
+    }
+
+    let mut file = OpenOptions::new()
+        .create(true)
+        .append(true)
+        .open(path)
+        .await?;
+    file.write_all(bytes).await?;
+    file.sync_data().await
+}
+
+/// Cuts the file at `path` down to its first `len` bytes.
+pub(super) async fn truncate(path: &Path, len: usize) -> io::Result<()> {
+    let file = OpenOptions::new().write(true).open(path).await?;
+    file.set_len(len as u64).await?;
+    file.sync_data().await
+}
+
+/// Sums up the size of the files found under the dir.
+/// Temporary files left over by a write the node was stopped in the middle of are skipped.
+pub(super) fn stored_bytes(dir: &Path) -> usize {
+    WalkDir::new(dir)
+        .into_iter()
+        .filter_map(|entry| entry.ok())
+        .filter(|entry| entry.file_type().is_file() && !is_tmp_file(entry.path()))
+        .filter_map(|entry| entry.metadata().ok())
+        .map(|metadata| metadata.len() as usize)
+        .sum()
+}
+
+/// Sums up the size of the files found under the dir, as `stored_bytes` does,
+/// on a blocking thread, so that walking a large dir doesn't stall the runtime.
+pub(super) async fn count_stored_bytes(dir: &Path) -> usize {
+    let dir = dir.to_path_buf();
+    match task::spawn_blocking(move || stored_bytes(&dir)).await {
+        Ok(size) => size,
+        Err(err) => {
+            warn!("Failed to sum up the size of the stored files: {err:?}");
+            0
+        }
+    }
+}
+
+async fn write_and_rename(tmp_path: &Path, path: &Path, bytes: &[u8]) -> io::Result<()> {
+    let mut file = fs::File::create(tmp_path).await?;
+    file.write_all(bytes).await?;
+    file.sync_data().await?;
+    drop(file);
+    fs::rename(tmp_path, path).await
+}
+
+fn is_tmp_file(path: &Path) -> bool {
+    path.extension()
+        .and_then(|ext| ext.to_str())
+        .and_then(|ext| ext.strip_prefix(TMP_EXTENSION))
+        .map_or(false, |suffix| suffix.parse::<u64>().is_ok())
+}
+
+fn decode_name(hex_name: &str) -> Option<XorName> {
+    let bytes = hex::decode(hex_name).ok()?;
+    let bytes: [u8; XOR_NAME_LEN] = bytes.as_slice().try_into().ok()?;
+    Some(XorName(bytes))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use eyre::Result;
+
+    #[tokio::test]
+    async fn written_files_are_listed_by_name() -> Result<()> {
+        let dir = tempfile::tempdir()?;
+        let mut rng = rand::thread_rng();
+        let names: Vec<_> = (0..10).map(|_| XorName::random(&mut rng)).collect();
+
+        for name in &names {
+            write_atomically(&sharded_path(dir.path(), name), &name.0).await?;
+        }
+
+        let mut listed = list_sharded_names(dir.path()).await?;
+        listed.sort();
+        let mut expected = names.clone();
+        expected.sort();
+        assert_eq!(listed, expected);
+
+        for name in &names {
+            let bytes = fs::read(sharded_path(dir.path(), name)).await?;
+            assert_eq!(bytes, name.0);
+        }
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn appended_bytes_follow_the_truncated_ones() -> Result<()> {
+        let dir = tempfile::tempdir()?;
+        let path = dir.path().join("shard").join("log");
+
+        append(&path, b"first").await?;
+        append(&path, b"second").await?;
+        assert_eq!(fs::read(&path).await?, b"firstsecond");
+
+        truncate(&path, 5).await?;
+        append(&path, b"third").await?;
+        assert_eq!(fs::read(&path).await?, b"firstthird");
+        assert_eq!(stored_bytes(dir.path()), 10);
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn leftover_tmp_files_are_not_counted() -> Result<()> {
+        let dir = tempfile::tempdir()?;
+        let path = dir.path().join("shard").join("file");
+
+        write_atomically(&path, b"stored").await?;
+        fs::write(
+            path.with_extension(format!("{TMP_EXTENSION}42")),
+            b"leftover",
+        )
+        .await?;
+        assert_eq!(stored_bytes(dir.path()), 6);
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn listing_a_missing_dir_returns_no_names() -> Result<()> {
+        let dir = tempfile::tempdir()?;
+        let names = list_sharded_names(&dir.path().join("missing")).await?;
+        assert!(names.is_empty());
+        Ok(())
+    }
+}
@@ -6,10 +6,16 @@
 // KIND, either express or implied. Please review the Licences for the specific language governing
 // permissions and limitations relating to use of the SAFE Network Software.
 
+mod address_locks;
 mod chunks;
+mod files;
 mod register_store;
 mod registers;
 mod spends;
 mod used_space;
+mod verification;
 
-pub(crate) use self::{chunks::ChunkStorage, registers::RegisterStorage, spends::SpendStorage};
+pub(crate) use self::{
+    address_locks::AddressLocks, chunks::ChunkStorage, files::write_atomically,
+    registers::RegisterStorage, spends::SpendStorage, verification::verify_batch,
+};
@@ -6,100 +6,497 @@
 // KIND, either express or implied. Please review the Licences for the specific language governing
 // permissions and limitations relating to use of the SAFE Network Software.
 
-use crate::protocol::{
-    address::RegisterAddress,
-    error::{Error, Result},
-    messages::RegisterCmd,
-    register::Register,
+use super::{
+    address_locks::AddressLocks,
+    files::{append, count_stored_bytes, sharded_path, truncate, write_atomically},
+    used_space::UsedSpace,
 };
 
-use clru::CLruCache;
-use std::{num::NonZeroUsize, sync::Arc};
-use tokio::sync::RwLock;
+use crate::{
+    metrics::CacheMetrics,
+    protocol::{
+        address::RegisterAddress,
+        error::{Error, Result},
+        messages::{RegisterCmd, SignedRegisterCreate, SignedRegisterEdit},
+        register::{Entry, EntryHash, Register},
+    },
+};
+
+use clru::{CLruCache, CLruCacheConfig, WeightScale};
+use serde::{Deserialize, Serialize};
+use std::{
+    collections::{hash_map::RandomState, BTreeMap, BTreeSet},
+    io::ErrorKind,
+    num::NonZeroUsize,
+    path::{Path, PathBuf},
+    sync::{Arc, OnceLock},
+};
+use tokio::{fs, sync::RwLock};
 use tracing::trace;
 
-const REGISTERS_CACHE_SIZE: usize = 20 * 1024 * 1024;
+/// The name of the dir under the node root dir, where Registers are stored.
+const REGISTERS_DIR_NAME: &str = "registers";
+/// The file holding the Register state and its log of cmds, as of the last compaction.
+const SNAPSHOT_FILE_NAME: &str = "snapshot";
+/// The file the cmds applied since the last compaction are appended to.
+const LOG_FILE_NAME: &str = "log";
+/// The log is compacted into the snapshot once it is bigger than the snapshot, and than this.
+/// Each compaction thus writes out at most about twice the bytes appended since the last one.
+const MIN_COMPACTED_LOG_SIZE: usize = 64 * 1024;
+/// The size of the length prefix of each cmd appended to the log.
+const LEN_PREFIX_SIZE: usize = 4;
 
 pub(super) type RegisterLog = Vec<RegisterCmd>;
 
-#[derive(Clone, Debug)]
+/// The current entries of a Register, shared among its readers.
+pub(super) type RegisterEntries = Arc<BTreeSet<(EntryHash, Entry)>>;
+
+type RegisterCache = CLruCache<RegisterAddress, CachedRegister, RandomState, RegisterWeight>;
+
+#[derive(Clone, Debug, Default, Serialize, Deserialize)]
 pub(super) struct StoredRegister {
     pub(super) state: Option<Register>,
+    /// The cmds applied, which are only to be added with `push`.
     pub(super) op_log: RegisterLog,
+    // The position in the log of the Edit cmd of each entry.
+    #[serde(skip)]
+    edits: BTreeMap<EntryHash, usize>,
+    // The current entries of the Register, read off it on the first read since cmds were
+    // last applied to it, so that a run of writes doesn't read them after each one.
+    #[serde(skip)]
+    entries: OnceLock<RegisterEntries>,
 }
 
-/// A store for Registers
+impl StoredRegister {
+    /// Appends the cmd to the log.
+    pub(super) fn push(&mut self, cmd: RegisterCmd) {
+        if let RegisterCmd::Edit(edit) = &cmd {
+            let _ = self.edits.insert(entry_hash(edit), self.op_log.len());
+        }
+        self.op_log.push(cmd);
+    }
+
+    /// Returns whether the cmd, or one with the same effect, was already applied.
+    pub(super) fn contains(&self, cmd: &RegisterCmd) -> bool {
+        match cmd {
+            RegisterCmd::Create(_) => self.state.is_some(),
+            RegisterCmd::Edit(edit) => self.edits.contains_key(&entry_hash(edit)),
+        }
+    }
+
+    /// Returns the cmds of the entries missing to a replica whose last entries are `known_heads`,
+    /// in the order they were logged. The Create cmd is included when no entries are known.
+    pub(super) fn delta(&self, known_heads: &BTreeSet<EntryHash>) -> RegisterLog {
+        let register = match &self.state {
+            Some(register) => register,
+            None => return RegisterLog::new(),
+        };
+
+        let mut positions: Vec<usize> = register
+            .missing_from(known_heads)
+            .iter()
+            .filter_map(|hash| self.edits.get(hash).copied())
+            .collect();
+        if known_heads.is_empty() {
+            positions.extend(
+                self.op_log
+                    .iter()
+                    .position(|cmd| matches!(cmd, RegisterCmd::Create(_))),
+            );
+        }
+        positions.sort_unstable();
+
+        positions
+            .into_iter()
+            .map(|position| self.op_log[position].clone())
+            .collect()
+    }
+
+    /// Returns the current entries of the Register, which are shared with all its readers,
+    /// rather than read off the Register again for each of them. They are read off it by the
+    /// first of them since the Register was last updated.
+    pub(super) fn entries(&self) -> RegisterEntries {
+        self.entries
+            .get_or_init(|| Arc::new(self.state.as_ref().map(Register::read).unwrap_or_default()))
+            .clone()
+    }
+
+    // Drops the entries read off the Register, once cmds were applied to it.
+    fn clear_entries(&mut self) {
+        self.entries = OnceLock::new();
+    }
+
+    // Indexes the Edit cmds of a log read back from a snapshot.
+    fn index_edits(&mut self) {
+        for (position, cmd) in self.op_log.iter().enumerate() {
+            if let RegisterCmd::Edit(edit) = cmd {
+                let _ = self.edits.insert(entry_hash(edit), position);
+            }
+        }
+    }
+
+    // Applies a cmd read back from the log on disk, which was validated before being logged.
+    fn replay(&mut self, cmd: RegisterCmd) -> Result<()> {
+        match (self.state.as_mut(), &cmd) {
+            (Some(_), RegisterCmd::Create(_)) => return Ok(()), // no op, since already created
+            (Some(register), RegisterCmd::Edit(SignedRegisterEdit { op, .. })) => {
+                register.apply_op(op.edit.clone())?;
+            }
+            (None, RegisterCmd::Create(SignedRegisterCreate { op, .. })) => {
+                let mut register =
+                    Register::new(*op.policy.owner(), op.name, op.tag, op.policy.clone());
+                for logged in &self.op_log {
+                    if let RegisterCmd::Edit(SignedRegisterEdit { op, .. }) = logged {
+                        register.apply_op(op.edit.clone())?;
+                    }
+                }
+                self.state = Some(register);
+            }
+            (None, RegisterCmd::Edit(_)) => {}
+        }
+
+        self.push(cmd);
+        Ok(())
+    }
+}
+
+fn entry_hash(edit: &SignedRegisterEdit) -> EntryHash {
+    EntryHash(edit.op.edit.crdt_op.hash())
+}
+
+/// A Register held in memory, along with the size of its files on disk.
+struct CachedRegister {
+    stored: StoredRegister,
+    snapshot_size: usize,
+    log_size: usize,
+}
+
+impl CachedRegister {
+    fn size(&self) -> usize {
+        self.snapshot_size + self.log_size
+    }
+}
+
+/// Charges each Register in the cache the size of its files, which is about its serialised size.
+struct RegisterWeight;
+
+impl WeightScale<RegisterAddress, CachedRegister> for RegisterWeight {
+    fn weight(&self, _address: &RegisterAddress, cached: &CachedRegister) -> usize {
+        cached.size()
+    }
+}
+
+/// Disk-backed storage of Registers.
+///
+/// Every Register is stored in its own dir, sharded by the prefix of its name, as a snapshot
+/// of its state and log of cmds, followed by an append-only log of the cmds applied since.
+/// The log is compacted into a new snapshot once it outgrows the current one.
+///
+/// Registers are updated in place, under a lock per address, and recently used ones are kept
+/// in an in-memory cache of bounded size in bytes. The bytes stored on disk are accounted for
+/// in `used_space`, and cmds are refused once the capacity is reached.
 #[derive(Clone)]
 pub(super) struct RegisterStore {
-    cache: Arc<RwLock<CLruCache<RegisterAddress, StoredRegister>>>,
+    registers_dir: PathBuf,
+    cache: Arc<RwLock<RegisterCache>>,
+    cache_metrics: CacheMetrics,
+    locks: AddressLocks<RegisterAddress>,
+    used_space: UsedSpace,
 }
 
-impl Default for RegisterStore {
-    fn default() -> Self {
-        let capacity = NonZeroUsize::new(REGISTERS_CACHE_SIZE)
-            .expect("Failed to create in-memory Registers storage");
+impl RegisterStore {
+    /// Creates a new `RegisterStore` at the given root dir, storing at most `capacity`
+    /// bytes of Registers on disk, and caching at most `cache_size` bytes of them in memory.
+    /// Registers previously stored at the same root dir are served again.
+    pub(super) async fn new(root_dir: &Path, cache_size: usize, capacity: usize) -> Self {
+        let cache_size = NonZeroUsize::new(cache_size.max(1))
+            .expect("Failed to create in-memory Registers cache");
+        let registers_dir = root_dir.join(REGISTERS_DIR_NAME);
+
+        let used_space = UsedSpace::new(capacity);
+        used_space.increase(count_stored_bytes(&registers_dir).await);
+
         Self {
-            cache: Arc::new(RwLock::new(CLruCache::new(capacity))),
+            registers_dir,
+            cache: Arc::new(RwLock::new(CLruCache::with_config(
+                CLruCacheConfig::new(cache_size).with_scale(RegisterWeight),
+            ))),
+            cache_metrics: CacheMetrics::default(),
+            locks: AddressLocks::default(),
+            used_space,
         }
     }
-}
 
-impl RegisterStore {
-    #[cfg(test)]
-    pub(super) async fn addrs(&self) -> Vec<RegisterAddress> {
-        self.cache
-            .read()
+    /// Returns the metrics of the in-memory cache of Registers.
+    pub(super) fn cache_metrics(&self) -> &CacheMetrics {
+        &self.cache_metrics
+    }
+
+    /// Returns the addresses of all the Registers stored.
+    pub(super) async fn addrs(&self) -> Result<Vec<RegisterAddress>> {
+        let names = super::files::list_sharded_names(&self.registers_dir)
             .await
-            .iter()
-            .map(|(addr, _)| *addr)
-            .collect()
+            .map_err(|err| Error::Io(err.to_string()))?;
+
+        let mut addrs = Vec::new();
+        for name in names {
+            let mut tags = fs::read_dir(sharded_path(&self.registers_dir, &name))
+                .await
+                .map_err(|err| Error::Io(err.to_string()))?;
+            while let Some(entry) = tags
+                .next_entry()
+                .await
+                .map_err(|err| Error::Io(err.to_string()))?
+            {
+                if let Some(tag) = entry.file_name().to_str().and_then(|tag| tag.parse().ok()) {
+                    addrs.push(RegisterAddress::new(name, tag));
+                }
+            }
+        }
+
+        Ok(addrs)
     }
 
     #[allow(dead_code)]
     pub(super) async fn remove(&self, address: &RegisterAddress) -> Result<()> {
         trace!("Removing Register: {address:?}");
-        if self.cache.write().await.pop(address).is_some() {
-            Ok(())
-        } else {
-            Err(Error::RegisterNotFound(*address))
+        let _guard = self.locks.lock(*address).await;
+        let _ = self.cache.write().await.pop(address);
+
+        let dir = self.register_dir(address);
+        let size = count_stored_bytes(&dir).await;
+        match fs::remove_dir_all(&dir).await {
+            Ok(()) => {
+                self.used_space.decrease(size);
+                Ok(())
+            }
+            Err(err) if err.kind() == ErrorKind::NotFound => Err(Error::RegisterNotFound(*address)),
+            Err(err) => Err(Error::Io(err.to_string())),
         }
     }
 
-    /// Opens the log of RegisterCmds for a given Register address.
-    /// Creates a new log if no data is found
-    pub(super) async fn get(&self, address: &RegisterAddress) -> StoredRegister {
+    /// Returns the state and log of RegisterCmds of the Register at the address.
+    /// An empty log is returned if no data is found.
+    #[cfg(test)]
+    pub(super) async fn get(&self, address: &RegisterAddress) -> Result<StoredRegister> {
         trace!("Getting Register ops log: {address:?}");
-        if let Some(stored_reg) = self.cache.read().await.peek(address) {
-            stored_reg.clone()
-        } else {
-            StoredRegister {
-                state: None,
-                op_log: RegisterLog::new(),
+        self.read(address, StoredRegister::clone).await
+    }
+
+    /// Returns the number of Registers in the in-memory cache.
+    #[cfg(test)]
+    pub(super) async fn cached_len(&self) -> usize {
+        self.cache.read().await.len()
+    }
+
+    /// Returns what `read` reads off the Register at the address, without copying it.
+    ///
+    /// A cached Register is read in place under the read lock of the cache, concurrently with
+    /// its other readers. Being only peeked at, it isn't marked as recently used by the read.
+    pub(super) async fn read<F, R>(&self, address: &RegisterAddress, read: F) -> Result<R>
+    where
+        F: FnOnce(&StoredRegister) -> R,
+    {
+        if let Some(cached) = self.cache.read().await.peek(address) {
+            self.cache_metrics.hit();
+            return Ok(read(&cached.stored));
+        }
+
+        let _guard = self.locks.lock(*address).await;
+        let cached = self.take_or_load(address).await?;
+        let result = read(&cached.stored);
+        self.put_back(*address, cached).await;
+
+        Ok(result)
+    }
+
+    /// Applies `apply` to the Register at the address in place, and appends the cmds it pushes
+    /// onto the log of the Register to the log on disk. A Register is updated by one call at a time.
+    ///
+    /// `apply` must leave the Register unchanged when it fails.
+    pub(super) async fn update<F>(&self, address: RegisterAddress, apply: F) -> Result<()>
+    where
+        F: FnOnce(&mut StoredRegister) -> Result<()>,
+    {
+        let _guard = self.locks.lock(address).await;
+        let mut cached = self.take_or_load(&address).await?;
+
+        let logged_len = cached.stored.op_log.len();
+        if let Err(err) = apply(&mut cached.stored) {
+            self.put_back(address, cached).await;
+            return Err(err);
+        }
+
+        let new_cmds = &cached.stored.op_log[logged_len..];
+        trace!(
+            "Storing {} new cmd/s of Register ops log: {address:?}",
+            new_cmds.len()
+        );
+        if new_cmds.is_empty() {
+            self.put_back(address, cached).await;
+            return Ok(());
+        }
+        cached.stored.clear_entries();
+
+        // From here on, should the cmds fail to be logged, the Register is not put back in
+        // the cache, so that it's read back from disk, without the cmds, when next used.
+        let mut records = Vec::new();
+        for cmd in new_cmds {
+            encode_record(cmd, &mut records)?;
+        }
+        if !self.used_space.try_reserve(records.len()) {
+            return Err(Error::NotEnoughSpace);
+        }
+
+        let dir = self.register_dir(&address);
+        if let Err(err) = append(&dir.join(LOG_FILE_NAME), &records).await {
+            self.used_space.decrease(records.len());
+            return Err(Error::Io(err.to_string()));
+        }
+        cached.log_size += records.len();
+
+        if cached.log_size > cached.snapshot_size.max(MIN_COMPACTED_LOG_SIZE) {
+            if let Err(err) = self.compact(&dir, &mut cached).await {
+                warn!("Failed to compact the ops log of Register {address:?}: {err:?}");
             }
         }
+
+        trace!("Register ops log stored successfully: {address:?}");
+        self.put_back(address, cached).await;
+        Ok(())
     }
 
-    /// Persists a RegisterLog
-    pub(super) async fn store_register_ops_log(
-        &self,
-        _log: &RegisterLog, // we'll need to write these ops to disk when disk store is implemented
-        reg: StoredRegister,
-        address: RegisterAddress,
-    ) -> Result<()> {
-        let log_len = reg.op_log.len();
-        trace!("Storing Register ops log with {log_len} cmd/s: {address:?}",);
+    // Takes the Register out of the cache, or reads it from disk if it's not cached.
+    async fn take_or_load(&self, address: &RegisterAddress) -> Result<CachedRegister> {
+        if let Some(cached) = self.cache.write().await.pop(address) {
+            self.cache_metrics.hit();
+            return Ok(cached);
+        }
+        self.cache_metrics.miss();
+        self.load(address).await
+    }
 
-        let _ = self.cache.write().await.try_put_or_modify(
-            address,
-            |_, _| Ok::<StoredRegister, Error>(reg.clone()),
-            |_, stored_reg, _| {
-                *stored_reg = reg.clone();
-                Ok(())
-            },
-            (),
-        )?;
+    // Nothing stored at the address is cached, so that lookups of unknown addresses can't
+    // fill the cache, evicting the Registers actually stored.
+    async fn put_back(&self, address: RegisterAddress, cached: CachedRegister) {
+        if cached.size() == 0 {
+            return;
+        }
+        let result =
+            self.cache_metrics
+                .put_with_weight(&mut *self.cache.write().await, address, cached);
+        if let Err((_, cached)) = result {
+            trace!(
+                "Register of {} bytes is too big to be cached: {address:?}",
+                cached.size()
+            );
+        }
+    }
+
+    // Reads the snapshot of the Register, and replays onto it the cmds logged since.
+    async fn load(&self, address: &RegisterAddress) -> Result<CachedRegister> {
+        let dir = self.register_dir(address);
+        let (mut stored, snapshot_size) = match fs::read(dir.join(SNAPSHOT_FILE_NAME)).await {
+            Ok(bytes) => {
+                let mut stored: StoredRegister =
+                    bincode::deserialize(&bytes).map_err(|err| Error::Bincode(err.to_string()))?;
+                stored.index_edits();
+                (stored, bytes.len())
+            }
+            Err(err) if err.kind() == ErrorKind::NotFound => (StoredRegister::default(), 0),
+            Err(err) => return Err(Error::Io(err.to_string())),
+        };
+
+        let log_path = dir.join(LOG_FILE_NAME);
+        let log = match fs::read(&log_path).await {
+            Ok(log) => log,
+            Err(err) if err.kind() == ErrorKind::NotFound => Vec::new(),
+            Err(err) => return Err(Error::Io(err.to_string())),
+        };
+
+        let mut log_size = 0;
+        while let Some((cmd, record_size)) =
+            decode_record(&log[log_size..]).map_err(|error| Error::RegisterLogCorrupt {
+                address: *address,
+                offset: log_size,
+                error,
+            })?
+        {
+            stored.replay(cmd)?;
+            log_size += record_size;
+        }
+        // Only a record cut short is dropped, a corrupt one is an error, so that the
+        // cmds after it are kept.
+        if log_size < log.len() {
+            // The node was stopped in the middle of appending a cmd, which was thus never applied.
+            warn!("Dropping the incomplete last cmd of the ops log of Register {address:?}");
+            truncate(&log_path, log_size)
+                .await
+                .map_err(|err| Error::Io(err.to_string()))?;
+        }
+
+        Ok(CachedRegister {
+            stored,
+            snapshot_size,
+            log_size,
+        })
+    }
+
+    // Writes the Register and its whole log of cmds to a new snapshot, replacing the log on disk.
+    // Should the node stop before the log is removed, its cmds are replayed onto the new snapshot
+    // when read back, which only duplicates them in the log of cmds, as their ops are idempotent.
+    async fn compact(&self, dir: &Path, cached: &mut CachedRegister) -> Result<()> {
+        let snapshot =
+            bincode::serialize(&cached.stored).map_err(|err| Error::Bincode(err.to_string()))?;
+        write_atomically(&dir.join(SNAPSHOT_FILE_NAME), &snapshot)
+            .await
+            .map_err(|err| Error::Io(err.to_string()))?;
+        if snapshot.len() > cached.snapshot_size {
+            self.used_space
+                .increase(snapshot.len() - cached.snapshot_size);
+        } else {
+            self.used_space
+                .decrease(cached.snapshot_size - snapshot.len());
+        }
+        cached.snapshot_size = snapshot.len();
+
+        match fs::remove_file(dir.join(LOG_FILE_NAME)).await {
+            Ok(()) => {}
+            Err(err) if err.kind() == ErrorKind::NotFound => {}
+            Err(err) => return Err(Error::Io(err.to_string())),
+        }
+        self.used_space.decrease(cached.log_size);
+        cached.log_size = 0;
 
-        trace!("Register ops log of {log_len} cmd/s stored successfully: {address:?}",);
         Ok(())
     }
+
+    fn register_dir(&self, address: &RegisterAddress) -> PathBuf {
+        sharded_path(&self.registers_dir, address.name()).join(address.tag().to_string())
+    }
+}
+
+// Appends the cmd to the records, prefixed by its length.
+fn encode_record(cmd: &RegisterCmd, records: &mut Vec<u8>) -> Result<()> {
+    let bytes = bincode::serialize(cmd).map_err(|err| Error::Bincode(err.to_string()))?;
+    records.extend_from_slice(&(bytes.len() as u32).to_le_bytes());
+    records.extend_from_slice(&bytes);
+    Ok(())
+}
+
+// Reads the first cmd of the records, returning it along with the size of its record,
+// or `None` if the records don't start with a complete one. A complete record whose
+// cmd doesn't decode is an error.
+fn decode_record(records: &[u8]) -> std::result::Result<Option<(RegisterCmd, usize)>, String> {
+    let len_prefix: [u8; LEN_PREFIX_SIZE] = match records.get(..LEN_PREFIX_SIZE) {
+        Some(len_prefix) => len_prefix.try_into().map_err(|_| "Invalid length prefix")?,
+        None => return Ok(None),
+    };
+    let record_size = LEN_PREFIX_SIZE + u32::from_le_bytes(len_prefix) as usize;
+    let bytes = match records.get(LEN_PREFIX_SIZE..record_size) {
+        Some(bytes) => bytes,
+        None => return Ok(None),
+    };
+    let cmd = bincode::deserialize(bytes).map_err(|err| err.to_string())?;
+    Ok(Some((cmd, record_size)))
 }
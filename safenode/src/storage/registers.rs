@@ -6,72 +6,99 @@
 // KIND, either express or implied. Please review the Licences for the specific language governing
 // permissions and limitations relating to use of the SAFE Network Software.
 
-use super::register_store::{RegisterStore, StoredRegister};
-
-use crate::protocol::{
-    address::RegisterAddress,
-    error::{Error, Result},
-    messages::{
-        EditRegister, QueryResponse, RegisterCmd, RegisterQuery, ReplicatedRegisterLog,
-        SignedRegisterCreate, SignedRegisterEdit,
+use super::{
+    register_store::{RegisterStore, StoredRegister},
+    verification::verify_batch,
+};
+
+use crate::{
+    metrics::CacheMetrics,
+    protocol::{
+        address::RegisterAddress,
+        error::{Error, Result},
+        messages::{
+            QueryResponse, RegisterCmd, RegisterQuery, ReplicatedRegisterLog, SignedRegisterCreate,
+            SignedRegisterEdit,
+        },
+        register::{Action, EntryHash, Register, User},
     },
-    register::{Action, EntryHash, Register, User},
 };
 
 use bincode::serialize;
+use std::{collections::BTreeSet, path::Path};
 
 /// Operations over the Register data type and its storage.
-#[derive(Clone, Default)]
+#[derive(Clone)]
 pub(crate) struct RegisterStorage {
     register_store: RegisterStore,
 }
 
 impl RegisterStorage {
-    /// Create new `RegisterStorage`
-    pub(crate) fn new() -> Self {
+    /// Create new `RegisterStorage` at the given root dir, storing at most `capacity` bytes of
+    /// Registers on disk, and caching at most `cache_size` bytes of them in memory.
+    pub(crate) async fn new(root_dir: &Path, cache_size: usize, capacity: usize) -> Self {
         Self {
-            register_store: RegisterStore::default(),
+            register_store: RegisterStore::new(root_dir, cache_size, capacity).await,
         }
     }
 
+    /// Returns the metrics of the in-memory cache of Registers.
+    pub(crate) fn cache_metrics(&self) -> &CacheMetrics {
+        self.register_store.cache_metrics()
+    }
+
     /// --- Writing ---
 
     pub(crate) async fn write(&self, cmd: &RegisterCmd) -> Result<()> {
-        info!("Writing register cmd: {cmd:?}");
-        let addr = cmd.dst();
-        // Let's first try to load and reconstruct the replica of targetted Register
-        // we have in local storage, to then try to apply the new command onto it.
-        let mut stored_reg = self.try_load_stored_register(&addr).await?;
-
-        self.try_to_apply_cmd_against_register_state(cmd, &mut stored_reg)?;
-
-        // Everything went fine, let's store the updated Register
+        debug!("Writing register cmd: {cmd:?}");
+        verify_cmd(cmd)?;
+        // The new command is applied onto the replica of the targetted Register we have
+        // in local storage, which is updated in place, and stored if everything went fine.
         self.register_store
-            .store_register_ops_log(&vec![cmd.clone()], stored_reg, addr)
+            .update(cmd.dst(), |stored_reg| {
+                self.try_to_apply_cmd_against_register_state(cmd, stored_reg)
+            })
             .await
     }
 
     /// Update our Register's replica on receiving data from other nodes.
-    #[allow(dead_code)]
-    pub(super) async fn update(&self, data: &ReplicatedRegisterLog) -> Result<()> {
+    pub(crate) async fn update(&self, data: &ReplicatedRegisterLog) -> Result<()> {
         let addr = data.address;
         debug!("Updating Register store: {addr:?}");
-        let mut stored_reg = self.try_load_stored_register(&addr).await?;
-
-        let mut log_to_write = Vec::new();
-        for replicated_cmd in &data.op_log {
-            if let Err(err) =
-                self.try_to_apply_cmd_against_register_state(replicated_cmd, &mut stored_reg)
-            {
-                warn!("Discarding ReplicatedRegisterLog cmd {replicated_cmd:?}: {err:?}",);
-            } else {
-                log_to_write.push(replicated_cmd.clone());
-            }
+
+        // Only the cmds we don't hold yet are verified and applied, so that the cost of
+        // a log is that of the cmds new to us, rather than that of the whole log.
+        let new_cmds = self
+            .register_store
+            .read(&addr, |stored_reg| {
+                data.op_log
+                    .iter()
+                    .filter(|cmd| !stored_reg.contains(cmd))
+                    .cloned()
+                    .collect::<Vec<_>>()
+            })
+            .await?;
+        if new_cmds.is_empty() {
+            trace!("No new cmds in the ReplicatedRegisterLog of {addr:?}");
+            return Ok(());
         }
 
-        // Write the new cmds all to disk
+        // The signatures of all the cmds are verified as one batch,
+        // before applying them in order.
+        let verified_log = verify_batch(new_cmds, verify_cmd).await?;
+
+        // The valid cmds are all written to disk at once.
         self.register_store
-            .store_register_ops_log(&log_to_write, stored_reg, addr)
+            .update(addr, |stored_reg| {
+                for (replicated_cmd, verification) in verified_log {
+                    if let Err(err) = verification.and_then(|()| {
+                        self.try_to_apply_cmd_against_register_state(&replicated_cmd, stored_reg)
+                    }) {
+                        warn!("Discarding ReplicatedRegisterLog cmd {replicated_cmd:?}: {err:?}",);
+                    }
+                }
+                Ok(())
+            })
             .await
     }
 
@@ -88,49 +115,63 @@ impl RegisterStorage {
             GetUserPermissions { address, user } => {
                 self.get_user_permissions(*address, *user, requester).await
             }
+            GetDelta {
+                address,
+                known_heads,
+            } => self.get_delta(*address, known_heads, requester).await,
         }
     }
 
-    /// Get `Register` from the store and check permissions.
-    async fn get_register(
+    /// Reads off the `Register` in the store, in place, after checking the requester
+    /// is allowed to read it.
+    async fn read_with<F, R>(
         &self,
         address: &RegisterAddress,
-        action: Action,
         requester: User,
-    ) -> Result<Register> {
-        let stored_reg = self.try_load_stored_register(address).await?;
-        if let Some(register) = stored_reg.state {
-            register
-                .check_permissions(action, Some(requester))
-                .map_err(Error::from)?;
-
-            Ok(register)
-        } else {
-            Err(Error::RegisterNotFound(*address))
-        }
+        read: F,
+    ) -> Result<R>
+    where
+        F: FnOnce(&StoredRegister, &Register) -> Result<R>,
+    {
+        self.register_store
+            .read(address, |stored_reg| match &stored_reg.state {
+                Some(register) => {
+                    register
+                        .check_permissions(Action::Read, Some(requester))
+                        .map_err(Error::from)?;
+                    read(stored_reg, register)
+                }
+                None => Err(Error::RegisterNotFound(*address)),
+            })
+            .await?
     }
 
     /// Get entire Register.
     async fn get(&self, address: RegisterAddress, requester: User) -> QueryResponse {
-        let result = self.get_register(&address, Action::Read, requester).await;
+        let result = self
+            .read_with(&address, requester, |_, register| Ok(register.clone()))
+            .await;
 
         QueryResponse::GetRegister(result)
     }
 
     async fn read_register(&self, address: RegisterAddress, requester: User) -> QueryResponse {
-        let result = match self.get_register(&address, Action::Read, requester).await {
-            Ok(register) => Ok(register.read()),
-            Err(error) => Err(error),
-        };
+        // The entries are shared with the other readers until the Register is next updated.
+        let result = self
+            .read_with(
+                &address,
+                requester,
+                |stored_reg, _| Ok(stored_reg.entries()),
+            )
+            .await;
 
         QueryResponse::ReadRegister(result)
     }
 
     async fn get_owner(&self, address: RegisterAddress, requester: User) -> QueryResponse {
-        let result = match self.get_register(&address, Action::Read, requester).await {
-            Ok(res) => Ok(res.owner()),
-            Err(error) => Err(error),
-        };
+        let result = self
+            .read_with(&address, requester, |_, register| Ok(register.owner()))
+            .await;
 
         QueryResponse::GetRegisterOwner(result)
     }
@@ -142,9 +183,10 @@ impl RegisterStorage {
         requester: User,
     ) -> QueryResponse {
         let result = self
-            .get_register(&address, Action::Read, requester)
-            .await
-            .and_then(|register| register.get(hash).map(|c| c.clone()));
+            .read_with(&address, requester, |_, register| {
+                register.get(hash).map(|c| c.clone())
+            })
+            .await;
 
         QueryResponse::GetRegisterEntry(result)
     }
@@ -156,52 +198,77 @@ impl RegisterStorage {
         requester: User,
     ) -> QueryResponse {
         let result = self
-            .get_register(&address, Action::Read, requester)
-            .await
-            .and_then(|register| register.permissions(user));
+            .read_with(&address, requester, |_, register| {
+                register.permissions(user)
+            })
+            .await;
 
         QueryResponse::GetRegisterUserPermissions(result)
     }
 
     async fn get_policy(&self, address: RegisterAddress, requester_pk: User) -> QueryResponse {
         let result = self
-            .get_register(&address, Action::Read, requester_pk)
-            .await
-            .map(|register| register.policy().clone());
+            .read_with(&address, requester_pk, |_, register| {
+                Ok(register.policy().clone())
+            })
+            .await;
 
         QueryResponse::GetRegisterPolicy(result)
     }
 
+    /// Get the cmds a replica with the given latest entries is missing.
+    async fn get_delta(
+        &self,
+        address: RegisterAddress,
+        known_heads: &BTreeSet<EntryHash>,
+        requester: User,
+    ) -> QueryResponse {
+        let result = self
+            .read_with(&address, requester, |stored_reg, _| {
+                Ok(ReplicatedRegisterLog {
+                    address,
+                    op_log: stored_reg.delta(known_heads),
+                })
+            })
+            .await;
+
+        QueryResponse::GetRegisterDelta(result)
+    }
+
     // ========================================================================
     // =========================== Helpers ====================================
     // ========================================================================
 
-    // Private helper which does all verification and tries to apply given cmd to given Register
+    // Private helper which does all verification but the one of the signature, which is
+    // expected to have been done with `verify_cmd`, and tries to apply given cmd to given Register
     // state. It accumulates the cmd, if valid, into the log so further calls can be made with
     // the same state and log, as used by the `update` function.
-    // Note the cmd is always pushed to the log even if it's a duplicated cmd.
+    // Note a cmd already in the log is a no op, and isn't pushed to the log again.
     fn try_to_apply_cmd_against_register_state(
         &self,
         cmd: &RegisterCmd,
         stored_reg: &mut StoredRegister,
     ) -> Result<()> {
+        if stored_reg.contains(cmd) {
+            return Ok(());
+        }
+
         // If we have the target Register, try to apply the cmd, otherwise let's keep
         // the cmd in the log anyway, whenever we receive the 'Register create' cmd
-        // it can be reconstructed from all cmds we hold in the log. If this is a 'Register create'
-        // cmd let's verify it's valid before accepting it, however 'Edits cmds' cannot be
+        // it can be reconstructed from all cmds we hold in the log. The signatures of all cmds
+        // were verified, however the permissions of 'Edits cmds' cannot be
         // verified until we have the `Register create` cmd.
         match (stored_reg.state.as_mut(), cmd) {
             (Some(_), RegisterCmd::Create { .. }) => return Ok(()), // no op, since already created
             (Some(ref mut register), RegisterCmd::Edit(_)) => self.apply(cmd, register)?,
             (None, RegisterCmd::Create(cmd)) => {
                 // the target Register is not in our store or we don't have the 'Register create',
-                // let's verify the create cmd we received is valid and try to apply stored cmds we may have.
-                let SignedRegisterCreate { op, auth } = cmd;
-                auth.verify_authority(serialize(op).map_err(|e| Error::Bincode(e.to_string()))?)?;
+                // let's try to apply stored cmds we may have onto the create cmd we received.
+                let SignedRegisterCreate { op, .. } = cmd;
 
                 trace!("Creating new register: {:?}", cmd.dst());
                 // let's do a final check, let's try to apply all cmds to it,
-                // those which are new cmds were not validated yet, so let's do it now.
+                // those which are new cmds were not checked against its permissions yet.
                 let mut register =
                     Register::new(*op.policy.owner(), op.name, op.tag, op.policy.clone());
 
@@ -214,11 +281,12 @@ impl RegisterStorage {
             (None, _edit_cmd) => { /* we cannot validate it right now, but we'll store it */ }
         }
 
-        stored_reg.op_log.push(cmd.clone());
+        stored_reg.push(cmd.clone());
         Ok(())
     }
 
     // Try to apply the provided cmd to the register state, performing all op validations
+    // but the one of its signature
     fn apply(&self, cmd: &RegisterCmd, register: &mut Register) -> Result<()> {
         let addr = cmd.dst();
         if &addr != register.address() {
@@ -231,8 +299,6 @@ impl RegisterStorage {
         match cmd {
             RegisterCmd::Create { .. } => Ok(()),
             RegisterCmd::Edit(SignedRegisterEdit { op, auth }) => {
-                auth.verify_authority(serialize(op).map_err(|e| Error::Bincode(e.to_string()))?)?;
-
                 info!("Editing Register: {addr:?}");
                 let public_key = auth.public_key;
                 register.check_permissions(Action::Write, Some(User::Key(public_key)))?;
@@ -252,47 +318,48 @@ impl RegisterStorage {
         }
     }
 
-    // Gets stored register log from disk, trying to reconstruct the Register
-    // Note this doesn't perform any cmd sig/perms validation, it's only used when the log
-    // is read from disk which has already been validated before storing it.
+    // Gets stored register state and log, as reconstructed when read from disk.
+    // Note this doesn't perform any cmd sig/perms validation, as the log
+    // has already been validated before storing it.
+    #[cfg(test)]
     async fn try_load_stored_register(&self, addr: &RegisterAddress) -> Result<StoredRegister> {
-        let mut stored_reg = self.register_store.get(addr).await;
-        // if we have the Register creation cmd, apply all ops to reconstruct the Register
-        if let Some(register) = &mut stored_reg.state {
-            for cmd in &stored_reg.op_log {
-                if let RegisterCmd::Edit(SignedRegisterEdit { op, .. }) = cmd {
-                    let EditRegister { edit, .. } = op;
-                    register.apply_op(edit.clone())?;
-                }
-            }
-        }
-
-        Ok(stored_reg)
+        self.register_store.get(addr).await
     }
 
-    #[cfg(test)]
-    async fn addrs(&self) -> Vec<RegisterAddress> {
+    /// Returns the addresses of all the Registers stored.
+    pub(crate) async fn addrs(&self) -> Result<Vec<RegisterAddress>> {
         self.register_store.addrs().await
     }
 
     /// Used for replication of data to new nodes.
-    /// Currently only used by the tests.
-    /// TODO: to be used by replication logic.
-    #[cfg(test)]
-    async fn get_register_replica(
+    pub(crate) async fn get_register_replica(
         &self,
         address: &RegisterAddress,
     ) -> Result<ReplicatedRegisterLog> {
-        let stored_reg = self.try_load_stored_register(address).await?;
+        // Only the log is copied, out of the Register replica as is stored,
+        // rather than the whole of it.
+        let op_log = self
+            .register_store
+            .read(address, |stored_reg| stored_reg.op_log.clone())
+            .await?;
         // Build the replicated register log assuming ops stored are all valid and correctly
         // signed since we performed such validations before storing them.
         Ok(ReplicatedRegisterLog {
             address: *address,
-            op_log: stored_reg.op_log,
+            op_log,
         })
     }
 }
 
+// Verifies the signature of the cmd, by the authority it holds.
+fn verify_cmd(cmd: &RegisterCmd) -> Result<()> {
+    let (auth, payload) = match cmd {
+        RegisterCmd::Create(SignedRegisterCreate { op, auth }) => (auth, serialize(op)),
+        RegisterCmd::Edit(SignedRegisterEdit { op, auth }) => (auth, serialize(op)),
+    };
+    auth.verify_authority(payload.map_err(|e| Error::Bincode(e.to_string()))?)
+}
+
 #[cfg(test)]
 mod test {
     use super::RegisterStorage;
@@ -308,11 +375,21 @@ mod test {
 
     use bincode::serialize;
     use bls::SecretKey;
-    use eyre::{bail, Result};
+    use eyre::{bail, eyre, Result};
     use rand::{distributions::Alphanumeric, Rng};
     use std::collections::BTreeSet;
+    use tempfile::TempDir;
     use xor_name::XorName;
 
+    const CACHE_SIZE: usize = 1024 * 1024;
+    const CAPACITY: usize = 100 * 1024 * 1024;
+
+    async fn new_store() -> Result<(RegisterStorage, TempDir)> {
+        let dir = tempfile::tempdir()?;
+        let store = RegisterStorage::new(dir.path(), CACHE_SIZE, CAPACITY).await;
+        Ok((store, dir))
+    }
+
     // Helper functions temporarily used for spentbook logic, but also used for tests.
     // This shouldn't be required outside of tests once we have a Spentbook data type.
     fn create_reg_w_policy(
@@ -334,7 +411,7 @@ mod test {
 
     #[tokio::test]
     async fn test_register_try_load_stored() -> Result<()> {
-        let store = RegisterStorage::default();
+        let (store, _dir) = new_store().await?;
 
         let (cmd_create, _, sk, name, policy) = create_register()?;
         let addr = cmd_create.dst();
@@ -374,7 +451,7 @@ mod test {
 
     #[tokio::test]
     async fn test_register_try_load_stored_inverted_cmds_order() -> Result<()> {
-        let store = RegisterStorage::default();
+        let (store, _dir) = new_store().await?;
 
         let (cmd_create, _, sk, name, policy) = create_register()?;
         let addr = cmd_create.dst();
@@ -410,7 +487,7 @@ mod test {
 
     #[tokio::test]
     async fn test_register_apply_cmd_against_state() -> Result<()> {
-        let store = RegisterStorage::default();
+        let (store, _dir) = new_store().await?;
 
         let (cmd_create, _, sk, name, policy) = create_register()?;
         let addr = cmd_create.dst();
@@ -449,10 +526,10 @@ mod test {
         assert_eq!(stored_reg.state.as_ref().map(|reg| reg.size()), Some(1));
 
         // applying the edit cmd again shouldn't fail or alter the register content,
-        // although the log will contain the edit cmd duplicated
+        // nor be logged again
         store.try_to_apply_cmd_against_register_state(&cmd_edit, &mut stored_reg)?;
         assert_eq!(stored_reg.state.as_ref(), Some(&register));
-        assert_eq!(stored_reg.op_log.len(), 3);
+        assert_eq!(stored_reg.op_log.len(), 2);
         assert!(
             stored_reg
                 .op_log
@@ -467,7 +544,7 @@ mod test {
 
     #[tokio::test]
     async fn test_register_apply_cmd_against_state_inverted_cmds_order() -> Result<()> {
-        let store = RegisterStorage::default();
+        let (store, _dir) = new_store().await?;
 
         let (cmd_create, _, sk, name, policy) = create_register()?;
         let addr = cmd_create.dst();
@@ -481,21 +558,16 @@ mod test {
         assert_eq!(stored_reg.state, None);
         assert_eq!(stored_reg.op_log, vec![cmd_edit.clone()]);
 
-        // applying the edit cmd again shouldn't fail,
-        // although the log will contain the edit cmd duplicated
+        // applying the edit cmd again shouldn't fail, nor be logged again
         store.try_to_apply_cmd_against_register_state(&cmd_edit, &mut stored_reg)?;
         assert_eq!(stored_reg.state, None);
-        assert_eq!(stored_reg.op_log.len(), 2);
-        assert!(
-            stored_reg.op_log.iter().all(|op| op == &cmd_edit),
-            "Op log doesn't match"
-        );
+        assert_eq!(stored_reg.op_log, vec![cmd_edit.clone()]);
 
         // let's apply the create cmd now
         store.try_to_apply_cmd_against_register_state(&cmd_create, &mut stored_reg)?;
         // it should contain the create and edit cmds
         assert_eq!(stored_reg.state.as_ref(), Some(&register));
-        assert_eq!(stored_reg.op_log.len(), 3);
+        assert_eq!(stored_reg.op_log.len(), 2);
         assert!(
             stored_reg
                 .op_log
@@ -520,7 +592,7 @@ mod test {
     #[tokio::test]
     async fn test_register_write() -> Result<()> {
         // setup store
-        let store = RegisterStorage::default();
+        let (store, _dir) = new_store().await?;
 
         // create register
         let (cmd, authority, _, _, _) = create_register()?;
@@ -546,10 +618,48 @@ mod test {
         }
     }
 
+    #[tokio::test]
+    async fn unknown_registers_are_not_cached() -> Result<()> {
+        let (store, _dir) = new_store().await?;
+        let (cmd, authority, _, _, _) = create_register()?;
+
+        for _ in 0..2 {
+            match store.read(&RegisterQuery::Read(cmd.dst()), authority).await {
+                QueryResponse::ReadRegister(Err(Error::RegisterNotFound(_))) => {}
+                e => bail!("Should not have found the register: {e:?}"),
+            }
+        }
+        assert_eq!(store.register_store.cached_len().await, 0);
+
+        store.write(&cmd).await?;
+        assert_eq!(store.register_store.cached_len().await, 1);
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn test_register_write_beyond_capacity() -> Result<()> {
+        // setup a store too small to hold any register
+        let dir = tempfile::tempdir()?;
+        let store = RegisterStorage::new(dir.path(), CACHE_SIZE, 10).await;
+
+        let (cmd, authority, _, _, _) = create_register()?;
+        match store.write(&cmd).await {
+            Err(Error::NotEnoughSpace) => {}
+            other => bail!("Should have failed with NotEnoughSpace: {other:?}"),
+        }
+
+        // nothing should have been stored
+        match store.read(&RegisterQuery::Get(cmd.dst()), authority).await {
+            QueryResponse::GetRegister(Err(Error::RegisterNotFound(_))) => Ok(()),
+            e => bail!("Should not have found the register: {e:?}"),
+        }
+    }
+
     #[tokio::test]
     async fn test_register_export() -> Result<()> {
         // setup store
-        let store = RegisterStorage::default();
+        let (store, _dir) = new_store().await?;
 
         let (cmd_create, authority, sk, name, policy) = create_register()?;
         let addr = cmd_create.dst();
@@ -572,10 +682,10 @@ mod test {
         }
 
         // export Registers, get all data we held in storage
-        let all_addrs = store.addrs().await;
+        let all_addrs = store.addrs().await?;
 
         // create new store and update it with the data from first store
-        let new_store = RegisterStorage::default();
+        let (new_store, _new_dir) = new_store().await?;
         for addr in all_addrs {
             let replica = store.get_register_replica(&addr).await?;
             new_store.update(&replica).await?;
@@ -608,7 +718,7 @@ mod test {
     #[tokio::test]
     async fn test_register_non_existing_entry() -> Result<()> {
         // setup store
-        let store = RegisterStorage::default();
+        let (store, _dir) = new_store().await?;
 
         // create register
         let (cmd_create, authority, _, _, _) = create_register()?;
@@ -637,7 +747,7 @@ mod test {
     #[tokio::test]
     async fn test_register_non_existing_permissions() -> Result<()> {
         // setup store
-        let store = RegisterStorage::default();
+        let (store, _dir) = new_store().await?;
 
         // create register
         let (cmd_create, authority, _, _, _) = create_register()?;
@@ -666,6 +776,186 @@ mod test {
         Ok(())
     }
 
+    #[tokio::test]
+    async fn test_register_survives_restart() -> Result<()> {
+        let (store, dir) = new_store().await?;
+
+        let (cmd_create, authority, sk, name, policy) = create_register()?;
+        let addr = cmd_create.dst();
+        let mut register = Register::new(*policy.owner(), name, 0, policy);
+
+        // enough edits for the log to be compacted into a snapshot a few times
+        store.write(&cmd_create).await?;
+        for _ in 0..1000 {
+            let cmd_edit = edit_register(&mut register, &sk)?;
+            store.write(&cmd_edit).await?;
+        }
+        let stored_reg = store.try_load_stored_register(&addr).await?;
+        assert_eq!(stored_reg.state.as_ref(), Some(&register));
+        assert_eq!(stored_reg.op_log.len(), 1001);
+
+        // a new store at the same dir reads the register back from disk
+        let restarted_store = RegisterStorage::new(dir.path(), CACHE_SIZE, CAPACITY).await;
+        let restored_reg = restarted_store.try_load_stored_register(&addr).await?;
+        assert_eq!(restored_reg.state.as_ref(), Some(&register));
+        assert_eq!(restored_reg.op_log, stored_reg.op_log);
+
+        // and keeps on applying edits onto it
+        let cmd_edit = edit_register(&mut register, &sk)?;
+        restarted_store.write(&cmd_edit).await?;
+        match restarted_store
+            .read(&RegisterQuery::Get(addr), authority)
+            .await
+        {
+            QueryResponse::GetRegister(Ok(reg)) => assert_eq!(reg, register),
+            e => bail!("Could not read register! {e:?}"),
+        }
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn test_register_corrupt_log_is_not_truncated() -> Result<()> {
+        let (store, dir) = new_store().await?;
+
+        let (cmd_create, _, sk, name, policy) = create_register()?;
+        let addr = cmd_create.dst();
+        let mut register = Register::new(*policy.owner(), name, 0, policy);
+        store.write(&cmd_create).await?;
+        store.write(&edit_register(&mut register, &sk)?).await?;
+
+        // a complete record which doesn't decode, followed by a valid one
+        let log_path = find_file(dir.path(), "log").ok_or_else(|| eyre!("No ops log"))?;
+        let mut log = std::fs::read(&log_path)?;
+        log.extend_from_slice(&3u32.to_le_bytes());
+        log.extend_from_slice(&[0xff; 3]);
+        let cmd_edit = serialize(&edit_register(&mut register, &sk)?)?;
+        log.extend_from_slice(&(cmd_edit.len() as u32).to_le_bytes());
+        log.extend_from_slice(&cmd_edit);
+        std::fs::write(&log_path, &log)?;
+
+        let restarted_store = RegisterStorage::new(dir.path(), CACHE_SIZE, CAPACITY).await;
+        match restarted_store.try_load_stored_register(&addr).await {
+            Err(Error::RegisterLogCorrupt { .. }) => {}
+            other => bail!("Expected the log to be corrupt, got {other:?}"),
+        }
+        assert_eq!(std::fs::read(&log_path)?, log);
+
+        Ok(())
+    }
+
+    fn find_file(dir: &std::path::Path, name: &str) -> Option<std::path::PathBuf> {
+        for entry in std::fs::read_dir(dir).ok()?.flatten() {
+            let path = entry.path();
+            if path.is_dir() {
+                if let Some(found) = find_file(&path, name) {
+                    return Some(found);
+                }
+            } else if path.file_name().map_or(false, |file| file == name) {
+                return Some(path);
+            }
+        }
+        None
+    }
+
+    #[tokio::test]
+    async fn test_register_read_follows_updates() -> Result<()> {
+        let (store, _dir) = new_store().await?;
+
+        let (cmd_create, authority, sk, name, policy) = create_register()?;
+        let addr = cmd_create.dst();
+        let mut register = Register::new(*policy.owner(), name, 0, policy);
+        store.write(&cmd_create).await?;
+
+        for _ in 0..3 {
+            let heads = register.heads();
+            let cmd_edit = edit_register_atop(&mut register, &sk, heads)?;
+            store.write(&cmd_edit).await?;
+
+            // the entries read are those of the last update
+            match store.read(&RegisterQuery::Read(addr), authority).await {
+                QueryResponse::ReadRegister(Ok(entries)) => assert_eq!(*entries, register.read()),
+                e => bail!("Could not read register! {e:?}"),
+            }
+        }
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn test_register_delta_sync() -> Result<()> {
+        let (store, _dir) = new_store().await?;
+
+        let (cmd_create, authority, sk, name, policy) = create_register()?;
+        let addr = cmd_create.dst();
+        let mut register = Register::new(*policy.owner(), name, 0, policy.clone());
+
+        store.write(&cmd_create).await?;
+        // a chain of edits, each written atop the previous one
+        let mut edits = Vec::new();
+        for _ in 0..10 {
+            let heads = register.heads();
+            let cmd_edit = edit_register_atop(&mut register, &sk, heads)?;
+            store.write(&cmd_edit).await?;
+            edits.push(cmd_edit);
+        }
+
+        // a replica which got only the first half of the edits
+        let mut replica = Register::new(*policy.owner(), name, 0, policy);
+        for cmd in &edits[..5] {
+            if let RegisterCmd::Edit(SignedRegisterEdit { op, .. }) = cmd {
+                replica.apply_op(op.edit.clone())?;
+            }
+        }
+
+        // is sent only the other half, and with them catches up
+        let known_heads = replica.heads();
+        let delta = match store
+            .read(
+                &RegisterQuery::GetDelta {
+                    address: addr,
+                    known_heads,
+                },
+                authority,
+            )
+            .await
+        {
+            QueryResponse::GetRegisterDelta(Ok(delta)) => delta,
+            e => bail!("Could not get the register delta! {e:?}"),
+        };
+        assert_eq!(delta.op_log, edits[5..]);
+        for cmd in delta.op_log {
+            if let RegisterCmd::Edit(SignedRegisterEdit { op, .. }) = cmd {
+                replica.apply_op(op.edit)?;
+            }
+        }
+        assert_eq!(replica.read(), register.read());
+
+        // while a replica knowing nothing is sent everything
+        let known_heads = BTreeSet::new();
+        match store
+            .read(
+                &RegisterQuery::GetDelta {
+                    address: addr,
+                    known_heads,
+                },
+                authority,
+            )
+            .await
+        {
+            QueryResponse::GetRegisterDelta(Ok(delta)) => assert_eq!(delta.op_log.len(), 11),
+            e => bail!("Could not get the register delta! {e:?}"),
+        }
+
+        // cmds already held are not applied again
+        let replica_log = store.get_register_replica(&addr).await?;
+        store.update(&replica_log).await?;
+        let stored_reg = store.try_load_stored_register(&addr).await?;
+        assert_eq!(stored_reg.op_log.len(), 11);
+
+        Ok(())
+    }
+
     fn random_user() -> (User, SecretKey) {
         let sk = SecretKey::random();
         let authority = User::Key(sk.public_key());
@@ -685,11 +975,19 @@ mod test {
     }
 
     fn edit_register(register: &mut Register, sk: &SecretKey) -> Result<RegisterCmd> {
+        edit_register_atop(register, sk, BTreeSet::default())
+    }
+
+    fn edit_register_atop(
+        register: &mut Register,
+        sk: &SecretKey,
+        children: BTreeSet<EntryHash>,
+    ) -> Result<RegisterCmd> {
         let data = rand::thread_rng()
             .sample_iter(&Alphanumeric)
             .take(15)
             .collect();
-        let (_, edit) = register.write(data, BTreeSet::default())?;
+        let (_, edit) = register.write(data, children)?;
         let op = EditRegister {
             address: *register.address(),
             edit,
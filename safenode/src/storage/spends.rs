@@ -6,65 +6,120 @@
 // KIND, either express or implied. Please review the Licences for the specific language governing
 // permissions and limitations relating to use of the SAFE Network Software.
 
+use super::{
+    files::{count_stored_bytes, list_sharded_names, sharded_path, write_atomically},
+    used_space::UsedSpace,
+};
+
 use crate::{
     network_transfers::{Error, Result},
     protocol::address::DbcAddress,
-    storage::used_space::UsedSpace,
 };
 
 use sn_dbc::{DbcId, SignedSpend};
 
+use serde::de::DeserializeOwned;
 use std::{
-    collections::BTreeMap,
     fmt::{self, Display, Formatter},
+    io::ErrorKind,
+    path::{Path, PathBuf},
     sync::Arc,
 };
-use tokio::sync::RwLock;
+use tokio::{
+    fs,
+    sync::{Mutex, MutexGuard},
+};
 use tracing::trace;
 use xor_name::XorName;
 
+/// The name of the dir under the node root dir, where spends are stored.
+const SPENDS_DIR_NAME: &str = "spends";
+/// The name of the dir under the spends dir, where valid spends are stored.
+const VALID_SPENDS_DIR_NAME: &str = "valid";
+/// The name of the dir under the spends dir, where double spends are stored.
+const DOUBLE_SPENDS_DIR_NAME: &str = "double";
+
 /// We will store at most 50MiB of data in a SpendStorage instance.
-const VALID_SPENDS_CACHE_SIZE: usize = 45 * 1024 * 1024;
-const DOUBLE_SPENDS_CACHE_SIZE: usize = 5 * 1024 * 1024;
-
-/// For every DbcId, there is a collection of transactions.
-/// Every transaction has a set of peers who reported that they hold this transaction.
-/// At a higher level, a peer will store a spend to `valid_spends` if the dbc checks out as valid, _and_ the parents of the dbc checks out as valid.
-/// A peer will move a spend from `valid_spends` to `double_spends` if it receives another tx id for the same dbc id.
-/// A peer will never again store such a spend to `valid_spends`.
-type ValidSpends<V> = Arc<RwLock<BTreeMap<DbcAddress, V>>>;
-type DoubleSpends<V> = Arc<RwLock<BTreeMap<DbcAddress, (V, V)>>>;
-
-/// Storage of Dbc spends.
+const VALID_SPENDS_CAPACITY: usize = 45 * 1024 * 1024;
+const DOUBLE_SPENDS_CAPACITY: usize = 5 * 1024 * 1024;
+
+/// The number of shards, one for each value of the first byte of a `DbcAddress`,
+/// which is also the shard dir the spend is stored in.
+const SHARD_COUNT: usize = 256;
+
+/// Disk-backed storage of Dbc spends.
 ///
-/// NB: The used space measurement is just an appromixation, and is not exact.
-/// Later, when all data types have this, we can verify that it is not wildly different.
+/// For every DbcId, there is at most one valid spend, or else the pair of spends it was found
+/// double spent with.
+/// At a higher level, a peer will store a spend as valid if the dbc checks out as valid, _and_ the parents of the dbc checks out as valid.
+/// A peer will move a spend from the valid spends to the double spends if it receives another tx id for the same dbc id.
+/// A peer will never again store such a spend as valid.
+///
+/// Every spend, or pair of double spends, is stored in its own file, in a dir sharded by the
+/// prefix of its address, so that the spends survive a restart. The spends of a shard are
+/// validated and added one at a time, under the lock of the shard, while spends of other shards
+/// proceed in parallel. The encoded bytes stored are accounted for against the capacities.
 #[derive(Clone, Debug)]
 pub(crate) struct SpendStorage {
-    valid_spends: ValidSpends<SignedSpend>,
-    double_spends: DoubleSpends<SignedSpend>,
-    valid_spends_cache_size: UsedSpace,
-    double_spends_cache_size: UsedSpace,
+    valid_spends_dir: PathBuf,
+    double_spends_dir: PathBuf,
+    shards: Arc<Vec<Mutex<()>>>,
+    valid_spends_size: UsedSpace,
+    double_spends_size: UsedSpace,
 }
 
 impl SpendStorage {
-    pub(crate) fn new() -> Self {
+    /// Creates a new `SpendStorage` at the given root dir.
+    /// Spends previously stored at the same root dir are served again.
+    pub(crate) async fn new(root_dir: &Path) -> Self {
+        let spends_dir = root_dir.join(SPENDS_DIR_NAME);
+        let valid_spends_dir = spends_dir.join(VALID_SPENDS_DIR_NAME);
+        let double_spends_dir = spends_dir.join(DOUBLE_SPENDS_DIR_NAME);
+
+        let valid_spends_size = UsedSpace::new(VALID_SPENDS_CAPACITY);
+        valid_spends_size.increase(count_stored_bytes(&valid_spends_dir).await);
+        let double_spends_size = UsedSpace::new(DOUBLE_SPENDS_CAPACITY);
+        double_spends_size.increase(count_stored_bytes(&double_spends_dir).await);
+
         Self {
-            valid_spends: Arc::new(RwLock::new(BTreeMap::new())),
-            double_spends: Arc::new(RwLock::new(BTreeMap::new())),
-            valid_spends_cache_size: UsedSpace::new(VALID_SPENDS_CACHE_SIZE),
-            double_spends_cache_size: UsedSpace::new(DOUBLE_SPENDS_CACHE_SIZE),
+            valid_spends_dir,
+            double_spends_dir,
+            shards: Arc::new((0..SHARD_COUNT).map(|_| Mutex::new(())).collect()),
+            valid_spends_size,
+            double_spends_size,
         }
     }
 
     // Read Spend from local store.
     pub(crate) async fn get(&self, address: DbcAddress) -> Result<SignedSpend> {
         trace!("Getting Spend: {address:?}");
-        if let Some(spend) = self.valid_spends.read().await.get(&address) {
-            Ok(spend.clone())
-        } else {
-            Err(Error::SpendNotFound(address))
-        }
+        // Files are written atomically, so the spend can be read without holding the shard lock.
+        read(&self.valid_spend_path(&address))
+            .await?
+            .ok_or(Error::SpendNotFound(address))
+    }
+
+    /// Returns the pair of spends the dbc at the address was found double spent with, if any.
+    pub(crate) async fn get_double(
+        &self,
+        address: DbcAddress,
+    ) -> Result<Option<(SignedSpend, SignedSpend)>> {
+        read(&self.double_spend_path(&address)).await
+    }
+
+    /// Returns the addresses of all the valid spends and double spends stored.
+    pub(crate) async fn addrs(&self) -> Result<Vec<DbcAddress>> {
+        let mut names = list_sharded_names(&self.valid_spends_dir)
+            .await
+            .map_err(io_error)?;
+        names.extend(
+            list_sharded_names(&self.double_spends_dir)
+                .await
+                .map_err(io_error)?,
+        );
+        names.sort();
+        names.dedup();
+        Ok(names.into_iter().map(DbcAddress::new).collect())
     }
 
     /// We need to check that the parent is spent before
@@ -72,27 +127,27 @@ impl SpendStorage {
     /// If a double spend attempt is detected, a `DoubleSpendAttempt` error
     /// will be returned including all the `SignedSpends`, for
     /// broadcasting to the other nodes.
-    /// NOTE: The `&mut self` signature is necessary to prevent race conditions
-    /// and double spent attempts to be missed (as the validation and adding
-    /// could otherwise happen in parallel in different threads.)
-    pub(crate) async fn try_add(&mut self, signed_spend: &SignedSpend) -> Result<()> {
-        self.validate(signed_spend).await?;
-
-        let size_of_new = std::mem::size_of_val(signed_spend);
+    pub(crate) async fn try_add(&self, signed_spend: &SignedSpend) -> Result<()> {
         let address = dbc_address(signed_spend.dbc_id());
+        // The shard lock is held from the validation until the spend is stored,
+        // so that no double spend attempt is missed in between.
+        let _shard = self.lock_shard(&address).await;
 
-        let mut valid_spends = self.valid_spends.write().await;
-
-        let replaced = valid_spends.insert(address, signed_spend.clone());
-        if replaced.is_none() {
-            self.valid_spends_cache_size.increase(size_of_new);
-        } else {
-            // The `&mut self` signature prevents any race,
-            // so this is a second layer of security on that,
-            // if some developer by mistake removes the &mut self.
-            drop(valid_spends);
-            self.validate(signed_spend).await?;
+        let bytes = match self.validate_locked(&address, signed_spend).await? {
+            Validated::Unspendable | Validated::Stored => return Ok(()),
+            Validated::New(bytes) => bytes,
+        };
+
+        // Only the shard is locked, so the space is reserved at once with the check of it,
+        // for spends of other shards not to take the same space.
+        if !self.valid_spends_size.try_reserve(bytes.len()) {
+            return Err(Error::NotEnoughSpace); // We don't have space for this spend.
         }
+        if let Err(err) = write_atomically(&self.valid_spend_path(&address), &bytes).await {
+            self.valid_spends_size.decrease(bytes.len());
+            return Err(io_error(err));
+        }
+        trace!("Spend successfully stored: {address:?}");
 
         Ok(())
     }
@@ -100,73 +155,19 @@ impl SpendStorage {
     /// Validates a spend without adding it to the storage.
     /// If it however is detected as a double spend, that fact is recorded immediately,
     /// and an error returned.
-    /// NOTE: The `&mut self` signature is necessary to prevent race conditions
-    /// and double spent attempts to be missed (as the validation and adding
-    /// could otherwise happen in parallel in different threads.)
-    pub(crate) async fn validate(&mut self, signed_spend: &SignedSpend) -> Result<()> {
-        if self.is_unspendable(signed_spend.dbc_id()).await {
-            return Ok(()); // Already unspendable, so we don't care about this spend.
-        }
-
-        let size_of_new = std::mem::size_of_val(signed_spend);
-        if !self.valid_spends_cache_size.can_add(size_of_new) {
-            return Err(Error::NotEnoughSpace); // We don't have space for this spend.
-        }
-
+    /// The signature of the spend must have been verified beforehand, see `verify_spends`.
+    pub(crate) async fn validate(&self, signed_spend: &SignedSpend) -> Result<()> {
         let address = dbc_address(signed_spend.dbc_id());
-
-        // The spend id is from the spend hash. That makes sure that a spend is compared based
-        // on all of `DbcTransaction`, `DbcReason`, `DbcId` and `BlindedAmount` being equal.
-        let mut valid_spends = self.valid_spends.write().await;
-        if let Some(existing) = valid_spends.get(&address).cloned() {
-            let tamper_attempted = signed_spend.spend.hash() != existing.spend.hash();
-            if tamper_attempted {
-                if !self.double_spends_cache_size.can_add(size_of_new) {
-                    return Err(Error::NotEnoughSpace); // We don't have space for this operation.
-                }
-
-                let mut double_spends = self.double_spends.write().await;
-                let replaced =
-                    double_spends.insert(address, (existing.clone(), signed_spend.clone()));
-
-                let size_of_existing = std::mem::size_of_val(&existing);
-                if replaced.is_none() {
-                    self.double_spends_cache_size
-                        .increase(size_of_new + size_of_existing);
-                }
-
-                // The spend is now permanently removed from the valid spends.
-                let removed = valid_spends.remove(&address);
-                if removed.is_some() {
-                    self.valid_spends_cache_size.decrease(size_of_existing);
-                }
-
-                return Err(Error::DoubleSpendAttempt {
-                    new: Box::new(signed_spend.clone()),
-                    existing: Box::new(existing.clone()),
-                });
-            }
-        };
-
-        // This hash input is pointless, since it will compare with
-        // the same hash in the verify fn.
-        // It does however verify that the derived key corresponding to
-        // the dbc id signed this spend.
-        signed_spend.verify(signed_spend.dst_tx_hash())?;
-        // TODO: We want to verify the transaction somehow as well..
-        // signed_spend.spend.tx.verify(blinded_amounts)
-
+        let _shard = self.lock_shard(&address).await;
+        let _ = self.validate_locked(&address, signed_spend).await?;
         Ok(())
     }
 
     /// When data is replicated to a new peer,
     /// it may contain double spends, and thus we need to add that here,
     /// so that we in the future can serve this info to Clients.
-    /// NOTE: The `&mut self` signature is necessary to prevent race conditions
-    /// and double spent attempts to be missed (as the validation and adding
-    /// could otherwise happen in parallel in different threads.)
     pub(crate) async fn try_add_double(
-        &mut self,
+        &self,
         a_spend: &SignedSpend,
         b_spend: &SignedSpend,
     ) -> Result<()> {
@@ -189,52 +190,142 @@ impl SpendStorage {
             ));
         }
 
-        if self.is_unspendable(a_spend.dbc_id()).await {
+        let address = dbc_address(a_spend.dbc_id());
+        let _shard = self.lock_shard(&address).await;
+
+        if self.is_unspendable(&address).await {
             return Ok(());
         }
 
-        let size_of_spends = std::mem::size_of_val(&(a_spend, b_spend));
-        if !self.double_spends_cache_size.can_add(size_of_spends) {
+        self.store_double(&address, a_spend, b_spend).await
+    }
+
+    // Validates the spend, with the lock of its shard held by the caller.
+    // Returns the encoded spend if it isn't stored yet.
+    async fn validate_locked(
+        &self,
+        address: &DbcAddress,
+        signed_spend: &SignedSpend,
+    ) -> Result<Validated> {
+        if self.is_unspendable(address).await {
+            return Ok(Validated::Unspendable); // Already unspendable, so we don't care about this spend.
+        }
+
+        let existing: Option<SignedSpend> = read(&self.valid_spend_path(address)).await?;
+        if let Some(existing) = existing {
+            // The spend id is from the spend hash. That makes sure that a spend is compared based
+            // on all of `DbcTransaction`, `DbcReason`, `DbcId` and `BlindedAmount` being equal.
+            let tamper_attempted = signed_spend.spend.hash() != existing.spend.hash();
+            if !tamper_attempted {
+                return Ok(Validated::Stored);
+            }
+
+            self.store_double(address, &existing, signed_spend).await?;
+
+            return Err(Error::DoubleSpendAttempt {
+                new: Box::new(signed_spend.clone()),
+                existing: Box::new(existing),
+            });
+        }
+
+        let bytes = encode(signed_spend)?;
+        // Spends are not validated and stored at once, so this only rejects early a spend
+        // that wouldn't fit. The space is reserved when it is stored.
+        if !self.valid_spends_size.can_add(bytes.len()) {
             return Err(Error::NotEnoughSpace); // We don't have space for this spend.
         }
 
-        let address = dbc_address(a_spend.dbc_id());
+        // The signature of the spend is verified by the caller, along with the ones of its parents,
+        // so that it isn't done while holding the lock.
+        // TODO: We want to verify the transaction somehow as well..
+        // signed_spend.spend.tx.verify(blinded_amounts)
+
+        Ok(Validated::New(bytes))
+    }
 
-        let mut double_spends = self.double_spends.write().await;
-        let replaced = double_spends.insert(address, (a_spend.clone(), b_spend.clone()));
-        if replaced.is_none() {
-            // This would only be reached if a double spend was registered
-            // in between the call to `is_unspendable` and the call to `double_spends.insert`.
-            self.double_spends_cache_size.increase(size_of_spends);
+    // Records the spends as double spends, and permanently removes the spend at the address
+    // from the valid spends. The lock of the shard of the address is held by the caller.
+    async fn store_double(
+        &self,
+        address: &DbcAddress,
+        a_spend: &SignedSpend,
+        b_spend: &SignedSpend,
+    ) -> Result<()> {
+        let bytes = encode(&(a_spend, b_spend))?;
+        if !self.double_spends_size.try_reserve(bytes.len()) {
+            return Err(Error::NotEnoughSpace); // We don't have space for this operation.
+        }
+        if let Err(err) = write_atomically(&self.double_spend_path(address), &bytes).await {
+            self.double_spends_size.decrease(bytes.len());
+            return Err(io_error(err));
         }
 
-        // The spend is now permanently removed from the valid spends.
-        let mut valid_spends = self.valid_spends.write().await;
-        if let Some(removed) = valid_spends.remove(&address) {
-            self.valid_spends_cache_size
-                .decrease(std::mem::size_of_val(&removed));
+        let valid_spend_path = self.valid_spend_path(address);
+        if let Ok(metadata) = fs::metadata(&valid_spend_path).await {
+            match fs::remove_file(&valid_spend_path).await {
+                Ok(()) => self.valid_spends_size.decrease(metadata.len() as usize),
+                Err(err) if err.kind() == ErrorKind::NotFound => {}
+                Err(err) => return Err(io_error(err)),
+            }
         }
 
         Ok(())
     }
 
-    /// Checks if the given DbcId is unspendable.
-    async fn is_unspendable(&self, dbc_id: &DbcId) -> bool {
-        let address = dbc_address(dbc_id);
-        self.double_spends.read().await.contains_key(&address)
+    /// Checks if the spends at the given address are unspendable.
+    async fn is_unspendable(&self, address: &DbcAddress) -> bool {
+        fs::metadata(self.double_spend_path(address)).await.is_ok()
+    }
+
+    async fn lock_shard(&self, address: &DbcAddress) -> MutexGuard<'_, ()> {
+        self.shards[address.name().0[0] as usize % SHARD_COUNT]
+            .lock()
+            .await
+    }
+
+    fn valid_spend_path(&self, address: &DbcAddress) -> PathBuf {
+        sharded_path(&self.valid_spends_dir, address.name())
+    }
+
+    fn double_spend_path(&self, address: &DbcAddress) -> PathBuf {
+        sharded_path(&self.double_spends_dir, address.name())
     }
 }
 
+// The outcome of validating a spend that isn't a double spend.
+enum Validated {
+    // The dbc is already unspendable.
+    Unspendable,
+    // The same spend is already stored.
+    Stored,
+    // The spend is valid, and can be stored with the given bytes.
+    New(Vec<u8>),
+}
+
 impl Display for SpendStorage {
     fn fmt(&self, formatter: &mut Formatter) -> fmt::Result {
         write!(formatter, "SpendStorage")
     }
 }
 
-impl Default for SpendStorage {
-    fn default() -> Self {
-        Self::new()
-    }
+// Reads and decodes the file at the path, if there is one.
+async fn read<T: DeserializeOwned>(path: &Path) -> Result<Option<T>> {
+    let bytes = match fs::read(path).await {
+        Ok(bytes) => bytes,
+        Err(err) if err.kind() == ErrorKind::NotFound => return Ok(None),
+        Err(err) => return Err(io_error(err)),
+    };
+    bincode::deserialize(&bytes)
+        .map(Some)
+        .map_err(|err| Error::SpendSerialisation(err.to_string()))
+}
+
+fn encode<T: serde::Serialize>(value: &T) -> Result<Vec<u8>> {
+    bincode::serialize(value).map_err(|err| Error::SpendSerialisation(err.to_string()))
+}
+
+fn io_error(err: std::io::Error) -> Error {
+    Error::SpendStorageIo(err.to_string())
 }
 
 /// Still thinking of best location for this.
@@ -248,3 +339,115 @@ fn dbc_address(dbc_id: &DbcId) -> DbcAddress {
 fn get_dbc_name(dbc_id: &DbcId) -> XorName {
     XorName::from_content(&dbc_id.to_bytes())
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use crate::protocol::{dbc_genesis::create_genesis_dbc, transfers::create_offline_transfer};
+
+    use sn_dbc::{MainKey, Token};
+
+    use eyre::Result;
+
+    // Returns two different spends of the same dbc, each sending to a new recipient.
+    fn double_spends() -> Result<(SignedSpend, SignedSpend)> {
+        let key = MainKey::random();
+        let genesis = create_genesis_dbc(&key).expect("Genesis creation to succeed.");
+        let derived_key = genesis.derived_key(&key)?;
+
+        let mut spends = (0..2).map(|_| {
+            let recipient = MainKey::random().random_dbc_id_src(&mut rand::thread_rng());
+            let transfer = create_offline_transfer(
+                vec![(genesis.clone(), derived_key.clone())],
+                vec![(Token::from_nano(100), recipient)],
+                key.public_address(),
+            )
+            .expect("There should be no issues creating this transfer.");
+            transfer.created_dbcs[0]
+                .dbc
+                .signed_spends
+                .iter()
+                .next()
+                .cloned()
+                .expect("The transfer to spend the genesis dbc")
+        });
+        let a_spend = spends.next().expect("Two spends");
+        let b_spend = spends.next().expect("Two spends");
+        Ok((a_spend, b_spend))
+    }
+
+    #[tokio::test]
+    async fn stored_spends_survive_a_restart() -> Result<()> {
+        let root_dir = tempfile::tempdir()?;
+        let (spend, _) = double_spends()?;
+        let address = dbc_address(spend.dbc_id());
+
+        let storage = SpendStorage::new(root_dir.path()).await;
+        storage.try_add(&spend).await?;
+        // Adding the same spend again changes nothing.
+        storage.try_add(&spend).await?;
+        assert_eq!(storage.get(address).await?, spend);
+
+        let storage = SpendStorage::new(root_dir.path()).await;
+        assert_eq!(storage.get(address).await?, spend);
+        assert_eq!(
+            count_stored_bytes(&storage.valid_spends_dir).await,
+            encode(&spend)?.len()
+        );
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn double_spends_are_recorded_and_survive_a_restart() -> Result<()> {
+        let root_dir = tempfile::tempdir()?;
+        let (a_spend, b_spend) = double_spends()?;
+        let address = dbc_address(a_spend.dbc_id());
+
+        let storage = SpendStorage::new(root_dir.path()).await;
+        storage.try_add(&a_spend).await?;
+        assert!(matches!(
+            storage.try_add(&b_spend).await,
+            Err(Error::DoubleSpendAttempt { .. })
+        ));
+        assert_eq!(
+            storage.get(address).await,
+            Err(Error::SpendNotFound(address))
+        );
+
+        // Neither of the spends is ever stored as valid again.
+        let storage = SpendStorage::new(root_dir.path()).await;
+        storage.try_add(&a_spend).await?;
+        assert_eq!(
+            storage.get(address).await,
+            Err(Error::SpendNotFound(address))
+        );
+        assert_eq!(count_stored_bytes(&storage.valid_spends_dir).await, 0);
+
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn notified_double_spends_make_the_dbc_unspendable() -> Result<()> {
+        let root_dir = tempfile::tempdir()?;
+        let (a_spend, b_spend) = double_spends()?;
+        let address = dbc_address(a_spend.dbc_id());
+
+        let storage = SpendStorage::new(root_dir.path()).await;
+        assert!(matches!(
+            storage.try_add_double(&a_spend, &a_spend).await,
+            Err(Error::NotADoubleSpendAttempt(..))
+        ));
+
+        storage.try_add(&a_spend).await?;
+        storage.try_add_double(&a_spend, &b_spend).await?;
+        assert!(storage.is_unspendable(&address).await);
+        assert_eq!(
+            storage.get(address).await,
+            Err(Error::SpendNotFound(address))
+        );
+
+        Ok(())
+    }
+}
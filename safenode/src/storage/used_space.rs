@@ -10,7 +10,7 @@ use std::sync::{
     atomic::{AtomicUsize, Ordering},
     Arc,
 };
-use tracing::info;
+use tracing::trace;
 
 /// Tracking used space.
 #[derive(Clone, Debug)]
@@ -35,12 +35,12 @@ impl UsedSpace {
 
     /// Increases used space.
     pub(crate) fn increase(&self, size: usize) {
-        let _ = self.used_space.fetch_add(size, Ordering::Relaxed);
-        let used_space = self.used_space.load(Ordering::Relaxed);
-        let used_space_ratio = used_space as f64 / self.capacity as f64;
-        info!("Used space: {:?}", used_space);
-        info!("Capacity: {:?}", self.capacity);
-        info!("Used space ratio: {:?}", used_space_ratio);
+        let used_space = self.used_space.fetch_add(size, Ordering::Relaxed) + size;
+        trace!(
+            "Used space: {used_space} of {} ({:.2})",
+            self.capacity,
+            used_space as f64 / self.capacity as f64
+        );
     }
 
     /// Decreases used space.
@@ -48,6 +48,32 @@ impl UsedSpace {
         let _ = self.used_space.fetch_sub(size, Ordering::Relaxed);
     }
 
+    /// Reserves `size` bytes of the capacity if they fit in it, returning whether they did.
+    /// The check and the increase are done at once, so that concurrent writes can't together
+    /// exceed the capacity. Reserved bytes that end up not being written are to be released
+    /// with `decrease`.
+    pub(crate) fn try_reserve(&self, size: usize) -> bool {
+        let reserved =
+            self.used_space
+                .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |used_space| {
+                    used_space
+                        .checked_add(size)
+                        .filter(|used_space| *used_space <= self.capacity)
+                });
+        match reserved {
+            Ok(used_space) => {
+                trace!(
+                    "Used space: {} of {} ({:.2})",
+                    used_space + size,
+                    self.capacity,
+                    (used_space + size) as f64 / self.capacity as f64
+                );
+                true
+            }
+            Err(_) => false,
+        }
+    }
+
     /// This prevents the node to fill up actual disk space
     /// beyond what a node operator deems convenient.
     pub(crate) fn can_add(&self, size: usize) -> bool {
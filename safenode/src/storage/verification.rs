@@ -0,0 +1,96 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use crate::protocol::error::{Error, Result};
+
+use rayon::prelude::*;
+use tokio::sync::oneshot;
+
+/// Batches with fewer items than this are checked inline,
+/// as handing them over to the pool would cost more than it saves.
+const MIN_POOLED_BATCH: usize = 2;
+
+/// Runs the signature checks of a batch of items across the rayon pool, off the async runtime,
+/// and returns each item along with the result of its check, in the order they were given.
+///
+/// The checks of a batch run in parallel, so that a burst of spends or a replicated Register log
+/// costs about the time of its slowest check, rather than that of all of them in a row.
+///
+/// Fails if the pool dropped the batch before returning the results of its checks.
+pub(crate) async fn verify_batch<T, E>(
+    items: Vec<T>,
+    check: fn(&T) -> std::result::Result<(), E>,
+) -> Result<Vec<(T, std::result::Result<(), E>)>>
+where
+    T: Send + 'static,
+    E: Send + 'static,
+{
+    if items.len() < MIN_POOLED_BATCH {
+        return Ok(items
+            .into_iter()
+            .map(|item| {
+                let result = check(&item);
+                (item, result)
+            })
+            .collect());
+    }
+
+    let len = items.len();
+    let (sender, receiver) = oneshot::channel();
+    rayon::spawn(move || {
+        let results = items
+            .into_par_iter()
+            .map(|item| {
+                let result = check(&item);
+                (item, result)
+            })
+            .collect();
+        // The caller may have given up on the batch.
+        let _ = sender.send(results);
+    });
+
+    receiver
+        .await
+        .map_err(|_| Error::BatchVerificationAborted(len))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn is_even(item: &u64) -> std::result::Result<(), u64> {
+        if item % 2 == 0 {
+            Ok(())
+        } else {
+            Err(*item)
+        }
+    }
+
+    #[tokio::test]
+    async fn results_are_returned_in_order_with_their_items() -> Result<()> {
+        let items: Vec<u64> = (0..1000).collect();
+        let results = verify_batch(items.clone(), is_even).await?;
+
+        assert_eq!(results.len(), items.len());
+        for ((item, result), expected) in results.into_iter().zip(items) {
+            assert_eq!(item, expected);
+            assert_eq!(result, is_even(&expected));
+        }
+        Ok(())
+    }
+
+    #[tokio::test]
+    async fn small_batches_are_checked_inline() -> Result<()> {
+        let results = verify_batch(vec![3], is_even).await?;
+        assert_eq!(results, vec![(3, Err(3))]);
+
+        let results = verify_batch(vec![], is_even).await?;
+        assert!(results.is_empty());
+        Ok(())
+    }
+}
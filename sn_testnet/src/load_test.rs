@@ -0,0 +1,526 @@
+// Copyright 2023 MaidSafe.net limited.
+//
+// This SAFE Network Software is licensed to you under The General Public License (GPL), version 3.
+// Unless required by applicable law or agreed to in writing, the SAFE Network Software distributed
+// under the GPL Licence is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied. Please review the Licences for the specific language governing
+// permissions and limitations relating to use of the SAFE Network Software.
+
+use sn_testnet::SAFENODE_BIN_NAME;
+
+use safenode::{
+    client::{Client, ClientEvent, Error as ClientError, Files, Register},
+    protocol::{
+        address::ChunkAddress,
+        wallet::{LocalWallet, SendWallet, Wallet},
+    },
+};
+
+use bytes::Bytes;
+use color_eyre::{eyre::eyre, Result};
+use rand::{seq::SliceRandom, Rng, RngCore};
+use sn_dbc::Token;
+use std::{
+    collections::BTreeMap,
+    fmt,
+    path::PathBuf,
+    str::FromStr,
+    sync::{Arc, Mutex},
+    time::{Duration, Instant},
+};
+use tokio::time::timeout;
+use tracing::{debug, info, warn};
+use xor_name::XorName;
+
+/// The tag of the Registers edited by the clients.
+const REGISTER_TAG: u64 = 3006;
+/// The size of the entries written to the Registers.
+const REGISTER_ENTRY_SIZE: usize = 64;
+/// How long a client waits to connect to the testnet.
+const CONNECT_TIMEOUT: Duration = Duration::from_secs(30);
+/// The number of clock ticks per second the CPU times of processes are given in.
+/// It is 100 on all Linux platforms we run testnets on.
+#[cfg(target_os = "linux")]
+const CLOCK_TICKS_PER_SEC: f64 = 100.0;
+
+/// Drive load against a running local testnet, and report the latencies of the operations.
+#[derive(Debug, clap::Args)]
+pub(crate) struct LoadArgs {
+    /// The number of clients driving load concurrently.
+    #[clap(long, default_value_t = 8)]
+    clients: usize,
+
+    /// How long to drive load for, in seconds.
+    #[clap(long, default_value_t = 60)]
+    duration: u64,
+
+    /// The mix of operations each client makes, as relative weights of
+    /// `upload`, `download`, `register` (edits) and `spend`.
+    #[clap(long, default_value = "upload=4,download=4,register=2,spend=1")]
+    mix: OpMix,
+
+    /// The size in bytes of each file uploaded.
+    #[clap(long, default_value_t = 1024 * 1024)]
+    file_size: usize,
+
+    /// The dir of the funded wallets the clients spend from, one in the sub dir named by the
+    /// index of each client (`0`, `1`, ..). Each spend sends a nano back to its own wallet.
+    ///
+    /// Without it, or for a client whose wallet is empty, spends are left out of the mix.
+    #[clap(long, value_name = "DIR_PATH")]
+    wallets_dir: Option<PathBuf>,
+}
+
+/// A kind of operation the load is made of.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord)]
+enum Op {
+    Upload,
+    Download,
+    RegisterEdit,
+    Spend,
+}
+
+impl fmt::Display for Op {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let name = match self {
+            Op::Upload => "upload",
+            Op::Download => "download",
+            Op::RegisterEdit => "register",
+            Op::Spend => "spend",
+        };
+        write!(f, "{name}")
+    }
+}
+
+/// The operations of the load, each weighted by how often it is made relative to the others.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub(crate) struct OpMix(Vec<(Op, u32)>);
+
+impl FromStr for OpMix {
+    type Err = String;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        let mut weights = Vec::new();
+        for part in s.split(',').map(str::trim).filter(|part| !part.is_empty()) {
+            let (name, weight) = part
+                .split_once('=')
+                .ok_or_else(|| format!("Expected `op=weight`, got `{part}`"))?;
+            let op = match name.trim() {
+                "upload" => Op::Upload,
+                "download" => Op::Download,
+                "register" => Op::RegisterEdit,
+                "spend" => Op::Spend,
+                other => return Err(format!("Unknown operation `{other}`")),
+            };
+            let weight = weight
+                .trim()
+                .parse()
+                .map_err(|err| format!("Invalid weight of `{name}`: {err}"))?;
+            weights.push((op, weight));
+        }
+        if weights.iter().all(|(_, weight)| *weight == 0) {
+            return Err("At least one operation must have a weight above zero".to_string());
+        }
+        Ok(Self(weights))
+    }
+}
+
+impl OpMix {
+    // Without the operation, for when a client can't make it.
+    fn without(&self, op: Op) -> Self {
+        Self(
+            self.0
+                .iter()
+                .filter(|(other, _)| *other != op)
+                .cloned()
+                .collect(),
+        )
+    }
+
+    fn has(&self, op: Op) -> bool {
+        self.0
+            .iter()
+            .any(|(other, weight)| *other == op && *weight > 0)
+    }
+
+    fn choose(&self, rng: &mut impl Rng) -> Option<Op> {
+        self.0
+            .choose_weighted(rng, |(_, weight)| *weight)
+            .ok()
+            .map(|(op, _)| *op)
+    }
+}
+
+/// The outcomes of the operations of a kind.
+#[derive(Debug, Default)]
+struct OpStats {
+    latencies: Vec<Duration>,
+    errors: usize,
+    bytes: usize,
+}
+
+impl OpStats {
+    fn merge(&mut self, other: OpStats) {
+        self.latencies.extend(other.latencies);
+        self.errors += other.errors;
+        self.bytes += other.bytes;
+    }
+}
+
+/// The CPU time and memory used by a node process.
+#[derive(Clone, Copy, Debug)]
+struct NodeUsage {
+    cpu_time: Duration,
+    rss_bytes: u64,
+}
+
+/// Drives the load against the testnet, then prints the report of it.
+pub(crate) async fn run(args: LoadArgs) -> Result<()> {
+    if args.clients == 0 {
+        return Err(eyre!("At least one client is needed to drive load"));
+    }
+
+    println!("Connecting {} clients to the testnet..", args.clients);
+    let mut clients = Vec::with_capacity(args.clients);
+    for index in 0..args.clients {
+        clients.push(LoadClient::connect(index, &args).await?);
+    }
+
+    let usage_before = node_usage();
+    let uploaded = Arc::new(Mutex::new(Vec::new()));
+    let duration = Duration::from_secs(args.duration);
+    println!(
+        "Driving load for {duration:?}, with the mix {}..",
+        format_mix(&args.mix)
+    );
+
+    let start = Instant::now();
+    let handles: Vec<_> = clients
+        .into_iter()
+        .map(|client| tokio::spawn(client.drive(start + duration, uploaded.clone())))
+        .collect();
+    let mut stats: BTreeMap<Op, OpStats> = BTreeMap::new();
+    for handle in handles {
+        for (op, client_stats) in handle.await? {
+            stats.entry(op).or_default().merge(client_stats);
+        }
+    }
+    let elapsed = start.elapsed();
+    let usage_after = node_usage();
+
+    print_latencies(&mut stats, elapsed);
+    print_node_usage(&usage_before, &usage_after, elapsed);
+
+    Ok(())
+}
+
+/// A client driving its share of the load.
+struct LoadClient {
+    index: usize,
+    files: Files,
+    register: Option<Register>,
+    wallet: Option<LocalWallet>,
+    client: Client,
+    mix: OpMix,
+    file_size: usize,
+}
+
+impl LoadClient {
+    async fn connect(index: usize, args: &LoadArgs) -> Result<Self> {
+        let client = Client::new(bls::SecretKey::random())?;
+        let mut events = client.events_channel();
+        match timeout(CONNECT_TIMEOUT, events.recv()).await {
+            Ok(Ok(ClientEvent::ConnectedToNetwork)) => debug!("Client {index} connected"),
+            _ => return Err(eyre!("Client {index} failed to connect to the testnet")),
+        }
+
+        let mut mix = args.mix.clone();
+
+        let register = if mix.has(Op::RegisterEdit) {
+            let name = XorName::random(&mut rand::thread_rng());
+            Some(client.create_register(name, REGISTER_TAG).await?)
+        } else {
+            None
+        };
+
+        let mut wallet = None;
+        if mix.has(Op::Spend) {
+            if let Some(wallets_dir) = &args.wallets_dir {
+                let loaded = LocalWallet::load_from(&wallets_dir.join(index.to_string())).await?;
+                if loaded.balance() > Token::zero() {
+                    wallet = Some(loaded);
+                }
+            }
+            if wallet.is_none() {
+                warn!("Client {index} has no funded wallet, so it makes no spends");
+                mix = mix.without(Op::Spend);
+            }
+        }
+
+        Ok(Self {
+            index,
+            files: Files::new(client.clone()),
+            register,
+            wallet,
+            client,
+            mix,
+            file_size: args.file_size,
+        })
+    }
+
+    // Makes operations one after the other until the deadline, and returns their outcomes.
+    async fn drive(
+        mut self,
+        deadline: Instant,
+        uploaded: Arc<Mutex<Vec<ChunkAddress>>>,
+    ) -> BTreeMap<Op, OpStats> {
+        let mut stats: BTreeMap<Op, OpStats> = BTreeMap::new();
+        while Instant::now() < deadline {
+            let op = match self.mix.choose(&mut rand::thread_rng()) {
+                // Nothing can be downloaded before a file is uploaded, so one is uploaded
+                // in its place, and recorded as the upload it is.
+                Some(Op::Download)
+                    if uploaded
+                        .lock()
+                        .unwrap_or_else(|err| err.into_inner())
+                        .is_empty() =>
+                {
+                    Op::Upload
+                }
+                Some(op) => op,
+                None => break,
+            };
+            let start = Instant::now();
+            let result = self.make(op, &uploaded).await;
+            let latency = start.elapsed();
+
+            let op_stats = stats.entry(op).or_default();
+            match result {
+                Ok(bytes) => {
+                    op_stats.latencies.push(latency);
+                    op_stats.bytes += bytes;
+                }
+                Err(err) => {
+                    warn!("Client {} failed to {op}: {err}", self.index);
+                    op_stats.errors += 1;
+                }
+            }
+        }
+        stats
+    }
+
+    // Makes the operation, returning the number of bytes of content it moved.
+    async fn make(&mut self, op: Op, uploaded: &Mutex<Vec<ChunkAddress>>) -> Result<usize> {
+        match op {
+            Op::Upload => self.upload(uploaded).await,
+            Op::Download => {
+                let address = {
+                    let uploaded = uploaded.lock().unwrap_or_else(|err| err.into_inner());
+                    uploaded.choose(&mut rand::thread_rng()).copied()
+                };
+                let address = address.ok_or_else(|| eyre!("No file uploaded to download"))?;
+                Ok(self.files.read_bytes(address).await?.len())
+            }
+            Op::RegisterEdit => {
+                let register = self
+                    .register
+                    .as_mut()
+                    .ok_or_else(|| eyre!("No Register to edit"))?;
+                let mut entry = vec![0u8; REGISTER_ENTRY_SIZE];
+                rand::thread_rng().fill_bytes(&mut entry);
+                match register.write(&entry).await {
+                    Err(ClientError::ContentBranchDetected(_)) => {
+                        register.write_merging_branches(&entry).await?
+                    }
+                    result => result?,
+                }
+                Ok(entry.len())
+            }
+            Op::Spend => {
+                let wallet = self
+                    .wallet
+                    .as_mut()
+                    .ok_or_else(|| eyre!("No wallet to spend from"))?;
+                let to = wallet.address();
+                let _created = wallet
+                    .send(vec![(Token::from_nano(1), to)], &self.client)
+                    .await?;
+                // Stored after every spend, for the wallet not to list dbcs spent already.
+                wallet.store().await?;
+                Ok(0)
+            }
+        }
+    }
+
+    async fn upload(&self, uploaded: &Mutex<Vec<ChunkAddress>>) -> Result<usize> {
+        let mut bytes = vec![0u8; self.file_size];
+        rand::thread_rng().fill_bytes(&mut bytes);
+        let address = self.files.upload(Bytes::from(bytes)).await?;
+        uploaded
+            .lock()
+            .unwrap_or_else(|err| err.into_inner())
+            .push(address);
+        Ok(self.file_size)
+    }
+}
+
+fn format_mix(mix: &OpMix) -> String {
+    mix.0
+        .iter()
+        .map(|(op, weight)| format!("{op}={weight}"))
+        .collect::<Vec<_>>()
+        .join(",")
+}
+
+// Returns the latency at the percentile of the sorted latencies, with the nearest-rank method.
+fn percentile(sorted: &[Duration], percentile: f64) -> Duration {
+    if sorted.is_empty() {
+        return Duration::ZERO;
+    }
+    let rank = (percentile * sorted.len() as f64 / 100.0).ceil() as usize;
+    sorted[rank.clamp(1, sorted.len()) - 1]
+}
+
+fn print_latencies(stats: &mut BTreeMap<Op, OpStats>, elapsed: Duration) {
+    println!();
+    println!("======== Operations over {elapsed:.1?} ========");
+    println!(
+        "{:<10} {:>8} {:>7} {:>9} {:>9} {:>10} {:>10} {:>10}",
+        "op", "ok", "errors", "ops/s", "MiB/s", "p50", "p99", "p999"
+    );
+    let secs = elapsed.as_secs_f64();
+    for (op, op_stats) in stats.iter_mut() {
+        op_stats.latencies.sort();
+        let latencies = &op_stats.latencies;
+        println!(
+            "{:<10} {:>8} {:>7} {:>9.2} {:>9.2} {:>10.1?} {:>10.1?} {:>10.1?}",
+            op.to_string(),
+            latencies.len(),
+            op_stats.errors,
+            latencies.len() as f64 / secs,
+            op_stats.bytes as f64 / (1024.0 * 1024.0) / secs,
+            percentile(latencies, 50.0),
+            percentile(latencies, 99.0),
+            percentile(latencies, 99.9),
+        );
+    }
+}
+
+fn print_node_usage(
+    before: &BTreeMap<u32, NodeUsage>,
+    after: &BTreeMap<u32, NodeUsage>,
+    elapsed: Duration,
+) {
+    println!();
+    println!("======== Node resource usage ========");
+    if after.is_empty() {
+        println!("No {SAFENODE_BIN_NAME} processes found to report the usage of.");
+        return;
+    }
+    println!("{:>8} {:>8} {:>10}", "pid", "cpu %", "rss MiB");
+    for (pid, usage) in after {
+        // A node started during the run is only accounted for from its start.
+        let cpu_time = match before.get(pid) {
+            Some(before) => usage.cpu_time.saturating_sub(before.cpu_time),
+            None => usage.cpu_time,
+        };
+        println!(
+            "{pid:>8} {:>8.1} {:>10.1}",
+            100.0 * cpu_time.as_secs_f64() / elapsed.as_secs_f64(),
+            usage.rss_bytes as f64 / (1024.0 * 1024.0)
+        );
+    }
+    info!("Reported the usage of {} nodes", after.len());
+}
+
+/// Returns the CPU time and memory used so far by each running node, by its pid.
+#[cfg(target_os = "linux")]
+fn node_usage() -> BTreeMap<u32, NodeUsage> {
+    let mut usage = BTreeMap::new();
+    let entries = match std::fs::read_dir("/proc") {
+        Ok(entries) => entries,
+        Err(err) => {
+            warn!("Failed to list the processes: {err}");
+            return usage;
+        }
+    };
+    for entry in entries.flatten() {
+        let pid = match entry.file_name().to_string_lossy().parse::<u32>() {
+            Ok(pid) => pid,
+            Err(_) => continue,
+        };
+        let dir = entry.path();
+        let is_node = std::fs::read_to_string(dir.join("comm"))
+            .map(|comm| comm.trim() == SAFENODE_BIN_NAME)
+            .unwrap_or(false);
+        if !is_node {
+            continue;
+        }
+        if let Some(node_usage) = read_usage(&dir) {
+            let _ = usage.insert(pid, node_usage);
+        }
+    }
+    usage
+}
+
+// Reads the user and system CPU times off `stat`, and the resident set size off `status`.
+#[cfg(target_os = "linux")]
+fn read_usage(dir: &std::path::Path) -> Option<NodeUsage> {
+    let stat = std::fs::read_to_string(dir.join("stat")).ok()?;
+    // The name of the process is in parentheses and may hold spaces, so fields are counted after it.
+    let fields: Vec<&str> = stat.rsplit_once(')')?.1.split_whitespace().collect();
+    let utime: u64 = fields.get(11)?.parse().ok()?;
+    let stime: u64 = fields.get(12)?.parse().ok()?;
+
+    let status = std::fs::read_to_string(dir.join("status")).ok()?;
+    let rss_kib: u64 = status
+        .lines()
+        .find_map(|line| line.strip_prefix("VmRSS:"))?
+        .trim()
+        .trim_end_matches("kB")
+        .trim()
+        .parse()
+        .ok()?;
+
+    Some(NodeUsage {
+        cpu_time: Duration::from_secs_f64((utime + stime) as f64 / CLOCK_TICKS_PER_SEC),
+        rss_bytes: rss_kib * 1024,
+    })
+}
+
+/// The usage of processes is only read on Linux, where `/proc` exposes it.
+#[cfg(not(target_os = "linux"))]
+fn node_usage() -> BTreeMap<u32, NodeUsage> {
+    BTreeMap::new()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn mix_is_parsed_from_weights() {
+        let mix: OpMix = "upload=3, download=1,spend=0".parse().expect("Valid mix");
+        assert_eq!(
+            mix,
+            OpMix(vec![(Op::Upload, 3), (Op::Download, 1), (Op::Spend, 0)])
+        );
+        assert!(mix.has(Op::Upload));
+        assert!(!mix.has(Op::Spend));
+        assert!(!mix.has(Op::RegisterEdit));
+
+        assert!("upload".parse::<OpMix>().is_err());
+        assert!("delete=1".parse::<OpMix>().is_err());
+        assert!("upload=0".parse::<OpMix>().is_err());
+    }
+
+    #[test]
+    fn percentiles_are_nearest_ranks() {
+        let latencies: Vec<_> = (1..=1000).map(Duration::from_millis).collect();
+        assert_eq!(percentile(&latencies, 50.0), Duration::from_millis(500));
+        assert_eq!(percentile(&latencies, 99.0), Duration::from_millis(990));
+        assert_eq!(percentile(&latencies, 99.9), Duration::from_millis(999));
+        assert_eq!(percentile(&latencies[..1], 99.9), Duration::from_millis(1));
+        assert_eq!(percentile(&[], 50.0), Duration::ZERO);
+    }
+}
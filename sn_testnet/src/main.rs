@@ -29,11 +29,13 @@
 
 #[cfg(feature = "verify-nodes")]
 mod check_testnet;
+mod load_test;
 
 use sn_testnet::{Testnet, DEFAULT_NODE_LAUNCH_INTERVAL, SAFENODE_BIN_NAME};
 
 use clap::Parser;
 use color_eyre::{eyre::eyre, Help, Result};
+use load_test::LoadArgs;
 use std::{
     path::PathBuf,
     process::{Command, Stdio},
@@ -97,6 +99,16 @@ struct Cmd {
     /// Any arguments must be valid safenode arguments.
     #[clap(last = true)]
     node_args: Vec<String>,
+
+    #[clap(subcommand)]
+    sub_cmd: Option<SubCmd>,
+}
+
+#[derive(Debug, clap::Subcommand)]
+enum SubCmd {
+    /// Drive load against a running local testnet, with many concurrent clients, and report
+    /// the throughput and latencies of their operations, along with the usage of the nodes.
+    Load(LoadArgs),
 }
 
 #[tokio::main]
@@ -106,6 +118,10 @@ async fn main() -> Result<()> {
 
     let args = Cmd::from_args();
 
+    if let Some(SubCmd::Load(load_args)) = args.sub_cmd {
+        return load_test::run(load_args).await;
+    }
+
     if args.flame {
         #[cfg(not(target_os = "windows"))]
         check_flamegraph_prerequisites().await?;